@@ -24,7 +24,400 @@ void *lws_zalloc(size_t size)
 	return ptr;
 }
 
+/*
+ * For things written by more than one thread, so nothing else shares their
+ * first cache line.  How far we moved up from what the allocator gave us is
+ * kept in the byte before.
+ */
+void *lws_zalloc_cl(size_t size)
+{
+	unsigned char *p = lws_zalloc(size + LWS_CACHE_LINE_BYTES), *a;
+
+	if (!p)
+		return NULL;
+
+	a = (unsigned char *)(((size_t)p + LWS_CACHE_LINE_BYTES) &
+			      ~(size_t)(LWS_CACHE_LINE_BYTES - 1));
+	a[-1] = (unsigned char)(a - p);
+
+	return a;
+}
+
+void lws_free_cl(void *p)
+{
+	if (p)
+		lws_free((unsigned char *)p - ((unsigned char *)p)[-1]);
+}
+
 void lws_set_allocator(void *(*cb)(void *ptr, size_t size))
 {
 	_lws_realloc = cb;
 }
+
+/*
+ * Memory accounting
+ *
+ * Each wsi keeps how much it holds of each kind of memory, and the vhost,
+ * protocol and service thread that was booked against.  When a wsi changes
+ * protocol or is moved to another service thread, what it holds is moved
+ * over to where it belongs now, and so that nothing is missed, that's also
+ * checked whenever what it holds changes.
+ *
+ * The counters are per service thread, but booking may be moved by the
+ * thread the wsi left, so they are only changed atomically.
+ */
+
+static const char * const mem_tag_names[] = {
+	"wsi", "ah", "rxbuf", "txq", "ext", "tls", "user", "arena"
+};
+
+/**
+ * lws_mem_tag_name() - name of a memory accounting tag
+ *
+ * @tag:	which one
+ *
+ *	Returns a short name like "txq", as used in the server status JSON.
+ */
+LWS_VISIBLE const char *
+lws_mem_tag_name(enum lws_mem_tags tag)
+{
+	if ((unsigned int)tag >= LWSMT_COUNT)
+		return "unknown";
+
+	return mem_tag_names[tag];
+}
+
+static struct lws_mem_acct *
+lws_mem_acct(struct lws_vhost *vh, int tsi, int pidx)
+{
+	if (pidx < 0)
+		return &vh->stats[tsi].mem;
+
+	return &vh->mem_proto[tsi * vh->count_protocols + pidx];
+}
+
+static void
+lws_mem_book(struct lws *wsi, int sign)
+{
+	struct lws_mem_acct *v, *p = NULL;
+	int n;
+
+	if (!wsi->mem_vh)
+		return;
+
+	v = lws_mem_acct(wsi->mem_vh, wsi->mem_tsi, -1);
+	if (wsi->mem_pidx >= 0)
+		p = lws_mem_acct(wsi->mem_vh, wsi->mem_tsi, wsi->mem_pidx);
+
+	for (n = 0; n < LWSMT_COUNT; n++) {
+		if (!wsi->mem[n])
+			continue;
+		lws_atomic_ll_add(&v->held[n], sign * (long long)wsi->mem[n]);
+		if (p)
+			lws_atomic_ll_add(&p->held[n],
+					  sign * (long long)wsi->mem[n]);
+	}
+}
+
+static unsigned long long
+lws_mem_held(struct lws_vhost *vh, int tsi, int pidx)
+{
+	struct lws_mem_acct *a = lws_mem_acct(vh, tsi, pidx);
+	long long t = 0;
+	int m;
+
+	for (m = 0; m < LWSMT_COUNT; m++)
+		t += a->held[m];
+
+	return t < 0 ? 0 : t;
+}
+
+static unsigned long long
+lws_mem_total(struct lws_vhost *vh, int pidx)
+{
+	unsigned long long t = 0;
+	int n;
+
+	for (n = 0; n < vh->context->count_threads; n++)
+		t += lws_mem_held(vh, n, pidx);
+
+	return t;
+}
+
+/* the service thread whose connections hold the most against it */
+
+static int
+lws_mem_top_thread(struct lws_vhost *vh, int pidx)
+{
+	unsigned long long held, most = 0;
+	int n, top = 0;
+
+	for (n = 0; n < vh->context->count_threads; n++) {
+		held = lws_mem_held(vh, n, pidx);
+		if (held > most) {
+			most = held;
+			top = n;
+		}
+	}
+
+	return top;
+}
+
+static int
+lws_mem_over_budget(struct lws_vhost *vh, int pidx)
+{
+	if (vh->mem_budget && lws_mem_total(vh, -1) > vh->mem_budget)
+		return 1;
+
+	return pidx >= 0 && vh->protocols[pidx].mem_budget &&
+	       lws_mem_total(vh, pidx) > vh->protocols[pidx].mem_budget;
+}
+
+/* book what the wsi holds against its vhost, protocol and thread as of now */
+
+void
+lws_mem_rebook(struct lws *wsi)
+{
+	struct lws_vhost *vh = wsi->vhost;
+	int pidx = -1;
+
+	if (vh && wsi->protocol >= vh->protocols &&
+	    wsi->protocol < vh->protocols + vh->count_protocols)
+		pidx = wsi->protocol - vh->protocols;
+
+	if (wsi->mem_vh == vh && wsi->mem_pidx == pidx &&
+	    wsi->mem_tsi == wsi->tsi)
+		return;
+
+	lws_mem_book(wsi, -1);
+	wsi->mem_vh = vh;
+	wsi->mem_pidx = pidx;
+	wsi->mem_tsi = wsi->tsi;
+	lws_mem_book(wsi, 1);
+}
+
+void
+lws_mem_charge(struct lws *wsi, enum lws_mem_tags tag, long delta)
+{
+	struct lws_vhost *vh;
+
+	if (!delta)
+		return;
+
+	lws_mem_rebook(wsi);
+	wsi->mem[tag] += delta;
+
+	vh = wsi->mem_vh;
+	if (!vh)
+		return;
+
+	lws_atomic_ll_add(&lws_mem_acct(vh, wsi->mem_tsi, -1)->held[tag],
+			  (long long)delta);
+	if (wsi->mem_pidx >= 0)
+		lws_atomic_ll_add(&lws_mem_acct(vh, wsi->mem_tsi,
+				  wsi->mem_pidx)->held[tag], (long long)delta);
+
+	/* the service threads will find something to close */
+	if (delta > 0 && !wsi->context->mem_over &&
+	    lws_mem_over_budget(vh, wsi->mem_pidx))
+		wsi->context->mem_over = 1;
+}
+
+void
+lws_mem_release(struct lws *wsi)
+{
+	lws_mem_book(wsi, -1);
+	memset(wsi->mem, 0, sizeof(wsi->mem));
+	wsi->mem_vh = NULL;
+}
+
+/* the connection of ours holding the most against the vhost / protocol */
+
+static struct lws *
+lws_mem_biggest(struct lws_context_per_thread *pt, struct lws_vhost *vh,
+		int pidx)
+{
+	struct lws *wsi, *big = NULL;
+	unsigned long held, most = 0;
+	unsigned int n;
+	int m;
+
+	for (n = 0; n < pt->fds_count; n++) {
+		wsi = wsi_from_fd(pt->context, pt->fds[n].fd);
+		if (!wsi || wsi->listener || wsi->mem_vh != vh ||
+		    (pidx >= 0 && wsi->mem_pidx != pidx))
+			continue;
+#ifdef LWS_WITH_CGI
+		if (wsi->mode == LWSCM_CGI)
+			continue;
+#endif
+		held = 0;
+		for (m = 0; m < LWSMT_COUNT; m++)
+			held += wsi->mem[m];
+		if (held > most) {
+			most = held;
+			big = wsi;
+		}
+	}
+
+	return big;
+}
+
+static int
+lws_mem_shed_one(struct lws_context_per_thread *pt, struct lws_vhost *vh,
+		 int pidx)
+{
+	struct lws *wsi = lws_mem_biggest(pt, vh, pidx);
+	int n;
+
+	if (!wsi)
+		return 1;
+
+	/*
+	 * an idle ws connection can give most of it back without closing,
+	 * if that was not enough he's still the biggest next time round
+	 */
+	if (vh->ws_hibernate_ms && !wsi->ws_hibernating) {
+		n = lws_ws_hibernate(wsi);
+		if (!n)
+			return 0;
+		if (n < 0) {
+			lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
+			return 0;
+		}
+	}
+
+	lwsl_notice("%s: vhost %s%s%s over budget, closing %p: txq %u, "
+		    "rxbuf %u, ext %u\n", __func__, vh->name,
+		    pidx >= 0 ? " protocol " : "",
+		    pidx >= 0 ? vh->protocols[pidx].name : "", wsi,
+		    wsi->mem[LWSMT_TXQ], wsi->mem[LWSMT_RXBUF],
+		    wsi->mem[LWSMT_EXT]);
+
+	lws_mem_acct(vh, pt->tid, pidx)->shed++;
+
+	/* what he has queued is why he is going, don't wait to flush it */
+	lws_txq_destroy(wsi);
+	wsi->socket_is_permanently_unusable = 1;
+	lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
+
+	return 0;
+}
+
+static void
+lws_mem_shed_cb(struct lws_context *context, int tsi, void *user)
+{
+	/* another thread sent us here, don't wait for our own retry */
+	context->pt[tsi].mem_shed_ms = 0;
+	lws_mem_shed(&context->pt[tsi]);
+}
+
+/*
+ * Close connections until the budget is met, but only ever on the service
+ * thread holding the most against it, otherwise one thread's hog would have
+ * every thread close all its own connections.  If that's another thread,
+ * it's asked to do it.  Returns nonzero if still over.
+ */
+
+static int
+lws_mem_shed_budget(struct lws_context_per_thread *pt, struct lws_vhost *vh,
+		    int pidx, unsigned long long budget)
+{
+	int top;
+
+	while (lws_mem_total(vh, pidx) > budget) {
+		top = lws_mem_top_thread(vh, pidx);
+		if (top != pt->tid) {
+			lws_pt_cmd_run(pt->context, top, lws_mem_shed_cb, NULL);
+			return 1;
+		}
+		if (lws_mem_shed_one(pt, vh, pidx))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Something went over budget: each budget that is exceeded is shed by the
+ * service thread holding the most against it
+ */
+
+void
+lws_mem_shed(struct lws_context_per_thread *pt)
+{
+	struct lws_context *context = pt->context;
+	struct lws_vhost *vh;
+	int over = 0, n;
+
+	if (pt->now_ms < pt->mem_shed_ms)
+		return;
+
+	for (vh = context->vhost_list; vh; vh = vh->vhost_next) {
+		if (vh->mem_budget)
+			over |= lws_mem_shed_budget(pt, vh, -1, vh->mem_budget);
+
+		for (n = 0; n < vh->count_protocols; n++)
+			if (vh->protocols[n].mem_budget)
+				over |= lws_mem_shed_budget(pt, vh, n,
+						vh->protocols[n].mem_budget);
+	}
+
+	if (over)
+		/* another thread is on it, or nobody holds it */
+		pt->mem_shed_ms = pt->now_ms + LWS_MEM_SHED_RETRY_MS;
+	else
+		context->mem_over = 0;
+}
+
+/**
+ * lws_mem_get_info() - how much memory connections hold on a vhost
+ *
+ * @vh:		the vhost
+ * @prot:	NULL for the whole vhost, or one of its protocols
+ * @info:	filled in with the bytes held now, by what they are for
+ *
+ *	Counts what lws holds for connections, the struct lws itself, header
+ *	tables, rx buffers, queued output, extension state and per session
+ *	data.  TLS sessions are counted at an estimate each, since the TLS
+ *	library allocates for them itself.  Connections are counted against
+ *	the protocol they are using now.
+ *
+ *	Returns 0 if @info was filled, or nonzero if @prot is not one of the
+ *	vhost's protocols.
+ */
+LWS_VISIBLE int
+lws_mem_get_info(struct lws_vhost *vh, const struct lws_protocols *prot,
+		 struct lws_mem_info *info)
+{
+	struct lws_mem_acct *a;
+	int pidx = -1, n, m;
+	long long t;
+
+	if (prot) {
+		for (pidx = 0; pidx < vh->count_protocols; pidx++)
+			if (&vh->protocols[pidx] == prot ||
+			    (prot->name && vh->protocols[pidx].name &&
+			     !strcmp(vh->protocols[pidx].name, prot->name)))
+				break;
+		if (pidx == vh->count_protocols)
+			return 1;
+	}
+
+	memset(info, 0, sizeof(*info));
+	for (m = 0; m < LWSMT_COUNT; m++) {
+		t = 0;
+		for (n = 0; n < vh->context->count_threads; n++)
+			t += lws_mem_acct(vh, n, pidx)->held[m];
+		info->held[m] = t < 0 ? 0 : t;
+		info->total += info->held[m];
+	}
+	for (n = 0; n < vh->context->count_threads; n++) {
+		a = lws_mem_acct(vh, n, pidx);
+		info->shed += a->shed;
+	}
+	info->budget = pidx < 0 ? vh->mem_budget :
+				  vh->protocols[pidx].mem_budget;
+
+	return 0;
+}
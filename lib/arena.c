@@ -0,0 +1,147 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * Things that only live as long as one http transaction come from an arena on
+ * the wsi.  It hands out pieces of a block in order, getting another block
+ * when one is full, and nothing is freed on its own: the whole arena is
+ * reset when the transaction completes, and freed with the wsi.
+ *
+ * On reset one block of the standard size is kept, so a keepalive connection
+ * serves one request after another out of the same block.  Blocks come from
+ * the service thread's slabs.
+ */
+
+#define LWS_ARENA_BLOCK LWS_SLAB_MAX_OBJECT
+#define LWS_ARENA_ALIGN 8
+
+/**
+ * lws_arena_alloc() - allocate memory that lasts for the http transaction
+ *
+ * @wsi:	the connection
+ * @size:	how many bytes
+ *
+ *	Returns memory that stays valid until the http transaction on @wsi
+ *	completes, or the connection closes, whichever is first.  It is
+ *	freed then with everything else allocated for the transaction, you
+ *	don't free it yourself.  The contents are not zeroed.
+ *
+ *	For a connection that upgraded to ws, the transaction lasts until the
+ *	connection closes.  Returns NULL if OOM.
+ */
+LWS_VISIBLE void *
+lws_arena_alloc(struct lws *wsi, size_t size)
+{
+	struct lws_arena_block *b = wsi->arena;
+	size_t len = (size + LWS_ARENA_ALIGN - 1) &
+		     ~(size_t)(LWS_ARENA_ALIGN - 1), bs;
+	void *p;
+
+	if (!b || b->size - b->used < len) {
+		bs = sizeof(*b) + len;
+		if (bs < LWS_ARENA_BLOCK)
+			bs = LWS_ARENA_BLOCK;
+		b = lws_slab_alloc(&wsi->context->pt[(int)wsi->tsi], bs);
+		if (!b) {
+			lwsl_err("%s: OOM\n", __func__);
+			return NULL;
+		}
+		b->size = bs - sizeof(*b);
+		b->used = 0;
+		b->next = wsi->arena;
+		wsi->arena = b;
+		lws_mem_charge(wsi, LWSMT_ARENA, bs);
+	}
+
+	p = (char *)(b + 1) + b->used;
+	b->used += len;
+
+	return p;
+}
+
+/**
+ * lws_hdr_copy_arena() - copy a header into the transaction's arena
+ *
+ * @wsi:	the connection
+ * @h:		which header
+ *
+ *	Like lws_hdr_copy(), but into memory from lws_arena_alloc() exactly
+ *	big enough for it.  Returns NULL if the header is not present, or
+ *	OOM, otherwise the NUL-terminated header content.
+ */
+LWS_VISIBLE char *
+lws_hdr_copy_arena(struct lws *wsi, enum lws_token_indexes h)
+{
+	int n = lws_hdr_total_length(wsi, h);
+	char *p;
+
+	if (n <= 0)
+		return NULL;
+
+	p = lws_arena_alloc(wsi, n + 1);
+	if (!p)
+		return NULL;
+
+	if (lws_hdr_copy(wsi, p, n + 1, h) < 0)
+		return NULL;
+
+	return p;
+}
+
+/* the transaction is over, keep one block for the next one */
+
+void
+lws_arena_reset(struct lws *wsi)
+{
+	struct lws_arena_block *b = wsi->arena, *keep = NULL, *next;
+	long freed = 0;
+
+	while (b) {
+		next = b->next;
+		if (!keep && b->size == LWS_ARENA_BLOCK - sizeof(*b)) {
+			keep = b;
+			b->used = 0;
+			b->next = NULL;
+		} else {
+			freed += sizeof(*b) + b->size;
+			lws_slab_free(b);
+		}
+		b = next;
+	}
+	wsi->arena = keep;
+	lws_mem_charge(wsi, LWSMT_ARENA, -freed);
+}
+
+void
+lws_arena_destroy(struct lws *wsi)
+{
+	struct lws_arena_block *b = wsi->arena, *next;
+
+	while (b) {
+		next = b->next;
+		lws_slab_free(b);
+		b = next;
+	}
+	wsi->arena = NULL;
+	lws_mem_set(wsi, LWSMT_ARENA, 0);
+}
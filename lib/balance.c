@@ -0,0 +1,175 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * Each service thread measures the time it spends outside its wait, per
+ * LWS_BALANCE_WINDOW_MS window, and how many events each of its wsi had in
+ * that window.  A thread that stays much busier than the idlest one gives it
+ * some of its established ws connections, choosing enough of them that, by
+ * their share of the events, about half the difference in load moves.
+ *
+ * Everything here runs on the thread that owns the pt, between service
+ * passes, so nothing it owns is in use.
+ */
+
+/* can this wsi be serviced by another thread without anything else moving */
+
+static int
+lws_balance_wsi_movable(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	if (wsi->mode != LWSCM_WS_SERVING || wsi->state != LWSS_ESTABLISHED ||
+	    wsi->listener || wsi->http2_substream || wsi->parent ||
+	    wsi->child_list || wsi->socket_is_permanently_unusable)
+		return 0;
+
+	/* these things live in lists belonging to the pt */
+	if (wsi->trunc_len || wsi->rxflow_buffer ||
+	    wsi->u.ws.rx_draining_ext || wsi->u.ws.tx_draining_ext)
+		return 0;
+	/* a borrowed rx buffer must go back to the pool it came from */
+	if (wsi->u.ws.rx_ubuf)
+		return 0;
+#if defined(LWS_USE_IO_URING)
+	/* ...and his ring recv completes on the ring it was queued on */
+	if (wsi->uring_recv)
+		return 0;
+#endif
+#ifdef LWS_WITH_CGI
+	if (wsi->cgi)
+		return 0;
+#endif
+#ifdef LWS_OPENSSL_SUPPORT
+	if (wsi->pending_read_list_prev || wsi->pending_read_list_next ||
+	    pt->pending_read_list == wsi)
+		return 0;
+#else
+	(void)pt;
+#endif
+
+	return 1;
+}
+
+static int
+lws_balance_shed(struct lws_context *context, struct lws_context_per_thread *pt,
+		 int tsi, unsigned long want)
+{
+	struct lws *wsi;
+	unsigned int cost;
+	int n, moved = 0;
+
+	/*
+	 * going down from the end, a removal only swaps in the last entry,
+	 * which we already looked at
+	 */
+	for (n = pt->fds_count - 1; n >= 0 && want &&
+				     moved < LWS_BALANCE_MAX_MOVES; n--) {
+		wsi = wsi_from_fd(context, pt->fds[n].fd);
+		if (!wsi || wsi->svc_window != pt->load.window ||
+		    !lws_balance_wsi_movable(pt, wsi))
+			continue;
+
+		cost = wsi->svc_events;
+		/* moving him would overshoot, the load would just swap */
+		if (cost > want)
+			continue;
+
+		if (lws_migrate_wsi(wsi, tsi)) {
+			if (context->pt[tsi].fds_count >=
+					    context->fd_limit_per_thread - 1)
+				break;
+			continue;
+		}
+
+		want -= cost;
+		moved++;
+	}
+
+	return moved;
+}
+
+void
+lws_pt_balance(struct lws_context *context, int tsi)
+{
+	struct lws_context_per_thread *pt = &context->pt[tsi];
+	struct lws_pt_load *l = &pt->load;
+	unsigned long long now, span, cur;
+	unsigned long want;
+	int n, idlest = -1, moved;
+
+	/* lws_pt_sleeping() just accounted the pass in busy_us */
+	if (!l->sleep_us)
+		return;
+
+	now = l->sleep_us / 1000;
+	if (!l->window_start_ms)
+		l->window_start_ms = now;
+	span = now - l->window_start_ms;
+	if (span < LWS_BALANCE_WINDOW_MS)
+		return;
+
+	cur = l->busy_us / span;
+	if (cur > 1000)
+		cur = 1000;
+	l->permille = (unsigned short)((l->permille * 3 + cur) / 4);
+	l->events_ps = (unsigned long)(l->events * 1000 / span);
+	l->rx_ps = (unsigned long)(l->rx * 1000 / span);
+	l->tx_ps = (unsigned long)(l->tx * 1000 / span);
+
+	if (l->cooldown)
+		l->cooldown--;
+	else if (lws_check_opt(context->options,
+			       LWS_SERVER_OPTION_BALANCE_THREADS) &&
+		 !LWS_LIBEV_ENABLED(context) && !LWS_LIBUV_ENABLED(context) &&
+		 l->permille >= LWS_BALANCE_MIN_PERMILLE && l->events) {
+		for (n = 0; n < context->count_threads; n++)
+			if (n != tsi && (idlest < 0 ||
+			    context->pt[n].load.permille <
+				    context->pt[idlest].load.permille))
+				idlest = n;
+
+		if (idlest >= 0 && l->permille >= LWS_BALANCE_RATIO *
+				   context->pt[idlest].load.permille) {
+			want = (unsigned long)((unsigned long long)l->events *
+			       (l->permille -
+				context->pt[idlest].load.permille) /
+			       (2 * l->permille));
+			moved = lws_balance_shed(context, pt, idlest, want);
+			if (moved) {
+				lwsl_info("%s: tsi %d (%d) moved %d to %d (%d)\n",
+					  __func__, tsi, l->permille, moved,
+					  idlest,
+					  context->pt[idlest].load.permille);
+				l->migrated_out += moved;
+				l->cooldown = LWS_BALANCE_COOLDOWN;
+			}
+		}
+	}
+
+	/* start the next window, wsi see the generation change and reset */
+	l->window++;
+	l->window_start_ms = now;
+	l->busy_us = 0;
+	l->events = 0;
+	l->rx = 0;
+	l->tx = 0;
+}
@@ -295,7 +295,7 @@ oom4:
 	if (wsi->position_in_fds_table != -1)
 		goto failed;
 	lws_header_table_detach(wsi, 0);
-	lws_free(wsi);
+	lws_slab_free(wsi);
 
 	return NULL;
 
@@ -480,11 +480,12 @@ lws_client_connect_via_info(struct lws_client_connect_info *i)
 	if (i->context->requested_kill)
 		return NULL;
 
-	wsi = lws_zalloc(sizeof(struct lws));
+	wsi = lws_slab_zalloc(&i->context->pt[0], sizeof(struct lws));
 	if (wsi == NULL)
 		goto bail;
 
 	wsi->context = i->context;
+	wsi->gen = lws_wsi_new_gen(i->context);
 	/* assert the mode and union status (hdr) clearly */
 	lws_union_transition(wsi, LWSCM_HTTP_CLIENT);
 	wsi->sock = LWS_SOCK_INVALID;
@@ -510,6 +511,7 @@ lws_client_connect_via_info(struct lws_client_connect_info *i)
 		wsi->vhost = i->context->vhost_list;
 
 	wsi->protocol = &wsi->vhost->protocols[0];
+	lws_mem_set(wsi, LWSMT_WSI, sizeof(*wsi));
 	if (wsi && !wsi->user_space && i->userdata) {
 		wsi->user_space_externally_allocated = 1;
 		wsi->user_space = i->userdata;
@@ -593,7 +595,7 @@ lws_client_connect_via_info(struct lws_client_connect_info *i)
 	return wsi;
 
 bail:
-	lws_free(wsi);
+	lws_slab_free(wsi);
 
 	return NULL;
 }
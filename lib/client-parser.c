@@ -55,6 +55,7 @@ int lws_client_rx_sm(struct lws *wsi, unsigned char c)
 	case LWS_RXPS_NEW:
 		/* control frames (PING) may interrupt checkable sequences */
 		wsi->u.ws.defeat_check_utf8 = 0;
+		wsi->u.ws.all_zero_nonce = 1;
 
 		switch (wsi->ietf_spec_revision) {
 		case 13:
@@ -166,12 +167,12 @@ int lws_client_rx_sm(struct lws *wsi, unsigned char c)
 			wsi->lws_rx_parse_state = LWS_RXPS_04_FRAME_HDR_LEN64_8;
 			break;
 		default:
-			wsi->u.ws.rx_packet_length = c;
+			wsi->u.ws.rx_packet_length = c & 0x7f;
 			if (wsi->u.ws.this_frame_masked)
 				wsi->lws_rx_parse_state =
 						LWS_RXPS_07_COLLECT_FRAME_KEY_1;
 			else {
-				if (c)
+				if (wsi->u.ws.rx_packet_length)
 					wsi->lws_rx_parse_state =
 					LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED;
 				else {
@@ -294,6 +295,7 @@ int lws_client_rx_sm(struct lws *wsi, unsigned char c)
 		wsi->u.ws.mask[3] = c;
 		if (c)
 			wsi->u.ws.all_zero_nonce = 0;
+		wsi->u.ws.mask_idx = 0;
 
 		if (wsi->u.ws.rx_packet_length)
 			wsi->lws_rx_parse_state =
@@ -306,7 +308,8 @@ int lws_client_rx_sm(struct lws *wsi, unsigned char c)
 
 	case LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED:
 
-		assert(wsi->u.ws.rx_ubuf);
+		if (lws_ws_rxbuf_get(wsi))
+			return -1;
 
 		if (wsi->u.ws.this_frame_masked && !wsi->u.ws.all_zero_nonce)
 			c ^= wsi->u.ws.mask[(wsi->u.ws.mask_idx++) & 3];
@@ -319,20 +322,15 @@ int lws_client_rx_sm(struct lws *wsi, unsigned char c)
 			goto spill;
 		}
 
-		/*
-		 * if there's no protocol max frame size given, we are
-		 * supposed to default to context->pt_serv_buf_size
-		 */
-		if (!wsi->protocol->rx_buffer_size &&
-		    wsi->u.ws.rx_ubuf_head != wsi->context->pt_serv_buf_size)
-			break;
-
-		if (wsi->protocol->rx_buffer_size &&
-		    wsi->u.ws.rx_ubuf_head != wsi->protocol->rx_buffer_size)
+		/* the buffer size we were lent is where we spill */
+		if (wsi->u.ws.rx_ubuf_head + LWS_PRE != wsi->u.ws.rx_ubuf_alloc)
 			break;
 
 		/* spill because we filled our rx buffer */
 spill:
+		/* zero length frames come here without having needed one */
+		if (lws_ws_rxbuf_get(wsi))
+			return -1;
 
 		handled = 0;
 
@@ -416,6 +414,8 @@ spill:
 			}
 
 			/* stash the pong payload */
+			if (lws_ensure_ws_ctrl_buf(wsi))
+				goto ping_drop;
 			memcpy(wsi->u.ws.ping_payload_buf + LWS_PRE,
 			       &wsi->u.ws.rx_ubuf[LWS_PRE],
 				wsi->u.ws.rx_ubuf_head);
@@ -480,6 +480,7 @@ ping_drop:
 
 		eff_buf.token = &wsi->u.ws.rx_ubuf[LWS_PRE];
 		eff_buf.token_len = wsi->u.ws.rx_ubuf_head;
+		lws_ws_rxbuf_count(wsi);
 
 drain_extension:
 		n = lws_ext_cb_active(wsi, LWS_EXT_CB_PAYLOAD_RX, &eff_buf, 0);
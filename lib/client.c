@@ -47,6 +47,10 @@ lws_handshake_client(struct lws *wsi, unsigned char **buf, size_t len)
 					return -1;
 				continue;
 			}
+			/* consume header and payload bytes efficiently */
+			if (wsi->mode == LWSCM_WS_CLIENT)
+				lws_ws_rx_bulk(wsi, buf, &len);
+
 			/* account for what we're using in rxflow buffer */
 			if (wsi->rxflow_buffer)
 				wsi->rxflow_pos++;
@@ -337,6 +341,8 @@ lws_http_transaction_completed_client(struct lws *wsi)
 		return 1;
 	}
 
+	lws_arena_reset(wsi);
+
 	/* otherwise set ourselves up ready to go again */
 	wsi->state = LWSS_CLIENT_HTTP_ESTABLISHED;
 	wsi->mode = LWSCM_HTTP_CLIENT_ACCEPTED;
@@ -676,13 +682,16 @@ check_extensions:
 
 			/* instantiate the extension on this conn */
 
-			wsi->active_extensions[wsi->count_act_ext] = ext;
+			if (lws_ensure_ext_space(wsi))
+				goto bail2;
+
+			wsi->ext->active_extensions[wsi->count_act_ext] = ext;
 
 			/* allow him to construct his ext instance */
 
 			if (ext->callback(lws_get_context(wsi), ext, wsi,
 				      LWS_EXT_CB_CLIENT_CONSTRUCT,
-				      (void *)&wsi->act_ext_user[wsi->count_act_ext],
+				      (void *)&wsi->ext->act_ext_user[wsi->count_act_ext],
 				      (void *)&opts, 0)) {
 				lwsl_notice(" ext %s failed construction\n", ext_name);
 				ext++;
@@ -701,7 +710,7 @@ check_extensions:
 				goto bail2;
 
 			if (ext_name[0] &&
-			    lws_ext_parse_options(ext, wsi, wsi->act_ext_user[
+			    lws_ext_parse_options(ext, wsi, wsi->ext->act_ext_user[
 						  wsi->count_act_ext], opts, ext_name,
 						  strlen(ext_name))) {
 				lwsl_err("%s: unable to parse user defaults '%s'",
@@ -713,7 +722,7 @@ check_extensions:
 			 * give the extension the server options
 			 */
 			if (a && lws_ext_parse_options(ext, wsi,
-					wsi->act_ext_user[wsi->count_act_ext],
+					wsi->ext->act_ext_user[wsi->count_act_ext],
 					opts, a, c - a)) {
 				lwsl_err("%s: unable to parse remote def '%s'",
 					 __func__, a);
@@ -722,7 +731,7 @@ check_extensions:
 
 			if (ext->callback(lws_get_context(wsi), ext, wsi,
 					LWS_EXT_CB_OPTION_CONFIRM,
-				      wsi->act_ext_user[wsi->count_act_ext],
+				      wsi->ext->act_ext_user[wsi->count_act_ext],
 				      NULL, 0)) {
 				lwsl_err("%s: ext %s rejects server options %s",
 					 ext->name, a);
@@ -787,17 +796,10 @@ check_accept:
 	 * size mentioned in the protocol definition.  If 0 there, then
 	 * use a big default for compatibility
 	 */
-	n = wsi->protocol->rx_buffer_size;
-	if (!n)
-		n = context->pt_serv_buf_size;
-	n += LWS_PRE;
-	wsi->u.ws.rx_ubuf = lws_malloc(n + 4 /* 0x0000ffff zlib */);
-	if (!wsi->u.ws.rx_ubuf) {
-		lwsl_err("Out of Mem allocating rx buffer %d\n", n);
-		goto bail2;
-	}
-       wsi->u.ws.rx_ubuf_alloc = n;
-	lwsl_info("Allocating client RX buffer %d\n", n);
+	/* it's only borrowed from the pt pool while rx is in flight */
+	lws_ws_rxbuf_init(wsi);
+	lws_ws_hibernate_arm(wsi);
+	n = wsi->u.ws.rx_ubuf_alloc;
 
 	if (setsockopt(wsi->sock, SOL_SOCKET, SO_SNDBUF, (const char *)&n,
 		       sizeof n)) {
@@ -822,8 +824,8 @@ check_accept:
 	while (ext && ext->callback) {
 		v = NULL;
 		for (n = 0; n < wsi->count_act_ext; n++)
-			if (wsi->active_extensions[n] == ext)
-				v = wsi->act_ext_user[n];
+			if (wsi->ext->active_extensions[n] == ext)
+				v = wsi->ext->act_ext_user[n];
 
 		ext->callback(context, ext, wsi,
 			  LWS_EXT_CB_ANY_WSI_ESTABLISHED, v, NULL, 0);
@@ -884,10 +886,9 @@ lws_generate_client_handshake(struct lws *wsi, char *pkt)
 		/*
 		 * create the random key
 		 */
-		n = lws_get_random(context, hash, 16);
+		n = lws_get_random_tsi(context, wsi->tsi, hash, 16);
 		if (n != 16) {
-			lwsl_err("Unable to read from random dev %s\n",
-				 SYSTEM_RANDOM_FILEPATH);
+			lwsl_err("Unable to get random handshake key\n");
 			lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
 			return NULL;
 		}
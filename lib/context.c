@@ -301,6 +301,10 @@ lws_create_vhost(struct lws_context *context,
 	if (!vh)
 		return NULL;
 
+	vh->stats = lws_zalloc_cl(sizeof(*vh->stats) * context->count_threads);
+	if (!vh->stats)
+		goto bail;
+
 	if (!info->protocols)
 		info->protocols = &protocols_dummy[0];
 
@@ -319,6 +323,11 @@ lws_create_vhost(struct lws_context *context,
 	vh->options = info->options;
 	vh->pvo = info->pvo;
 	vh->keepalive_timeout = info->keepalive_timeout;
+	vh->accept_budget = info->accept_budget;
+	if (!vh->accept_budget)
+		vh->accept_budget = LWS_DEF_ACCEPT_BUDGET;
+	vh->mem_budget = info->mem_budget;
+	vh->ws_hibernate_ms = info->ws_hibernate_secs * 1000;
 
 #ifdef LWS_WITH_PLUGINS
 	if (plugin) {
@@ -369,6 +378,12 @@ lws_create_vhost(struct lws_context *context,
 	vh->same_vh_protocol_list = (struct lws **)
 			lws_zalloc(sizeof(struct lws *) * vh->count_protocols);
 
+	vh->mem_proto = lws_zalloc_cl(sizeof(*vh->mem_proto) *
+				      context->count_threads *
+				      vh->count_protocols);
+	if (!vh->mem_proto)
+		goto bail;
+
 	vh->mount_list = info->mounts;
 
 #ifdef LWS_USE_UNIX_SOCK
@@ -502,6 +517,9 @@ lws_create_vhost(struct lws_context *context,
 	return vh;
 
 bail:
+	lws_free(vh->same_vh_protocol_list);
+	lws_free_cl(vh->stats);
+	lws_free_cl(vh->mem_proto);
 	lws_free(vh);
 
 	return NULL;
@@ -611,7 +629,10 @@ lws_create_context(struct lws_context_creation_info *info)
 	if (lws_plat_context_early_init())
 		return NULL;
 
-	context = lws_zalloc(sizeof(struct lws_context));
+	lws_ws_mask_init();
+	lws_utf8_init();
+
+	context = lws_zalloc_cl(sizeof(struct lws_context));
 	if (!context) {
 		lwsl_err("No memory for websocket context\n");
 		return NULL;
@@ -622,6 +643,9 @@ lws_create_context(struct lws_context_creation_info *info)
 	else
 		context->pt_serv_buf_size = 4096;
 
+	context->tx_queue_limit = info->tx_queue_limit;
+	context->tx_queue_limit_pt = info->tx_queue_limit_pt;
+
 	context->time_up = time(NULL);
 #ifndef LWS_NO_DAEMONIZE
 	if (pid_daemon) {
@@ -671,10 +695,16 @@ lws_create_context(struct lws_context_creation_info *info)
 		context->max_http_header_pool = info->max_http_header_pool;
 	else
 		context->max_http_header_pool = LWS_DEF_HEADER_POOL;
+	if (info->min_http_header_pool)
+		context->min_http_header_pool = info->min_http_header_pool;
+	else
+		context->min_http_header_pool = LWS_DEF_HEADER_POOL;
+	if (context->min_http_header_pool > context->max_http_header_pool)
+		context->min_http_header_pool = context->max_http_header_pool;
 
 	/*
-	 * Allocate the per-thread storage for scratchpad buffers,
-	 * and header data pool
+	 * Allocate the per-thread storage for scratchpad buffers.  The
+	 * header tables are allocated as each thread needs them.
 	 */
 	for (n = 0; n < context->count_threads; n++) {
 		context->pt[n].serv_buf = lws_zalloc(context->pt_serv_buf_size);
@@ -685,18 +715,9 @@ lws_create_context(struct lws_context_creation_info *info)
 
 		context->pt[n].context = context;
 		context->pt[n].tid = n;
-		context->pt[n].http_header_data = lws_malloc(context->max_http_header_data *
-						       context->max_http_header_pool);
-		if (!context->pt[n].http_header_data)
-			goto bail;
-
-		context->pt[n].ah_pool = lws_zalloc(sizeof(struct allocated_headers) *
-					      context->max_http_header_pool);
-		for (m = 0; m < context->max_http_header_pool; m++)
-			context->pt[n].ah_pool[m].data =
-				(char *)context->pt[n].http_header_data +
-				(m * context->max_http_header_data);
-		if (!context->pt[n].ah_pool)
+		if (lws_timer_wheel_init(&context->pt[n]) ||
+		    lws_pt_hist_init(&context->pt[n]) ||
+		    lws_pt_slab_init(&context->pt[n]))
 			goto bail;
 
 		lws_pt_mutex_init(&context->pt[n]);
@@ -747,22 +768,18 @@ lws_create_context(struct lws_context_creation_info *info)
 		  context->count_threads,
 		  context->pt_serv_buf_size);
 
-	lwsl_info(" mem: http hdr rsvd:   %5u bytes (%u thr x (%u + %u) x %u))\n",
-		    (context->max_http_header_data +
-		     sizeof(struct allocated_headers)) *
-		    context->max_http_header_pool * context->count_threads,
-		    context->count_threads,
-		    context->max_http_header_data,
+	lwsl_info(" mem: http hdr:        %5u bytes each, %d - %d per thread\n",
+		    context->max_http_header_data +
 		    sizeof(struct allocated_headers),
+		    context->min_http_header_pool,
 		    context->max_http_header_pool);
-	n = sizeof(struct lws_pollfd) * context->count_threads *
-	    context->fd_limit_per_thread;
-	context->pt[0].fds = lws_zalloc(n);
-	if (context->pt[0].fds == NULL) {
-		lwsl_err("OOM allocating %d fds\n", context->max_fds);
-		goto bail;
-	}
-	lwsl_info(" mem: pollfd map:      %5u\n", n);
+	/* each thread serves his own chunk of fds, the table grows as needed */
+	for (m = 0; m < context->count_threads; m++)
+		if (lws_pt_fds_grow(&context->pt[m]))
+			goto bail;
+	lwsl_info(" mem: pollfd map:      %5u bytes per thread, up to %u\n",
+		  sizeof(struct lws_pollfd) * context->pt[0].fds_alloc,
+		  sizeof(struct lws_pollfd) * context->fd_limit_per_thread);
 
 	if (info->server_string) {
 		context->server_string = info->server_string;
@@ -773,13 +790,6 @@ lws_create_context(struct lws_context_creation_info *info)
 		context->server_string_len = 13;
 	}
 
-#if LWS_MAX_SMP > 1
-	/* each thread serves his own chunk of fds */
-	for (n = 1; n < (int)info->count_threads; n++)
-		context->pt[n].fds = context->pt[n - 1].fds +
-				     context->fd_limit_per_thread;
-#endif
-
 	if (lws_plat_init(context, info))
 		goto bail;
 
@@ -836,6 +846,45 @@ bail:
 	return NULL;
 }
 
+/*
+ * Called by the service thread itself the first time it services.  After
+ * pinning it if asked to, the buffers it works in are allocated again from
+ * here, so with the usual first-touch policy their pages come from the
+ * thread's own NUMA node.  If any allocation fails we keep the old one.
+ */
+void
+lws_pt_service_start(struct lws_context_per_thread *pt)
+{
+	struct lws_context *context = pt->context;
+	char *p;
+
+	pt->service_started = 1;
+
+	if (lws_check_opt(context->options,
+			  LWS_SERVER_OPTION_PIN_SERVICE_THREADS))
+		lws_plat_pin_thread(context, pt->tid);
+
+	/* nobody else uses serv_buf */
+	p = lws_zalloc(context->pt_serv_buf_size);
+	if (p) {
+		lws_free(pt->serv_buf);
+		pt->serv_buf = (unsigned char *)p;
+	}
+
+	/*
+	 * other threads only touch the pollfd table with the pt lock held...
+	 * growing it once now moves it here, the old one is reaped before we
+	 * first wait
+	 */
+	lws_pt_lock(pt);
+	if (lws_pt_fds_grow(pt))
+		lwsl_info("%s: keeping pollfd table\n", __func__);
+	lws_pt_unlock(pt);
+
+	/* the header tables we keep even when idle */
+	lws_pt_ah_pool_fill(pt);
+}
+
 /**
  * lws_context_destroy() - Destroy the websocket context
  * @context:	Websocket context
@@ -882,6 +931,7 @@ lws_context_destroy(struct lws_context *context)
 				/* no protocol close */);
 			n--;
 		}
+		lws_pt_fds_reap(pt);
 		lws_pt_mutex_destroy(pt);
 	}
 	/*
@@ -927,16 +977,20 @@ lws_context_destroy(struct lws_context *context)
 		lws_libuv_destroyloop(context, n);
 
 		lws_free_set_NULL(context->pt[n].serv_buf);
-		if (pt->ah_pool)
-			lws_free(pt->ah_pool);
-		if (pt->http_header_data)
-			lws_free(pt->http_header_data);
+		lws_timer_wheel_destroy(pt);
+		lws_pt_hist_destroy(pt);
+		lws_pt_cmd_destroy(pt);
+		lws_pt_ah_pool_destroy(pt);
 	}
 	lws_plat_context_early_destroy(context);
 	lws_ssl_context_destroy(context);
 
-	if (context->pt[0].fds)
-		lws_free_set_NULL(context->pt[0].fds);
+	for (n = 0; n < context->count_threads; n++) {
+		lws_pt_fds_free(context->pt[n].fds);
+		context->pt[n].fds = NULL;
+		lws_pt_slab_destroy(&context->pt[n]);
+		lws_pt_rxbuf_destroy(&context->pt[n]);
+	}
 
 	/* free all the vhost allocations */
 
@@ -973,11 +1027,13 @@ lws_context_destroy(struct lws_context *context)
 #endif
 
 		vh1 = vh->vhost_next;
+		lws_free_cl(vh->stats);
+		lws_free_cl(vh->mem_proto);
 		lws_free(vh);
 		vh = vh1;
 	}
 
 	lws_plat_context_late_destroy(context);
 
-	lws_free(context);
+	lws_free_cl(context);
 }
@@ -27,6 +27,38 @@
 
 #define LWS_ZLIB_MEMLEVEL 8
 
+/*
+ * zlib's own allocations are counted against the wsi, so we keep the size
+ * in front of each one to uncount it again when it is freed
+ */
+
+#define LWS_PMD_ZHDR 16
+
+static voidpf
+lws_pmd_zalloc(voidpf opaque, uInt items, uInt size)
+{
+	size_t n = (size_t)items * size;
+	char *p = lws_malloc(LWS_PMD_ZHDR + n);
+
+	if (!p)
+		return Z_NULL;
+
+	*(size_t *)p = n;
+	lws_mem_charge((struct lws *)opaque, LWSMT_EXT, LWS_PMD_ZHDR + n);
+
+	return p + LWS_PMD_ZHDR;
+}
+
+static void
+lws_pmd_zfree(voidpf opaque, voidpf address)
+{
+	char *p = (char *)address - LWS_PMD_ZHDR;
+
+	lws_mem_charge((struct lws *)opaque, LWSMT_EXT,
+		       -(long)(LWS_PMD_ZHDR + *(size_t *)p));
+	lws_free(p);
+}
+
 const struct lws_ext_options lws_ext_pm_deflate_options[] = {
 	/* public RFC7692 settings */
 	{ "server_no_context_takeover", EXTARG_NONE },
@@ -129,7 +161,14 @@ lws_extension_callback_pm_deflate(struct lws_context *context,
 		priv = lws_zalloc(sizeof(*priv));
 		*((void **)user) = priv;
 		lwsl_ext("%s: LWS_EXT_CB_*CONSTRUCT\n", __func__);
+		if (!priv)
+			return -1;
 		memset(priv, 0, sizeof(*priv));
+		lws_mem_charge(wsi, LWSMT_EXT, sizeof(*priv));
+
+		priv->rx.zalloc = priv->tx.zalloc = lws_pmd_zalloc;
+		priv->rx.zfree = priv->tx.zfree = lws_pmd_zfree;
+		priv->rx.opaque = priv->tx.opaque = wsi;
 
 		/* fill in pointer to options list */
 		if (in)
@@ -159,15 +198,50 @@ lws_extension_callback_pm_deflate(struct lws_context *context,
 
 	case LWS_EXT_CB_DESTROY:
 		lwsl_ext("%s: LWS_EXT_CB_DESTROY\n", __func__);
+		if (priv->buf_rx_inflated)
+			lws_mem_charge(wsi, LWSMT_EXT, -(long)(LWS_PRE + 7 + 5 +
+				       (1 << priv->args[PMD_RX_BUF_PWR2])));
+		if (priv->buf_tx_deflated)
+			lws_mem_charge(wsi, LWSMT_EXT, -(long)(LWS_PRE + 7 + 5 +
+				       (1 << priv->args[PMD_TX_BUF_PWR2])));
 		lws_free(priv->buf_rx_inflated);
 		lws_free(priv->buf_tx_deflated);
 		if (priv->rx_init)
 			(void)inflateEnd(&priv->rx);
 		if (priv->tx_init)
 			(void)deflateEnd(&priv->tx);
+		lws_mem_charge(wsi, LWSMT_EXT, -(long)sizeof(*priv));
 		lws_free(priv);
 		return ret;
 
+	case LWS_EXT_CB_HIBERNATE:
+		/* only if nothing is held over to the next message */
+		if (priv->rx_held_valid || priv->tx_held_valid ||
+		    priv->count_rx_between_fin)
+			break;
+		if (priv->buf_rx_inflated) {
+			lws_mem_charge(wsi, LWSMT_EXT, -(long)(LWS_PRE + 7 + 5 +
+				       (1 << priv->args[PMD_RX_BUF_PWR2])));
+			lws_free_set_NULL(priv->buf_rx_inflated);
+		}
+		if (priv->buf_tx_deflated) {
+			lws_mem_charge(wsi, LWSMT_EXT, -(long)(LWS_PRE + 7 + 5 +
+				       (1 << priv->args[PMD_TX_BUF_PWR2])));
+			lws_free_set_NULL(priv->buf_tx_deflated);
+		}
+		/* streams keeping context for the next message must stay */
+		if (priv->rx_init &&
+		    priv->args[PMD_SERVER_NO_CONTEXT_TAKEOVER]) {
+			(void)inflateEnd(&priv->rx);
+			priv->rx_init = 0;
+		}
+		if (priv->tx_init &&
+		    priv->args[PMD_CLIENT_NO_CONTEXT_TAKEOVER]) {
+			(void)deflateEnd(&priv->tx);
+			priv->tx_init = 0;
+		}
+		break;
+
 	case LWS_EXT_CB_PAYLOAD_RX:
 		lwsl_ext(" %s: LWS_EXT_CB_PAYLOAD_RX: in %d, existing in %d\n",
 			 __func__, eff_buf->token_len, priv->rx.avail_in);
@@ -188,12 +262,14 @@ lws_extension_callback_pm_deflate(struct lws_context *context,
 				return -1;
 			}
 		priv->rx_init = 1;
-		if (!priv->buf_rx_inflated)
-			priv->buf_rx_inflated = lws_malloc(LWS_PRE + 7 + 5 +
-					    (1 << priv->args[PMD_RX_BUF_PWR2]));
 		if (!priv->buf_rx_inflated) {
-			lwsl_err("%s: OOM\n", __func__);
-			return -1;
+			n = LWS_PRE + 7 + 5 + (1 << priv->args[PMD_RX_BUF_PWR2]);
+			priv->buf_rx_inflated = lws_malloc(n);
+			if (!priv->buf_rx_inflated) {
+				lwsl_err("%s: OOM\n", __func__);
+				return -1;
+			}
+			lws_mem_charge(wsi, LWSMT_EXT, n);
 		}
 
 		/*
@@ -335,12 +411,14 @@ lws_extension_callback_pm_deflate(struct lws_context *context,
 				return 1;
 			}
 		priv->tx_init = 1;
-		if (!priv->buf_tx_deflated)
-			priv->buf_tx_deflated = lws_malloc(LWS_PRE + 7 + 5 +
-					    (1 << priv->args[PMD_TX_BUF_PWR2]));
 		if (!priv->buf_tx_deflated) {
-			lwsl_err("%s: OOM\n", __func__);
-			return -1;
+			n = LWS_PRE + 7 + 5 + (1 << priv->args[PMD_TX_BUF_PWR2]);
+			priv->buf_tx_deflated = lws_malloc(n);
+			if (!priv->buf_tx_deflated) {
+				lwsl_err("%s: OOM\n", __func__);
+				return -1;
+			}
+			lws_mem_charge(wsi, LWSMT_EXT, n);
 		}
 
 		if (eff_buf->token) {
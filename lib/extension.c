@@ -164,17 +164,17 @@ int lws_ext_cb_active(struct lws *wsi, int reason, void *arg, int len)
 	int n, m, handled = 0;
 
 	for (n = 0; n < wsi->count_act_ext; n++) {
-		m = wsi->active_extensions[n]->callback(lws_get_context(wsi),
-			wsi->active_extensions[n], wsi, reason,
-			wsi->act_ext_user[n], arg, len);
+		m = wsi->ext->active_extensions[n]->callback(lws_get_context(wsi),
+			wsi->ext->active_extensions[n], wsi, reason,
+			wsi->ext->act_ext_user[n], arg, len);
 		if (m < 0) {
 			lwsl_ext("Ext '%s' failed to handle callback %d!\n",
-				 wsi->active_extensions[n]->name, reason);
+				 wsi->ext->active_extensions[n]->name, reason);
 			return -1;
 		}
 		/* valgrind... */
 		if (reason == LWS_EXT_CB_DESTROY)
-			wsi->act_ext_user[n] = NULL;
+			wsi->ext->act_ext_user[n] = NULL;
 		if (m > handled)
 			handled = m;
 	}
@@ -198,7 +198,7 @@ int lws_ext_cb_all_exts(struct lws_context *context, struct lws *wsi,
 				  (void *)(long)n, arg, len);
 		if (m < 0) {
 			lwsl_ext("Ext '%s' failed to handle callback %d!\n",
-				 wsi->active_extensions[n]->name, reason);
+				 wsi->ext->active_extensions[n]->name, reason);
 			return -1;
 		}
 		if (m)
@@ -307,12 +307,12 @@ lws_any_extension_handled(struct lws *wsi, enum lws_extension_callback_reasons r
 	/* maybe an extension will take care of it for us */
 
 	for (n = 0; n < wsi->count_act_ext && !handled; n++) {
-		if (!wsi->active_extensions[n]->callback)
+		if (!wsi->ext->active_extensions[n]->callback)
 			continue;
 
-		handled |= wsi->active_extensions[n]->callback(context,
-			wsi->active_extensions[n], wsi,
-			r, wsi->act_ext_user[n], v, len);
+		handled |= wsi->ext->active_extensions[n]->callback(context,
+			wsi->ext->active_extensions[n], wsi,
+			r, wsi->ext->act_ext_user[n], v, len);
 	}
 
 	return handled;
@@ -336,7 +336,7 @@ lws_set_extension_option(struct lws *wsi, const char *ext_name,
 
 	/* first identify if the ext is active on this wsi */
 	while (idx < wsi->count_act_ext &&
-	       strcmp(wsi->active_extensions[idx]->name, ext_name))
+	       strcmp(wsi->ext->active_extensions[idx]->name, ext_name))
 		idx++;
 
 	if (idx == wsi->count_act_ext)
@@ -347,7 +347,7 @@ lws_set_extension_option(struct lws *wsi, const char *ext_name,
 	oa.start = opt_val;
 	oa.len = 0;
 
-	return wsi->active_extensions[idx]->callback(
-			wsi->context, wsi->active_extensions[idx], wsi,
-			LWS_EXT_CB_NAMED_OPTION_SET, wsi->act_ext_user[idx], &oa, 0);
+	return wsi->ext->active_extensions[idx]->callback(
+			wsi->context, wsi->ext->active_extensions[idx], wsi,
+			LWS_EXT_CB_NAMED_OPTION_SET, wsi->ext->act_ext_user[idx], &oa, 0);
 }
@@ -238,6 +238,9 @@ postbody_completion:
 	}
 
 read_ok:
+	/* if no frame is part way through, give the rx buffer back */
+	lws_ws_rxbuf_idle(wsi);
+
 	/* Nothing more to do for now */
 	lwsl_info("%s: read_ok, used %d\n", __func__, buf - oldbuf);
 
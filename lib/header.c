@@ -152,7 +152,8 @@ lws_add_http_header_status(struct lws *wsi, unsigned int code,
 	};
 
 #ifdef LWS_WITH_ACCESS_LOG
-	wsi->access_log.response = code;
+	if (wsi->access_log)
+		wsi->access_log->response = code;
 #endif
 
 #ifdef LWS_USE_HTTP2
@@ -0,0 +1,161 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * A ws connection that wasn't serviced for the vhost's ws_hibernate_ms gives
+ * back what it holds that can be made again: the control frame buffer, what
+ * the extensions and the TLS library keep for it, and the user_space if the
+ * protocol lets it.  The rx buffer and output queue are already only held
+ * while something is in flight.  The next service of the connection, or a
+ * writeable request on it, wakes it up again.
+ *
+ * Service only stamps active_ms, the timer finds out at expiry if that was
+ * recent and goes again for the rest of the time.  So a busy connection
+ * costs one timer per ws_hibernate_ms, not one per frame.
+ */
+
+static void
+lws_ws_hibernate_cb(struct lws_timer *t)
+{
+	struct lws *wsi = lws_container_of(t, struct lws, hibernate_timer);
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	unsigned int ms = wsi->vhost->ws_hibernate_ms,
+		     idle = (unsigned int)pt->now_ms - wsi->u.ws.active_ms;
+	int n;
+
+	if (wsi->ws_hibernating ||
+	    (wsi->mode != LWSCM_WS_SERVING && wsi->mode != LWSCM_WS_CLIENT))
+		return;
+
+	if (idle < ms) {
+		lws_timer_schedule(wsi->context, wsi->tsi, t,
+				   lws_ws_hibernate_cb, ms - idle);
+		return;
+	}
+
+	n = lws_ws_hibernate(wsi);
+	if (n < 0) {
+		lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
+		return;
+	}
+	if (n)
+		/* something is still in flight, look again later */
+		lws_timer_schedule(wsi->context, wsi->tsi, t,
+				   lws_ws_hibernate_cb, ms);
+}
+
+void
+lws_ws_hibernate_arm(struct lws *wsi)
+{
+	unsigned int ms = wsi->vhost->ws_hibernate_ms;
+
+	wsi->u.ws.active_ms = (unsigned int)
+			wsi->context->pt[(int)wsi->tsi].now_ms;
+	if (ms)
+		lws_timer_schedule(wsi->context, wsi->tsi,
+				   &wsi->hibernate_timer, lws_ws_hibernate_cb,
+				   ms);
+}
+
+/* nothing half done that would need what we are about to free */
+
+static int
+lws_ws_can_hibernate(struct lws *wsi)
+{
+	return (wsi->mode == LWSCM_WS_SERVING ||
+		wsi->mode == LWSCM_WS_CLIENT) &&
+	       wsi->state == LWSS_ESTABLISHED &&
+	       wsi->lws_rx_parse_state == LWS_RXPS_NEW &&
+	       !wsi->u.ws.rx_ubuf && !wsi->u.hdr.ah && !wsi->rxflow_buffer &&
+	       !wsi->trunc_len && !wsi->u.ws.inside_frame &&
+	       !wsi->u.ws.rx_draining_ext && !wsi->u.ws.tx_draining_ext &&
+	       !wsi->u.ws.ping_pending_flag &&
+	       !wsi->u.ws.close_in_ping_buffer_len && !lws_ssl_pending(wsi);
+}
+
+/*
+ * Returns 0 if the wsi is hibernating, 1 if it is busy and can't yet, or -1
+ * if the user code wants it closed instead.
+ */
+
+int
+lws_ws_hibernate(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	int release_user = 0;
+
+	if (wsi->ws_hibernating)
+		return 0;
+
+	lws_ws_rxbuf_idle(wsi);
+	if (!lws_ws_can_hibernate(wsi))
+		return 1;
+
+	if (wsi->protocol->callback(wsi, LWS_CALLBACK_WS_HIBERNATE,
+				    wsi->user_space, &release_user, 0))
+		return -1;
+
+	lws_slab_free_set_NULL(wsi->u.ws.ping_payload_buf);
+	lws_ext_cb_active(wsi, LWS_EXT_CB_HIBERNATE, NULL, 0);
+	lws_ssl_hibernate(wsi, 1);
+
+	if (release_user && wsi->user_space &&
+	    !wsi->user_space_externally_allocated) {
+		lws_slab_free_set_NULL(wsi->user_space);
+		lws_mem_set(wsi, LWSMT_USER, 0);
+		wsi->ws_hibernated_user_space = 1;
+	}
+
+	wsi->ws_hibernating = 1;
+	lws_atomic_int_add(&pt->ws_hibernating, 1);
+	lws_timer_cancel(wsi->context, wsi->tsi, &wsi->hibernate_timer);
+
+	lwsl_info("%s: %p hibernating\n", __func__, wsi);
+
+	return 0;
+}
+
+/* returns nonzero if the wsi should be closed, it is still hibernating then */
+
+int
+lws_ws_wake(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	int released = wsi->ws_hibernated_user_space;
+
+	if (released && lws_ensure_user_space(wsi))
+		return -1;
+
+	wsi->ws_hibernated_user_space = 0;
+	wsi->ws_hibernating = 0;
+	lws_atomic_int_add(&pt->ws_hibernating, -1);
+	pt->ws_wakes++;
+
+	lws_ssl_hibernate(wsi, 0);
+	lws_ws_hibernate_arm(wsi);
+
+	lwsl_info("%s: %p woke\n", __func__, wsi);
+
+	return !!wsi->protocol->callback(wsi, LWS_CALLBACK_WS_WAKE,
+					 wsi->user_space, NULL, released);
+}
@@ -0,0 +1,253 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * Only the owning service thread adds samples, so there is no locking.
+ * Readers on other threads may see a sample half-added, which is fine for
+ * statistics.
+ */
+
+int
+lws_pt_hist_init(struct lws_context_per_thread *pt)
+{
+	pt->hist = lws_zalloc(sizeof(*pt->hist));
+
+	return !pt->hist;
+}
+
+void
+lws_pt_hist_destroy(struct lws_context_per_thread *pt)
+{
+	lws_free_set_NULL(pt->hist);
+}
+
+void
+lws_histogram_add(struct lws_histogram *h, unsigned long long us)
+{
+	int n = 0;
+
+	if (us)
+		n = 64 - __builtin_clzll(us);
+	if (n >= LWS_HISTOGRAM_BUCKETS)
+		n = LWS_HISTOGRAM_BUCKETS - 1;
+
+	h->bucket[n]++;
+	h->count++;
+	h->sum_us += us;
+	if (us > h->max_us)
+		h->max_us = us > 0xffffffffull ? 0xffffffff : (unsigned int)us;
+}
+
+/*
+ * The plat service code calls these either side of its wait.  The clock is
+ * read once each side, and the wake time is reused as pt->now_ms for the
+ * whole pass.
+ */
+
+void
+lws_pt_woke(struct lws_context_per_thread *pt)
+{
+	unsigned long long now = lws_plat_monotonic_us();
+
+	if (pt->load.sleep_us && pt->hist)
+		lws_histogram_add(&pt->hist->h[LWS_HIST_POLL_WAIT],
+				  now - pt->load.sleep_us);
+	pt->load.sleep_us = 0;
+	pt->load.wake_us = now;
+	pt->now_ms = now / 1000;
+	pt->clock_cached = 1;
+}
+
+void
+lws_pt_sleeping(struct lws_context_per_thread *pt)
+{
+	unsigned long long now;
+
+	if (!pt->load.wake_us)
+		return;
+
+	now = lws_plat_monotonic_us();
+	pt->load.busy_us += now - pt->load.wake_us;
+	if (pt->hist)
+		lws_histogram_add(&pt->hist->h[LWS_HIST_SERVICE_PASS],
+				  now - pt->load.wake_us);
+	pt->load.wake_us = 0;
+	pt->load.sleep_us = now;
+}
+
+/**
+ * lws_histogram_get() - copy out one of a service thread's histograms
+ *
+ * @context:	lws context
+ * @tsi:	service thread index
+ * @kind:	which histogram
+ * @reason:	for LWS_HIST_CALLBACK, the callback reason, otherwise ignored
+ * @h:		where to copy it
+ *
+ *	LWS_HIST_CALLBACK covers the callbacks lws makes while servicing
+ *	connections: RECEIVE, WRITEABLE, HTTP, HTTP_BODY and so on.  Reasons
+ *	above the built-in ones are all counted together.  The copy is taken
+ *	without stopping the service thread.  Returns 0 if @h was filled.
+ */
+LWS_VISIBLE int
+lws_histogram_get(struct lws_context *context, int tsi,
+		  enum lws_histogram_kind kind, int reason,
+		  struct lws_histogram *h)
+{
+	struct lws_context_per_thread *pt;
+
+	if (tsi < 0 || tsi >= context->count_threads)
+		return 1;
+	pt = &context->pt[tsi];
+	if (!pt->hist)
+		return 1;
+
+	if (kind != LWS_HIST_CALLBACK) {
+		if ((int)kind < 0 || kind > LWS_HIST_CALLBACK)
+			return 1;
+		memcpy(h, &pt->hist->h[kind], sizeof(*h));
+
+		return 0;
+	}
+
+	if (reason < 0)
+		return 1;
+	if (reason >= LWS_HIST_REASONS)
+		reason = LWS_HIST_REASONS - 1;
+	memcpy(h, &pt->hist->cb[reason], sizeof(*h));
+
+	return 0;
+}
+
+/**
+ * lws_histogram_percentile() - approximate percentile of a histogram
+ *
+ * @h:		histogram
+ * @permille:	which one, eg, 500 for the median or 999 for p99.9
+ *
+ *	Returns the top of the bucket the sample falls in, in us, so the
+ *	real figure is between half that and that.
+ */
+LWS_VISIBLE unsigned int
+lws_histogram_percentile(const struct lws_histogram *h, int permille)
+{
+	unsigned long long want, seen = 0;
+	unsigned int top;
+	int n;
+
+	if (!h->count)
+		return 0;
+
+	want = (h->count * permille + 999) / 1000;
+	if (!want)
+		want = 1;
+
+	for (n = 0; n < LWS_HISTOGRAM_BUCKETS - 1; n++) {
+		seen += h->bucket[n];
+		if (seen >= want)
+			break;
+	}
+
+	if (n == LWS_HISTOGRAM_BUCKETS - 1)
+		return h->max_us;
+
+	top = n ? (1u << n) - 1 : 0;
+
+	return top < h->max_us ? top : h->max_us;
+}
+
+/**
+ * lws_histogram_reset() - zero a service thread's histograms
+ *
+ * @context:	lws context
+ * @tsi:	service thread index
+ *
+ *	Best called from the service thread itself, otherwise a sample being
+ *	added at the same time may survive.
+ */
+LWS_VISIBLE void
+lws_histogram_reset(struct lws_context *context, int tsi)
+{
+	if (tsi < 0 || tsi >= context->count_threads ||
+	    !context->pt[tsi].hist)
+		return;
+
+	memset(context->pt[tsi].hist, 0, sizeof(*context->pt[tsi].hist));
+}
+
+#if defined(LWS_WITH_SERVER_STATUS)
+
+static int
+lws_json_dump_histogram(const struct lws_histogram *h, char *buf, int len)
+{
+	return snprintf(buf, len,
+			"{\"count\":\"%llu\",\"mean_us\":\"%llu\","
+			"\"p50_us\":\"%u\",\"p99_us\":\"%u\",\"p999_us\":\"%u\","
+			"\"max_us\":\"%u\"}",
+			h->count, h->count ? h->sum_us / h->count : 0,
+			lws_histogram_percentile(h, 500),
+			lws_histogram_percentile(h, 990),
+			lws_histogram_percentile(h, 999), h->max_us);
+}
+
+int
+lws_json_dump_pt_hist(const struct lws_context_per_thread *pt, char *buf,
+		      int len)
+{
+	static const char * const names[] = {
+		"poll_wait", "service_pass", "rx_delay"
+	};
+	char *orig = buf, *end = buf + len - 1;
+	int n, first = 1;
+
+	if (!pt->hist || len < 1024)
+		return 0;
+
+	buf += snprintf(buf, end - buf, "{");
+	for (n = 0; n < LWS_HIST_CALLBACK; n++) {
+		buf += snprintf(buf, end - buf, "%s\"%s\":", n ? "," : "",
+				names[n]);
+		buf += lws_json_dump_histogram(&pt->hist->h[n], buf,
+					       end - buf);
+	}
+
+	buf += snprintf(buf, end - buf, ",\"callbacks\":[");
+	for (n = 0; n < LWS_HIST_REASONS; n++) {
+		if (!pt->hist->cb[n].count)
+			continue;
+		/* each entry is < 200 chars, stop rather than truncate */
+		if (end - buf < 200)
+			break;
+		buf += snprintf(buf, end - buf, "%s{\"reason\":\"%d\",\"h\":",
+				first ? "" : ",", n);
+		buf += lws_json_dump_histogram(&pt->hist->cb[n], buf,
+					       end - buf);
+		buf += snprintf(buf, end - buf, "}");
+		first = 0;
+	}
+	buf += snprintf(buf, end - buf, "]}");
+
+	return buf - orig;
+}
+
+#endif
@@ -55,7 +55,8 @@ struct lws *
 lws_create_server_child_wsi(struct lws_vhost *vhost, struct lws *parent_wsi,
 			    unsigned int sid)
 {
-	struct lws *wsi = lws_create_new_server_wsi(vhost);
+	struct lws *wsi = lws_create_new_server_wsi(vhost,
+						    parent_wsi->tsi);
 
 	if (!wsi)
 		return NULL;
@@ -93,7 +94,7 @@ lws_create_server_child_wsi(struct lws_vhost *vhost, struct lws *parent_wsi,
 bail:
 	vhost->protocols[0].callback(wsi, LWS_CALLBACK_WSI_DESTROY,
 			       NULL, NULL, 0);
-	lws_free(wsi);
+	lws_slab_free(wsi);
 
 	return NULL;
 }
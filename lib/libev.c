@@ -54,6 +54,64 @@ lws_accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents)
 	lws_service_fd(context, &eventfd);
 }
 
+/* another thread posted us lws_pt_cmd_*() work */
+
+static void
+lws_ev_wake_cb(struct ev_loop *loop, struct ev_io *watcher, int revents)
+{
+	struct lws_context_per_thread *pt = lws_container_of(watcher,
+			struct lws_context_per_thread, w_wake.ev_watcher);
+
+	lws_plat_pipe_drain(pt);
+	if (lws_pt_cmd_pending(pt))
+		lws_pt_cmd_drain(pt);
+}
+
+/*
+ * ev_run() doesn't come back to lws_service(), so this is how the timer
+ * wheel and the once-a-second housekeeping get run
+ */
+
+static void
+lws_ev_tw_cb(struct ev_loop *loop, struct ev_timer *watcher, int revents)
+{
+	struct lws_context_per_thread *pt = lws_container_of(watcher,
+			struct lws_context_per_thread, ev_tw_timer);
+	int n;
+
+	pt->loop_tw_at = 0;
+	lws_service_fd_tsi(pt->context, NULL, pt->tid);
+
+	n = lws_timer_wheel_next_ms(pt);
+	if (n < 0 || n > 1000)
+		n = 1000;
+	lws_libev_timer(pt, pt->now_ms + n);
+}
+
+/*
+ * The wheel has something due at monotonic ms "at": bring the loop timer
+ * forward if it wasn't going to fire by then.
+ */
+void
+lws_libev_timer(struct lws_context_per_thread *pt, unsigned long long at)
+{
+	unsigned long long now;
+
+	if (!LWS_LIBEV_ENABLED(pt->context) || !pt->io_loop_ev ||
+	    pt->context->being_destroyed)
+		return;
+
+	if (pt->loop_tw_at && pt->loop_tw_at <= at)
+		return;
+
+	pt->loop_tw_at = at;
+	now = lws_plat_monotonic_ms();
+	ev_timer_stop(pt->io_loop_ev, &pt->ev_tw_timer);
+	ev_timer_set(&pt->ev_tw_timer,
+		     at > now ? (ev_tstamp)(at - now) / 1000.0 : 0., 0.);
+	ev_timer_start(pt->io_loop_ev, &pt->ev_tw_timer);
+}
+
 LWS_VISIBLE void
 lws_ev_sigint_cb(struct ev_loop *loop, struct ev_signal *watcher, int revents)
 {
@@ -104,6 +162,14 @@ lws_ev_initloop(struct lws_context *context, struct ev_loop *loop, int tsi)
 	}
 	ev_io_start(context->pt[tsi].io_loop_ev, w_accept);
 
+	context->pt[tsi].w_wake.context = context;
+	ev_io_init(&context->pt[tsi].w_wake.ev_watcher, lws_ev_wake_cb,
+		   context->pt[tsi].dummy_pipe_fds[0], EV_READ);
+	ev_io_start(loop, &context->pt[tsi].w_wake.ev_watcher);
+
+	ev_init(&context->pt[tsi].ev_tw_timer, lws_ev_tw_cb);
+	lws_libev_timer(&context->pt[tsi], context->pt[tsi].now_ms);
+
 	/* Register the signal watcher unless the user says not to */
 	if (context->use_ev_sigint) {
 		ev_signal_init(w_sigint, context->lws_ev_sigint_cb, SIGINT);
@@ -152,6 +218,9 @@ lws_libev_destroyloop(struct lws_context *context, int tsi)
 		return;
 
 	ev_io_stop(pt->io_loop_ev, &pt->w_accept.ev_watcher);
+	ev_io_stop(pt->io_loop_ev, &pt->w_wake.ev_watcher);
+	ev_timer_stop(pt->io_loop_ev, &pt->ev_tw_timer);
+	pt->loop_tw_at = 0;
 	if (context->use_ev_sigint)
 		ev_signal_stop(pt->io_loop_ev,
 		       &pt->w_sigint.ev_watcher);
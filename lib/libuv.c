@@ -141,6 +141,67 @@ lws_uv_timeout_cb(uv_timer_t *timer
 	lws_service_fd_tsi(pt->context, NULL, pt->tid);
 }
 
+static void
+lws_uv_tw_cb(uv_timer_t *timer
+#if UV_VERSION_MAJOR == 0
+		, int status
+#endif
+)
+{
+	struct lws_context_per_thread *pt = lws_container_of(timer,
+			struct lws_context_per_thread, uv_tw_timer);
+	int n;
+
+	pt->loop_tw_at = 0;
+	if (pt->context->requested_kill)
+		return;
+
+	/* runs the timer wheel up to now */
+	lws_service_fd_tsi(pt->context, NULL, pt->tid);
+
+	n = lws_timer_wheel_next_ms(pt);
+	if (n >= 0)
+		lws_libuv_timer(pt, pt->now_ms + n);
+}
+
+/*
+ * The wheel has something due at monotonic ms "at": bring the loop timer
+ * forward if it wasn't going to fire by then.  A timer that was cancelled
+ * meanwhile just costs an early wake.
+ */
+void
+lws_libuv_timer(struct lws_context_per_thread *pt, unsigned long long at)
+{
+	unsigned long long now;
+
+	if (!LWS_LIBUV_ENABLED(pt->context) || !pt->io_loop_uv ||
+	    pt->context->being_destroyed)
+		return;
+
+	if (pt->loop_tw_at && pt->loop_tw_at <= at)
+		return;
+
+	pt->loop_tw_at = at;
+	now = lws_plat_monotonic_ms();
+	uv_timer_start(&pt->uv_tw_timer, lws_uv_tw_cb,
+		       at > now ? at - now : 0, 0);
+}
+
+#if !defined(WIN32) && !defined(_WIN32)
+/* another thread posted us lws_pt_cmd_*() work */
+
+static void
+lws_uv_wake_cb(uv_poll_t *watcher, int status, int revents)
+{
+	struct lws_context_per_thread *pt = lws_container_of(watcher,
+			struct lws_context_per_thread, w_wake.uv_watcher);
+
+	lws_plat_pipe_drain(pt);
+	if (lws_pt_cmd_pending(pt))
+		lws_pt_cmd_drain(pt);
+}
+#endif
+
 static const int sigs[] = { SIGINT, SIGTERM, SIGSEGV, SIGFPE };
 
 LWS_VISIBLE int
@@ -170,6 +231,7 @@ lws_uv_initloop(struct lws_context *context, uv_loop_t *loop, int tsi)
 
 	pt->io_loop_uv = loop;
 	uv_idle_init(loop, &pt->uv_idle);
+	uv_timer_init(loop, &pt->uv_tw_timer);
 
 	if (pt->context->use_ev_sigint) {
 		assert(ARRAY_SIZE(sigs) <= ARRAY_SIZE(pt->signals));
@@ -208,6 +270,23 @@ lws_uv_initloop(struct lws_context *context, uv_loop_t *loop, int tsi)
 	uv_timer_init(pt->io_loop_uv, &pt->uv_timeout_watcher);
 	uv_timer_start(&pt->uv_timeout_watcher, lws_uv_timeout_cb, 10, 1000);
 
+	/* anything scheduled before we had a loop */
+	n = lws_timer_wheel_next_ms(pt);
+	if (n >= 0)
+		lws_libuv_timer(pt, pt->now_ms + n);
+
+#if !defined(WIN32) && !defined(_WIN32)
+	pt->w_wake.context = context;
+	n = uv_poll_init(pt->io_loop_uv, &pt->w_wake.uv_watcher,
+			 pt->dummy_pipe_fds[0]);
+	if (n) {
+		lwsl_err("uv_poll_init failed %d on wake fd\n", n);
+
+		return -1;
+	}
+	uv_poll_start(&pt->w_wake.uv_watcher, UV_READABLE, lws_uv_wake_cb);
+#endif
+
 	return status;
 }
 
@@ -245,6 +324,15 @@ lws_libuv_destroyloop(struct lws_context *context, int tsi)
 	uv_timer_stop(&pt->uv_timeout_watcher);
 	uv_close((uv_handle_t *)&pt->uv_timeout_watcher, lws_uv_close_cb);
 
+	uv_timer_stop(&pt->uv_tw_timer);
+	uv_close((uv_handle_t *)&pt->uv_tw_timer, lws_uv_close_cb);
+	pt->loop_tw_at = 0;
+
+#if !defined(WIN32) && !defined(_WIN32)
+	uv_poll_stop(&pt->w_wake.uv_watcher);
+	uv_close((uv_handle_t *)&pt->w_wake.uv_watcher, lws_uv_close_cb);
+#endif
+
 	uv_idle_stop(&pt->uv_idle);
 	uv_close((uv_handle_t *)&pt->uv_idle, lws_uv_close_cb);
 
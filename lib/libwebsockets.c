@@ -57,10 +57,26 @@ lws_free_wsi(struct lws *wsi)
 	 * We should only free what we allocated. */
 	if (wsi->protocol && wsi->protocol->per_session_data_size &&
 	    wsi->user_space && !wsi->user_space_externally_allocated)
-		lws_free(wsi->user_space);
+		lws_slab_free(wsi->user_space);
 
 	lws_free_set_NULL(wsi->rxflow_buffer);
-	lws_free_set_NULL(wsi->trunc_alloc);
+	lws_txq_destroy(wsi);
+#ifndef LWS_NO_EXTENSIONS
+	lws_slab_free_set_NULL(wsi->ext);
+#endif
+#ifdef LWS_WITH_ACCESS_LOG
+	/* its strings were in the arena */
+	lws_slab_free_set_NULL(wsi->access_log);
+#endif
+	lws_arena_destroy(wsi);
+
+	/* no timer may call back into us after this */
+	lws_timer_cancel(wsi->context, wsi->tsi, &wsi->timeout_timer);
+	lws_timer_cancel(wsi->context, wsi->tsi, &wsi->user_timer);
+	lws_timer_cancel(wsi->context, wsi->tsi, &wsi->hibernate_timer);
+	if (wsi->ws_hibernating)
+		lws_atomic_int_add(
+			&wsi->context->pt[(int)wsi->tsi].ws_hibernating, -1);
 
 	if (wsi->u.hdr.ah)
 		/* we're closing, losing some rx is OK */
@@ -73,28 +89,18 @@ lws_free_wsi(struct lws *wsi)
 	lwsl_debug("%s: %p, remaining wsi %d\n", __func__, wsi,
 			wsi->context->count_wsi_allocated);
 
-	lws_free(wsi);
+	/* whatever he still holds is no longer counted against anybody */
+	lws_mem_release(wsi);
+
+	lws_slab_free(wsi);
 }
 
 static void
 lws_remove_from_timeout_list(struct lws *wsi)
 {
-	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
-
-	if (!wsi->timeout_list_prev) /* ie, not part of the list */
-		return;
-
-	lws_pt_lock(pt);
-	/* if we have a next guy, set his prev to our prev */
-	if (wsi->timeout_list)
-		wsi->timeout_list->timeout_list_prev = wsi->timeout_list_prev;
-	/* set our prev guy to our next guy instead of us */
-	*wsi->timeout_list_prev = wsi->timeout_list;
-
-	/* we're out of the list, we should not point anywhere any more */
-	wsi->timeout_list_prev = NULL;
-	wsi->timeout_list = NULL;
-	lws_pt_unlock(pt);
+	lws_timer_cancel(wsi->context, wsi->tsi, &wsi->timeout_timer);
+	lws_timer_cancel(wsi->context, wsi->tsi, &wsi->user_timer);
+	lws_timer_cancel(wsi->context, wsi->tsi, &wsi->hibernate_timer);
 }
 
 /**
@@ -111,32 +117,26 @@ LWS_VISIBLE void
 lws_set_timeout(struct lws *wsi, enum pending_timeout reason, int secs)
 {
 	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
-	time_t now;
+	unsigned int ms = secs * 1000;
 
-	lws_pt_lock(pt);
+	lwsl_debug("%s: %p: %d secs\n", __func__, wsi, secs);
 
-	time(&now);
+	wsi->pending_timeout = reason;
 
-	if (reason && !wsi->timeout_list_prev) {
-		/* our next guy is current first guy */
-		wsi->timeout_list = pt->timeout_list;
-		/* if there is a next guy, set his prev ptr to our next ptr */
-		if (wsi->timeout_list)
-			wsi->timeout_list->timeout_list_prev = &wsi->timeout_list;
-		/* our prev ptr is first ptr */
-		wsi->timeout_list_prev = &pt->timeout_list;
-		/* set the first guy to be us */
-		*wsi->timeout_list_prev = wsi;
+	if (!reason) {
+		lws_timer_cancel(wsi->context, wsi->tsi, &wsi->timeout_timer);
+		return;
 	}
 
-	lwsl_debug("%s: %p: %d secs\n", __func__, wsi, secs);
-	wsi->pending_timeout_limit = now + secs;
-	wsi->pending_timeout = reason;
-
-	lws_pt_unlock(pt);
+	wsi->pending_timeout_ms = pt->now_ms + ms;
+#ifndef LWS_NO_EXTENSIONS
+	/* active extensions get LWS_EXT_CB_1HZ until then */
+	if (wsi->count_act_ext && ms > 1000)
+		ms = 1000;
+#endif
 
-	if (!reason)
-		lws_remove_from_timeout_list(wsi);
+	lws_timer_schedule(wsi->context, wsi->tsi, &wsi->timeout_timer,
+			   lws_service_timeout_cb, ms);
 }
 
 void
@@ -321,7 +321,8 @@ lws_close_free_wsi(struct lws *wsi, enum lws_close_status reason)
 	if (wsi->state_pre_close == LWSS_ESTABLISHED &&
 	    (wsi->u.ws.close_in_ping_buffer_len || /* already a reason */
 	     (reason != LWS_CLOSE_STATUS_NOSTATUS &&
-	     (reason != LWS_CLOSE_STATUS_NOSTATUS_CONTEXT_DESTROY)))) {
+	     (reason != LWS_CLOSE_STATUS_NOSTATUS_CONTEXT_DESTROY))) &&
+	    !lws_ensure_ws_ctrl_buf(wsi)) {
 		lwsl_debug("sending close indication...\n");
 
 		/* if no prepared close reason, use 1000 and no aux data */
@@ -464,11 +465,10 @@ just_kill_connection:
 			}
 			wsi->u.ws.tx_draining_ext_list = NULL;
 		}
-		lws_free_set_NULL(wsi->u.ws.rx_ubuf);
+		lws_ws_rxbuf_put(wsi);
+		lws_slab_free_set_NULL(wsi->u.ws.ping_payload_buf);
 
-		if (wsi->trunc_alloc)
-			/* not going to be completed... nuke it */
-			lws_free_set_NULL(wsi->trunc_alloc);
+		lws_txq_destroy(wsi);
 
 		wsi->u.ws.ping_payload_len = 0;
 		wsi->u.ws.ping_pending_flag = 0;
@@ -1032,9 +1032,25 @@ int user_callback_handle_rxflow(lws_callback_function callback_function,
 				enum lws_callback_reasons reason, void *user,
 				void *in, size_t len)
 {
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	unsigned long long t = 0;
 	int n;
 
+	if (pt->hist) {
+		t = lws_plat_monotonic_us();
+		if ((reason == LWS_CALLBACK_RECEIVE ||
+		     reason == LWS_CALLBACK_CLIENT_RECEIVE) &&
+		    pt->load.wake_us && t >= pt->load.wake_us)
+			lws_histogram_add(&pt->hist->h[LWS_HIST_RX_DELAY],
+					  t - pt->load.wake_us);
+	}
+
 	n = callback_function(wsi, reason, user, in, len);
+
+	if (t)
+		lws_histogram_add(&pt->hist->cb[reason < LWS_HIST_REASONS ?
+					reason : LWS_HIST_REASONS - 1],
+				  lws_plat_monotonic_us() - t);
 	if (!n)
 		n = _lws_rx_flow_control(wsi);
 
@@ -1154,14 +1170,20 @@ lws_ensure_user_space(struct lws *wsi)
 	if (!wsi->protocol)
 		return 1;
 
+	/* he may have just been bound to this protocol */
+	lws_mem_rebook(wsi);
+
 	/* allocate the per-connection user memory (if any) */
 
 	if (wsi->protocol->per_session_data_size && !wsi->user_space) {
-		wsi->user_space = lws_zalloc(wsi->protocol->per_session_data_size);
+		wsi->user_space = lws_slab_zalloc(&wsi->context->pt[(int)wsi->tsi],
+					wsi->protocol->per_session_data_size);
 		if (wsi->user_space  == NULL) {
 			lwsl_err("Out of memory for conn user space\n");
 			return 1;
 		}
+		lws_mem_set(wsi, LWSMT_USER,
+			    wsi->protocol->per_session_data_size);
 	} else
 		lwsl_info("%s: %p protocol pss %u, user_space=%d\n",
 			  __func__, wsi, wsi->protocol->per_session_data_size,
@@ -1169,6 +1191,45 @@ lws_ensure_user_space(struct lws *wsi)
 	return 0;
 }
 
+int
+lws_ensure_ws_ctrl_buf(struct lws *wsi)
+{
+	if (wsi->u.ws.ping_payload_buf)
+		return 0;
+
+	wsi->u.ws.ping_payload_buf = lws_slab_zalloc(
+			&wsi->context->pt[(int)wsi->tsi], LWS_WS_CTRL_BUF);
+	if (!wsi->u.ws.ping_payload_buf) {
+		lwsl_err("OOM for ws control buf\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+#ifndef LWS_NO_EXTENSIONS
+int
+lws_ensure_ext_space(struct lws *wsi)
+{
+	if (wsi->count_act_ext == LWS_MAX_EXTENSIONS_ACTIVE) {
+		lwsl_notice("%s: too many extensions\n", __func__);
+		return 1;
+	}
+	if (wsi->ext)
+		return 0;
+
+	wsi->ext = lws_slab_zalloc(&wsi->context->pt[(int)wsi->tsi],
+				   sizeof(*wsi->ext));
+	if (!wsi->ext) {
+		lwsl_err("OOM for extension state\n");
+		return 1;
+	}
+	lws_mem_charge(wsi, LWSMT_EXT, sizeof(*wsi->ext));
+
+	return 0;
+}
+#endif
+
 /**
  * lwsl_timestamp: generate logging timestamp string
  *
@@ -1403,10 +1464,13 @@ lws_close_reason(struct lws *wsi, enum lws_close_status status,
 		 unsigned char *buf, size_t len)
 {
 	unsigned char *p, *start;
-	int budget = sizeof(wsi->u.ws.ping_payload_buf) - LWS_PRE;
+	int budget = LWS_WS_CTRL_BUF - LWS_PRE;
 
 	assert(wsi->mode == LWSCM_WS_SERVING || wsi->mode == LWSCM_WS_CLIENT);
 
+	if (lws_ensure_ws_ctrl_buf(wsi))
+		return;
+
 	start = p = &wsi->u.ws.ping_payload_buf[LWS_PRE];
 
 	*p++ = (((int)status) >> 8) & 0xff;
@@ -1456,63 +1520,6 @@ _lws_rx_flow_control(struct lws *wsi)
 	return 0;
 }
 
-LWS_EXTERN int
-lws_check_utf8(unsigned char *state, unsigned char *buf, size_t len)
-{
-	static const unsigned char e0f4[] = {
-		0xa0 | ((2 - 1) << 2) | 1, /* e0 */
-		0x80 | ((4 - 1) << 2) | 1, /* e1 */
-		0x80 | ((4 - 1) << 2) | 1, /* e2 */
-		0x80 | ((4 - 1) << 2) | 1, /* e3 */
-		0x80 | ((4 - 1) << 2) | 1, /* e4 */
-		0x80 | ((4 - 1) << 2) | 1, /* e5 */
-		0x80 | ((4 - 1) << 2) | 1, /* e6 */
-		0x80 | ((4 - 1) << 2) | 1, /* e7 */
-		0x80 | ((4 - 1) << 2) | 1, /* e8 */
-		0x80 | ((4 - 1) << 2) | 1, /* e9 */
-		0x80 | ((4 - 1) << 2) | 1, /* ea */
-		0x80 | ((4 - 1) << 2) | 1, /* eb */
-		0x80 | ((4 - 1) << 2) | 1, /* ec */
-		0x80 | ((2 - 1) << 2) | 1, /* ed */
-		0x80 | ((4 - 1) << 2) | 1, /* ee */
-		0x80 | ((4 - 1) << 2) | 1, /* ef */
-		0x90 | ((3 - 1) << 2) | 2, /* f0 */
-		0x80 | ((4 - 1) << 2) | 2, /* f1 */
-		0x80 | ((4 - 1) << 2) | 2, /* f2 */
-		0x80 | ((4 - 1) << 2) | 2, /* f3 */
-		0x80 | ((1 - 1) << 2) | 2, /* f4 */
-
-		0,			   /* s0 */
-		0x80 | ((4 - 1) << 2) | 0, /* s2 */
-		0x80 | ((4 - 1) << 2) | 1, /* s3 */
-	};
-	unsigned char s = *state;
-
-	while (len--) {
-		unsigned char c = *buf++;
-
-		if (!s) {
-			if (c >= 0x80) {
-				if (c < 0xc2 || c > 0xf4)
-					return 1;
-				if (c < 0xe0)
-					s = 0x80 | ((4 - 1) << 2);
-				else
-					s = e0f4[c - 0xe0];
-			}
-		} else {
-			if (c < (s & 0xf0) ||
-			    c >= (s & 0xf0) + 0x10 + ((s << 2) & 0x30))
-				return 1;
-			s = e0f4[21 + (s & 3)];
-		}
-	}
-
-	*state = s;
-
-	return 0;
-}
-
 /**
  * lws_parse_uri:	cut up prot:/ads:port/path into pieces
  *			Notice it does so by dropping '\0' into input string
@@ -1831,6 +1838,7 @@ enum urldecode_stateful {
 struct lws_urldecode_stateful {
 	char *out;
 	void *data;
+	struct lws *wsi; /* non-NULL if we are in its arena */
 	char name[32];
 	int out_len;
 	int pos;
@@ -1840,15 +1848,41 @@ struct lws_urldecode_stateful {
 	lws_urldecode_stateful_cb output;
 };
 
+/* with a wsi, from its transaction arena, otherwise from the heap */
+
+static void *
+lws_urldecode_alloc(struct lws *wsi, size_t size)
+{
+	void *p;
+
+	if (!wsi)
+		return lws_zalloc(size);
+
+	p = lws_arena_alloc(wsi, size);
+	if (p)
+		memset(p, 0, size);
+
+	return p;
+}
+
+static void
+lws_urldecode_free(struct lws *wsi, void *p)
+{
+	if (!wsi)
+		lws_free(p);
+}
+
 static struct lws_urldecode_stateful *
-lws_urldecode_s_create(char *out, int out_len, void *data,
+lws_urldecode_s_create(struct lws *wsi, char *out, int out_len, void *data,
 		       lws_urldecode_stateful_cb output)
 {
-	struct lws_urldecode_stateful *s = lws_malloc(sizeof(*s));
+	struct lws_urldecode_stateful *s = lws_urldecode_alloc(wsi, sizeof(*s));
 
 	if (!s)
 		return NULL;
 
+	s->wsi = wsi;
+
 	s->out = out;
 	s->out_len  = out_len;
 	s->output = output;
@@ -1960,13 +1994,14 @@ lws_urldecode_s_destroy(struct lws_urldecode_stateful *s)
 		if (s->output(s->data, s->name, &s->out, s->pos, 1))
 			ret = -1;
 
-	lws_free(s);
+	lws_urldecode_free(s->wsi, s);
 
 	return ret;
 }
 
 struct lws_urldecode_stateful_param_array {
 	struct lws_urldecode_stateful *s;
+	struct lws *wsi; /* non-NULL if we are in its arena */
 	lws_urldecode_stateful_cb opt_cb;
 	const char * const *param_names;
 	int count_params;
@@ -2051,37 +2086,40 @@ lws_urldecode_spa_cb(void *data, const char *name, char **buf, int len,
  * wants the data to be handled as name=value.
  */
 
-LWS_VISIBLE LWS_EXTERN struct lws_urldecode_stateful_param_array *
-lws_urldecode_spa_create(const char * const *param_names, int count_params,
-			 int max_storage, lws_urldecode_stateful_cb opt_cb,
-			 void *opt_data)
+static struct lws_urldecode_stateful_param_array *
+_lws_urldecode_spa_create(struct lws *wsi, const char * const *param_names,
+			  int count_params, int max_storage,
+			  lws_urldecode_stateful_cb opt_cb, void *opt_data)
 {
-	struct lws_urldecode_stateful_param_array *spa = lws_malloc(sizeof(*spa));
+	struct lws_urldecode_stateful_param_array *spa =
+				lws_urldecode_alloc(wsi, sizeof(*spa));
 
 	if (!spa)
 		return NULL;
 
+	spa->wsi = wsi;
 	spa->param_names = param_names;
 	spa->count_params = count_params;
 	spa->max_storage = max_storage;
 	spa->opt_cb = opt_cb;
 	spa->opt_data = opt_data;
 
-	spa->storage = lws_malloc(max_storage);
+	spa->storage = lws_urldecode_alloc(wsi, max_storage);
 	if (!spa->storage)
 		goto bail2;
 	spa->end = spa->storage + max_storage - 1;
 
-	spa->params = lws_zalloc(sizeof(char *) * count_params);
+	spa->params = lws_urldecode_alloc(wsi, sizeof(char *) * count_params);
 	if (!spa->params)
 		goto bail3;
 
-	spa->s = lws_urldecode_s_create(spa->storage, max_storage, spa,
+	spa->s = lws_urldecode_s_create(wsi, spa->storage, max_storage, spa,
 					lws_urldecode_spa_cb);
 	if (!spa->s)
 		goto bail4;
 
-	spa->param_length = lws_zalloc(sizeof(int) * count_params);
+	spa->param_length = lws_urldecode_alloc(wsi,
+						sizeof(int) * count_params);
 	if (!spa->param_length)
 		goto bail5;
 
@@ -2090,15 +2128,52 @@ lws_urldecode_spa_create(const char * const *param_names, int count_params,
 bail5:
 	lws_urldecode_s_destroy(spa->s);
 bail4:
-	lws_free(spa->params);
+	lws_urldecode_free(wsi, spa->params);
 bail3:
-	lws_free(spa->storage);
+	lws_urldecode_free(wsi, spa->storage);
 bail2:
-	lws_free(spa);
+	lws_urldecode_free(wsi, spa);
 
 	return NULL;
 }
 
+LWS_VISIBLE LWS_EXTERN struct lws_urldecode_stateful_param_array *
+lws_urldecode_spa_create(const char * const *param_names, int count_params,
+			 int max_storage, lws_urldecode_stateful_cb opt_cb,
+			 void *opt_data)
+{
+	return _lws_urldecode_spa_create(NULL, param_names, count_params,
+					 max_storage, opt_cb, opt_data);
+}
+
+/**
+ * lws_urldecode_spa_create_arena() - create urldecode parser for a request
+ *
+ * @wsi: the http connection the form data is coming on
+ * @param_names: array of form parameter names, like "username"
+ * @count_params: count of param_names
+ * @max_storage: total amount of form parameter values we can store
+ * @opt_cb: NULL, or callback to filter data.  Needed for file transfer case
+ * @opt_data: NULL, or user pointer provided to opt_cb.
+ *
+ * Like lws_urldecode_spa_create(), but the parser and what it stores come
+ * from the transaction arena of @wsi, see lws_arena_alloc().  So it goes
+ * away by itself when the http transaction completes, and must not be used
+ * after that.  lws_urldecode_spa_destroy() may still be called on it before
+ * then, it just finalizes it.
+ */
+
+LWS_VISIBLE LWS_EXTERN struct lws_urldecode_stateful_param_array *
+lws_urldecode_spa_create_arena(struct lws *wsi,
+			       const char * const *param_names,
+			       int count_params, int max_storage,
+			       lws_urldecode_stateful_cb opt_cb,
+			       void *opt_data)
+{
+	return _lws_urldecode_spa_create(wsi, param_names, count_params,
+					 max_storage, opt_cb, opt_data);
+}
+
 /**
  * lws_urldecode_spa_process() - parses a chunk of input data
  *
@@ -2181,10 +2256,10 @@ lws_urldecode_spa_destroy(struct lws_urldecode_stateful_param_array *spa)
 
 	lwsl_debug("%s\n", __func__);
 
-	lws_free(spa->param_length);
-	lws_free(spa->params);
-	lws_free(spa->storage);
-	lws_free(spa);
+	lws_urldecode_free(spa->wsi, spa->param_length);
+	lws_urldecode_free(spa->wsi, spa->params);
+	lws_urldecode_free(spa->wsi, spa->storage);
+	lws_urldecode_free(spa->wsi, spa);
 
 	return n;
 }
@@ -2261,7 +2336,7 @@ lws_create_basic_wsi(struct lws_context *context, int tsi)
 		return NULL;
 	}
 
-	new_wsi = lws_zalloc(sizeof(struct lws));
+	new_wsi = lws_slab_zalloc(&context->pt[tsi], sizeof(struct lws));
 	if (new_wsi == NULL) {
 		lwsl_err("Out of memory for new connection\n");
 		return NULL;
@@ -2269,6 +2344,7 @@ lws_create_basic_wsi(struct lws_context *context, int tsi)
 
 	new_wsi->tsi = tsi;
 	new_wsi->context = context;
+	new_wsi->gen = lws_wsi_new_gen(context);
 	new_wsi->pending_timeout = NO_PENDING_TIMEOUT;
 	new_wsi->rxflow_change_to = LWS_RXFLOW_ALLOW;
 
@@ -2903,21 +2979,22 @@ lws_set_extension_option(struct lws *wsi, const char *ext_name,
 int
 lws_access_log(struct lws *wsi)
 {
-	char *p = wsi->access_log.user_agent, ass[512];
+	char *p, ass[512];
 	int l;
 
-	if (!wsi->access_log_pending)
+	if (!wsi->access_log_pending || !wsi->access_log)
 		return 0;
 
-	if (!wsi->access_log.header_log)
+	p = wsi->access_log->user_agent;
+	if (!wsi->access_log->header_log)
 		return 0;
 
 	if (!p)
 		p = "";
 
 	l = snprintf(ass, sizeof(ass) - 1, "%s %d %lu %s\n",
-		     wsi->access_log.header_log,
-		     wsi->access_log.response, wsi->access_log.sent, p);
+		     wsi->access_log->header_log,
+		     wsi->access_log->response, wsi->access_log->sent, p);
 
 	if (wsi->vhost->log_fd != (int)LWS_INVALID_FILE) {
 		if (write(wsi->vhost->log_fd, ass, l) != l)
@@ -2925,14 +3002,9 @@ lws_access_log(struct lws *wsi)
 	} else
 		lwsl_err("%s", ass);
 
-	if (wsi->access_log.header_log) {
-		lws_free(wsi->access_log.header_log);
-		wsi->access_log.header_log = NULL;
-	}
-	if (wsi->access_log.user_agent) {
-		lws_free(wsi->access_log.user_agent);
-		wsi->access_log.user_agent = NULL;
-	}
+	/* they're in the transaction arena, which is about to go */
+	wsi->access_log->header_log = NULL;
+	wsi->access_log->user_agent = NULL;
 	wsi->access_log_pending = 0;
 
 	return 0;
@@ -2941,6 +3013,28 @@ lws_access_log(struct lws *wsi)
 
 #ifdef LWS_WITH_SERVER_STATUS
 
+static int
+lws_json_dump_mem(const struct lws_vhost *vh, const struct lws_protocols *prot,
+		  char *buf, int len)
+{
+	char *orig = buf, *end = buf + len - 1;
+	struct lws_mem_info mi;
+	int n;
+
+	if (len < 256 || lws_mem_get_info((struct lws_vhost *)vh, prot, &mi))
+		return 0;
+
+	buf += snprintf(buf, end - buf, "\"mem\":{");
+	for (n = 0; n < LWSMT_COUNT; n++)
+		buf += snprintf(buf, end - buf, "\"%s\":\"%llu\",",
+				lws_mem_tag_name(n), mi.held[n]);
+	buf += snprintf(buf, end - buf, "\"total\":\"%llu\","
+			"\"budget\":\"%llu\",\"shed\":\"%lu\"}",
+			mi.total, mi.budget, mi.shed);
+
+	return buf - orig;
+}
+
 LWS_EXTERN int
 lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
 {
@@ -2954,11 +3048,32 @@ lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
 		"callback://"
 	};
 	char *orig = buf, *end = buf + len - 1, first = 1;
+	struct lws_vhost_stats st;
 	int n = 0;
 
 	if (len < 100)
 		return 0;
 
+	/* each service thread keeps its own */
+	memset(&st, 0, sizeof(st));
+	for (n = 0; n < vh->context->count_threads; n++) {
+		const struct lws_vhost_stats *s = &vh->stats[n];
+
+		st.rx += s->rx;
+		st.tx += s->tx;
+		st.conn += s->conn;
+		st.trans += s->trans;
+		st.ws_upgrades += s->ws_upgrades;
+		st.http2_upgrades += s->http2_upgrades;
+		st.accept_wakeups += s->accept_wakeups;
+		st.accepts += s->accepts;
+		st.accept_budget_hit += s->accept_budget_hit;
+		st.listen_q_full += s->listen_q_full;
+		if (s->accept_batch_peak > st.accept_batch_peak)
+			st.accept_batch_peak = s->accept_batch_peak;
+	}
+	n = 0;
+
 	buf += snprintf(buf, end - buf,
 			"{\n \"name\":\"%s\",\n"
 			" \"port\":\"%d\",\n"
@@ -2969,7 +3084,12 @@ lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
 			" \"conn\":\"%lu\",\n"
 			" \"trans\":\"%lu\",\n"
 			" \"ws_upg\":\"%lu\",\n"
-			" \"http2_upg\":\"%lu\""
+			" \"http2_upg\":\"%lu\",\n"
+			" \"acc_wakeups\":\"%lu\",\n"
+			" \"acc\":\"%lu\",\n"
+			" \"acc_batch_peak\":\"%u\",\n"
+			" \"acc_budget_hit\":\"%lu\",\n"
+			" \"listen_q_full\":\"%lu\""
 			,
 			vh->name, vh->listen_port,
 #ifdef LWS_OPENSSL_SUPPORT
@@ -2978,10 +3098,15 @@ lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
 			0,
 #endif
 			!!(vh->options & LWS_SERVER_OPTION_STS),
-			vh->rx, vh->tx, vh->conn, vh->trans, vh->ws_upgrades,
-			vh->http2_upgrades
+			st.rx, st.tx, st.conn, st.trans, st.ws_upgrades,
+			st.http2_upgrades, st.accept_wakeups, st.accepts,
+			st.accept_batch_peak, st.accept_budget_hit,
+			st.listen_q_full
 	);
 
+	buf += snprintf(buf, end - buf, ",\n ");
+	buf += lws_json_dump_mem(vh, NULL, buf, end - buf);
+
 	if (vh->mount_list) {
 		const struct lws_http_mount *m = vh->mount_list;
 
@@ -3025,9 +3150,12 @@ lws_json_dump_vhost(const struct lws_vhost *vh, char *buf, int len)
 				buf += snprintf(buf, end - buf, ",");
 			buf += snprintf(buf, end - buf,
 					"\n  {\n   \"%s\":{\n"
-					"    \"status\":\"ok\"\n   }\n  }"
+					"    \"status\":\"ok\",\n    "
 					,
 					vh->protocols[n].name);
+			buf += lws_json_dump_mem(vh, &vh->protocols[n], buf,
+						 end - buf);
+			buf += snprintf(buf, end - buf, "\n   }\n  }");
 			first = 0;
 			n++;
 		}
@@ -3051,25 +3179,31 @@ lws_json_dump_context(const struct lws_context *context, char *buf, int len)
 #endif
 	const struct lws_context_per_thread *pt;
 	time_t t = time(NULL);
-	int listening = 0, cgi_count = 0, n;
+	int listening = 0, cgi_count = 0, n, m;
+	unsigned int spare;
 
 	buf += snprintf(buf, end - buf, "{ "
 					"\"version\":\"%s\",\n"
 					"\"uptime\":\"%ld\",\n"
 					"\"cgi_spawned\":\"%d\",\n"
 					"\"pt_fd_max\":\"%d\",\n"
+#if !defined(_WIN32) && !defined(MBED_OPERATORS)
+					"\"fd_pages\":\"%d\",\n"
+#endif
 					"\"ah_pool_max\":\"%d\",\n"
 					"\"wsi_alive\":\"%d\",\n",
 					lws_get_library_version(),
 					(unsigned long)(t - context->time_up),
 					context->count_cgi_spawned,
 					context->fd_limit_per_thread,
+#if !defined(_WIN32) && !defined(MBED_OPERATORS)
+					context->fd_pages,
+#endif
 					context->max_http_header_pool,
 					context->count_wsi_allocated);
 #ifdef LWS_HAVE_GETLOADAVG
 	{
 		double d[3];
-		int m;
 
 		m = getloadavg(d, 3);
 		for (n = 0; n < m; n++) {
@@ -3083,17 +3217,77 @@ lws_json_dump_context(const struct lws_context *context, char *buf, int len)
 	buf += snprintf(buf, end - buf, "\"pt\":[\n ");
 	for (n = 0; n < context->count_threads; n++) {
 		pt = &context->pt[n];
+		spare = 0;
+		for (m = 0; m < LWS_RXBUF_POOL_SIZES; m++)
+			spare += pt->rxbuf_pool.s[m].count;
 		if (n)
 			buf += snprintf(buf, end - buf, ",");
 		buf += snprintf(buf, end - buf,
 				"\n  {\n"
 				"    \"fds_count\":\"%d\",\n"
+				"    \"fds_alloc\":\"%u\",\n"
 				"    \"ah_pool_inuse\":\"%d\",\n"
-				"    \"ah_wait_list\":\"%d\"\n"
-				"    }",
+				"    \"ah_wait_list\":\"%d\",\n"
+				"    \"ah_pool_size\":\"%d\",\n"
+				"    \"ah_pool_peak\":\"%d\",\n"
+				"    \"ah_waits\":\"%lu\",\n"
+				"    \"ah_wait_ms_avg\":\"%llu\",\n"
+				"    \"ah_wait_ms_max\":\"%u\",\n"
+				"    \"ah_starved\":\"%lu\",\n"
+				"    \"load_permille\":\"%u\",\n"
+				"    \"events_ps\":\"%lu\",\n"
+				"    \"rx_ps\":\"%lu\",\n"
+				"    \"tx_ps\":\"%lu\",\n"
+				"    \"migrated_out\":\"%lu\",\n"
+				"    \"rxbuf_lent\":\"%u\",\n"
+				"    \"rxbuf_spare\":\"%u\",\n"
+				"    \"rxbuf_borrows\":\"%llu\",\n"
+				"    \"rxbuf_grows\":\"%lu\",\n"
+				"    \"rxbuf_shrinks\":\"%lu\",\n"
+				"    \"rx_messages\":\"%llu\",\n"
+				"    \"rx_spills\":\"%llu\",\n"
+				"    \"txq_bytes\":\"%lu\",\n"
+				"    \"txq_refs\":\"%lu\",\n"
+				"    \"ws_hibernating\":\"%d\",\n"
+				"    \"ws_wakes\":\"%lu\",\n"
+				"    \"hist\":",
 				pt->fds_count,
+				pt->fds_alloc,
 				pt->ah_count_in_use,
-				pt->ah_wait_list_length);
+				pt->ah_wait_list_length,
+				pt->ah_count_alloc,
+				pt->ah_stats.peak_in_use,
+				pt->ah_stats.waits,
+				pt->ah_stats.served ? pt->ah_stats.wait_ms /
+						      pt->ah_stats.served : 0,
+				pt->ah_stats.wait_ms_max,
+				pt->ah_stats.starved,
+				pt->load.permille,
+				pt->load.events_ps,
+				pt->load.rx_ps,
+				pt->load.tx_ps,
+				pt->load.migrated_out,
+				pt->rxbuf_pool.lent,
+				spare,
+				pt->rxbuf_pool.borrows,
+				pt->rxbuf_pool.grows,
+				pt->rxbuf_pool.shrinks,
+				pt->rxbuf_pool.messages,
+				pt->rxbuf_pool.spills,
+				pt->txq_bytes,
+				pt->txq_refs,
+				pt->ws_hibernating,
+				pt->ws_wakes);
+		m = lws_json_dump_pt_hist(pt, buf, end - buf);
+		if (!m)
+			m = snprintf(buf, end - buf, "{}");
+		buf += m;
+		buf += snprintf(buf, end - buf, ",\n    \"slabs\":");
+		m = lws_json_dump_pt_slabs(pt, buf, end - buf);
+		if (!m)
+			m = snprintf(buf, end - buf, "[]");
+		buf += m;
+		buf += snprintf(buf, end - buf, "\n    }");
 	}
 
 	buf += snprintf(buf, end - buf, "], \"vhosts\":[\n ");
@@ -386,6 +386,40 @@ struct lws;
  *
  * LWS_SERVER_OPTION_IPV6_V6ONLY_VALUE:  (VH) if set, only ipv6 allowed on the
  *	vhost
+ *
+ * LWS_SERVER_OPTION_EPOLL:  (CTX) On Linux, service the fds using epoll
+ *	instead of poll(), so the cost of a service pass scales with the
+ *	number of active fds rather than the total number of fds.  Ignored
+ *	if epoll support was not compiled in, or libev / libuv is in use
+ *
+ * LWS_SERVER_OPTION_EPOLL_EDGE_TRIGGERED:  (CTX) As LWS_SERVER_OPTION_EPOLL
+ *	but register the connection fds edge-triggered; provides
+ *	LWS_SERVER_OPTION_EPOLL
+ *
+ * LWS_SERVER_OPTION_IO_URING:  (CTX) On Linux, service the fds using an
+ *	io_uring per service thread, so all the pollfd changes and the wait
+ *	for events of a service pass are one syscall.  Falls back to epoll
+ *	(if also given) or poll() if the kernel can't support it
+ *
+ * LWS_SERVER_OPTION_LISTEN_AFFINITY:  (VH) On Linux with more than one
+ *	service thread, each thread already has its own SO_REUSEPORT listen
+ *	socket.  With this, connections stay on the service thread whose
+ *	listener accepted them (unless it is full), and the kernel is asked
+ *	to pick the listener of thread (cpu % count_threads) for the cpu that
+ *	received the SYN.  Pin service thread n to cpu n to keep accept,
+ *	handshake and service of a connection all on one core
+ *
+ * LWS_SERVER_OPTION_BALANCE_THREADS:  (CTX) With more than one service
+ *	thread, each thread measures how busy it is.  When one thread stays
+ *	much busier than the idlest one, it hands some of its established
+ *	websocket connections over to it.  Protocols get
+ *	LWS_CALLBACK_MIGRATE_THREAD first and may refuse
+ *
+ * LWS_SERVER_OPTION_PIN_SERVICE_THREADS:  (CTX) When a service thread
+ *	first services, pin it to one cpu: service thread n gets the nth of
+ *	the cpus the process was allowed when the context was created
+ *	(wrapping round if there are more threads).  Limit the process to a
+ *	set of cpus, eg, with taskset, to choose which cpus are used
  */
 enum lws_context_options {
 	LWS_SERVER_OPTION_REQUIRE_VALID_OPENSSL_CLIENT_CERT	= (1 << 1) |
@@ -410,6 +444,13 @@ enum lws_context_options {
 	LWS_SERVER_OPTION_STS					= (1 << 15),
 	LWS_SERVER_OPTION_IPV6_V6ONLY_MODIFY			= (1 << 16),
 	LWS_SERVER_OPTION_IPV6_V6ONLY_VALUE			= (1 << 17),
+	LWS_SERVER_OPTION_EPOLL					= (1 << 18),
+	LWS_SERVER_OPTION_EPOLL_EDGE_TRIGGERED			= (1 << 19) |
+								  (1 << 18),
+	LWS_SERVER_OPTION_IO_URING				= (1 << 20),
+	LWS_SERVER_OPTION_LISTEN_AFFINITY			= (1 << 21),
+	LWS_SERVER_OPTION_BALANCE_THREADS			= (1 << 22),
+	LWS_SERVER_OPTION_PIN_SERVICE_THREADS			= (1 << 23),
 
 	/****** add new things just above ---^ ******/
 };
@@ -479,6 +520,10 @@ enum lws_callback_reasons {
 	LWS_CALLBACK_CHECK_ACCESS_RIGHTS			= 50,
 	LWS_CALLBACK_PROCESS_HTML				= 51,
 	LWS_CALLBACK_ADD_HEADERS				= 52,
+	LWS_CALLBACK_TIMER					= 53,
+	LWS_CALLBACK_MIGRATE_THREAD				= 54,
+	LWS_CALLBACK_WS_HIBERNATE				= 55,
+	LWS_CALLBACK_WS_WAKE					= 56,
 
 	/****** add new things just above ---^ ******/
 
@@ -599,6 +644,7 @@ enum lws_extension_callback_reasons {
 	LWS_EXT_CB_OPTION_SET				= 24,
 	LWS_EXT_CB_OPTION_CONFIRM			= 25,
 	LWS_EXT_CB_NAMED_OPTION_SET			= 26,
+	LWS_EXT_CB_HIBERNATE				= 27,
 
 	/****** add new things just above ---^ ******/
 };
@@ -1218,6 +1264,34 @@ struct lws_extension;
  *		If you return 0 lws will echo the close and then close the
  *		connection.  If you return nonzero lws will just close the
  *		connection.
+ *
+ *	LWS_CALLBACK_TIMER: the timer you set on this wsi with
+ *		lws_set_timer_ms() expired.  It is one-shot, call
+ *		lws_set_timer_ms() again from here if you want it periodic.
+ *		If you return nonzero lws will close the connection.
+ *
+ *	LWS_CALLBACK_MIGRATE_THREAD: with LWS_SERVER_OPTION_BALANCE_THREADS,
+ *		lws wants to move this connection to the service thread
+ *		whose index is in len.  You are called from the old service
+ *		thread, if you return nonzero the connection stays where it
+ *		is.  After this, callbacks for the connection come from the
+ *		new thread.  If you keep per-thread state about your
+ *		connections, this is the time to move it.
+ *
+ *	LWS_CALLBACK_WS_HIBERNATE: the vhost has ws_hibernate_secs set and
+ *		this ws connection was idle for that long, or the vhost is
+ *		over its mem_budget.  lws is giving back what it holds for
+ *		the connection until it is next serviced.  @in points to an
+ *		int, set it to 1 if lws should free your user_space too; it
+ *		is NULL in any callback before the next
+ *		LWS_CALLBACK_WS_WAKE, including LWS_CALLBACK_CLOSED.  If you
+ *		return nonzero lws will close the connection instead.
+ *
+ *	LWS_CALLBACK_WS_WAKE: the hibernating connection has rx, or you
+ *		asked for a writeable callback, or its timer went off.  @len
+ *		is 1 if your user_space was freed, it has been allocated
+ *		again zeroed for you to restore.  If you return nonzero lws
+ *		will close the connection.
  */
 typedef int
 lws_callback_function(struct lws *wsi, enum lws_callback_reasons reason,
@@ -1281,6 +1355,10 @@ lws_callback_function(struct lws *wsi, enum lws_callback_reasons reason,
  *		buffer safely, it should copy the data into its own buffer and
  *		set the lws_tokens token pointer to it.
  *
+ *	LWS_EXT_CB_HIBERNATE: the connection is idle between messages and
+ *		is hibernating.  Free whatever you can make again when it is
+ *		next used.
+ *
  *	LWS_EXT_CB_ARGS_VALIDATE:
  */
 typedef int
@@ -1319,6 +1397,17 @@ lws_extension_callback_function(struct lws_context *context,
  *		Accessible via lws_get_protocol(wsi)->user
  *		This should not be confused with wsi->user, it is not the same.
  *		The library completely ignores any value in here.
+ * @mem_budget: 0 = no budget.  If the memory held by connections using
+ *		this protocol on one vhost goes over this many bytes, the ones
+ *		holding the most are closed until it is back under.
+ * @rx_buffer_size_max: 0, or not bigger than rx_buffer_size, means the rx
+ *		buffer is always rx_buffer_size.  Otherwise each connection's
+ *		rx buffer grows when a frame bigger than it arrives, doubling
+ *		until the frame fits or it reaches this size, and shrinks
+ *		back when no frame needed it for a few seconds.  Big frames
+ *		are then delivered whole without every connection paying for
+ *		a big buffer.  Sends are also limited to this size rather than
+ *		rx_buffer_size.
  *
  *	This structure represents one protocol supported by the server.  An
  *	array of these structures is passed to lws_create_server()
@@ -1336,6 +1425,8 @@ struct lws_protocols {
 	size_t rx_buffer_size;
 	unsigned int id;
 	void *user;
+	size_t mem_budget;
+	size_t rx_buffer_size_max;
 
 	/* Add new things just above here ---^
 	 * This is part of the ABI, don't needlessly break compatibility */
@@ -1539,14 +1630,14 @@ struct lws_http_mount {
  * @max_http_header_data: CONTEXT: The max amount of header payload that can be handled
  *		in an http request (unrecognized header payload is dropped)
  * @max_http_header_pool: CONTEXT: The max number of connections with http headers that
- *		can be processed simultaneously (the corresponding memory is
- *		allocated for the lifetime of the context).  If the pool is
- *		busy new incoming connections must wait for accept until one
- *		becomes free.
+ *		can be processed simultaneously by each service thread.  If
+ *		they are all busy, new connections wait for one in the order
+ *		they arrived.
  * @count_threads: CONTEXT: how many contexts to create in an array, 0 = 1
  * @fd_limit_per_thread: CONTEXT: nonzero means restrict each service thread to this
  *		many fds, 0 means the default which is divide the process fd
- *		limit by the number of threads.
+ *		limit by the number of threads.  It's a ceiling, the tables
+ *		grow towards it as connections come.
  * @timeout_secs: VHOST: various processes involving network roundtrips in the
  *		library are protected from hanging forever by timeouts.  If
  *		nonzero, this member lets you set the timeout used in seconds.
@@ -1575,6 +1666,33 @@ struct lws_http_mount {
  *		is nonzero, this will be used in place of the default.  It's
  *		like this for compatibility with the original short version,
  *		this is unsigned int length.
+ * @accept_budget: VHOST: 0 = default of 16.  Max number of connections
+ *		the listener will accept in one go each time it is signalled,
+ *		before going back to service the other connections.
+ * @tx_queue_limit: CONTEXT: 0 = no limit.  Max bytes of output that may be
+ *		queued on one connection because the peer is not reading it
+ *		fast enough.  A write that would go over it fails and the
+ *		connection is closed.
+ * @tx_queue_limit_pt: CONTEXT: 0 = no limit.  Like @tx_queue_limit but
+ *		for the total queued on all the connections of one service
+ *		thread.
+ * @min_http_header_pool: CONTEXT: 0 = default of 16, or
+ *		@max_http_header_pool if that is smaller.  Each service thread
+ *		allocates header tables as it needs them, up to
+ *		@max_http_header_pool, and frees the ones that stay idle
+ *		again, but keeps at least this many.
+ * @mem_budget: VHOST: 0 = no budget.  If the memory held by connections on
+ *		this vhost goes over this many bytes, the ones holding the most
+ *		are closed until it is back under, rather than letting the
+ *		process grow until it is killed.  See lws_mem_get_info().
+ * @ws_hibernate_secs: VHOST: 0 = never.  Ws connections that were idle for
+ *		this long hibernate: lws frees their rx buffer, control
+ *		frame buffer, permessage-deflate buffers and any streams
+ *		without context takeover, and the TLS library's buffers, and
+ *		offers to free the user_space, see LWS_CALLBACK_WS_HIBERNATE.
+ *		It is all made again when the connection is next used.  Over
+ *		@mem_budget, the connections holding the most are hibernated
+ *		first and only closed if that was not enough.
  */
 
 struct lws_context_creation_info {
@@ -1619,6 +1737,12 @@ struct lws_context_creation_info {
 	const char *server_string;			/* context */
 	unsigned int pt_serv_buf_size;			/* context */
 	unsigned int max_http_header_data2;		/* context */
+	unsigned int accept_budget;			/* VH */
+	unsigned int tx_queue_limit;			/* context */
+	unsigned int tx_queue_limit_pt;			/* context */
+	short min_http_header_pool;			/* context */
+	size_t mem_budget;				/* VH */
+	unsigned int ws_hibernate_secs;			/* VH */
 
 	/* Add new things just above here ---^
 	 * This is part of the ABI, don't needlessly break compatibility
@@ -1760,6 +1884,28 @@ lws_cancel_service_pt(struct lws *wsi);
 LWS_VISIBLE LWS_EXTERN void
 lws_cancel_service(struct lws_context *context);
 
+/*
+ * Ways for other threads to have a service thread act on its connections.
+ * The commands are queued without locking and the service thread is woken
+ * to run them, in the order posted, on its next pass.
+ */
+typedef void (*lws_pt_cmd_run_cb)(struct lws_context *context, int tsi,
+				  void *user);
+
+LWS_VISIBLE LWS_EXTERN int
+lws_pt_cmd_writable(struct lws *wsi);
+
+LWS_VISIBLE LWS_EXTERN int
+lws_pt_cmd_close(struct lws *wsi);
+
+LWS_VISIBLE LWS_EXTERN int
+lws_pt_cmd_writable_all_protocol(struct lws_context *context,
+				 const struct lws_protocols *protocol);
+
+LWS_VISIBLE LWS_EXTERN int
+lws_pt_cmd_run(struct lws_context *context, int tsi, lws_pt_cmd_run_cb cb,
+	       void *user);
+
 LWS_VISIBLE LWS_EXTERN int
 lws_interface_to_sa(int ipv6, const char *ifname, struct sockaddr_in *addr,
 		    size_t addrlen);
@@ -1829,6 +1975,13 @@ lws_urldecode_spa_create(const char * const *param_names, int count_params,
 			 int max_storage, lws_urldecode_stateful_cb opt_cb,
 			 void *opt_data);
 
+LWS_VISIBLE LWS_EXTERN struct lws_urldecode_stateful_param_array *
+lws_urldecode_spa_create_arena(struct lws *wsi,
+			       const char * const *param_names,
+			       int count_params, int max_storage,
+			       lws_urldecode_stateful_cb opt_cb,
+			       void *opt_data);
+
 LWS_VISIBLE LWS_EXTERN int
 lws_urldecode_spa_process(struct lws_urldecode_stateful_param_array *ludspa,
 			  const char *in, int len);
@@ -1934,6 +2087,128 @@ enum pending_timeout {
 LWS_VISIBLE LWS_EXTERN void
 lws_set_timeout(struct lws *wsi, enum pending_timeout reason, int secs);
 
+/*
+ * millisecond timers, serviced from the thread's service loop
+ */
+
+struct lws_timer;
+
+typedef void (*lws_timer_cb)(struct lws_timer *t);
+
+/*
+ * Embed one of these in your own struct (eg, your per-session data) for each
+ * timer you want, and use lws_container_of() in the callback to get back to
+ * your struct.  It must be zeroed before first use; the members are private
+ * to lws.
+ */
+struct lws_timer {
+	struct lws_timer *next;
+	struct lws_timer **prev;
+	lws_timer_cb cb;
+	unsigned long long expiry_ms;
+};
+
+LWS_VISIBLE LWS_EXTERN void
+lws_timer_schedule(struct lws_context *context, int tsi, struct lws_timer *t,
+		   lws_timer_cb cb, unsigned int ms);
+
+LWS_VISIBLE LWS_EXTERN void
+lws_timer_cancel(struct lws_context *context, int tsi, struct lws_timer *t);
+
+LWS_VISIBLE LWS_EXTERN void
+lws_set_timer_ms(struct lws *wsi, int ms);
+
+/*
+ * service thread latency histograms
+ *
+ * Each service thread always keeps these.  Bucket 0 counts 0us samples,
+ * bucket n counts samples from 2^(n - 1) to 2^n - 1 us, the last bucket also
+ * takes everything bigger.
+ */
+
+#define LWS_HISTOGRAM_BUCKETS 24
+
+struct lws_histogram {
+	unsigned int bucket[LWS_HISTOGRAM_BUCKETS];
+	unsigned long long count;
+	unsigned long long sum_us;
+	unsigned int max_us;
+};
+
+enum lws_histogram_kind {
+	LWS_HIST_POLL_WAIT,		/* time spent waiting for events */
+	LWS_HIST_SERVICE_PASS,		/* time from waking to waiting again */
+	LWS_HIST_RX_DELAY,		/* wake to (CLIENT_)RECEIVE callback */
+	LWS_HIST_CALLBACK,		/* callback duration, by reason */
+
+	/****** add new things just above ---^ ******/
+};
+
+LWS_VISIBLE LWS_EXTERN int
+lws_histogram_get(struct lws_context *context, int tsi,
+		  enum lws_histogram_kind kind, int reason,
+		  struct lws_histogram *h);
+
+LWS_VISIBLE LWS_EXTERN unsigned int
+lws_histogram_percentile(const struct lws_histogram *h, int permille);
+
+LWS_VISIBLE LWS_EXTERN void
+lws_histogram_reset(struct lws_context *context, int tsi);
+
+/*
+ * service thread slab allocators
+ *
+ * Each service thread recycles struct lws and per-session user space from
+ * its own slabs, one per object size.  Slab 0 is the one for struct lws.
+ */
+
+struct lws_slab_info {
+	unsigned int size;		/* object size in bytes */
+	unsigned int chunks;		/* chunks allocated from the heap */
+	unsigned int objects;		/* objects those chunks hold */
+	unsigned int in_use;		/* objects allocated right now */
+	unsigned long long allocs;	/* allocations ever */
+	unsigned long long recycled;	/* ... served by a previous free */
+};
+
+LWS_VISIBLE LWS_EXTERN int
+lws_slab_get_info(struct lws_context *context, int tsi, int index,
+		  struct lws_slab_info *info);
+
+/*
+ * memory accounting
+ *
+ * What lws holds for each connection is counted against its vhost and its
+ * protocol, by what the memory is for.
+ */
+
+enum lws_mem_tags {
+	LWSMT_WSI,	/* struct lws itself */
+	LWSMT_AH,	/* http header tables */
+	LWSMT_RXBUF,	/* ws rx buffers */
+	LWSMT_TXQ,	/* output queued because the peer is slow */
+	LWSMT_EXT,	/* extension state, eg, zlib */
+	LWSMT_TLS,	/* TLS sessions, an estimate */
+	LWSMT_USER,	/* per session data */
+	LWSMT_ARENA,	/* http transaction arena */
+
+	LWSMT_COUNT
+};
+
+struct lws_mem_info {
+	unsigned long long held[LWSMT_COUNT];	/* bytes held now, by tag */
+	unsigned long long total;		/* all of held[] */
+	unsigned long long budget;		/* 0 = no budget */
+	unsigned long shed;		/* connections closed to keep to it */
+};
+
+LWS_VISIBLE LWS_EXTERN int
+lws_mem_get_info(struct lws_vhost *vh, const struct lws_protocols *prot,
+		 struct lws_mem_info *info);
+
+LWS_VISIBLE LWS_EXTERN const char *
+lws_mem_tag_name(enum lws_mem_tags tag);
+
 /*
  * IMPORTANT NOTICE!
  *
@@ -2003,6 +2278,32 @@ LWS_VISIBLE LWS_EXTERN int
 lws_write(struct lws *wsi, unsigned char *buf, size_t len,
 	  enum lws_write_protocol protocol);
 
+/* a ws message framed once and written to many connections without copies */
+struct lws_txbuf;
+
+LWS_VISIBLE LWS_EXTERN struct lws_txbuf *
+lws_txbuf_create(const void *payload, size_t len,
+		 enum lws_write_protocol protocol);
+
+LWS_VISIBLE LWS_EXTERN void
+lws_txbuf_unref(struct lws_txbuf *b);
+
+LWS_VISIBLE LWS_EXTERN int
+lws_write_txbuf(struct lws *wsi, struct lws_txbuf *b);
+
+/* a message written from several buffers without gathering them first */
+struct lws_iov {
+	const void *base;
+	size_t len;
+};
+
+/* most segments one lws_write_vec() takes */
+#define LWS_WRITE_VEC_MAX 15
+
+LWS_VISIBLE LWS_EXTERN int
+lws_write_vec(struct lws *wsi, const struct lws_iov *iov, int count,
+	      enum lws_write_protocol protocol);
+
 /**
  * lws_close_reason - Set reason and aux data to send with Close packet
  *		If you are going to return nonzero from the callback
@@ -2130,6 +2431,9 @@ lws_get_peer_simple(struct lws *wsi, char *name, int namelen);
 LWS_VISIBLE LWS_EXTERN int
 lws_get_random(struct lws_context *context, void *buf, int len);
 
+LWS_VISIBLE LWS_EXTERN int
+lws_get_random_tsi(struct lws_context *context, int tsi, void *buf, int len);
+
 LWS_VISIBLE LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_daemonize(const char *_lock_path);
 
@@ -2209,6 +2513,16 @@ LWS_VISIBLE LWS_EXTERN int
 lws_hdr_copy_fragment(struct lws *wsi, char *dest, int len,
 		      enum lws_token_indexes h, int frag_idx);
 
+/*
+ * memory that lasts until the http transaction completes, when it is all
+ * freed together.  lws_hdr_copy_arena() copies a header into some of it.
+ */
+LWS_VISIBLE LWS_EXTERN void * LWS_WARN_UNUSED_RESULT
+lws_arena_alloc(struct lws *wsi, size_t size);
+
+LWS_VISIBLE LWS_EXTERN char *
+lws_hdr_copy_arena(struct lws *wsi, enum lws_token_indexes h);
+
 LWS_VISIBLE LWS_EXTERN const char *
 lws_get_urlarg_by_name(struct lws *wsi, const char *name, char *buf, int len);
 
@@ -12,6 +12,22 @@ unsigned long long time_in_microseconds(void)
 	return 0;
 }
 
+unsigned long long lws_plat_monotonic_us(void)
+{
+	return time_in_microseconds();
+}
+
+unsigned long long lws_plat_monotonic_ms(void)
+{
+	return time_in_microseconds() / 1000;
+}
+
+void lws_plat_pin_thread(struct lws_context *context, int tsi)
+{
+	(void)context;
+	(void)tsi;
+}
+
 LWS_VISIBLE int lws_get_random(struct lws_context *context, void *buf, int len)
 {
 	int n = len;
@@ -64,13 +80,6 @@ LWS_VISIBLE int lws_send_pipe_choked(struct lws *wsi)
 	return 0;
 }
 
-LWS_VISIBLE int
-lws_poll_listen_fd(struct lws_pollfd *fd)
-{
-	(void)fd;
-	return -1;
-}
-
 /**
  * lws_cancel_service() - Cancel servicing of pending websocket activity
  * @context:	Websocket context
@@ -87,6 +96,12 @@ lws_cancel_service(struct lws_context *context)
 	(void)context;
 }
 
+void
+lws_plat_pipe_signal(struct lws_context_per_thread *pt)
+{
+	(void)pt;
+}
+
 LWS_VISIBLE void
 lws_cancel_service_pt(struct lws *wsi)
 {
@@ -137,6 +137,17 @@ lws_ssl_capable_write_no_ssl(struct lws *wsi, unsigned char *buf, int len)
 	return LWS_SSL_CAPABLE_ERROR;
 }
 
+extern "C" LWS_VISIBLE int
+lws_ssl_capable_write_vec_no_ssl(struct lws *wsi, const struct lws_iov *iov,
+				 int count)
+{
+	/* no gathered send, a short send of the first segment is fine */
+	(void)count;
+
+	return lws_ssl_capable_write_no_ssl(wsi, (unsigned char *)iov->base,
+					    iov->len);
+}
+
 /*
  * Set the listening socket to listen.
  */
@@ -6,6 +6,13 @@
 #include <dlfcn.h>
 #include <dirent.h>
 
+#if defined(LWS_USE_EPOLL)
+#include <sys/epoll.h>
+#endif
+#if defined(LWS_HAVE_SYS_EVENTFD_H)
+#include <sys/eventfd.h>
+#endif
+
 
 /*
  * included from libwebsockets.c for unix builds
@@ -18,6 +25,49 @@ unsigned long long time_in_microseconds(void)
 	return ((unsigned long long)tv.tv_sec * 1000000LL) + tv.tv_usec;
 }
 
+unsigned long long lws_plat_monotonic_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000000LL) + ts.tv_nsec / 1000;
+}
+
+unsigned long long lws_plat_monotonic_ms(void)
+{
+	return lws_plat_monotonic_us() / 1000;
+}
+
+/* pin the calling thread to the tsi'th cpu we were allowed at init */
+
+void
+lws_plat_pin_thread(struct lws_context *context, int tsi)
+{
+#if defined(LWS_HAVE_SCHED_SETAFFINITY)
+	int n, cpu, count = CPU_COUNT(&context->cpus_allowed);
+	cpu_set_t set;
+
+	if (!count)
+		return;
+
+	n = tsi % count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &context->cpus_allowed) && !n--)
+			break;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		lwsl_warn("%s: tsi %d: unable to pin to cpu %d: %d\n",
+			  __func__, tsi, cpu, LWS_ERRNO);
+	else
+		lwsl_notice("service thread %d pinned to cpu %d\n", tsi, cpu);
+#else
+	(void)context;
+	(void)tsi;
+#endif
+}
+
 LWS_VISIBLE int
 lws_get_random(struct lws_context *context, void *buf, int len)
 {
@@ -33,6 +83,17 @@ lws_send_pipe_choked(struct lws *wsi)
 	if (wsi->trunc_len)
 		return 1;
 
+	/*
+	 * No send came up short and no EAGAIN since the last POLLOUT, so
+	 * it's still writable as far as we know without asking the kernel
+	 */
+	if (!wsi->sock_send_blocking)
+		return 0;
+
+	/*
+	 * We only learn it drained by POLLOUT if somebody asked for writable,
+	 * or an external poll loop passes it on... so check ourselves
+	 */
 	fds.fd = wsi->sock;
 	fds.events = POLLOUT;
 	fds.revents = 0;
@@ -44,14 +105,69 @@ lws_send_pipe_choked(struct lws *wsi)
 		return 1;
 
 	/* okay to send another packet without blocking */
+	wsi->sock_send_blocking = 0;
 
 	return 0;
 }
 
-LWS_VISIBLE int
-lws_poll_listen_fd(struct lws_pollfd *fd)
+/*
+ * Each service thread has an fd it waits on along with the sockets, that
+ * other threads can poke to wake it.  With eventfd both ends are the same fd
+ * and however many wakes were queued, one read clears them all.
+ */
+
+static int
+lws_plat_pipe_create(struct lws_context_per_thread *pt)
 {
-	return poll(fd, 1, 0);
+#if defined(LWS_HAVE_SYS_EVENTFD_H)
+	pt->dummy_pipe_fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pt->dummy_pipe_fds[1] = pt->dummy_pipe_fds[0];
+
+	return pt->dummy_pipe_fds[0] < 0;
+#else
+	return pipe(pt->dummy_pipe_fds);
+#endif
+}
+
+void
+lws_plat_pipe_signal(struct lws_context_per_thread *pt)
+{
+#if defined(LWS_HAVE_SYS_EVENTFD_H)
+	uint64_t one = 1;
+
+	if (write(pt->dummy_pipe_fds[1], &one, sizeof(one)) != sizeof(one))
+		lwsl_err("Cannot write to wake eventfd\n");
+#else
+	char buf = 0;
+
+	if (write(pt->dummy_pipe_fds[1], &buf, sizeof(buf)) != 1)
+		lwsl_err("Cannot write to dummy pipe");
+#endif
+}
+
+void
+lws_plat_pipe_drain(struct lws_context_per_thread *pt)
+{
+#if defined(LWS_HAVE_SYS_EVENTFD_H)
+	uint64_t count;
+
+	if (read(pt->dummy_pipe_fds[0], &count, sizeof(count)) < 0 &&
+	    LWS_ERRNO != LWS_EAGAIN)
+		lwsl_err("Cannot read from wake eventfd\n");
+#else
+	char buf;
+
+	if (read(pt->dummy_pipe_fds[0], &buf, 1) != 1)
+		lwsl_err("Cannot read from dummy pipe.");
+#endif
+}
+
+static void
+lws_plat_pipe_close(struct lws_context_per_thread *pt)
+{
+	close(pt->dummy_pipe_fds[0]);
+	if (pt->dummy_pipe_fds[1] != pt->dummy_pipe_fds[0])
+		close(pt->dummy_pipe_fds[1]);
 }
 
 /**
@@ -65,11 +181,7 @@ lws_poll_listen_fd(struct lws_pollfd *fd)
 LWS_VISIBLE void
 lws_cancel_service_pt(struct lws *wsi)
 {
-	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
-	char buf = 0;
-
-	if (write(pt->dummy_pipe_fds[1], &buf, sizeof(buf)) != 1)
-		lwsl_err("Cannot write to dummy pipe");
+	lws_plat_pipe_signal(&wsi->context->pt[(int)wsi->tsi]);
 }
 
 /**
@@ -83,13 +195,10 @@ LWS_VISIBLE void
 lws_cancel_service(struct lws_context *context)
 {
 	struct lws_context_per_thread *pt = &context->pt[0];
-	char buf = 0, m = context->count_threads;
+	int m = context->count_threads;
 
-	while (m--) {
-		if (write(pt->dummy_pipe_fds[1], &buf, sizeof(buf)) != 1)
-			lwsl_err("Cannot write to dummy pipe");
-		pt++;
-	}
+	while (m--)
+		lws_plat_pipe_signal(pt++);
 }
 
 LWS_VISIBLE void lwsl_emit_syslog(int level, const char *line)
@@ -113,20 +222,183 @@ LWS_VISIBLE void lwsl_emit_syslog(int level, const char *line)
 	syslog(syslog_level, "%s", line);
 }
 
+#if defined(LWS_USE_EPOLL)
+static int
+lws_plat_epoll_ctl(struct lws_context_per_thread *pt, int op, int fd,
+		   short events, int et)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	if (events & LWS_POLLIN)
+		ev.events |= EPOLLIN;
+	if (events & LWS_POLLOUT)
+		ev.events |= EPOLLOUT;
+	if (et)
+		ev.events |= EPOLLET;
+
+	return epoll_ctl(pt->epoll_fd, op, fd, &ev);
+}
+
+static int
+lws_plat_epoll_init_pt(struct lws_context_per_thread *pt)
+{
+	pt->epoll_events = lws_zalloc(sizeof(struct epoll_event) *
+				      LWS_EPOLL_MAX_EVENTS);
+	if (!pt->epoll_events) {
+		lwsl_err("OOM on epoll events\n");
+		return 1;
+	}
+	pt->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (pt->epoll_fd < 0) {
+		lwsl_err("Unable to create epoll fd\n");
+		lws_free_set_NULL(pt->epoll_events);
+		return 1;
+	}
+
+	/* the dummy pipe is always level-triggered */
+	if (lws_plat_epoll_ctl(pt, EPOLL_CTL_ADD, pt->dummy_pipe_fds[0],
+			       LWS_POLLIN, 0)) {
+		lwsl_err("Unable to add pipe to epoll\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Only the fds the kernel reported get looked at, the readiness is copied
+ * into their pt->fds[] entry so lws_service_fd_tsi() and
+ * lws_service_flag_pending() see the usual pollfd.
+ */
+static int
+lws_plat_service_tsi_epoll(struct lws_context *context, int timeout_ms,
+			   int tsi)
+{
+	struct lws_context_per_thread *pt = &context->pt[tsi];
+	struct epoll_event *ev = pt->epoll_events;
+	struct lws_pollfd *pfd;
+	int n, m, i, out;
+	struct lws *wsi;
+
+	n = epoll_wait(pt->epoll_fd, ev, LWS_EPOLL_MAX_EVENTS, timeout_ms);
+	lws_pt_woke(pt);
+	if (n < 0) {
+		if (LWS_ERRNO != LWS_EINTR)
+			return -1;
+		n = 0;
+	}
+
+#ifdef LWS_OPENSSL_SUPPORT
+	if (!pt->rx_draining_ext_list &&
+	    !lws_ssl_anybody_has_buffered_read_tsi(context, tsi) && !n) {
+#else
+	if (!pt->rx_draining_ext_list && !n) /* epoll timeout */ {
+#endif
+		lws_service_fd_tsi(context, NULL, tsi);
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (ev[i].data.fd == pt->dummy_pipe_fds[0]) {
+			lws_plat_pipe_drain(pt);
+			ev[i].data.fd = -1;
+			continue;
+		}
+		wsi = wsi_from_fd(context, ev[i].data.fd);
+		if (!wsi || wsi->position_in_fds_table < 0) {
+			ev[i].data.fd = -1;
+			continue;
+		}
+		pt->fds[wsi->position_in_fds_table].revents =
+			ev[i].events & (LWS_POLLIN | LWS_POLLOUT |
+					LWS_POLLHUP | POLLERR);
+	}
+
+	if (lws_service_flag_pending(context, tsi)) {
+		/* somebody had POLLIN faked, find them the slow way */
+		for (m = 0; m < (int)pt->fds_count; m++) {
+			if (!pt->fds[m].revents)
+				continue;
+			if (pt->fds[m].fd == pt->dummy_pipe_fds[0]) {
+				pt->fds[m].revents = 0;
+				continue;
+			}
+			i = lws_service_fd_tsi(context, &pt->fds[m], tsi);
+			if (i < 0)
+				return -1;
+			/* if something closed, retry this slot */
+			if (i)
+				m--;
+		}
+
+		goto cmds;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (ev[i].data.fd < 0)
+			continue;
+		/* an earlier service action may have closed him */
+		wsi = wsi_from_fd(context, ev[i].data.fd);
+		if (!wsi || wsi->position_in_fds_table < 0)
+			continue;
+		pfd = &pt->fds[wsi->position_in_fds_table];
+		if (!pfd->revents)
+			continue;
+
+		out = pfd->revents & LWS_POLLOUT;
+		wsi->epoll_rearm = 0;
+
+		if (lws_service_fd_tsi(context, pfd, tsi) < 0)
+			return -1;
+
+		if (!LWS_EPOLL_ET_ENABLED(context) ||
+		    wsi_from_fd(context, ev[i].data.fd) != wsi ||
+		    wsi->position_in_fds_table < 0)
+			continue;
+
+		/*
+		 * edge-triggered won't tell us again about rx we did not
+		 * drain, or POLLOUT we still want... re-arming has the kernel
+		 * re-evaluate readiness and queue a fresh event if so
+		 */
+		pfd = &pt->fds[wsi->position_in_fds_table];
+		if (wsi->epoll_rearm || (out && (pfd->events & LWS_POLLOUT)))
+			lws_plat_epoll_ctl(pt, EPOLL_CTL_MOD, pfd->fd,
+					   pfd->events, 1);
+	}
+
+cmds:
+	/* the wake may have been all there was, nobody else drained them */
+	if (lws_pt_cmd_pending(pt))
+		lws_pt_cmd_drain(pt);
+
+	return 0;
+}
+#endif
+
 LWS_VISIBLE int
 lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 {
 	struct lws_context_per_thread *pt = &context->pt[tsi];
+	struct lws_pollfd *fds;
+	unsigned int count;
 	int n = -1, m, c;
-	char buf;
 
 	/* stay dead once we are dead */
 
 	if (!context || !context->vhost_list)
 		return 1;
 
-	if (timeout_ms < 0)
+	if (!pt->service_started)
+		lws_pt_service_start(pt);
+	lws_pt_fds_reap(pt);
+
+	if (timeout_ms < 0) {
+		lws_pt_woke(pt);
 		goto faked_service;
+	}
 
 	lws_libev_run(context, tsi);
 	lws_libuv_run(context, tsi);
@@ -143,9 +415,31 @@ lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 	}
 	context->service_tid = context->service_tid_detected;
 
+	lws_pt_sleeping(pt);
+	/* between passes is the one time it's safe to move wsi elsewhere */
+	lws_pt_balance(context, tsi);
+
 	timeout_ms = lws_service_adjust_timeout(context, timeout_ms, tsi);
 
-	n = poll(pt->fds, pt->fds_count, timeout_ms);
+	if (LWS_URING_ENABLED(context))
+		return lws_uring_service_tsi(context, timeout_ms, tsi);
+#if defined(LWS_USE_EPOLL)
+	if (LWS_EPOLL_ENABLED(context))
+		return lws_plat_service_tsi_epoll(context, timeout_ms, tsi);
+#endif
+
+	fds = pt->fds;
+	count = pt->fds_count;
+	n = poll(fds, count, timeout_ms);
+	lws_pt_woke(pt);
+
+	if (n > 0 && fds != pt->fds) {
+		/* another thread outgrew the table while we were in poll() */
+		lws_pt_lock(pt);
+		for (m = 0; m < (int)count; m++)
+			pt->fds[m].revents = fds[m].revents;
+		lws_pt_unlock(pt);
+	}
 
 #ifdef LWS_OPENSSL_SUPPORT
 	if (!pt->rx_draining_ext_list &&
@@ -177,8 +471,7 @@ faked_service:
 		c--;
 
 		if (pt->fds[n].fd == pt->dummy_pipe_fds[0]) {
-			if (read(pt->fds[n].fd, &buf, 1) != 1)
-				lwsl_err("Cannot read from dummy pipe.");
+			lws_plat_pipe_drain(pt);
 			continue;
 		}
 
@@ -190,6 +483,10 @@ faked_service:
 			n--;
 	}
 
+	/* the wake may have been all there was, nobody else drained them */
+	if (lws_pt_cmd_pending(pt))
+		lws_pt_cmd_drain(pt);
+
 	return 0;
 }
 
@@ -268,6 +565,60 @@ lws_plat_set_socket_options(struct lws_vhost *vhost, int fd)
 	return 0;
 }
 
+/*
+ * Accept a connection from a listen socket that was itself set up with
+ * lws_plat_set_socket_options().  Linux copies the keepalive and nodelay
+ * settings from the listener to the accepted socket, so accept4() to get it
+ * nonblocking is all the syscalls needed.
+ */
+
+LWS_VISIBLE lws_sockfd_type
+lws_plat_accept(struct lws_vhost *vhost, lws_sockfd_type fd,
+		struct sockaddr *sa, socklen_t *len)
+{
+	lws_sockfd_type afd;
+
+#if defined(LWS_USE_IO_URING)
+	/* multishot accept already took it, there's no peer address then */
+	if (LWS_URING_ENABLED(vhost->context) &&
+	    lws_uring_accept(vhost->context, fd, &afd)) {
+		memset(sa, 0, *len);
+		return afd;
+	}
+#endif
+#if defined(__linux__) && defined(LWS_HAVE_ACCEPT4)
+	afd = accept4(fd, sa, len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	afd = accept(fd, sa, len);
+	if (afd >= 0 && lws_plat_set_socket_options(vhost, afd))
+		lwsl_info("%s: unable to set options on fd %d\n", __func__, afd);
+#endif
+
+	return afd;
+}
+
+/*
+ * After the listener used up its accept budget, see if the kernel's accept
+ * queue for it is full, ie, it's dropping connection attempts
+ */
+
+LWS_VISIBLE int
+lws_plat_listen_q_full(lws_sockfd_type fd)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	/* for listeners, unacked is the queue length, sacked the backlog */
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+		return 0;
+
+	return ti.tcpi_unacked >= ti.tcpi_sacked;
+#else
+	return 0;
+#endif
+}
+
 LWS_VISIBLE void
 lws_plat_drop_app_privileges(struct lws_context_creation_info *info)
 {
@@ -462,19 +813,30 @@ LWS_VISIBLE void
 lws_plat_context_late_destroy(struct lws_context *context)
 {
 	struct lws_context_per_thread *pt = &context->pt[0];
-	int m = context->count_threads;
+	int m = context->count_threads, n;
 
 #ifdef LWS_WITH_PLUGINS
 	if (context->plugin_list)
 		lws_plat_plugins_destroy(context);
 #endif
 
-	if (context->lws_lookup)
+	if (context->lws_lookup) {
+		for (n = 0; n < lws_fd_page_count(context); n++)
+			lws_free(context->lws_lookup[n]);
 		lws_free(context->lws_lookup);
+	}
+
+	if (LWS_URING_ENABLED(context))
+		lws_uring_destroy(context);
 
 	while (m--) {
-		close(pt->dummy_pipe_fds[0]);
-		close(pt->dummy_pipe_fds[1]);
+		lws_plat_pipe_close(pt);
+#if defined(LWS_USE_EPOLL)
+		if (pt->epoll_events) {
+			close(pt->epoll_fd);
+			lws_free_set_NULL(pt->epoll_events);
+		}
+#endif
 		pt++;
 	}
 	close(context->fd_random);
@@ -551,6 +913,38 @@ lws_interface_to_sa(int ipv6, const char *ifname, struct sockaddr_in *addr,
 	return rc;
 }
 
+/*
+ * Service threads insert into the lookup under their own pt lock, so two of
+ * them may want the same missing page at once.  Whoever loses the race frees
+ * theirs and uses the winner's.
+ */
+int
+insert_wsi(struct lws_context *context, struct lws *wsi)
+{
+	struct lws_fd_page **pp, *page, *none = NULL;
+
+	pp = &context->lws_lookup[wsi->sock >> LWS_FD_PAGE_BITS];
+	page = lws_atomic_ptr_load(pp);
+	if (!page) {
+		page = lws_zalloc(sizeof(*page));
+		if (!page) {
+			lwsl_err("OOM on fd lookup page for fd %d\n", wsi->sock);
+			return 1;
+		}
+		if (lws_atomic_ptr_cas(pp, none, page))
+			lws_atomic_int_add(&context->fd_pages, 1);
+		else {
+			lws_free(page);
+			page = lws_atomic_ptr_load(pp);
+		}
+	}
+
+	assert(!page->wsi[wsi->sock & (LWS_FD_PAGE - 1)]);
+	page->wsi[wsi->sock & (LWS_FD_PAGE - 1)] = wsi;
+
+	return 0;
+}
+
 LWS_VISIBLE void
 lws_plat_insert_socket_into_fds(struct lws_context *context, struct lws *wsi)
 {
@@ -559,6 +953,16 @@ lws_plat_insert_socket_into_fds(struct lws_context *context, struct lws *wsi)
 	lws_libev_io(wsi, LWS_EV_START | LWS_EV_READ);
 	lws_libuv_io(wsi, LWS_EV_START | LWS_EV_READ);
 
+#if defined(LWS_USE_EPOLL)
+	if (LWS_EPOLL_ENABLED(context) &&
+	    lws_plat_epoll_ctl(pt, EPOLL_CTL_ADD, wsi->sock,
+			       pt->fds[pt->fds_count].events,
+			       LWS_EPOLL_ET_ENABLED(context)))
+		lwsl_err("%s: epoll add fd %d failed: %d\n", __func__,
+			 wsi->sock, LWS_ERRNO);
+#endif
+	lws_uring_arm(pt, wsi);
+
 	pt->fds[pt->fds_count++].revents = 0;
 }
 
@@ -571,6 +975,13 @@ lws_plat_delete_socket_from_fds(struct lws_context *context,
 	lws_libev_io(wsi, LWS_EV_STOP | LWS_EV_READ | LWS_EV_WRITE);
 	lws_libuv_io(wsi, LWS_EV_STOP | LWS_EV_READ | LWS_EV_WRITE);
 
+#if defined(LWS_USE_EPOLL)
+	/* the fd may already be closed, in which case epoll dropped it */
+	if (LWS_EPOLL_ENABLED(context) && lws_socket_is_valid(wsi->sock))
+		lws_plat_epoll_ctl(pt, EPOLL_CTL_DEL, wsi->sock, 0, 0);
+#endif
+	lws_uring_remove(pt, wsi);
+
 	pt->fds_count--;
 }
 
@@ -587,6 +998,19 @@ LWS_VISIBLE int
 lws_plat_change_pollfd(struct lws_context *context,
 		      struct lws *wsi, struct lws_pollfd *pfd)
 {
+#if defined(LWS_USE_EPOLL)
+	if (LWS_EPOLL_ENABLED(context) &&
+	    lws_plat_epoll_ctl(&context->pt[(int)wsi->tsi], EPOLL_CTL_MOD,
+			       pfd->fd, pfd->events,
+			       LWS_EPOLL_ET_ENABLED(context))) {
+		lwsl_err("%s: epoll mod fd %d failed: %d\n", __func__,
+			 pfd->fd, LWS_ERRNO);
+		return 1;
+	}
+#endif
+	/* polls only get added here, anything unwanted is masked on cqe */
+	lws_uring_arm(&context->pt[(int)wsi->tsi], wsi);
+
 	return 0;
 }
 
@@ -666,19 +1090,28 @@ lws_plat_init(struct lws_context *context,
 	      struct lws_context_creation_info *info)
 {
 	struct lws_context_per_thread *pt = &context->pt[0];
-	int n = context->count_threads, fd;
+	int n = context->count_threads, m, fd;
 
-	/* master context has the global fd lookup array */
-	context->lws_lookup = lws_zalloc(sizeof(struct lws *) *
-					 context->max_fds);
+	/* master context has the global fd lookup, its pages come later */
+	context->lws_lookup = lws_zalloc(sizeof(struct lws_fd_page *) *
+					 lws_fd_page_count(context));
 	if (context->lws_lookup == NULL) {
 		lwsl_err("OOM on lws_lookup array for %d connections\n",
 			 context->max_fds);
 		return 1;
 	}
 
-	lwsl_notice(" mem: platform fd map: %5u bytes\n",
-		    sizeof(struct lws *) * context->max_fds);
+	lwsl_notice(" mem: platform fd map: %5u bytes + %u per %d fds used\n",
+		    sizeof(struct lws_fd_page *) * lws_fd_page_count(context),
+		    sizeof(struct lws_fd_page), LWS_FD_PAGE);
+
+#if defined(LWS_HAVE_SCHED_SETAFFINITY)
+	/* before any service thread pins itself and is copied by others */
+	if (sched_getaffinity(0, sizeof(context->cpus_allowed),
+			      &context->cpus_allowed))
+		CPU_ZERO(&context->cpus_allowed);
+#endif
+
 	fd = open(SYSTEM_RANDOM_FILEPATH, O_RDONLY);
 
 	context->fd_random = fd;
@@ -688,16 +1121,25 @@ lws_plat_init(struct lws_context *context,
 		return 1;
 	}
 
+	if ((LWS_EPOLL_ENABLED(context) || LWS_URING_ENABLED(context)) &&
+	    (LWS_LIBEV_ENABLED(context) || LWS_LIBUV_ENABLED(context))) {
+		lwsl_notice("epoll / io_uring not used with a foreign loop\n");
+		context->options &= ~(LWS_SERVER_OPTION_EPOLL_EDGE_TRIGGERED |
+				      LWS_SERVER_OPTION_IO_URING);
+	}
+
+	/* libev / libuv watch it themselves, for lws_pt_cmd_*() wakes */
+	for (m = 0; m < n; m++)
+		if (lws_plat_pipe_create(&pt[m])) {
+			lwsl_err("Unable to create pipe\n");
+			return 1;
+		}
+
 	if (!lws_libev_init_fd_table(context) &&
 	    !lws_libuv_init_fd_table(context)) {
 		/* otherwise libev handled it instead */
 
 		while (n--) {
-			if (pipe(pt->dummy_pipe_fds)) {
-				lwsl_err("Unable to create pipe\n");
-				return 1;
-			}
-
 			/* use the read end of pipe as first item */
 			pt->fds[0].fd = pt->dummy_pipe_fds[0];
 			pt->fds[0].events = LWS_POLLIN;
@@ -705,6 +1147,22 @@ lws_plat_init(struct lws_context *context,
 			pt->fds_count = 1;
 			pt++;
 		}
+
+		/* if io_uring is unusable here, we fall back to the others */
+		if (LWS_URING_ENABLED(context) && !lws_uring_init(context))
+			context->options &=
+				~LWS_SERVER_OPTION_EPOLL_EDGE_TRIGGERED;
+
+#if defined(LWS_USE_EPOLL)
+		if (LWS_EPOLL_ENABLED(context)) {
+			lwsl_notice(" epoll service backend (%s-triggered)\n",
+				    LWS_EPOLL_ET_ENABLED(context) ?
+						    "edge" : "level");
+			for (n = 0; n < context->count_threads; n++)
+				if (lws_plat_epoll_init_pt(&context->pt[n]))
+					return 1;
+		}
+#endif
 	}
 
 	context->fops.open	= _lws_plat_file_open;
@@ -27,6 +27,55 @@ time_in_microseconds()
 	return (datetime.QuadPart - DELTA_EPOCH_IN_MICROSECS) / 10;
 }
 
+unsigned long long
+lws_plat_monotonic_ms(void)
+{
+#ifdef _WIN32_WCE
+	return GetTickCount();
+#else
+	return GetTickCount64();
+#endif
+}
+
+unsigned long long
+lws_plat_monotonic_us(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (now.QuadPart / freq.QuadPart) * 1000000ull +
+	       (now.QuadPart % freq.QuadPart) * 1000000ull / freq.QuadPart;
+}
+
+/* pin the calling thread to the tsi'th cpu the process may use */
+
+void
+lws_plat_pin_thread(struct lws_context *context, int tsi)
+{
+	DWORD_PTR proc, sys, bit;
+	int n, count = 0;
+
+	(void)context;
+
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &proc, &sys) || !proc)
+		return;
+
+	for (bit = proc; bit; bit &= bit - 1)
+		count++;
+
+	n = tsi % count;
+	for (bit = 1; bit; bit <<= 1)
+		if ((proc & bit) && !n--)
+			break;
+
+	if (!SetThreadAffinityMask(GetCurrentThread(), bit))
+		lwsl_warn("%s: tsi %d: unable to pin\n", __func__, tsi);
+}
+
 #ifdef _WIN32_WCE
 time_t time(time_t *t)
 {
@@ -109,19 +158,6 @@ LWS_VISIBLE int lws_send_pipe_choked(struct lws *wsi)
 	return (int)wsi->sock_send_blocking;
 }
 
-LWS_VISIBLE int lws_poll_listen_fd(struct lws_pollfd *fd)
-{
-	fd_set readfds;
-	struct timeval tv = { 0, 0 };
-
-	assert((fd->events & LWS_POLLIN) == LWS_POLLIN);
-
-	FD_ZERO(&readfds);
-	FD_SET(fd->fd, &readfds);
-
-	return select(fd->fd + 1, &readfds, NULL, NULL, &tv);
-}
-
 /**
  * lws_cancel_service() - Cancel servicing of pending websocket activity
  * @context:	Websocket context
@@ -141,6 +177,12 @@ lws_cancel_service(struct lws_context *context)
 	}
 }
 
+void
+lws_plat_pipe_signal(struct lws_context_per_thread *pt)
+{
+	WSASetEvent(pt->events[0]);
+}
+
 LWS_VISIBLE void
 lws_cancel_service_pt(struct lws *wsi)
 {
@@ -168,6 +210,10 @@ lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 	if (context == NULL)
 		return 1;
 
+	if (!pt->service_started)
+		lws_pt_service_start(pt);
+	lws_pt_fds_reap(pt);
+
 	if (!context->service_tid_detected) {
 		struct lws _lws;
 
@@ -203,11 +249,14 @@ lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
 			i--;
 	}
 
+	lws_pt_sleeping(pt);
+
 	/* if we know something needs service already, don't wait in poll */
 	timeout_ms = lws_service_adjust_timeout(context, timeout_ms, tsi);
 
 	ev = WSAWaitForMultipleEvents(pt->fds_count + 1, pt->events,
 				      FALSE, timeout_ms, FALSE);
+	lws_pt_woke(pt);
 	context->service_tid = 0;
 
 	if (ev == WSA_WAIT_TIMEOUT) {
@@ -276,6 +325,24 @@ lws_plat_service(struct lws_context *context, int timeout_ms)
 	return lws_plat_service_tsi(context, timeout_ms, 0);
 }
 
+LWS_VISIBLE lws_sockfd_type
+lws_plat_accept(struct lws_vhost *vhost, lws_sockfd_type fd,
+		struct sockaddr *sa, socklen_t *len)
+{
+	lws_sockfd_type afd = accept(fd, sa, len);
+
+	if (afd != INVALID_SOCKET && lws_plat_set_socket_options(vhost, afd))
+		lwsl_info("%s: unable to set options\n", __func__);
+
+	return afd;
+}
+
+LWS_VISIBLE int
+lws_plat_listen_q_full(lws_sockfd_type fd)
+{
+	return 0;
+}
+
 LWS_VISIBLE int
 lws_plat_set_socket_options(struct lws_vhost *vhost, lws_sockfd_type fd)
 {
@@ -0,0 +1,185 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * XOR ws payload with the frame mask, for rx unmasking and client tx masking.
+ *
+ * The kernels are given the mask already rotated to where the payload starts,
+ * and only ever step by multiples of 4 bytes, so it stays in phase.  Which
+ * one is used is decided at context creation from what the cpu can do; the
+ * x86 ones are built with target attributes so the library doesn't need
+ * building for a newer cpu than it runs on.
+ */
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define LWS_MASK_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*lws_xor_mask_kernel)(unsigned char *out,
+				    const unsigned char *in, size_t len,
+				    const unsigned char *m4);
+
+/* works anywhere, 8 bytes at a time */
+
+static void
+lws_xor_mask_64(unsigned char *out, const unsigned char *in, size_t len,
+		const unsigned char *m4)
+{
+	unsigned long long m, v;
+	unsigned int m32;
+	size_t n;
+
+	memcpy(&m32, m4, 4);
+	/* the same 4 bytes twice, whatever the byte order */
+	m = ((unsigned long long)m32 << 32) | m32;
+
+	for (; len >= 8; len -= 8, in += 8, out += 8) {
+		memcpy(&v, in, 8);
+		v ^= m;
+		memcpy(out, &v, 8);
+	}
+	for (n = 0; n < len; n++)
+		out[n] = in[n] ^ m4[n & 3];
+}
+
+#if defined(LWS_MASK_X86)
+
+__attribute__((target("sse2")))
+static void
+lws_xor_mask_sse2(unsigned char *out, const unsigned char *in, size_t len,
+		  const unsigned char *m4)
+{
+	__m128i m;
+	int m32;
+
+	memcpy(&m32, m4, 4);
+	m = _mm_set1_epi32(m32);
+
+	for (; len >= 16; len -= 16, in += 16, out += 16)
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(m,
+				 _mm_loadu_si128((const __m128i *)in)));
+
+	lws_xor_mask_64(out, in, len, m4);
+}
+
+__attribute__((target("avx2")))
+static void
+lws_xor_mask_avx2(unsigned char *out, const unsigned char *in, size_t len,
+		  const unsigned char *m4)
+{
+	__m256i m;
+	int m32;
+
+	memcpy(&m32, m4, 4);
+	m = _mm256_set1_epi32(m32);
+
+	for (; len >= 64; len -= 64, in += 64, out += 64) {
+		_mm256_storeu_si256((__m256i *)out, _mm256_xor_si256(m,
+				    _mm256_loadu_si256((const __m256i *)in)));
+		_mm256_storeu_si256((__m256i *)(out + 32), _mm256_xor_si256(m,
+				    _mm256_loadu_si256((const __m256i *)(in + 32))));
+	}
+	for (; len >= 32; len -= 32, in += 32, out += 32)
+		_mm256_storeu_si256((__m256i *)out, _mm256_xor_si256(m,
+				    _mm256_loadu_si256((const __m256i *)in)));
+
+	lws_xor_mask_64(out, in, len, m4);
+}
+
+#endif
+
+static lws_xor_mask_kernel lws_xor_mask_best = lws_xor_mask_64;
+
+/*
+ * Use the given kernel instead of the best one, so the self-test can check
+ * and time each of them.  Returns nonzero if this build or cpu can't run it.
+ * Nothing may be masking meanwhile.
+ */
+
+int
+lws_ws_mask_force(int kernel)
+{
+	switch (kernel) {
+	case LWS_WS_MASK_64:
+		lws_xor_mask_best = lws_xor_mask_64;
+		return 0;
+#if defined(LWS_MASK_X86)
+	case LWS_WS_MASK_SSE2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("sse2"))
+			return 1;
+		lws_xor_mask_best = lws_xor_mask_sse2;
+		return 0;
+	case LWS_WS_MASK_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			return 1;
+		lws_xor_mask_best = lws_xor_mask_avx2;
+		return 0;
+#endif
+	}
+
+	return 1;
+}
+
+void
+lws_ws_mask_init(void)
+{
+	if (!lws_ws_mask_force(LWS_WS_MASK_AVX2)) {
+		lwsl_info(" ws masking            : avx2\n");
+		return;
+	}
+	if (!lws_ws_mask_force(LWS_WS_MASK_SSE2)) {
+		lwsl_info(" ws masking            : sse2\n");
+		return;
+	}
+	lws_ws_mask_force(LWS_WS_MASK_64);
+	lwsl_info(" ws masking            : 64-bit\n");
+}
+
+/*
+ * out may be the same as in.  idx is where in the mask the payload starts,
+ * the caller moves its mask_idx on by len afterwards.
+ */
+
+void
+lws_ws_xor_mask(unsigned char *out, const unsigned char *in, size_t len,
+		const unsigned char *mask, int idx)
+{
+	unsigned char m4[4];
+	size_t n;
+
+	/* not worth the call for what's left after a header */
+	if (len < 16) {
+		for (n = 0; n < len; n++)
+			out[n] = in[n] ^ mask[(idx + n) & 3];
+		return;
+	}
+
+	for (n = 0; n < 4; n++)
+		m4[n] = mask[(idx + n) & 3];
+
+	lws_xor_mask_best(out, in, len, m4);
+}
@@ -33,10 +33,10 @@ lws_0405_frame_mask_generate(struct lws *wsi)
 	int n;
 	/* fetch the per-frame nonce */
 
-	n = lws_get_random(lws_get_context(wsi), wsi->u.ws.mask, 4);
+	n = lws_get_random_tsi(lws_get_context(wsi), wsi->tsi,
+			       wsi->u.ws.mask, 4);
 	if (n != 4) {
-		lwsl_parser("Unable to read from random device %s %d\n",
-			    SYSTEM_RANDOM_FILEPATH, n);
+		lwsl_parser("Unable to get random mask %d\n", n);
 		return 1;
 	}
 #endif
@@ -89,50 +89,46 @@ LWS_VISIBLE void lwsl_hexdump(void *vbuf, size_t len)
 #endif
 
 /*
- * notice this returns number of bytes consumed, or -1
+ * most we hand the socket at once, the biggest rx buffer if it can grow.  A
+ * blocked TLS write gets retried with the same length, so this mustn't change
+ * for the life of the wsi.
  */
 
-int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
+size_t
+lws_issue_raw_limit(struct lws *wsi)
 {
-	struct lws_context *context = lws_get_context(wsi);
-	size_t real_len = len;
-	unsigned int n;
-	int m;
+	size_t n = wsi->protocol->rx_buffer_size;
 
-	if (!len)
-		return 0;
-	/* just ignore sends after we cleared the truncation buffer */
-	if (wsi->state == LWSS_FLUSHING_STORED_SEND_BEFORE_CLOSE &&
-	    !wsi->trunc_len)
-		return len;
+	if (!n)
+		n = wsi->context->pt_serv_buf_size;
+	if (wsi->protocol->rx_buffer_size_max > n)
+		n = wsi->protocol->rx_buffer_size_max;
+
+	return n + LWS_PRE + 4;
+}
 
-	if (wsi->trunc_len && (buf < wsi->trunc_alloc ||
-	    buf > (wsi->trunc_alloc + wsi->trunc_len +
-		   wsi->trunc_offset))) {
-		lwsl_err("****** %p: Sending new, pending truncated ...\n"
-			 "       It's illegal to do an lws_write outside of\n"
-			 "       the writable callback: fix your code", wsi);
-		assert(0);
+/*
+ * send what the socket will take right now, returns bytes sent (which may be
+ * 0) or -1
+ */
 
-		return -1;
-	}
+int
+lws_issue_raw_sock(struct lws *wsi, unsigned char *buf, size_t len)
+{
+	struct lws_context *context = lws_get_context(wsi);
+	unsigned int n;
+	int m;
 
 	m = lws_ext_cb_active(wsi, LWS_EXT_CB_PACKET_TX_DO_SEND, &buf, len);
 	if (m < 0)
 		return -1;
-	if (m) /* handled */ {
-		n = m;
-		goto handle_truncated_send;
-	}
+	if (m) /* handled */
+		return m;
 
 	if (!lws_socket_is_valid(wsi->sock))
 		lwsl_warn("** error invalid sock but expected to send\n");
 
-	/* limit sending */
-	n = wsi->protocol->rx_buffer_size;
-	if (!n)
-		n = context->pt_serv_buf_size;
-	n += LWS_PRE + 4;
+	n = lws_issue_raw_limit(wsi);
 	if (n > len)
 		n = len;
 
@@ -148,68 +144,139 @@ int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
 		return -1;
 	case LWS_SSL_CAPABLE_MORE_SERVICE:
 		/* nothing got sent, not fatal, retry the whole thing later */
-		n = 0;
-		break;
+		return 0;
 	}
 
-handle_truncated_send:
+	return n;
+}
+
+/*
+ * notice this returns number of bytes consumed, or -1
+ */
+
+int lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len)
+{
+	int n;
+
+	if (!len)
+		return 0;
+	/* just ignore sends after we cleared the truncation buffer */
+	if (wsi->state == LWSS_FLUSHING_STORED_SEND_BEFORE_CLOSE &&
+	    !wsi->trunc_len)
+		return len;
+
 	/*
-	 * we were already handling a truncated send?
+	 * Something is already queued: this must go out after it, so it joins
+	 * the queue without trying the socket
 	 */
 	if (wsi->trunc_len) {
-		lwsl_info("%p partial adv %d (vs %d)\n", wsi, n, real_len);
-		wsi->trunc_offset += n;
-		wsi->trunc_len -= n;
-
-		if (!wsi->trunc_len) {
-			lwsl_info("***** %x partial send completed\n", wsi);
-			/* done with it, but don't free it */
-			n = real_len;
-			if (wsi->state == LWSS_FLUSHING_STORED_SEND_BEFORE_CLOSE) {
-				lwsl_info("***** %x signalling to close now\n", wsi);
-				return -1; /* retry closing now */
-			}
-		}
-		/* always callback on writeable */
-		lws_callback_on_writable(wsi);
+		if (lws_txq_append(wsi, buf, len))
+			return -1;
 
-		return n;
+		return len;
 	}
 
-	if ((unsigned int)n == real_len)
+	n = lws_issue_raw_sock(wsi, buf, len);
+	if (n < 0)
+		return -1;
+
+	if ((unsigned int)n == len)
 		/* what we just sent went out cleanly */
 		return n;
 
 	/*
-	 * Newly truncated send.  Buffer the remainder (it will get
+	 * Newly truncated send.  Queue the remainder (it will get
 	 * first priority next time the socket is writable)
 	 */
-	lwsl_info("%p new partial sent %d from %d total\n", wsi, n, real_len);
+	lwsl_info("%p new partial sent %d from %d total\n", wsi, n, len);
 
-	/*
-	 *  - if we still have a suitable malloc lying around, use it
-	 *  - or, if too small, reallocate it
-	 *  - or, if no buffer, create it
-	 */
-	if (!wsi->trunc_alloc || real_len - n > wsi->trunc_alloc_len) {
-		lws_free(wsi->trunc_alloc);
-
-		wsi->trunc_alloc_len = real_len - n;
-		wsi->trunc_alloc = lws_malloc(real_len - n);
-		if (!wsi->trunc_alloc) {
-			lwsl_err("truncated send: unable to malloc %d\n",
-				 real_len - n);
-			return -1;
-		}
-	}
-	wsi->trunc_offset = 0;
-	wsi->trunc_len = real_len - n;
-	memcpy(wsi->trunc_alloc, buf + n, real_len - n);
+#ifdef LWS_OPENSSL_SUPPORT
+	/* the blocked TLS write is retried from the queue, keep it in one */
+	if (wsi->ssl && !n && lws_txq_reserve(wsi, len))
+		return -1;
+#endif
+	if (lws_txq_append(wsi, buf + n, len - n))
+		return -1;
 
 	/* since something buffered, force it to get another chance to send */
 	lws_callback_on_writable(wsi);
 
-	return real_len;
+	return len;
+}
+
+/*
+ * Build a ws frame header so it ends at @end, returns its length or -1.
+ * If @is_masked_bit is set, the caller puts the 4 byte mask at @end.
+ */
+
+int
+lws_ws_frame_header(unsigned char *end, size_t len, int wp,
+		    unsigned char is_masked_bit)
+{
+	int n, pre;
+
+	switch (wp & 0xf) {
+	case LWS_WRITE_TEXT:
+		n = LWSWSOPC_TEXT_FRAME;
+		break;
+	case LWS_WRITE_BINARY:
+		n = LWSWSOPC_BINARY_FRAME;
+		break;
+	case LWS_WRITE_CONTINUATION:
+		n = LWSWSOPC_CONTINUATION;
+		break;
+
+	case LWS_WRITE_CLOSE:
+		n = LWSWSOPC_CLOSE;
+		break;
+	case LWS_WRITE_PING:
+		n = LWSWSOPC_PING;
+		break;
+	case LWS_WRITE_PONG:
+		n = LWSWSOPC_PONG;
+		break;
+	default:
+		lwsl_warn("lws_write: unknown write opc / wp\n");
+		return -1;
+	}
+
+	if (!(wp & LWS_WRITE_NO_FIN))
+		n |= 1 << 7;
+
+	if (len < 126) {
+		pre = 2;
+		end[-pre] = n;
+		end[-pre + 1] = (unsigned char)(len | is_masked_bit);
+	} else {
+		if (len < 65536) {
+			pre = 4;
+			end[-pre] = n;
+			end[-pre + 1] = 126 | is_masked_bit;
+			end[-pre + 2] = (unsigned char)(len >> 8);
+			end[-pre + 3] = (unsigned char)len;
+		} else {
+			pre = 10;
+			end[-pre] = n;
+			end[-pre + 1] = 127 | is_masked_bit;
+#if defined __LP64__
+				end[-pre + 2] = (len >> 56) & 0x7f;
+				end[-pre + 3] = len >> 48;
+				end[-pre + 4] = len >> 40;
+				end[-pre + 5] = len >> 32;
+#else
+				end[-pre + 2] = 0;
+				end[-pre + 3] = 0;
+				end[-pre + 4] = 0;
+				end[-pre + 5] = 0;
+#endif
+			end[-pre + 6] = (unsigned char)(len >> 24);
+			end[-pre + 7] = (unsigned char)(len >> 16);
+			end[-pre + 8] = (unsigned char)(len >> 8);
+			end[-pre + 9] = (unsigned char)len;
+		}
+	}
+
+	return pre;
 }
 
 /**
@@ -252,10 +319,12 @@ LWS_VISIBLE int lws_write(struct lws *wsi, unsigned char *buf, size_t len,
 	size_t orig_len = len;
 
 #ifdef LWS_WITH_ACCESS_LOG
-	wsi->access_log.sent += len;
+	if (wsi->access_log)
+		wsi->access_log->sent += len;
 #endif
 	if (wsi->vhost)
-		wsi->vhost->tx += len;
+		lws_vh_stats(wsi)->tx += len;
+	pt->load.tx += len;
 
 	if (wsi->state == LWSS_ESTABLISHED && wsi->u.ws.tx_draining_ext) {
 		/* remove us from the list */
@@ -387,66 +456,10 @@ LWS_VISIBLE int lws_write(struct lws *wsi, unsigned char *buf, size_t len,
 			is_masked_bit = 0x80;
 		}
 
-		switch (wp & 0xf) {
-		case LWS_WRITE_TEXT:
-			n = LWSWSOPC_TEXT_FRAME;
-			break;
-		case LWS_WRITE_BINARY:
-			n = LWSWSOPC_BINARY_FRAME;
-			break;
-		case LWS_WRITE_CONTINUATION:
-			n = LWSWSOPC_CONTINUATION;
-			break;
-
-		case LWS_WRITE_CLOSE:
-			n = LWSWSOPC_CLOSE;
-			break;
-		case LWS_WRITE_PING:
-			n = LWSWSOPC_PING;
-			break;
-		case LWS_WRITE_PONG:
-			n = LWSWSOPC_PONG;
-			break;
-		default:
-			lwsl_warn("lws_write: unknown write opc / wp\n");
+		n = lws_ws_frame_header(buf - pre, len, wp, is_masked_bit);
+		if (n < 0)
 			return -1;
-		}
-
-		if (!(wp & LWS_WRITE_NO_FIN))
-			n |= 1 << 7;
-
-		if (len < 126) {
-			pre += 2;
-			buf[-pre] = n;
-			buf[-pre + 1] = (unsigned char)(len | is_masked_bit);
-		} else {
-			if (len < 65536) {
-				pre += 4;
-				buf[-pre] = n;
-				buf[-pre + 1] = 126 | is_masked_bit;
-				buf[-pre + 2] = (unsigned char)(len >> 8);
-				buf[-pre + 3] = (unsigned char)len;
-			} else {
-				pre += 10;
-				buf[-pre] = n;
-				buf[-pre + 1] = 127 | is_masked_bit;
-#if defined __LP64__
-					buf[-pre + 2] = (len >> 56) & 0x7f;
-					buf[-pre + 3] = len >> 48;
-					buf[-pre + 4] = len >> 40;
-					buf[-pre + 5] = len >> 32;
-#else
-					buf[-pre + 2] = 0;
-					buf[-pre + 3] = 0;
-					buf[-pre + 4] = 0;
-					buf[-pre + 5] = 0;
-#endif
-				buf[-pre + 6] = (unsigned char)(len >> 24);
-				buf[-pre + 7] = (unsigned char)(len >> 16);
-				buf[-pre + 8] = (unsigned char)(len >> 8);
-				buf[-pre + 9] = (unsigned char)len;
-			}
-		}
+		pre += n;
 		break;
 	}
 
@@ -468,9 +481,9 @@ do_more_inside_frame:
 		 * in v7, just mask the payload
 		 */
 		if (dropmask) { /* never set if already inside frame */
-			for (n = 4; n < (int)len + 4; n++)
-				dropmask[n] = dropmask[n] ^ wsi->u.ws.mask[
-					(wsi->u.ws.mask_idx++) & 3];
+			lws_ws_xor_mask(dropmask + 4, dropmask + 4, len,
+					wsi->u.ws.mask, wsi->u.ws.mask_idx);
+			wsi->u.ws.mask_idx = (wsi->u.ws.mask_idx + len) & 3;
 
 			/* copy the frame nonce into place */
 			memcpy(dropmask, wsi->u.ws.mask, 4);
@@ -564,6 +577,192 @@ send_raw:
 	return n - pre;
 }
 
+/*
+ * lws_issue_raw() for a payload in pieces: one gathered send of what the
+ * socket will take, then whatever it didn't is copied onto the queue in
+ * order.  Returns 0, or -1 if the connection should close.
+ */
+
+static int
+lws_issue_raw_vec(struct lws *wsi, const struct lws_iov *iov, int count)
+{
+	struct lws_iov v[LWS_WRITE_VEC_MAX + 1];
+	int n = 0, i, c, tried = !wsi->trunc_len;
+	size_t skip, limit, total = 0;
+
+	/* just ignore sends after we cleared the truncation buffer */
+	if (wsi->state == LWSS_FLUSHING_STORED_SEND_BEFORE_CLOSE &&
+	    !wsi->trunc_len)
+		return 0;
+
+	/* if something is already queued, this goes behind it */
+	if (tried) {
+		/* no more than lws_issue_raw_sock() would send */
+		limit = lws_issue_raw_limit(wsi);
+		memcpy(v, iov, count * sizeof(*iov));
+		for (c = 0; c < count && limit; c++) {
+			if (v[c].len > limit)
+				v[c].len = limit;
+			limit -= v[c].len;
+		}
+		n = lws_ssl_capable_write_vec(wsi, v, c);
+		switch (n) {
+		case LWS_SSL_CAPABLE_ERROR:
+			wsi->socket_is_permanently_unusable = 1;
+			return -1;
+		case LWS_SSL_CAPABLE_MORE_SERVICE:
+			n = 0;
+			break;
+		}
+	}
+
+#ifdef LWS_OPENSSL_SUPPORT
+	/*
+	 * A blocked TLS write is retried from the head of the queue, which
+	 * must start with the same bytes, at least as many, in one piece
+	 */
+	if (tried && wsi->ssl && !n) {
+		for (i = 0; i < count; i++)
+			total += iov[i].len;
+		if (lws_txq_reserve(wsi, total))
+			return -1;
+	}
+#else
+	(void)total;
+#endif
+
+	skip = n;
+	for (i = 0; i < count; i++) {
+		if (skip >= iov[i].len) {
+			skip -= iov[i].len;
+			continue;
+		}
+		if (lws_txq_append(wsi, (const unsigned char *)iov[i].base +
+				   skip, iov[i].len - skip))
+			return -1;
+		skip = 0;
+	}
+
+	if (tried && wsi->trunc_len) {
+		/* newly truncated, it gets first go when writeable */
+		lwsl_info("%p new partial vec sent %d\n", wsi, n);
+		lws_callback_on_writable(wsi);
+	}
+
+	return 0;
+}
+
+/**
+ * lws_write_vec() - lws_write() a payload that is in several buffers
+ * @wsi:	Websocket instance (available from user callback)
+ * @iov:	the segments of the payload, in order
+ * @count:	how many segments, 1 to LWS_WRITE_VEC_MAX
+ * @protocol:	as for lws_write()
+ *
+ *	The segments don't need LWS_PRE in front of them and aren't written
+ *	to, the ws frame header is made separately.  On a ws server
+ *	connection with no extension active, or for http, the header and
+ *	segments go out in one writev-style send (batched into one TLS write
+ *	on TLS connections), and what the socket didn't take is queued.  A
+ *	client connection masks a copy of the payload.  Otherwise, like with
+ *	an extension active, the segments are gathered and passed to
+ *	lws_write().
+ *
+ *	Returns -1 for a fatal error needing connection close, otherwise the
+ *	payload length, since anything not sent is queued.
+ */
+LWS_VISIBLE int
+lws_write_vec(struct lws *wsi, const struct lws_iov *iov, int count,
+	      enum lws_write_protocol wp)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_iov v[LWS_WRITE_VEC_MAX + 1];
+	unsigned char hdr[14], stack[1024], *p, *copy;
+	size_t len = 0;
+	int n, i, http = wp == LWS_WRITE_HTTP || wp == LWS_WRITE_HTTP_FINAL ||
+			 wp == LWS_WRITE_HTTP_HEADERS;
+
+	if (count < 1 || count > LWS_WRITE_VEC_MAX)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		len += iov[i].len;
+
+	if (http ? wsi->mode == LWSCM_HTTP2_SERVING :
+	    (wsi->mode != LWSCM_WS_SERVING && wsi->mode != LWSCM_WS_CLIENT) ||
+	    wsi->state != LWSS_ESTABLISHED || wsi->count_act_ext ||
+	    wsi->u.ws.inside_frame || wsi->u.ws.tx_draining_ext ||
+	    ((wp & 0xf) != LWS_WRITE_TEXT && (wp & 0xf) != LWS_WRITE_BINARY &&
+	     (wp & 0xf) != LWS_WRITE_CONTINUATION)) {
+		/* lws_write() has to see it all in one place */
+		copy = lws_malloc(LWS_PRE + len);
+		if (!copy)
+			return -1;
+		p = copy + LWS_PRE;
+		for (i = 0; i < count; i++) {
+			memcpy(p, iov[i].base, iov[i].len);
+			p += iov[i].len;
+		}
+		n = lws_write(wsi, copy + LWS_PRE, len, wp);
+		lws_free(copy);
+
+		return n;
+	}
+
+#ifdef LWS_WITH_ACCESS_LOG
+	if (wsi->access_log)
+		wsi->access_log->sent += len;
+#endif
+	if (wsi->vhost)
+		lws_vh_stats(wsi)->tx += len;
+	pt->load.tx += len;
+
+	if (http)
+		return lws_issue_raw_vec(wsi, iov, count) ? -1 : (int)len;
+
+	if (wsi->mode == LWSCM_WS_CLIENT) {
+		/* the segments are the user's, mask a copy behind the header */
+		if (sizeof(hdr) + len <= sizeof(stack))
+			copy = stack;
+		else {
+			copy = lws_malloc(sizeof(hdr) + len);
+			if (!copy)
+				return -1;
+		}
+		p = copy + sizeof(hdr);
+		n = lws_ws_frame_header(p - 4, len, wp, 0x80);
+		if (n < 0 || lws_0405_frame_mask_generate(wsi))
+			goto bail;
+		memcpy(p - 4, wsi->u.ws.mask, 4);
+		for (i = 0; i < count; i++) {
+			lws_ws_xor_mask(p, iov[i].base, iov[i].len,
+					wsi->u.ws.mask, wsi->u.ws.mask_idx);
+			wsi->u.ws.mask_idx = (wsi->u.ws.mask_idx + iov[i].len) & 3;
+			p += iov[i].len;
+		}
+		n = lws_issue_raw(wsi, copy + sizeof(hdr) - 4 - n, n + 4 + len);
+		if (copy != stack)
+			lws_free(copy);
+
+		return n < 0 ? -1 : (int)len;
+	}
+
+	n = lws_ws_frame_header(hdr + sizeof(hdr), len, wp, 0);
+	if (n < 0)
+		return -1;
+	v[0].base = hdr + sizeof(hdr) - n;
+	v[0].len = n;
+	memcpy(&v[1], iov, count * sizeof(*iov));
+
+	return lws_issue_raw_vec(wsi, v, count + 1) ? -1 : (int)len;
+
+bail:
+	if (copy != stack)
+		lws_free(copy);
+
+	return -1;
+}
+
 LWS_VISIBLE int lws_serve_http_file_fragment(struct lws *wsi)
 {
 	struct lws_context *context = wsi->context;
@@ -575,9 +774,7 @@ LWS_VISIBLE int lws_serve_http_file_fragment(struct lws *wsi)
 
 	while (wsi->http2_substream || !lws_send_pipe_choked(wsi)) {
 		if (wsi->trunc_len) {
-			if (lws_issue_raw(wsi, wsi->trunc_alloc +
-					  wsi->trunc_offset,
-					  wsi->trunc_len) < 0) {
+			if (lws_txq_drain(wsi) < 0) {
 				lwsl_info("%s: closing\n", __func__);
 				return -1;
 			}
@@ -667,12 +864,29 @@ lws_ssl_capable_read_no_ssl(struct lws *wsi, unsigned char *buf, int len)
 {
 	int n;
 
-	n = recv(wsi->sock, (char *)buf, len, 0);
+#if defined(LWS_USE_IO_URING)
+	/* with a ring recv queued, data must come from that to stay in order */
+	if (wsi->uring_rx_len || wsi->uring_eof ||
+	    (!wsi->listener && (wsi->uring_armed & LWS_URING_DIR_RX)))
+		n = lws_uring_read(wsi, buf, len);
+	else
+#endif
+		n = recv(wsi->sock, (char *)buf, len, 0);
 	if (n >= 0) {
 		if (wsi->vhost)
-			wsi->vhost->rx += n;
+			lws_vh_stats(wsi)->rx += n;
+		wsi->context->pt[(int)wsi->tsi].load.rx += n;
+#if defined(LWS_USE_EPOLL)
+		/* our buffer limited the read, the socket may have more */
+		if (n == len)
+			wsi->epoll_rearm = 1;
+#endif
 		return n;
 	}
+#if defined(LWS_USE_IO_URING)
+	if (n == LWS_SSL_CAPABLE_MORE_SERVICE)
+		return n;
+#endif
 #if LWS_POSIX
 	if (LWS_ERRNO == LWS_EAGAIN ||
 	    LWS_ERRNO == LWS_EWOULDBLOCK ||
@@ -691,13 +905,23 @@ lws_ssl_capable_write_no_ssl(struct lws *wsi, unsigned char *buf, int len)
 #if LWS_POSIX
 	n = send(wsi->sock, (char *)buf, len, MSG_NOSIGNAL);
 //	lwsl_info("%s: sent len %d result %d", __func__, len, n);
-	if (n >= 0)
+	if (n >= 0) {
+#if !defined(_WIN32)
+		/*
+		 * a short send means the kernel buffer is full now (windows
+		 * only signals FD_WRITE again after an actual WSAEWOULDBLOCK)
+		 */
+		if (n < len)
+			lws_set_blocking_send(wsi);
+#endif
 		return n;
+	}
 
 	if (LWS_ERRNO == LWS_EAGAIN ||
 	    LWS_ERRNO == LWS_EWOULDBLOCK ||
 	    LWS_ERRNO == LWS_EINTR) {
-		if (LWS_ERRNO == LWS_EWOULDBLOCK)
+		if (LWS_ERRNO == LWS_EAGAIN ||
+		    LWS_ERRNO == LWS_EWOULDBLOCK)
 			lws_set_blocking_send(wsi);
 
 		return LWS_SSL_CAPABLE_MORE_SERVICE;
@@ -713,6 +937,60 @@ lws_ssl_capable_write_no_ssl(struct lws *wsi, unsigned char *buf, int len)
 	lwsl_debug("ERROR writing len %d to skt fd %d err %d / errno %d\n", len, wsi->sock, n, LWS_ERRNO);
 	return LWS_SSL_CAPABLE_ERROR;
 }
+
+/* one gathered send on a plain socket, same returns as the above */
+
+LWS_VISIBLE int
+lws_ssl_capable_write_vec_no_ssl(struct lws *wsi, const struct lws_iov *iov,
+				 int count)
+{
+#if !defined(_WIN32)
+	struct iovec v[LWS_WRITE_VEC_MAX + 1];
+	struct msghdr mh;
+	size_t len = 0;
+	int n;
+
+	if (count > LWS_WRITE_VEC_MAX + 1)
+		count = LWS_WRITE_VEC_MAX + 1;
+
+	for (n = 0; n < count; n++) {
+		v[n].iov_base = (void *)iov[n].base;
+		v[n].iov_len = iov[n].len;
+		len += iov[n].len;
+	}
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = v;
+	mh.msg_iovlen = count;
+
+	n = sendmsg(wsi->sock, &mh, MSG_NOSIGNAL);
+	if (n >= 0) {
+		/* a short send means the kernel buffer is full now */
+		if ((size_t)n < len)
+			lws_set_blocking_send(wsi);
+		return n;
+	}
+
+	if (LWS_ERRNO == LWS_EAGAIN ||
+	    LWS_ERRNO == LWS_EWOULDBLOCK ||
+	    LWS_ERRNO == LWS_EINTR) {
+		if (LWS_ERRNO == LWS_EAGAIN ||
+		    LWS_ERRNO == LWS_EWOULDBLOCK)
+			lws_set_blocking_send(wsi);
+
+		return LWS_SSL_CAPABLE_MORE_SERVICE;
+	}
+
+	lwsl_debug("ERROR writing vec len %d to skt fd %d errno %d\n",
+		   (int)len, wsi->sock, LWS_ERRNO);
+	return LWS_SSL_CAPABLE_ERROR;
+#else
+	/* sending just the first segment is a short send like any other */
+	(void)count;
+
+	return lws_ssl_capable_write_no_ssl(wsi, (unsigned char *)iov->base,
+					    iov->len);
+#endif
+}
 #endif
 LWS_VISIBLE int
 lws_ssl_pending_no_ssl(struct lws *wsi)
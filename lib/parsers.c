@@ -110,14 +110,215 @@ lws_header_table_reset(struct lws *wsi, int autoservice)
 	}
 }
 
+/*
+ * The ah pool.  Each service thread keeps its idle ahs on pt->ah_free, most
+ * recently used first, and only allocates a new one when none is idle and it
+ * has fewer than max_http_header_pool.  Ahs that stayed idle for a whole
+ * LWS_AH_TRIM_MS window are freed again, down to min_http_header_pool.
+ *
+ * A wsi that can't get one waits on pt->ah_wait_list, in the order they
+ * came, and detach hands its ah straight to the oldest waiter.
+ */
+
+/* pt lock held */
+static struct allocated_headers *
+lws_ah_create(struct lws_context_per_thread *pt)
+{
+	struct lws_context *context = pt->context;
+	struct allocated_headers *ah;
+
+	ah = lws_zalloc(sizeof(*ah) + context->max_http_header_data);
+	if (!ah) {
+		lwsl_err("%s: OOM\n", __func__);
+		return NULL;
+	}
+	ah->data = (char *)(ah + 1);
+	ah->next = pt->ah_list;
+	pt->ah_list = ah;
+	pt->ah_count_alloc++;
+	pt->ah_stats.grown++;
+
+	return ah;
+}
+
+/* pt lock held */
+static struct allocated_headers *
+lws_ah_get(struct lws_context_per_thread *pt)
+{
+	struct allocated_headers *ah = pt->ah_free;
+
+	if (ah)
+		pt->ah_free = ah->next_free;
+	else {
+		if (pt->ah_count_alloc >= pt->context->max_http_header_pool)
+			return NULL;
+		ah = lws_ah_create(pt);
+		if (!ah)
+			return NULL;
+		lwsl_info("%s: pt %d: ah pool grew to %d\n", __func__,
+			  pt->tid, pt->ah_count_alloc);
+	}
+
+	ah->in_use = 1;
+	pt->ah_count_in_use++;
+	if (pt->ah_count_in_use > pt->ah_stats.peak_in_use)
+		pt->ah_stats.peak_in_use = pt->ah_count_in_use;
+	if (pt->ah_count_alloc - pt->ah_count_in_use < pt->ah_free_low)
+		pt->ah_free_low = pt->ah_count_alloc - pt->ah_count_in_use;
+
+	return ah;
+}
+
+/* pt lock held */
+static void
+lws_ah_put(struct lws_context_per_thread *pt, struct allocated_headers *ah)
+{
+	ah->in_use = 0;
+	ah->next_free = pt->ah_free;
+	pt->ah_free = ah;
+	pt->ah_count_in_use--;
+}
+
+/* called on the service thread before it first services */
+void
+lws_pt_ah_pool_fill(struct lws_context_per_thread *pt)
+{
+	struct allocated_headers *ah;
+
+	lws_pt_lock(pt);
+	while (pt->ah_count_alloc < pt->context->min_http_header_pool) {
+		ah = lws_ah_create(pt);
+		if (!ah)
+			break;
+		ah->next_free = pt->ah_free;
+		pt->ah_free = ah;
+	}
+	pt->ah_free_low = pt->ah_count_alloc - pt->ah_count_in_use;
+	lws_pt_unlock(pt);
+}
+
+/* once per LWS_AH_TRIM_MS, free the ahs nobody needed in that time */
+void
+lws_pt_ah_pool_trim(struct lws_context_per_thread *pt)
+{
+	struct allocated_headers *ah, **pah, **p;
+	int n, keep;
+
+	if (pt->now_ms - pt->ah_trim_ms < LWS_AH_TRIM_MS)
+		return;
+
+	lws_pt_lock(pt);
+	pt->ah_trim_ms = pt->now_ms;
+
+	/* the fewest idle during the window were never needed in it */
+	n = pt->ah_free_low;
+	if (n > pt->ah_count_alloc - pt->context->min_http_header_pool)
+		n = pt->ah_count_alloc - pt->context->min_http_header_pool;
+	keep = pt->ah_count_alloc - pt->ah_count_in_use - n;
+
+	/* the warmest idle ones are at the head, free from the tail */
+	pah = &pt->ah_free;
+	while (*pah && keep--)
+		pah = &(*pah)->next_free;
+	while (*pah) {
+		ah = *pah;
+		*pah = ah->next_free;
+		for (p = &pt->ah_list; *p != ah; p = &(*p)->next)
+			;
+		*p = ah->next;
+		lws_free(ah);
+		pt->ah_count_alloc--;
+		pt->ah_stats.trimmed++;
+	}
+
+	pt->ah_free_low = pt->ah_count_alloc - pt->ah_count_in_use;
+	lws_pt_unlock(pt);
+}
+
+void
+lws_pt_ah_pool_destroy(struct lws_context_per_thread *pt)
+{
+	struct allocated_headers *ah;
+
+	while (pt->ah_list) {
+		ah = pt->ah_list;
+		pt->ah_list = ah->next;
+		lws_free(ah);
+	}
+	pt->ah_free = NULL;
+	pt->ah_count_alloc = 0;
+}
+
+/* pt lock held */
+static void
+lws_ah_wait_list_add(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	struct lws_pollargs pa;
+
+	lwsl_info("%s: adding %p to ah waiting list\n", __func__, wsi);
+
+	wsi->u.hdr.ah_wait_list = NULL;
+	if (pt->ah_wait_list_tail)
+		pt->ah_wait_list_tail->u.hdr.ah_wait_list = wsi;
+	else
+		pt->ah_wait_list = wsi;
+	pt->ah_wait_list_tail = wsi;
+	pt->ah_wait_list_length++;
+
+	wsi->u.hdr.ah_wait_since = (unsigned int)pt->now_ms;
+	pt->ah_stats.waits++;
+
+	/* we cannot accept input then */
+
+	_lws_change_pollfd(wsi, LWS_POLLIN, 0, &pa);
+}
+
+/* pt lock held, returns 1 if he was waiting */
+static int
+lws_ah_wait_list_remove(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	struct lws **pwsi = &pt->ah_wait_list, *prev = NULL;
+
+	while (*pwsi) {
+		if (*pwsi == wsi) {
+			/* point prev guy to next guy in list instead */
+			*pwsi = wsi->u.hdr.ah_wait_list;
+			if (pt->ah_wait_list_tail == wsi)
+				pt->ah_wait_list_tail = prev;
+			wsi->u.hdr.ah_wait_list = NULL;
+			pt->ah_wait_list_length--;
+
+			return 1;
+		}
+		prev = *pwsi;
+		pwsi = &(*pwsi)->u.hdr.ah_wait_list;
+	}
+
+	return 0;
+}
+
+/* pt lock held, the oldest waiter is getting an ah */
+static void
+lws_ah_wait_list_served(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	unsigned int ms = (unsigned int)pt->now_ms - wsi->u.hdr.ah_wait_since;
+
+	lws_ah_wait_list_remove(pt, wsi);
+
+	pt->ah_stats.served++;
+	pt->ah_stats.wait_ms += ms;
+	if (ms > pt->ah_stats.wait_ms_max)
+		pt->ah_stats.wait_ms_max = ms;
+}
+
 int LWS_WARN_UNUSED_RESULT
 lws_header_table_attach(struct lws *wsi, int autoservice)
 {
 	struct lws_context *context = wsi->context;
 	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
+	struct allocated_headers *ah = NULL;
 	struct lws_pollargs pa;
-	struct lws **pwsi;
-	int n;
+	struct lws *w;
 
 	lwsl_info("%s: wsi %p: ah %p (tsi %d)\n", __func__, (void *)wsi,
 		 (void *)wsi->u.hdr.ah, wsi->tsi);
@@ -129,50 +330,28 @@ lws_header_table_attach(struct lws *wsi, int autoservice)
 	}
 
 	lws_pt_lock(pt);
-	pwsi = &pt->ah_wait_list;
-	while (*pwsi) {
-		if (*pwsi == wsi) {
-			/* if already waiting on list, if no new ah just ret */
-			if (pt->ah_count_in_use ==
-			    context->max_http_header_pool) {
-				lwsl_err("ah wl denied\n");
-				goto bail;
-			}
-			/* new ah.... remove ourselves from waiting list */
-			*pwsi = wsi->u.hdr.ah_wait_list; /* set our prev to our next */
-			wsi->u.hdr.ah_wait_list = NULL; /* no next any more */
-			pt->ah_wait_list_length--;
-			break;
-		}
-		pwsi = &(*pwsi)->u.hdr.ah_wait_list;
-	}
+
 	/*
-	 * pool is all busy... add us to waiting list and return that we
-	 * weren't able to deliver it right now
+	 * if anybody is waiting, only the oldest waiter may take an ah, the
+	 * rest of us go on (or stay on) the end of the list
 	 */
-	if (pt->ah_count_in_use == context->max_http_header_pool) {
-		lwsl_info("%s: adding %p to ah waiting list\n", __func__, wsi);
-		wsi->u.hdr.ah_wait_list = pt->ah_wait_list;
-		pt->ah_wait_list = wsi;
-		pt->ah_wait_list_length++;
-
-		/* we cannot accept input then */
+	if (!pt->ah_wait_list || pt->ah_wait_list == wsi)
+		ah = lws_ah_get(pt);
+	if (!ah) {
+		for (w = pt->ah_wait_list; w; w = w->u.hdr.ah_wait_list)
+			if (w == wsi)
+				break;
+		if (!w)
+			lws_ah_wait_list_add(pt, wsi);
 
-		_lws_change_pollfd(wsi, LWS_POLLIN, 0, &pa);
 		goto bail;
 	}
+	if (pt->ah_wait_list == wsi)
+		lws_ah_wait_list_served(pt, wsi);
 
-	for (n = 0; n < context->max_http_header_pool; n++)
-		if (!pt->ah_pool[n].in_use)
-			break;
-
-	/* if the count of in use said something free... */
-	assert(n != context->max_http_header_pool);
-
-	wsi->u.hdr.ah = &pt->ah_pool[n];
-	wsi->u.hdr.ah->in_use = 1;
-	pt->ah_pool[n].wsi = wsi; /* mark our owner */
-	pt->ah_count_in_use++;
+	wsi->u.hdr.ah = ah;
+	ah->wsi = wsi; /* mark our owner */
+	lws_mem_set(wsi, LWSMT_AH, sizeof(*ah) + context->max_http_header_data);
 
 	_lws_change_pollfd(wsi, 0, LWS_POLLIN, &pa);
 
@@ -208,7 +387,6 @@ int lws_header_table_detach(struct lws *wsi, int autoservice)
 	struct allocated_headers *ah = wsi->u.hdr.ah;
 	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
 	struct lws_pollargs pa;
-	struct lws **pwsi;
 	time_t now;
 
 	lwsl_info("%s: wsi %p: ah %p (tsi=%d, count = %d)\n", __func__,
@@ -227,18 +405,11 @@ int lws_header_table_detach(struct lws *wsi, int autoservice)
 
 	lws_pt_lock(pt);
 
-	pwsi = &pt->ah_wait_list;
 	if (!ah) { /* remove from wait list if none attached */
-		while (*pwsi) {
-			if (*pwsi == wsi) {
-				lwsl_info("%s: wsi %p, remv wait\n",
-					  __func__, wsi);
-				*pwsi = wsi->u.hdr.ah_wait_list;
-				wsi->u.hdr.ah_wait_list = NULL;
-				pt->ah_wait_list_length--;
-				goto bail;
-			}
-			pwsi = &(*pwsi)->u.hdr.ah_wait_list;
+		if (lws_ah_wait_list_remove(pt, wsi)) {
+			lwsl_info("%s: wsi %p, remv wait\n", __func__, wsi);
+			/* he gave up before his turn came */
+			pt->ah_stats.starved++;
 		}
 		/* no ah, not on list... no more business here */
 		goto bail;
@@ -264,26 +435,24 @@ int lws_header_table_detach(struct lws *wsi, int autoservice)
 	assert(wsi->u.hdr.ah->in_use);
 	wsi->u.hdr.ah = NULL;
 	ah->wsi = NULL; /* no owner */
+	lws_mem_set(wsi, LWSMT_AH, 0);
 
 	/* oh there is nobody on the waiting list... leave it at that then */
-	if (!*pwsi) {
-		ah->in_use = 0;
-		pt->ah_count_in_use--;
+	if (!pt->ah_wait_list) {
+		lws_ah_put(pt, ah);
 
 		goto bail;
 	}
 
 	/* somebody else on same tsi is waiting, give it to oldest guy */
 
-	lwsl_info("pt wait list %p\n", *pwsi);
-	while ((*pwsi)->u.hdr.ah_wait_list)
-		pwsi = &(*pwsi)->u.hdr.ah_wait_list;
-
-	wsi = *pwsi;
-	lwsl_info("last wsi in wait list %p\n", wsi);
+	wsi = pt->ah_wait_list;
+	lwsl_info("oldest wsi in wait list %p\n", wsi);
+	lws_ah_wait_list_served(pt, wsi);
 
 	wsi->u.hdr.ah = ah;
 	ah->wsi = wsi; /* new owner */
+	lws_mem_set(wsi, LWSMT_AH, sizeof(*ah) + context->max_http_header_data);
 	lws_header_table_reset(wsi, autoservice);
 	time(&wsi->u.hdr.ah->assigned);
 
@@ -296,12 +465,6 @@ int lws_header_table_detach(struct lws *wsi, int autoservice)
 	 */
 	_lws_change_pollfd(wsi, 0, LWS_POLLIN, &pa);
 
-	/* point prev guy to next guy in list instead */
-	*pwsi = wsi->u.hdr.ah_wait_list;
-	/* the guy who got one is out of the list */
-	wsi->u.hdr.ah_wait_list = NULL;
-	pt->ah_wait_list_length--;
-
 #ifndef LWS_NO_CLIENT
 	if (wsi->state == LWSS_CLIENT_UNCONNECTED)
 		if (!lws_client_connect_via_info2(wsi)) {
@@ -1162,8 +1325,13 @@ handle_first:
 			wsi->lws_rx_parse_state =
 					LWS_RXPS_07_COLLECT_FRAME_KEY_1;
 		else
-			wsi->lws_rx_parse_state =
-				LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED;
+			if (wsi->u.ws.rx_packet_length)
+				wsi->lws_rx_parse_state =
+					LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED;
+			else {
+				wsi->lws_rx_parse_state = LWS_RXPS_NEW;
+				goto spill;
+			}
 		break;
 
 	case LWS_RXPS_04_FRAME_HDR_LEN64_8:
@@ -1222,8 +1390,13 @@ handle_first:
 			wsi->lws_rx_parse_state =
 					LWS_RXPS_07_COLLECT_FRAME_KEY_1;
 		else
-			wsi->lws_rx_parse_state =
-				LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED;
+			if (wsi->u.ws.rx_packet_length)
+				wsi->lws_rx_parse_state =
+					LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED;
+			else {
+				wsi->lws_rx_parse_state = LWS_RXPS_NEW;
+				goto spill;
+			}
 		break;
 
 	case LWS_RXPS_07_COLLECT_FRAME_KEY_1:
@@ -1262,7 +1435,8 @@ handle_first:
 
 
 	case LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED:
-		assert(wsi->u.ws.rx_ubuf);
+		if (lws_ws_rxbuf_get(wsi))
+			return -1;
 
 		if (wsi->u.ws.rx_ubuf_head + LWS_PRE >=
 		    wsi->u.ws.rx_ubuf_alloc) {
@@ -1284,22 +1458,16 @@ handle_first:
 			goto spill;
 		}
 
-		/*
-		 * if there's no protocol max frame size given, we are
-		 * supposed to default to context->pt_serv_buf_size
-		 */
-
-		if (!wsi->protocol->rx_buffer_size &&
-		    wsi->u.ws.rx_ubuf_head != wsi->context->pt_serv_buf_size)
-			break;
-		else
-			if (wsi->protocol->rx_buffer_size &&
-					wsi->u.ws.rx_ubuf_head !=
-						  wsi->protocol->rx_buffer_size)
+		/* the buffer size we were lent is where we spill */
+		if (wsi->u.ws.rx_ubuf_head + LWS_PRE != wsi->u.ws.rx_ubuf_alloc)
 			break;
 
 		/* spill because we filled our rx buffer */
 spill:
+		/* zero length frames come here without having needed one */
+		if (lws_ws_rxbuf_get(wsi))
+			return -1;
+
 		/*
 		 * is this frame a control packet we should take care of at this
 		 * layer?  If so service it and hide it from the user callback
@@ -1357,6 +1525,8 @@ process_as_ping:
 			}
 
 			/* stash the pong payload */
+			if (lws_ensure_ws_ctrl_buf(wsi))
+				goto ping_drop;
 			memcpy(wsi->u.ws.ping_payload_buf + LWS_PRE,
 			       &wsi->u.ws.rx_ubuf[LWS_PRE],
 				wsi->u.ws.rx_ubuf_head);
@@ -1414,6 +1584,7 @@ ping_drop:
 
 		eff_buf.token = &wsi->u.ws.rx_ubuf[LWS_PRE];
 		eff_buf.token_len = wsi->u.ws.rx_ubuf_head;
+		lws_ws_rxbuf_count(wsi);
 
 drain_extension:
 		lwsl_ext("%s: passing %d to ext\n", __func__, eff_buf.token_len);
@@ -1504,20 +1675,20 @@ lws_remaining_packet_payload(struct lws *wsi)
  * to expect in that state and can deal with it in bulk more efficiently.
  */
 
-void
+static void
 lws_payload_until_length_exhausted(struct lws *wsi, unsigned char **buf,
 				   size_t *len)
 {
-	unsigned char *buffer = *buf, mask[4];
-	int buffer_size, n;
+	unsigned char *buffer = *buf;
 	unsigned int avail;
 	char *rx_ubuf;
 
-	if (wsi->protocol->rx_buffer_size)
-		buffer_size = wsi->protocol->rx_buffer_size;
-	else
-		buffer_size = wsi->context->pt_serv_buf_size;
-	avail = buffer_size - wsi->u.ws.rx_ubuf_head;
+	/* the parser takes a lone byte itself */
+	if (*len <= 1 || wsi->u.ws.rx_packet_length <= 1 ||
+	    lws_ws_rxbuf_get(wsi))
+		return;
+
+	avail = wsi->u.ws.rx_ubuf_alloc - LWS_PRE - wsi->u.ws.rx_ubuf_head;
 
 	/* do not consume more than we should */
 	if (avail > wsi->u.ws.rx_packet_length)
@@ -1533,25 +1704,11 @@ lws_payload_until_length_exhausted(struct lws *wsi, unsigned char **buf,
 
 	avail--;
 	rx_ubuf = wsi->u.ws.rx_ubuf + LWS_PRE + wsi->u.ws.rx_ubuf_head;
-	if (wsi->u.ws.all_zero_nonce)
+	if (!wsi->u.ws.this_frame_masked || wsi->u.ws.all_zero_nonce)
 		memcpy(rx_ubuf, buffer, avail);
 	else {
-
-		for (n = 0; n < 4; n++)
-			mask[n] = wsi->u.ws.mask[(wsi->u.ws.mask_idx + n) & 3];
-
-		/* deal with 4-byte chunks using unwrapped loop */
-		n = avail >> 2;
-		while (n--) {
-			*(rx_ubuf++) = *(buffer++) ^ mask[0];
-			*(rx_ubuf++) = *(buffer++) ^ mask[1];
-			*(rx_ubuf++) = *(buffer++) ^ mask[2];
-			*(rx_ubuf++) = *(buffer++) ^ mask[3];
-		}
-		/* and the remaining bytes bytewise */
-		for (n = 0; n < (int)(avail & 3); n++)
-			*(rx_ubuf++) = *(buffer++) ^ mask[n];
-
+		lws_ws_xor_mask((unsigned char *)rx_ubuf, buffer, avail,
+				wsi->u.ws.mask, wsi->u.ws.mask_idx);
 		wsi->u.ws.mask_idx = (wsi->u.ws.mask_idx + avail) & 3;
 	}
 
@@ -1559,4 +1716,83 @@ lws_payload_until_length_exhausted(struct lws *wsi, unsigned char **buf,
 	wsi->u.ws.rx_ubuf_head += avail;
 	wsi->u.ws.rx_packet_length -= avail;
 	*len -= avail;
+	/* account for what we're using in rxflow buffer */
+	if (wsi->rxflow_buffer)
+		wsi->rxflow_pos += avail;
+}
+
+/*
+ * The role's parser took the first byte of the frame header.  If the rest of
+ * it and at least one payload byte are in the buffer, take the header in one
+ * go.  Otherwise, or if it's anything the parser should complain about or an
+ * empty frame it must spill, leave it to the parser a byte at a time.
+ */
+
+static void
+lws_frame_header_remainder(struct lws *wsi, unsigned char **buf, size_t *len)
+{
+	unsigned char *p = *buf, c = p[0];
+	size_t hlen = 1, plen = c & 0x7f;
+	int n;
+
+	if (plen >= 126) {
+		/* control frames are not allowed to have big lengths */
+		if (wsi->u.ws.opcode & 8)
+			return;
+		hlen += plen == 126 ? 2 : 8;
+	}
+	if (c & 0x80)
+		hlen += 4;
+
+	if (*len <= hlen)
+		return;
+
+	if (plen == 126)
+		plen = (p[1] << 8) | p[2];
+	else
+		if (plen == 127) {
+			/* b63 of length must be zero */
+			if (p[1] & 0x80)
+				return;
+			/* above 4GiB is truncated on 32-bit like the parser */
+			plen = 0;
+			for (n = 1; n < 9; n++)
+				plen = (plen << 8) | p[n];
+		}
+	if (!plen)
+		return;
+
+	wsi->u.ws.this_frame_masked = !!(c & 0x80);
+	wsi->u.ws.all_zero_nonce = 1;
+	if (wsi->u.ws.this_frame_masked) {
+		memcpy(wsi->u.ws.mask, p + hlen - 4, 4);
+		if (wsi->u.ws.mask[0] | wsi->u.ws.mask[1] |
+		    wsi->u.ws.mask[2] | wsi->u.ws.mask[3])
+			wsi->u.ws.all_zero_nonce = 0;
+	}
+	wsi->u.ws.mask_idx = 0;
+	wsi->u.ws.rx_packet_length = plen;
+	wsi->lws_rx_parse_state = LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED;
+
+	(*buf) += hlen;
+	*len -= hlen;
+	if (wsi->rxflow_buffer)
+		wsi->rxflow_pos += hlen;
+}
+
+/*
+ * Server and client both call this before giving their parser the next byte.
+ * It takes what it can of the frame in bulk and always leaves at least one
+ * byte, so the parser is the one that sees frames start and end.  For a
+ * frame all in one read that's two bytes, not every header and payload byte.
+ */
+
+void
+lws_ws_rx_bulk(struct lws *wsi, unsigned char **buf, size_t *len)
+{
+	if (wsi->lws_rx_parse_state == LWS_RXPS_04_FRAME_HDR_LEN)
+		lws_frame_header_remainder(wsi, buf, len);
+
+	if (wsi->lws_rx_parse_state == LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED)
+		lws_payload_until_length_exhausted(wsi, buf, len);
 }
@@ -21,6 +21,84 @@
 
 #include "private-libwebsockets.h"
 
+/*
+ * pt->fds starts with LWS_POLLFD_INITIAL entries and doubles when it fills,
+ * up to fd_limit_per_thread.  Whatever is servicing an fd may still hold a
+ * pointer into the old array when an accept grows it, and another thread may
+ * grow it while the service thread is in poll() on it.  So outgrown arrays
+ * are linked through the cache line in front of them and only freed by the
+ * service thread, before it next waits.
+ */
+
+static struct lws_pollfd **
+lws_pt_fds_link(struct lws_pollfd *fds)
+{
+	return (struct lws_pollfd **)((char *)fds - LWS_CACHE_LINE_BYTES);
+}
+
+void
+lws_pt_fds_free(struct lws_pollfd *fds)
+{
+	if (fds)
+		lws_free_cl((char *)fds - LWS_CACHE_LINE_BYTES);
+}
+
+/* pt lock held, or the pt isn't in use yet */
+
+int
+lws_pt_fds_grow(struct lws_context_per_thread *pt)
+{
+	unsigned int n = pt->fds_alloc * 2;
+	struct lws_pollfd *fds;
+	char *p;
+
+	if (!n)
+		n = LWS_POLLFD_INITIAL;
+	if (n > pt->context->fd_limit_per_thread)
+		n = pt->context->fd_limit_per_thread;
+	if (n <= pt->fds_alloc)
+		return 1;
+
+	p = lws_zalloc_cl(LWS_CACHE_LINE_BYTES + sizeof(*fds) * n);
+	if (!p) {
+		lwsl_err("OOM growing pollfd table to %u\n", n);
+		return 1;
+	}
+	fds = (struct lws_pollfd *)(p + LWS_CACHE_LINE_BYTES);
+
+	if (pt->fds) {
+		memcpy(fds, pt->fds, sizeof(*fds) * pt->fds_count);
+		*lws_pt_fds_link(pt->fds) = pt->fds_retired;
+		pt->fds_retired = pt->fds;
+	}
+	pt->fds = fds;
+	pt->fds_alloc = n;
+
+	return 0;
+}
+
+/* the service thread, between passes, when nothing can be looking at them */
+
+void
+lws_pt_fds_reap(struct lws_context_per_thread *pt)
+{
+	struct lws_pollfd *fds, *next;
+
+	if (!pt->fds_retired)
+		return;
+
+	lws_pt_lock(pt);
+	fds = pt->fds_retired;
+	pt->fds_retired = NULL;
+	lws_pt_unlock(pt);
+
+	while (fds) {
+		next = *lws_pt_fds_link(fds);
+		lws_pt_fds_free(fds);
+		fds = next;
+	}
+}
+
 int
 _lws_change_pollfd(struct lws *wsi, int _and, int _or, struct lws_pollargs *pa)
 {
@@ -105,10 +183,11 @@ bail:
 	return ret;
 }
 
-int
-insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi)
+static int
+__insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi,
+			     short events)
 {
-	struct lws_pollargs pa = { wsi->sock, LWS_POLLIN, 0 };
+	struct lws_pollargs pa = { wsi->sock, events, 0 };
 	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
 	int ret = 0;
 #ifndef LWS_NO_SERVER
@@ -141,11 +220,16 @@ insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi)
 		return -1;
 
 	lws_pt_lock(pt);
+	if ((pt->fds_count == pt->fds_alloc && lws_pt_fds_grow(pt)) ||
+	    insert_wsi(context, wsi)) {
+		lws_pt_unlock(pt);
+		ret = 1;
+		goto bail;
+	}
 	pt->count_conns++;
-	insert_wsi(context, wsi);
 	wsi->position_in_fds_table = pt->fds_count;
 	pt->fds[pt->fds_count].fd = wsi->sock;
-	pt->fds[pt->fds_count].events = LWS_POLLIN;
+	pt->fds[pt->fds_count].events = events;
 	pa.events = pt->fds[pt->fds_count].events;
 
 	lws_plat_insert_socket_into_fds(context, wsi);
@@ -161,6 +245,7 @@ insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi)
 #endif
 	lws_pt_unlock(pt);
 
+bail:
 	if (wsi->vhost->protocols[0].callback(wsi, LWS_CALLBACK_UNLOCK_POLL,
 					   wsi->user_space, (void *)&pa, 1))
 		ret = -1;
@@ -169,7 +254,13 @@ insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi)
 }
 
 int
-remove_wsi_socket_from_fds(struct lws *wsi)
+insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi)
+{
+	return __insert_wsi_socket_into_fds(context, wsi, LWS_POLLIN);
+}
+
+static int
+__remove_wsi_socket_from_fds(struct lws *wsi, int unlink_protocol)
 {
 	struct lws_pollargs pa = { wsi->sock, 0, 0 };
 #ifndef LWS_NO_SERVER
@@ -197,7 +288,7 @@ remove_wsi_socket_from_fds(struct lws *wsi)
 	 * A -> C , or, B -> C, or A -> B
 	 */
 	lwsl_info("%s: removing same prot wsi %p\n", __func__, wsi);
-	if (wsi->same_vh_protocol_prev) {
+	if (unlink_protocol && wsi->same_vh_protocol_prev) {
 		assert (*(wsi->same_vh_protocol_prev) == wsi);
 		lwsl_info("have prev %p, setting him to our next %p\n",
 			 wsi->same_vh_protocol_prev,
@@ -208,7 +299,7 @@ remove_wsi_socket_from_fds(struct lws *wsi)
 	} //else
 		//lwsl_err("null wsi->prev\n");
 	/* our next should point back to our prev */
-	if (wsi->same_vh_protocol_next) {
+	if (unlink_protocol && wsi->same_vh_protocol_next) {
 		lwsl_info("have next %p\n");
 		wsi->same_vh_protocol_next->same_vh_protocol_prev =
 				wsi->same_vh_protocol_prev;
@@ -262,6 +353,100 @@ remove_wsi_socket_from_fds(struct lws *wsi)
 	return ret;
 }
 
+int
+remove_wsi_socket_from_fds(struct lws *wsi)
+{
+	return __remove_wsi_socket_from_fds(wsi, 1);
+}
+
+static void
+lws_migrate_timer(struct lws_context_per_thread *from, int tsi,
+		  struct lws_timer *t)
+{
+	struct lws_context_per_thread *to = &from->context->pt[tsi];
+	long long ms;
+
+	if (!t->prev)
+		return;
+
+	/* the two threads' idea of "now" differs a little */
+	ms = (long long)(t->expiry_ms - from->now_ms) +
+	     (long long)(from->now_ms - to->now_ms);
+	if (ms < 0)
+		ms = 0;
+
+	lws_timer_cancel(from->context, from->tid, t);
+	lws_timer_schedule(from->context, tsi, t, t->cb, (unsigned int)ms);
+}
+
+/*
+ * Hand an idle, established wsi over to another service thread.  Must be
+ * called from the wsi's own service thread, between service passes.
+ * Returns 0 if it moved.
+ */
+int
+lws_migrate_wsi(struct lws *wsi, int tsi)
+{
+	struct lws_context *context = wsi->context;
+	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
+	short events;
+
+	if (tsi == wsi->tsi || wsi->position_in_fds_table < 0 ||
+	    context->pt[tsi].fds_count >= context->fd_limit_per_thread - 1)
+		return 1;
+
+	if (wsi->protocol && wsi->protocol->callback(wsi,
+				LWS_CALLBACK_MIGRATE_THREAD,
+				wsi->user_space, NULL, tsi))
+		return 1;
+
+	events = pt->fds[wsi->position_in_fds_table].events;
+
+	/* he stays on the vhost protocol list, only the thread changes */
+	if (__remove_wsi_socket_from_fds(wsi, 0))
+		return -1;
+
+	/* any timer callback must already see the new tsi */
+	wsi->tsi = tsi;
+	lws_mem_rebook(wsi);
+	lws_migrate_timer(pt, tsi, &wsi->timeout_timer);
+	lws_migrate_timer(pt, tsi, &wsi->user_timer);
+	lws_migrate_timer(pt, tsi, &wsi->hibernate_timer);
+	if (wsi->ws_hibernating) {
+		lws_atomic_int_add(&pt->ws_hibernating, -1);
+		lws_atomic_int_add(&context->pt[tsi].ws_hibernating, 1);
+	}
+
+	/*
+	 * the new thread may service him as soon as he is in its fds, so we
+	 * must not touch him after this
+	 */
+	if (__insert_wsi_socket_into_fds(context, wsi, events) &&
+	    wsi->position_in_fds_table < 0) {
+		lwsl_err("%s: %p couldn't join tsi %d\n", __func__, wsi, tsi);
+		/* nobody else can see him, put him back */
+		wsi->tsi = pt->tid;
+		lws_mem_rebook(wsi);
+		lws_migrate_timer(&context->pt[tsi], pt->tid,
+				  &wsi->timeout_timer);
+		lws_migrate_timer(&context->pt[tsi], pt->tid, &wsi->user_timer);
+		lws_migrate_timer(&context->pt[tsi], pt->tid,
+				  &wsi->hibernate_timer);
+		if (wsi->ws_hibernating) {
+			lws_atomic_int_add(&context->pt[tsi].ws_hibernating, -1);
+			lws_atomic_int_add(&pt->ws_hibernating, 1);
+		}
+
+		return __insert_wsi_socket_into_fds(context, wsi, events) ?
+								     -1 : 1;
+	}
+
+	/* get the new thread to notice him, he may have rx waiting */
+	lws_plat_pipe_signal(&context->pt[tsi]);
+
+	return 0;
+}
+
 int
 lws_change_pollfd(struct lws *wsi, int _and, int _or)
 {
@@ -300,6 +485,9 @@ lws_change_pollfd(struct lws *wsi, int _and, int _or)
  *					 blocking
  *
  * @wsi:	Websocket connection instance to get callback for
+ *
+ *	A hibernating ws connection is woken up first, if that fails
+ *	this returns -1 and the connection should be closed.
  */
 
 LWS_VISIBLE int
@@ -316,6 +504,9 @@ lws_callback_on_writable(struct lws *wsi)
 	if (wsi->socket_is_permanently_unusable)
 		return 0;
 
+	if (wsi->ws_hibernating && lws_ws_wake(wsi))
+		return -1;
+
 #ifdef LWS_USE_HTTP2
 	lwsl_info("%s: %p\n", __func__, wsi);
 
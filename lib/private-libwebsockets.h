@@ -23,7 +23,8 @@
 #include "lws_config_private.h"
 
 
-#if defined(LWS_WITH_CGI) && defined(LWS_HAVE_VFORK)
+#if (defined(LWS_WITH_CGI) && defined(LWS_HAVE_VFORK)) || \
+    defined(LWS_HAVE_ACCEPT4) || defined(LWS_HAVE_SCHED_SETAFFINITY)
 #define  _GNU_SOURCE
 #endif
 
@@ -42,6 +43,9 @@
 #if LWS_MAX_SMP > 1
 #include <pthread.h>
 #endif
+#if defined(LWS_HAVE_SCHED_SETAFFINITY)
+#include <sched.h>
+#endif
 
 #ifdef LWS_HAVE_SYS_STAT_H
 #include <sys/stat.h>
@@ -152,6 +156,9 @@
 #endif
 
 #include <sys/time.h>
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
 
 #define LWS_ERRNO errno
 #define LWS_EAGAIN EAGAIN
@@ -164,7 +171,7 @@
 #define LWS_POLLIN (POLLIN)
 #define LWS_POLLOUT (POLLOUT)
 static inline int compatible_close(int fd) { return close(fd); }
-#define lws_set_blocking_send(wsi)
+#define lws_set_blocking_send(wsi) wsi->sock_send_blocking = 1
 
 #ifdef MBED_OPERATORS
 #define lws_socket_is_valid(x) ((x) != NULL)
@@ -350,6 +357,29 @@ extern "C" {
 #ifndef LWS_SOMAXCONN
 #define LWS_SOMAXCONN SOMAXCONN
 #endif
+#ifndef LWS_DEF_ACCEPT_BUDGET
+#define LWS_DEF_ACCEPT_BUDGET 16
+#endif
+#ifndef LWS_CACHE_LINE_BYTES
+#define LWS_CACHE_LINE_BYTES 64
+#endif
+/* put in front of a struct member to start it on a new cache line */
+#if defined(_MSC_VER)
+#define LWS_CL_ALIGN __declspec(align(LWS_CACHE_LINE_BYTES))
+#else
+#define LWS_CL_ALIGN __attribute__((aligned(LWS_CACHE_LINE_BYTES)))
+#endif
+#ifndef LWS_BALANCE_WINDOW_MS
+#define LWS_BALANCE_WINDOW_MS 1000
+#endif
+/* a thread busier than this per mille may shed load... */
+#define LWS_BALANCE_MIN_PERMILLE 250
+/* ...if it is also at least this many times busier than the idlest one */
+#define LWS_BALANCE_RATIO 2
+/* most connections moved in one window */
+#define LWS_BALANCE_MAX_MOVES 64
+/* windows to let things settle after moving some */
+#define LWS_BALANCE_COOLDOWN 3
 
 #define MAX_WEBSOCKET_04_KEY_LEN 128
 
@@ -526,13 +556,17 @@ struct lws_fragments {
 };
 
 /*
- * these are assigned from a pool held in the context.
+ * these are assigned from a pool held by each service thread, which grows on
+ * demand up to max_http_header_pool and gives back ones that stay idle down
+ * to min_http_header_pool.
  * Both client and server mode uses them for http header analysis
  */
 
 struct allocated_headers {
+	struct allocated_headers *next; /* every ah the pt has */
+	struct allocated_headers *next_free; /* idle ones */
 	struct lws *wsi; /* owner */
-	char *data; /* prepared by context init to point to dedicated storage */
+	char *data; /* max_http_header_data, allocated after us */
 	/*
 	 * the randomly ordered fragments, indexed by frag_index and
 	 * lws_fragments->nfrag for continuation.
@@ -558,26 +592,291 @@ struct allocated_headers {
 	unsigned char nfrag;
 };
 
+/* idle ahs that were never needed for this long are freed */
+#define LWS_AH_TRIM_MS 1000
+/* how long to leave it before looking again for something to shed */
+#define LWS_MEM_SHED_RETRY_MS 100
+/* what we count a TLS session as holding, mostly its record buffers */
+#define LWS_TLS_MEM_ESTIMATE (40 * 1024)
+/* ...and once its buffers were given back while it hibernates */
+#define LWS_TLS_MEM_HIBERNATED (8 * 1024)
+
+struct lws_ah_stats {
+	unsigned long long wait_ms; /* total time spent on the wait list */
+	unsigned long waits; /* times a wsi had to wait */
+	unsigned long served; /* waits that ended with an ah */
+	unsigned long starved; /* wsi that went away still waiting */
+	unsigned long grown; /* ahs allocated */
+	unsigned long trimmed; /* ahs freed as idle */
+	unsigned int wait_ms_max;
+	short peak_in_use;
+};
+
 /*
  * so we can have n connections being serviced simultaneously,
  * these things need to be isolated per-thread.
  */
 
+#if defined(LWS_USE_IO_URING)
+/*
+ * per-thread submission / completion rings, mmap'd from the kernel
+ */
+struct lws_io_uring {
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+	int *ready; /* fds reported by the last pass */
+	unsigned int ready_size;
+	unsigned int sq_entries;
+	int fd;
+
+	/* provided buffers the kernel picks from for ring recv */
+	struct io_uring_buf_ring *br;
+	unsigned char *bufs;
+	size_t br_size;
+	unsigned short br_tail;
+
+	struct lws *rx_pending; /* wsi holding ring recv data or accepted fds */
+
+	/* fds multishot accept gave us, until the listener takes them */
+	struct lws_uring_acc {
+		int lfd;
+		int fd;
+	} *accq;
+	unsigned int accq_count, accq_size;
+
+	unsigned char pipe_armed;
+	unsigned char no_multishot_accept;
+};
+#endif
+
+/*
+ * hierarchical timer wheel, one per service thread
+ *
+ * l0 has 1ms slots, each level above has slots the size of the whole level
+ * below it.  Timers cascade down a level each time the level below wraps.
+ */
+#define LWS_TW_L0_BITS 8
+#define LWS_TW_LN_BITS 6
+#define LWS_TW_LEVELS 3 /* above l0 */
+
+struct lws_timer_wheel {
+	struct lws_timer *l0[1 << LWS_TW_L0_BITS];
+	struct lws_timer *ln[LWS_TW_LEVELS][1 << LWS_TW_LN_BITS];
+	unsigned long long l0_map[(1 << LWS_TW_L0_BITS) / 64];
+	unsigned long long next; /* next ms tick to process */
+	unsigned int count;
+};
+
+/*
+ * how busy a service thread is, measured over LWS_BALANCE_WINDOW_MS windows.
+ * Only the owning service thread writes it.
+ */
+struct lws_pt_load {
+	unsigned long long wake_us; /* when the service wait last returned */
+	unsigned long long sleep_us; /* when the service wait last started */
+	unsigned long long window_start_ms;
+	unsigned long long busy_us; /* time outside the wait, this window */
+	unsigned long events, rx, tx; /* this window */
+	unsigned long events_ps, rx_ps, tx_ps; /* rates over the last window */
+	unsigned long migrated_out;
+	unsigned short permille; /* smoothed busy time per 1000 */
+	unsigned char window; /* generation, to age wsi->svc_events */
+	unsigned char cooldown;
+};
+
+/*
+ * latency histograms, one set per service thread
+ */
+#define LWS_HIST_REASONS 64 /* the last one takes any higher reason too */
+
+struct lws_pt_hist {
+	struct lws_histogram h[LWS_HIST_CALLBACK];
+	struct lws_histogram cb[LWS_HIST_REASONS];
+};
+
+/*
+ * slab allocators for struct lws and pss, one set per service thread
+ */
+#define LWS_SLAB_CLASSES 16 /* [0] is struct lws, the rest by pss size */
+#define LWS_SLAB_MAX_OBJECT 4096 /* bigger pss come from the heap */
+#define LWS_SLAB_CHUNK_BYTES 16384
+#define LWS_SLAB_MIN_PER_CHUNK 8
+/* in front of each object, keeps the object 16-byte aligned */
+#define LWS_SLAB_HDR 16
+/* in front of each chunk's objects, a multiple of LWS_SLAB_HDR */
+#define LWS_SLAB_CHUNK_HDR 48
+/* fully idle chunks a slab keeps for the next burst, more are freed */
+#define LWS_SLAB_KEEP_IDLE 1
+
+struct lws_slab_chunk {
+	struct lws_slab_chunk *next; /* on its slab's partial / full / idle */
+	struct lws_slab_chunk **prev;
+	struct lws_slab *slab;
+	void *free_list; /* object headers, linked through their first word */
+	unsigned int carved; /* objects handed out at least once */
+	unsigned int in_use;
+};
+
+struct lws_slab {
+	struct lws_context_per_thread *pt; /* whose lock protects us */
+	struct lws_slab_chunk *partial; /* some in use, room for more */
+	struct lws_slab_chunk *full;
+	struct lws_slab_chunk *idle; /* none in use */
+	unsigned int size; /* object size, 0 = slab unused */
+	unsigned int per_chunk;
+	unsigned int chunk_count;
+	unsigned int idle_count;
+	unsigned int in_use;
+	unsigned long long allocs;
+	unsigned long long recycled;
+};
+
+struct lws_pt_slabs {
+	struct lws_slab s[LWS_SLAB_CLASSES];
+};
+
+/*
+ * ws rx buffers, lent to connections only while they are assembling a frame
+ */
+#define LWS_RXBUF_POOL_SIZES 4 /* different buffer sizes kept */
+#define LWS_RXBUF_POOL_SPARE 16 /* idle buffers kept per size */
+#define LWS_RXBUF_POOL_BIG 65536 /* over this, only keep... */
+#define LWS_RXBUF_POOL_SPARE_BIG 2 /* ...this many idle ones */
+/* a grown buffer goes back down when no frame needed it for this long */
+#define LWS_RXBUF_SHRINK_MS 5000
+
+struct lws_rxbuf_pool {
+	struct {
+		void *free_list; /* linked through their first word */
+		unsigned int size;
+		unsigned int count;
+	} s[LWS_RXBUF_POOL_SIZES];
+	unsigned long long borrows;
+	unsigned long long heap_allocs; /* borrows the spares didn't cover */
+	unsigned long long spills; /* payload delivered before message end */
+	unsigned long long messages; /* payload deliveries ending a message */
+	unsigned long grows; /* adaptive buffers made bigger */
+	unsigned long shrinks; /* ...and smaller again */
+	unsigned int lent; /* held by connections right now */
+};
+
+/*
+ * commands posted to a service thread by other threads
+ */
+enum lws_pt_cmd_type {
+	LWS_PT_CMD_WRITABLE,
+	LWS_PT_CMD_CLOSE,
+	LWS_PT_CMD_RUN,
+	LWS_PT_CMD_WRITABLE_ALL_PROTOCOL,
+};
+
+struct lws_pt_cmd {
+	struct lws_pt_cmd *next;
+	struct lws *wsi;
+	lws_sockfd_type fd; /* to find wsi again */
+	unsigned int gen; /* wsi->gen, to confirm it's still the same one */
+	lws_pt_cmd_run_cb cb;
+	void *user;
+	const struct lws_protocols *protocol;
+	unsigned char type;
+};
+
+#if defined(_MSC_VER)
+#define lws_atomic_ptr_load(p) \
+	InterlockedCompareExchangePointer((PVOID volatile *)(p), NULL, NULL)
+#define lws_atomic_ptr_cas(p, o, n) \
+	(InterlockedCompareExchangePointer((PVOID volatile *)(p), (n), (o)) == (o))
+#define lws_atomic_ptr_swap(p, n) \
+	InterlockedExchangePointer((PVOID volatile *)(p), (n))
+#define lws_atomic_int_add(p, n) \
+	(InterlockedExchangeAdd((LONG volatile *)(p), (n)) + (n))
+#define lws_atomic_ll_add(p, n) \
+	(InterlockedExchangeAdd64((LONGLONG volatile *)(p), (n)) + (n))
+#else
+#define lws_atomic_ptr_load(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define lws_atomic_ptr_cas(p, o, n) \
+	__atomic_compare_exchange_n(p, &(o), n, 0, __ATOMIC_RELEASE, \
+				    __ATOMIC_RELAXED)
+#define lws_atomic_ptr_swap(p, n) __atomic_exchange_n(p, n, __ATOMIC_ACQ_REL)
+#define lws_atomic_int_add(p, n) __atomic_add_fetch(p, n, __ATOMIC_ACQ_REL)
+#define lws_atomic_ll_add(p, n) __atomic_add_fetch(p, n, __ATOMIC_ACQ_REL)
+#endif
+
+#define lws_wsi_new_gen(ctx) \
+	((unsigned int)lws_atomic_int_add(&(ctx)->wsi_gen, 1))
+
+/*
+ * Output queued on a wsi because the socket would not take it yet.  Each node
+ * refers to part of a refcounted buffer: either a pooled segment the queued
+ * bytes were copied into, or a whole ws frame from lws_txbuf_create() shared
+ * by every connection it was written to.
+ */
+#define LWS_TXQ_SEG_SIZE (LWS_SLAB_MAX_OBJECT - sizeof(struct lws_txbuf))
+
+struct lws_txbuf {
+	int refcount;
+	unsigned int size; /* bytes after the struct */
+	unsigned int len; /* payload, or bytes filled so far for a segment */
+	unsigned char pre; /* ws header length in front of the payload */
+	unsigned char shared; /* from lws_txbuf_create(), never appended to */
+	unsigned char heap; /* segment too big for the slab, from lws_malloc */
+	unsigned char wp; /* enum lws_write_protocol it was made for */
+	/* shared: LWS_PRE then payload.  segment: the queued bytes */
+};
+
+#define lws_txbuf_data(b) ((unsigned char *)((b) + 1))
+
+struct lws_txq_node {
+	struct lws_txq_node *next;
+	struct lws_txbuf *b;
+	unsigned char *p; /* next byte to send */
+	unsigned int len; /* bytes left from p */
+};
+
+/* per-thread ChaCha20 keystream for lws_get_random_tsi(), see random.c */
+
+#define LWS_RNG_BUF 512
+
+struct lws_rng {
+	unsigned int key[8];
+	unsigned char buf[LWS_RNG_BUF]; /* unused keystream is the tail */
+	unsigned int have; /* bytes left at the end of buf */
+	unsigned int since_stir; /* bytes given out since the OS was asked */
+	unsigned char seeded;
+};
+
+/*
+ * Each of these starts on its own cache line and the part other threads
+ * write is kept apart from the part the service thread works in, so the
+ * threads don't steal lines from each other.
+ */
 struct lws_context_per_thread {
+	/* written by other threads */
 #if LWS_MAX_SMP > 1
 	pthread_mutex_t lock;
 #endif
-	struct lws_pollfd *fds;
+	struct lws_pt_cmd *cmd_head; /* lock-free LIFO, other threads push */
+
+	/* mostly only the service thread from here */
+	LWS_CL_ALIGN struct lws_pollfd *fds;
+	struct lws_pollfd *fds_retired; /* outgrown, freed on next pass */
 	struct lws *rx_draining_ext_list;
 	struct lws *tx_draining_ext_list;
-	struct lws *timeout_list;
+	struct lws_timer_wheel *tw;
+	struct lws_pt_hist *hist;
+	struct lws_pt_slabs *slabs;
 	struct lws_context *context;
 #ifdef LWS_WITH_CGI
 	struct lws_cgi *cgi_list;
 #endif
-	void *http_header_data;
-	struct allocated_headers *ah_pool;
-	struct lws *ah_wait_list;
+	struct allocated_headers *ah_list; /* every ah we allocated */
+	struct allocated_headers *ah_free; /* the idle ones, last freed first */
+	struct lws *ah_wait_list; /* FIFO, oldest first */
+	struct lws *ah_wait_list_tail;
 	int ah_wait_list_length;
 #ifdef LWS_OPENSSL_SUPPORT
 	struct lws *pending_read_list; /* linked list */
@@ -587,11 +886,13 @@ struct lws_context_per_thread {
 #endif
 #if defined(LWS_USE_LIBEV)
 	struct ev_loop *io_loop_ev;
+	ev_timer ev_tw_timer; /* next timer wheel expiry */
 #endif
 #if defined(LWS_USE_LIBUV)
 	uv_loop_t *io_loop_uv;
 	uv_signal_t signals[8];
 	uv_timer_t uv_timeout_watcher;
+	uv_timer_t uv_tw_timer; /* next timer wheel expiry */
 	uv_idle_t uv_idle;
 #endif
 #if defined(LWS_USE_LIBEV)
@@ -599,10 +900,22 @@ struct lws_context_per_thread {
 #endif
 #if defined(LWS_USE_LIBEV) || defined(LWS_USE_LIBUV)
 	struct lws_signal_watcher w_sigint;
+	struct lws_io_watcher w_wake; /* wake fd, for lws_pt_cmd_*() */
+	unsigned long long loop_tw_at; /* loop timer is due then, or 0 */
 	unsigned char ev_loop_foreign:1;
 #endif
 
+	struct lws_pt_load load;
+	struct lws_rxbuf_pool rxbuf_pool;
+	struct lws_rng rng;
+	unsigned long txq_bytes; /* queued on all our wsi */
+	unsigned long txq_refs; /* queued shared frames that weren't copied */
+	unsigned long ws_wakes; /* hibernating ws connections that woke */
+	int ws_hibernating; /* our ws connections hibernating now */
+
 	unsigned long count_conns;
+	/* monotonic ms, read once per service pass */
+	unsigned long long now_ms;
 	/*
 	 * usable by anything in the service code, but only if the scope
 	 * does not last longer than the service action (since next service
@@ -613,11 +926,28 @@ struct lws_context_per_thread {
 	WSAEVENT *events;
 #else
 	int dummy_pipe_fds[2];
+#endif
+#if defined(LWS_USE_EPOLL)
+	struct epoll_event *epoll_events;
+	int epoll_fd;
+#endif
+#if defined(LWS_USE_IO_URING)
+	struct lws_io_uring uring;
 #endif
 	unsigned int fds_count;
+	unsigned int fds_alloc; /* entries in fds, grows to fd_limit_per_thread */
 
+	struct lws_ah_stats ah_stats;
+	/* start of the window ah_free_low was measured over */
+	unsigned long long ah_trim_ms;
+	/* over budget but nothing of ours to close, don't look again till */
+	unsigned long long mem_shed_ms;
 	short ah_count_in_use;
+	short ah_count_alloc; /* in use + idle */
+	short ah_free_low; /* fewest idle seen in this trim window */
 	unsigned char tid;
+	unsigned char clock_cached:1; /* the plat service set now_ms already */
+	unsigned char service_started:1; /* lws_pt_service_start() done */
 };
 
 /*
@@ -638,6 +968,35 @@ struct lws_context_per_thread {
  *    SSL SNI -> wsi -> bind after SSL negotiation
  */
 
+/*
+ * vhost counters, kept per service thread so the threads don't all write the
+ * same cache line.  lws_json_dump_vhost() adds them up.
+ */
+/* lws_arena_alloc() hands out pieces of these, newest block first */
+struct lws_arena_block {
+	struct lws_arena_block *next;
+	unsigned int size; /* bytes after the header */
+	unsigned int used;
+};
+
+/* bytes held by connections, by enum lws_mem_tags */
+struct lws_mem_acct {
+	long long held[LWSMT_COUNT];
+	unsigned long shed; /* connections closed for going over budget */
+};
+
+struct lws_vhost_stats {
+	LWS_CL_ALIGN unsigned long long rx;
+	unsigned long long tx;
+	unsigned long conn, trans, ws_upgrades, http2_upgrades;
+	/* listener accept batching */
+	unsigned long accept_wakeups, accepts, accept_budget_hit, listen_q_full;
+	unsigned int accept_batch_peak;
+	struct lws_mem_acct mem;
+};
+
+#define lws_vh_stats(wsi) (&(wsi)->vhost->stats[(int)(wsi)->tsi])
+
 struct lws_vhost {
 	char http_proxy_address[128];
 	char proxy_basic_auth_token[128];
@@ -658,8 +1017,12 @@ struct lws_vhost {
 #ifndef LWS_NO_EXTENSIONS
 	const struct lws_extension *extensions;
 #endif
-	unsigned long long rx, tx;
-	unsigned long conn, trans, ws_upgrades, http2_upgrades;
+	struct lws_vhost_stats *stats; /* one per service thread */
+	/* per service thread, count_protocols of them each */
+	struct lws_mem_acct *mem_proto;
+	size_t mem_budget;
+	unsigned int accept_budget;
+	unsigned int ws_hibernate_ms; /* 0, or idle time before hibernating */
 
 	int listen_port;
 	unsigned int http_proxy_port;
@@ -681,6 +1044,26 @@ struct lws_vhost {
 	unsigned char default_protocol_index;
 };
 
+/*
+ * The fd -> wsi lookup covers every fd up to max_fds, but only the pages for
+ * fds that were actually used get allocated.  Pages stay until the context
+ * is destroyed, so a reader never sees one go away.
+ */
+#define LWS_FD_PAGE_BITS 12
+#define LWS_FD_PAGE (1 << LWS_FD_PAGE_BITS)
+#define lws_fd_page_count(c) \
+	(((c)->max_fds + LWS_FD_PAGE - 1) >> LWS_FD_PAGE_BITS)
+
+struct lws_fd_page {
+	struct lws *wsi[LWS_FD_PAGE];
+#if defined(LWS_USE_IO_URING)
+	unsigned short uring_gen[LWS_FD_PAGE]; /* spots stale cqes */
+#endif
+};
+
+/* pt->fds starts this big and doubles as needed */
+#define LWS_POLLFD_INITIAL 64
+
 /*
  * the rest is managed per-context, that includes
  *
@@ -697,7 +1080,8 @@ struct lws_context {
 /* different implementation between unix and windows */
 	struct lws_fd_hashtable fd_hashtable[FD_HASHTABLE_MODULUS];
 #else
-	struct lws **lws_lookup;  /* fd to wsi */
+	struct lws_fd_page **lws_lookup;  /* fd to wsi, pages made as used */
+	int fd_pages; /* how many of them exist */
 #endif
 	struct lws_vhost *vhost_list;
 	struct lws_plugin *plugin_list;
@@ -725,6 +1109,9 @@ struct lws_context {
 	int uid, gid;
 
 	int fd_random;
+#if defined(LWS_HAVE_SCHED_SETAFFINITY)
+	cpu_set_t cpus_allowed; /* when the context was created */
+#endif
 #ifdef LWS_OPENSSL_SUPPORT
 #define lws_ssl_anybody_has_buffered_read(w) \
 		(w->vhost->use_ssl && \
@@ -737,11 +1124,14 @@ struct lws_context {
 #define lws_ssl_anybody_has_buffered_read_tsi(ctx, t) (0)
 #endif
 	int count_wsi_allocated;
+	int wsi_gen; /* last wsi->gen given out, atomic */
 	int count_cgi_spawned;
 	unsigned int options;
 	unsigned int fd_limit_per_thread;
 	unsigned int timeout_secs;
 	unsigned int pt_serv_buf_size;
+	unsigned int tx_queue_limit; /* per wsi, 0 = no limit */
+	unsigned int tx_queue_limit_pt; /* per service thread, 0 = no limit */
 	int max_http_header_data;
 
 	/*
@@ -752,8 +1142,11 @@ struct lws_context {
 	 */
 	volatile int service_tid;
 	int service_tid_detected;
+	/* a vhost or protocol went over its memory budget */
+	volatile int mem_over;
 
 	short max_http_header_pool;
+	short min_http_header_pool;
 	short count_threads;
 	short plugin_protocol_count;
 	short plugin_extension_count;
@@ -798,6 +1191,8 @@ LWS_EXTERN void
 lws_libev_destroyloop(struct lws_context *context, int tsi);
 LWS_EXTERN void
 lws_libev_run(const struct lws_context *context, int tsi);
+LWS_EXTERN void
+lws_libev_timer(struct lws_context_per_thread *pt, unsigned long long at);
 #define LWS_LIBEV_ENABLED(context) lws_check_opt(context->options, LWS_SERVER_OPTION_LIBEV)
 LWS_EXTERN void lws_feature_status_libev(struct lws_context_creation_info *info);
 #else
@@ -806,6 +1201,7 @@ LWS_EXTERN void lws_feature_status_libev(struct lws_context_creation_info *info)
 #define lws_libev_init_fd_table(_a) (0)
 #define lws_libev_run(_a, _b) ((void) 0)
 #define lws_libev_destroyloop(_a, _b) ((void) 0)
+#define lws_libev_timer(_a, _b) ((void) 0)
 #define LWS_LIBEV_ENABLED(context) (0)
 #if LWS_POSIX
 #define lws_feature_status_libev(_a) \
@@ -826,6 +1222,8 @@ LWS_EXTERN void
 lws_libuv_run(const struct lws_context *context, int tsi);
 LWS_EXTERN void
 lws_libuv_destroyloop(struct lws_context *context, int tsi);
+LWS_EXTERN void
+lws_libuv_timer(struct lws_context_per_thread *pt, unsigned long long at);
 #define LWS_LIBUV_ENABLED(context) lws_check_opt(context->options, LWS_SERVER_OPTION_LIBUV)
 LWS_EXTERN void lws_feature_status_libuv(struct lws_context_creation_info *info);
 #else
@@ -834,6 +1232,7 @@ LWS_EXTERN void lws_feature_status_libuv(struct lws_context_creation_info *info)
 #define lws_libuv_init_fd_table(_a) (0)
 #define lws_libuv_run(_a, _b) ((void) 0)
 #define lws_libuv_destroyloop(_a, _b) ((void) 0)
+#define lws_libuv_timer(_a, _b) ((void) 0)
 #define LWS_LIBUV_ENABLED(context) (0)
 #if LWS_POSIX
 #define lws_feature_status_libuv(_a) \
@@ -844,6 +1243,61 @@ LWS_EXTERN void lws_feature_status_libuv(struct lws_context_creation_info *info)
 #endif
 
 
+#if defined(LWS_USE_EPOLL)
+/* max events collected from the kernel per service pass */
+#define LWS_EPOLL_MAX_EVENTS 256
+#define LWS_EPOLL_ENABLED(context) \
+	lws_check_opt(context->options, LWS_SERVER_OPTION_EPOLL)
+#define LWS_EPOLL_ET_ENABLED(context) \
+	lws_check_opt(context->options, LWS_SERVER_OPTION_EPOLL_EDGE_TRIGGERED)
+#else
+#define LWS_EPOLL_ENABLED(context) (0)
+#define LWS_EPOLL_ET_ENABLED(context) (0)
+#endif
+
+#if defined(LWS_USE_IO_URING)
+/* sq entries per thread, cq is twice that */
+#define LWS_URING_SQ_ENTRIES 256
+/* provided buffers per thread for ring recv, a power of 2, and their size */
+#define LWS_URING_RX_BUFS 128
+#define LWS_URING_RX_BUF_SIZE 4096
+enum {
+	LWS_URING_DIR_IN = 1, /* poll for POLLIN */
+	LWS_URING_DIR_OUT = 2, /* poll for POLLOUT */
+	LWS_URING_DIR_RX = 4, /* ring recv, or multishot accept on a listener */
+};
+#define LWS_URING_ENABLED(context) \
+	lws_check_opt(context->options, LWS_SERVER_OPTION_IO_URING)
+LWS_EXTERN int
+lws_uring_init(struct lws_context *context);
+LWS_EXTERN void
+lws_uring_destroy(struct lws_context *context);
+LWS_EXTERN void
+lws_uring_arm(struct lws_context_per_thread *pt, struct lws *wsi);
+LWS_EXTERN void
+lws_uring_remove(struct lws_context_per_thread *pt, struct lws *wsi);
+LWS_EXTERN int
+lws_uring_service_tsi(struct lws_context *context, int timeout_ms, int tsi);
+LWS_EXTERN void
+lws_uring_adopt(struct lws *wsi);
+LWS_EXTERN int
+lws_uring_read(struct lws *wsi, unsigned char *buf, int len);
+LWS_EXTERN int
+lws_uring_accept(struct lws_context *context, lws_sockfd_type lfd,
+		 lws_sockfd_type *afd);
+LWS_EXTERN int
+lws_uring_pending(struct lws_context_per_thread *pt);
+#else
+#define LWS_URING_ENABLED(context) (0)
+#define lws_uring_init(_a) (1)
+#define lws_uring_destroy(_a) ((void)0)
+#define lws_uring_arm(_a, _b) ((void)0)
+#define lws_uring_remove(_a, _b) ((void)0)
+#define lws_uring_service_tsi(_a, _b, _c) (-1)
+#define lws_uring_adopt(_a) ((void)0)
+#define lws_uring_pending(_a) (0)
+#endif
+
 #ifdef LWS_USE_IPV6
 #define LWS_IPV6_ENABLED(vh) \
 	(!lws_check_opt(vh->context->options, LWS_SERVER_OPTION_DISABLE_IPV6) && \
@@ -915,6 +1369,7 @@ struct _lws_header_related {
 	char post_literal_equal;
 	unsigned char parser_state; /* enum lws_token_indexes */
 	char redirects;
+	unsigned int ah_wait_since; /* (unsigned int)pt->now_ms when queued */
 };
 
 struct _lws_http_mode_related {
@@ -1084,18 +1539,26 @@ struct _lws_http2_related {
 
 #endif
 
+#define LWS_WS_CTRL_BUF (128 - 3 + LWS_PRE)
+
 struct _lws_websocket_related {
 	/* cheapest way to deal with ah overlap with ws union transition */
 	struct _lws_header_related hdr;
-	char *rx_ubuf;
-	unsigned int rx_ubuf_alloc;
+	char *rx_ubuf; /* only while assembling a frame, see rxbuf.c */
+	unsigned int rx_ubuf_alloc; /* LWS_PRE + what we spill at */
+	unsigned int rx_ubuf_used_ms; /* last frame needing over half of it */
+	unsigned int active_ms; /* last service, see hibernate.c */
 	struct lws *rx_draining_ext_list;
 	struct lws *tx_draining_ext_list;
 	size_t rx_packet_length;
 	unsigned int rx_ubuf_head;
+	/*
+	 * LWS_WS_CTRL_BUF, only allocated when a control frame or close
+	 * reason needs it.  Also used for close content... control
+	 * opcode == < 128
+	 */
+	unsigned char *ping_payload_buf;
 	unsigned char mask[4];
-	/* Also used for close content... control opcode == < 128 */
-	unsigned char ping_payload_buf[128 - 3 + LWS_PRE];
 
 	unsigned char ping_payload_len;
 	unsigned char mask_idx;
@@ -1166,6 +1629,20 @@ struct lws_access_log {
 };
 #endif
 
+#ifndef LWS_NO_EXTENSIONS
+struct lws_wsi_ext {
+	const struct lws_extension *active_extensions[LWS_MAX_EXTENSIONS_ACTIVE];
+	void *act_ext_user[LWS_MAX_EXTENSIONS_ACTIVE];
+};
+#endif
+
+/*
+ * Everything every connection needs is kept inline.  State that only some
+ * connections use, or only use for a while, hangs off pointers and is
+ * allocated when first needed: ws control frame payloads, extension state,
+ * access log, cgi and rewriting.
+ */
+
 struct lws {
 
 	/* structs */
@@ -1188,7 +1665,10 @@ struct lws {
 #if defined(LWS_USE_LIBEV)
 	struct lws_io_watcher w_write;
 #endif
-	time_t pending_timeout_limit;
+	struct lws_timer timeout_timer; /* drives pending_timeout */
+	unsigned long long pending_timeout_ms; /* pt->now_ms when it's due */
+	struct lws_timer user_timer; /* lws_set_timer_ms() */
+	struct lws_timer hibernate_timer; /* idle ws, see hibernate.c */
 
 	/* pointers */
 
@@ -1202,19 +1682,18 @@ struct lws {
 #endif
 	const struct lws_protocols *protocol;
 	struct lws **same_vh_protocol_prev, *same_vh_protocol_next;
-	struct lws *timeout_list;
-	struct lws **timeout_list_prev;
+	struct lws_vhost *mem_vh; /* where mem[] is booked */
 #ifdef LWS_WITH_ACCESS_LOG
-	struct lws_access_log access_log;
+	struct lws_access_log *access_log; /* first logged transaction on */
 #endif
 	void *user_space;
 	/* rxflow handling */
 	unsigned char *rxflow_buffer;
 	/* truncated send handling */
-	unsigned char *trunc_alloc; /* non-NULL means buffering in progress */
+	struct lws_txq_node *txq, *txq_tail; /* non-NULL means output queued */
+	struct lws_arena_block *arena; /* this http transaction's allocations */
 #ifndef LWS_NO_EXTENSIONS
-	const struct lws_extension *active_extensions[LWS_MAX_EXTENSIONS_ACTIVE];
-	void *act_ext_user[LWS_MAX_EXTENSIONS_ACTIVE];
+	struct lws_wsi_ext *ext; /* only once an extension is negotiated */
 #endif
 #ifdef LWS_OPENSSL_SUPPORT
 	SSL *ssl;
@@ -1232,14 +1711,22 @@ struct lws {
 #endif
 	/* pointer / int */
 	lws_sockfd_type sock;
+#if defined(LWS_USE_IO_URING)
+	struct lws *uring_rx_next; /* on pt->uring.rx_pending */
+#endif
 
 	/* ints */
 	int position_in_fds_table;
+#if defined(LWS_USE_IO_URING)
+	/* what a ring recv got that wasn't read yet */
+	unsigned short uring_bid, uring_rx_off, uring_rx_len;
+#endif
+	unsigned int gen; /* unique per wsi, the struct itself is reused */
 	int rxflow_len;
 	int rxflow_pos;
-	unsigned int trunc_alloc_len; /* size of malloc */
-	unsigned int trunc_offset; /* where we are in terms of spilling */
-	unsigned int trunc_len; /* how much is buffered */
+	unsigned int trunc_len; /* how much is queued on txq */
+	unsigned int mem[LWSMT_COUNT]; /* bytes we hold, by enum lws_mem_tags */
+	unsigned int svc_events; /* serviced in pt load window svc_window */
 #ifndef LWS_NO_CLIENT
 	int chunk_remaining;
 #endif
@@ -1276,12 +1763,22 @@ struct lws {
 	unsigned int use_ssl:2;
 	unsigned int upgraded:1;
 #endif
-#ifdef _WIN32
-	unsigned int sock_send_blocking:1;
-#endif
+	unsigned int sock_send_blocking:1; /* no POLLOUT since last EAGAIN */
+	unsigned int ws_hibernating:1;
+	unsigned int ws_hibernated_user_space:1; /* user_space went with it */
 #ifdef LWS_OPENSSL_SUPPORT
 	unsigned int redirect_to_https:1;
 #endif
+#if defined(LWS_USE_EPOLL)
+	unsigned int epoll_rearm:1; /* ET: read filled the buffer, may be more */
+#endif
+#if defined(LWS_USE_IO_URING)
+	unsigned int uring_armed:3; /* LWS_URING_DIR_ bits with a sqe queued */
+	unsigned int uring_recv:1; /* input comes by ring recv */
+	unsigned int uring_poll_in:1; /* ring had no buffers, poll once */
+	unsigned int uring_eof:1; /* ring recv saw the peer close */
+	unsigned int uring_rx_listed:1; /* on pt->uring.rx_pending */
+#endif
 
 	/* chars */
 #ifndef LWS_NO_EXTENSIONS
@@ -1296,6 +1793,9 @@ struct lws {
 	char pending_timeout; /* enum pending_timeout */
 	char pps; /* enum lws_pending_protocol_send */
 	char tsi; /* thread service index we belong to */
+	char mem_tsi; /* ...and mem_pidx, where mem[] is booked */
+	short mem_pidx;
+	unsigned char svc_window;
 	char protocol_interpret_idx;
 #ifdef LWS_WITH_CGI
 	char cgi_channel; /* which of stdin/out/err */
@@ -1374,11 +1874,45 @@ insert_wsi(struct lws_context *context, struct lws *wsi);
 LWS_EXTERN int
 delete_from_fd(struct lws_context *context, lws_sockfd_type fd);
 #else
-#define wsi_from_fd(A,B)  A->lws_lookup[B]
-#define insert_wsi(A,B)   assert(A->lws_lookup[B->sock] == 0); A->lws_lookup[B->sock]=B
-#define delete_from_fd(A,B) A->lws_lookup[B]=0
+static LWS_INLINE struct lws_fd_page *
+lws_fd_page(const struct lws_context *context, lws_sockfd_type fd)
+{
+	if (fd < 0 || fd >= context->max_fds)
+		return NULL;
+
+	return lws_atomic_ptr_load(&context->lws_lookup[fd >> LWS_FD_PAGE_BITS]);
+}
+
+static LWS_INLINE struct lws *
+wsi_from_fd(const struct lws_context *context, lws_sockfd_type fd)
+{
+	struct lws_fd_page *page = lws_fd_page(context, fd);
+
+	return page ? page->wsi[fd & (LWS_FD_PAGE - 1)] : NULL;
+}
+
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+insert_wsi(struct lws_context *context, struct lws *wsi);
+
+static LWS_INLINE void
+delete_from_fd(struct lws_context *context, lws_sockfd_type fd)
+{
+	struct lws_fd_page *page = lws_fd_page(context, fd);
+
+	if (page)
+		page->wsi[fd & (LWS_FD_PAGE - 1)] = NULL;
+}
 #endif
 
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_pt_fds_grow(struct lws_context_per_thread *pt);
+
+LWS_EXTERN void
+lws_pt_fds_reap(struct lws_context_per_thread *pt);
+
+LWS_EXTERN void
+lws_pt_fds_free(struct lws_pollfd *fds);
+
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 insert_wsi_socket_into_fds(struct lws_context *context, struct lws *wsi);
 
@@ -1386,8 +1920,116 @@ LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_issue_raw(struct lws *wsi, unsigned char *buf, size_t len);
 
 
+LWS_EXTERN void
+lws_service_timeout_cb(struct lws_timer *t);
+
+LWS_EXTERN int
+lws_timer_wheel_init(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_timer_wheel_destroy(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_timer_wheel_service(struct lws_context_per_thread *pt);
+LWS_EXTERN int
+lws_timer_wheel_next_ms(struct lws_context_per_thread *pt);
+
+#define lws_pt_cmd_pending(pt) (!!lws_atomic_ptr_load(&(pt)->cmd_head))
+LWS_EXTERN void
+lws_pt_cmd_drain(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_pt_cmd_destroy(struct lws_context_per_thread *pt);
+
+LWS_EXTERN void
+lws_pt_service_start(struct lws_context_per_thread *pt);
+
+LWS_EXTERN int
+lws_migrate_wsi(struct lws *wsi, int tsi);
+LWS_EXTERN void
+lws_pt_balance(struct lws_context *context, int tsi);
+
+LWS_EXTERN int
+lws_pt_hist_init(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_pt_hist_destroy(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_histogram_add(struct lws_histogram *h, unsigned long long us);
+LWS_EXTERN void
+lws_pt_woke(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_pt_sleeping(struct lws_context_per_thread *pt);
+#if defined(LWS_WITH_SERVER_STATUS)
+LWS_EXTERN int
+lws_json_dump_pt_hist(const struct lws_context_per_thread *pt, char *buf,
+		      int len);
+#endif
+
+LWS_EXTERN int
+lws_pt_slab_init(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_pt_slab_destroy(struct lws_context_per_thread *pt);
+LWS_EXTERN void * LWS_WARN_UNUSED_RESULT
+lws_slab_zalloc(struct lws_context_per_thread *pt, size_t size);
+LWS_EXTERN void * LWS_WARN_UNUSED_RESULT
+lws_slab_alloc(struct lws_context_per_thread *pt, size_t size);
+LWS_EXTERN void
+lws_slab_free(void *p);
+#define lws_slab_free_set_NULL(P) do { lws_slab_free(P); (P) = NULL; } while(0)
+
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_txq_append(struct lws *wsi, const unsigned char *buf, size_t len);
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_txq_reserve(struct lws *wsi, size_t len);
+LWS_EXTERN int
+lws_txq_drain(struct lws *wsi);
+LWS_EXTERN void
+lws_txq_destroy(struct lws *wsi);
+LWS_EXTERN size_t
+lws_issue_raw_limit(struct lws *wsi);
+LWS_EXTERN int
+lws_issue_raw_sock(struct lws *wsi, unsigned char *buf, size_t len);
+LWS_EXTERN int
+lws_ws_frame_header(unsigned char *end, size_t len, int wp,
+		    unsigned char is_masked_bit);
+
+LWS_EXTERN void
+lws_mem_charge(struct lws *wsi, enum lws_mem_tags tag, long delta);
+#define lws_mem_set(wsi, tag, n) \
+	lws_mem_charge(wsi, tag, (long)(n) - (long)(wsi)->mem[tag])
+LWS_EXTERN void
+lws_mem_rebook(struct lws *wsi);
+LWS_EXTERN void
+lws_mem_release(struct lws *wsi);
+LWS_EXTERN void
+lws_mem_shed(struct lws_context_per_thread *pt);
+
+LWS_EXTERN void
+lws_arena_reset(struct lws *wsi);
+LWS_EXTERN void
+lws_arena_destroy(struct lws *wsi);
+
+LWS_EXTERN void
+lws_pt_rxbuf_destroy(struct lws_context_per_thread *pt);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
-lws_service_timeout_check(struct lws *wsi, unsigned int sec);
+lws_ws_rxbuf_get(struct lws *wsi);
+LWS_EXTERN void
+lws_ws_rxbuf_put(struct lws *wsi);
+LWS_EXTERN void
+lws_ws_rxbuf_idle(struct lws *wsi);
+LWS_EXTERN void
+lws_ws_rxbuf_init(struct lws *wsi);
+LWS_EXTERN void
+lws_ws_rxbuf_count(struct lws *wsi);
+
+LWS_EXTERN void
+lws_ws_hibernate_arm(struct lws *wsi);
+LWS_EXTERN int
+lws_ws_hibernate(struct lws *wsi);
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_ws_wake(struct lws *wsi);
+#if defined(LWS_WITH_SERVER_STATUS)
+LWS_EXTERN int
+lws_json_dump_pt_slabs(const struct lws_context_per_thread *pt, char *buf,
+		       int len);
+#endif
 
 LWS_EXTERN struct lws * LWS_WARN_UNUSED_RESULT
 lws_client_connect_2(struct lws *wsi);
@@ -1397,7 +2039,7 @@ lws_client_reset(struct lws *wsi, int ssl, const char *address, int port,
 		 const char *path, const char *host);
 
 LWS_EXTERN struct lws * LWS_WARN_UNUSED_RESULT
-lws_create_new_server_wsi(struct lws_vhost *vhost);
+lws_create_new_server_wsi(struct lws_vhost *vhost, int tsi);
 
 LWS_EXTERN char * LWS_WARN_UNUSED_RESULT
 lws_generate_client_handshake(struct lws *wsi, char *pkt);
@@ -1441,7 +2083,25 @@ LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_rx_sm(struct lws *wsi, unsigned char c);
 
 LWS_EXTERN void
-lws_payload_until_length_exhausted(struct lws *wsi, unsigned char **buf, size_t *len);
+lws_ws_rx_bulk(struct lws *wsi, unsigned char **buf, size_t *len);
+
+LWS_EXTERN void
+lws_ws_mask_init(void);
+
+enum lws_ws_mask_kernels {
+	LWS_WS_MASK_64,
+	LWS_WS_MASK_SSE2,
+	LWS_WS_MASK_AVX2,
+
+	LWS_WS_MASK_COUNT
+};
+
+LWS_EXTERN int
+lws_ws_mask_force(int kernel);
+
+LWS_EXTERN void
+lws_ws_xor_mask(unsigned char *out, const unsigned char *in, size_t len,
+		const unsigned char *mask, int idx);
 
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_issue_raw_ext_access(struct lws *wsi, unsigned char *buf, size_t len);
@@ -1494,6 +2154,13 @@ void lws_http2_configure_if_upgraded(struct lws *wsi);
 LWS_EXTERN int
 lws_plat_set_socket_options(struct lws_vhost *vhost, lws_sockfd_type fd);
 
+LWS_EXTERN lws_sockfd_type
+lws_plat_accept(struct lws_vhost *vhost, lws_sockfd_type fd,
+		struct sockaddr *sa, socklen_t *len);
+
+LWS_EXTERN int
+lws_plat_listen_q_full(lws_sockfd_type fd);
+
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_header_table_attach(struct lws *wsi, int autoservice);
 
@@ -1503,6 +2170,13 @@ lws_header_table_detach(struct lws *wsi, int autoservice);
 LWS_EXTERN void
 lws_header_table_reset(struct lws *wsi, int autoservice);
 
+LWS_EXTERN void
+lws_pt_ah_pool_fill(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_pt_ah_pool_trim(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_pt_ah_pool_destroy(struct lws_context_per_thread *pt);
+
 LWS_EXTERN char * LWS_WARN_UNUSED_RESULT
 lws_hdr_simple_ptr(struct lws *wsi, enum lws_token_indexes h);
 
@@ -1512,6 +2186,14 @@ lws_hdr_simple_create(struct lws *wsi, enum lws_token_indexes h, const char *s);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ensure_user_space(struct lws *wsi);
 
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_ensure_ws_ctrl_buf(struct lws *wsi);
+
+#ifndef LWS_NO_EXTENSIONS
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_ensure_ext_space(struct lws *wsi);
+#endif
+
 LWS_EXTERN int
 lws_change_pollfd(struct lws *wsi, int _and, int _or);
 
@@ -1558,12 +2240,14 @@ enum lws_ssl_capable_status {
 #define lws_context_init_http2_ssl(_a)
 #define lws_ssl_capable_read lws_ssl_capable_read_no_ssl
 #define lws_ssl_capable_write lws_ssl_capable_write_no_ssl
+#define lws_ssl_capable_write_vec lws_ssl_capable_write_vec_no_ssl
 #define lws_ssl_pending lws_ssl_pending_no_ssl
 #define lws_server_socket_service_ssl(_b, _c) (0)
 #define lws_ssl_close(_a) (0)
 #define lws_ssl_context_destroy(_a)
 #define lws_ssl_SSL_CTX_destroy(_a)
 #define lws_ssl_remove_wsi_from_buffered_list(_a)
+#define lws_ssl_hibernate(_a, _b)
 #define lws_context_init_ssl_library(_a)
 #else
 #define LWS_SSL_ENABLED(context) (context->use_ssl)
@@ -1573,6 +2257,9 @@ lws_ssl_capable_read(struct lws *wsi, unsigned char *buf, int len);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ssl_capable_write(struct lws *wsi, unsigned char *buf, int len);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_ssl_capable_write_vec(struct lws *wsi, const struct lws_iov *iov,
+			  int count);
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ssl_pending(struct lws *wsi);
 LWS_EXTERN int
 lws_context_init_ssl_library(struct lws_context_creation_info *info);
@@ -1586,6 +2273,8 @@ LWS_EXTERN void
 lws_ssl_context_destroy(struct lws_context *context);
 LWS_VISIBLE void
 lws_ssl_remove_wsi_from_buffered_list(struct lws *wsi);
+LWS_EXTERN void
+lws_ssl_hibernate(struct lws *wsi, int hibernate);
 LWS_EXTERN int
 lws_ssl_client_bio_create(struct lws *wsi);
 LWS_EXTERN int
@@ -1651,6 +2340,10 @@ lws_ssl_capable_read_no_ssl(struct lws *wsi, unsigned char *buf, int len);
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ssl_capable_write_no_ssl(struct lws *wsi, unsigned char *buf, int len);
 
+LWS_EXTERN int LWS_WARN_UNUSED_RESULT
+lws_ssl_capable_write_vec_no_ssl(struct lws *wsi, const struct lws_iov *iov,
+				 int count);
+
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_ssl_pending_no_ssl(struct lws *wsi);
 
@@ -1747,6 +2440,12 @@ lws_zalloc(size_t size);
 #define lws_free(P)	lws_realloc(P, 0)
 #define lws_free_set_NULL(P)	do { lws_realloc(P, 0); (P) = NULL; } while(0)
 
+/* cache line aligned, free with lws_free_cl() */
+LWS_EXTERN void * LWS_WARN_UNUSED_RESULT
+lws_zalloc_cl(size_t size);
+LWS_EXTERN void
+lws_free_cl(void *p);
+
 /* lws_plat_ */
 LWS_EXTERN void
 lws_plat_delete_socket_from_fds(struct lws_context *context,
@@ -1767,8 +2466,6 @@ lws_plat_context_early_destroy(struct lws_context *context);
 LWS_EXTERN void
 lws_plat_context_late_destroy(struct lws_context *context);
 LWS_EXTERN int
-lws_poll_listen_fd(struct lws_pollfd *fd);
-LWS_EXTERN int
 lws_plat_service(struct lws_context *context, int timeout_ms);
 LWS_EXTERN LWS_VISIBLE int
 lws_plat_service_tsi(struct lws_context *context, int timeout_ms, int tsi);
@@ -1779,11 +2476,34 @@ LWS_EXTERN void
 lws_plat_drop_app_privileges(struct lws_context_creation_info *info);
 LWS_EXTERN unsigned long long
 time_in_microseconds(void);
+LWS_EXTERN unsigned long long
+lws_plat_monotonic_ms(void);
+LWS_EXTERN unsigned long long
+lws_plat_monotonic_us(void);
+LWS_EXTERN void
+lws_plat_pin_thread(struct lws_context *context, int tsi);
+LWS_EXTERN void
+lws_plat_pipe_signal(struct lws_context_per_thread *pt);
+LWS_EXTERN void
+lws_plat_pipe_drain(struct lws_context_per_thread *pt);
 LWS_EXTERN const char * LWS_WARN_UNUSED_RESULT
 lws_plat_inet_ntop(int af, const void *src, char *dst, int cnt);
 
 LWS_EXTERN int LWS_WARN_UNUSED_RESULT
 lws_check_utf8(unsigned char *state, unsigned char *buf, size_t len);
+LWS_EXTERN void
+lws_utf8_init(void);
+
+enum lws_utf8_kernels {
+	LWS_UTF8_SCALAR,
+	LWS_UTF8_SSSE3,
+	LWS_UTF8_AVX2,
+
+	LWS_UTF8_COUNT
+};
+
+LWS_EXTERN int
+lws_utf8_force(int kernel);
 
 #ifdef __cplusplus
 };
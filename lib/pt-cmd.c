@@ -0,0 +1,253 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * Any number of threads may push onto pt->cmd_head with CAS, only the
+ * service thread that owns the pt takes them off, by swapping the whole list
+ * out at once.  So there's no ABA problem and no lock.
+ *
+ * Only the first post onto an empty list signals the wake fd.  The service
+ * pass that wakes drains the list after it has read the wake fd, so later
+ * posts either join a list it's about to take, or find it empty and signal
+ * again.
+ */
+
+static int
+lws_pt_cmd_post(struct lws_context_per_thread *pt, struct lws_pt_cmd *c)
+{
+	struct lws_pt_cmd *head;
+
+	do {
+		head = lws_atomic_ptr_load(&pt->cmd_head);
+		c->next = head;
+	} while (!lws_atomic_ptr_cas(&pt->cmd_head, head, c));
+
+	/* if the list wasn't empty, a wake is already on its way */
+	if (!head)
+		lws_plat_pipe_signal(pt);
+
+	return 0;
+}
+
+static struct lws_pt_cmd *
+lws_pt_cmd_new(unsigned char type)
+{
+	struct lws_pt_cmd *c = lws_zalloc(sizeof(*c));
+
+	if (!c) {
+		lwsl_err("OOM on pt cmd\n");
+		return NULL;
+	}
+	c->type = type;
+
+	return c;
+}
+
+static int
+lws_pt_cmd_wsi(struct lws *wsi, unsigned char type)
+{
+	struct lws_pt_cmd *c = lws_pt_cmd_new(type);
+
+	if (!c)
+		return 1;
+
+	c->wsi = wsi;
+	c->fd = wsi->sock;
+	c->gen = wsi->gen;
+
+	return lws_pt_cmd_post(&wsi->context->pt[(int)wsi->tsi], c);
+}
+
+/**
+ * lws_pt_cmd_writable() - lws_callback_on_writable() from any thread
+ *
+ * @wsi:	connection to get a writable callback on
+ *
+ *	The request is queued for the service thread that owns @wsi, which
+ *	is woken to act on it.  If the connection closed meanwhile, the
+ *	request is dropped.  Returns 0 if queued.
+ */
+LWS_VISIBLE int
+lws_pt_cmd_writable(struct lws *wsi)
+{
+	return lws_pt_cmd_wsi(wsi, LWS_PT_CMD_WRITABLE);
+}
+
+/**
+ * lws_pt_cmd_close() - have the service thread close a connection
+ *
+ * @wsi:	connection to close
+ *
+ *	As lws_pt_cmd_writable() but the owning service thread closes the
+ *	connection instead.  Returns 0 if queued.
+ */
+LWS_VISIBLE int
+lws_pt_cmd_close(struct lws *wsi)
+{
+	return lws_pt_cmd_wsi(wsi, LWS_PT_CMD_CLOSE);
+}
+
+/**
+ * lws_pt_cmd_writable_all_protocol() - broadcast writable from any thread
+ *
+ * @context:	lws context
+ * @protocol:	protocol whose connections should get writable callbacks
+ *
+ *	Every service thread is asked to do the equivalent of
+ *	lws_callback_on_writable_all_protocol() on its own connections, so
+ *	nothing owned by another thread is touched.  Returns 0 if all queued.
+ */
+LWS_VISIBLE int
+lws_pt_cmd_writable_all_protocol(struct lws_context *context,
+				 const struct lws_protocols *protocol)
+{
+	struct lws_pt_cmd *c;
+	int n, ret = 0;
+
+	for (n = 0; n < context->count_threads; n++) {
+		c = lws_pt_cmd_new(LWS_PT_CMD_WRITABLE_ALL_PROTOCOL);
+		if (!c) {
+			ret = 1;
+			continue;
+		}
+		c->protocol = protocol;
+		lws_pt_cmd_post(&context->pt[n], c);
+	}
+
+	return ret;
+}
+
+/**
+ * lws_pt_cmd_run() - run a function on a service thread
+ *
+ * @context:	lws context
+ * @tsi:	service thread index to run it on
+ * @cb:		function to call from the service thread
+ * @user:	opaque pointer passed to @cb
+ *
+ *	@cb is free to use any lws apis on connections owned by @tsi.
+ *	Returns 0 if queued.
+ */
+LWS_VISIBLE int
+lws_pt_cmd_run(struct lws_context *context, int tsi, lws_pt_cmd_run_cb cb,
+	       void *user)
+{
+	struct lws_pt_cmd *c;
+
+	if (tsi < 0 || tsi >= context->count_threads)
+		return 1;
+
+	c = lws_pt_cmd_new(LWS_PT_CMD_RUN);
+	if (!c)
+		return 1;
+
+	c->cb = cb;
+	c->user = user;
+
+	return lws_pt_cmd_post(&context->pt[tsi], c);
+}
+
+static void
+lws_pt_cmd_writable_protocol(struct lws_context_per_thread *pt,
+			     const struct lws_protocols *protocol)
+{
+	struct lws *wsi;
+	unsigned int n;
+
+	for (n = 0; n < pt->fds_count; n++) {
+		wsi = wsi_from_fd(pt->context, pt->fds[n].fd);
+		if (!wsi || !wsi->protocol)
+			continue;
+		if (wsi->protocol->callback == protocol->callback &&
+		    !strcmp(wsi->protocol->name, protocol->name))
+			lws_callback_on_writable(wsi);
+	}
+}
+
+/*
+ * Called from the service thread that owns pt
+ */
+void
+lws_pt_cmd_drain(struct lws_context_per_thread *pt)
+{
+	struct lws_pt_cmd *c, *next, *list = NULL;
+	struct lws *wsi;
+
+	c = lws_atomic_ptr_swap(&pt->cmd_head, NULL);
+
+	/* it's LIFO, reverse it to act in the order things were posted */
+	while (c) {
+		next = c->next;
+		c->next = list;
+		list = c;
+		c = next;
+	}
+
+	while ((c = list)) {
+		list = c->next;
+
+		switch (c->type) {
+		case LWS_PT_CMD_WRITABLE:
+		case LWS_PT_CMD_CLOSE:
+			/* the struct may be reused by now, gen tells us */
+			wsi = wsi_from_fd(pt->context, c->fd);
+			if (wsi != c->wsi || wsi->gen != c->gen)
+				break; /* he went away already */
+			if (wsi->tsi != pt->tid) {
+				/*
+				 * he was migrated after this was posted, only
+				 * his new thread may touch him now
+				 */
+				lws_pt_cmd_post(&pt->context->pt[(int)wsi->tsi],
+						c);
+				continue;
+			}
+			if (c->type == LWS_PT_CMD_WRITABLE)
+				lws_callback_on_writable(wsi);
+			else
+				lws_close_free_wsi(wsi,
+						   LWS_CLOSE_STATUS_NOSTATUS);
+			break;
+		case LWS_PT_CMD_RUN:
+			c->cb(pt->context, pt->tid, c->user);
+			break;
+		case LWS_PT_CMD_WRITABLE_ALL_PROTOCOL:
+			lws_pt_cmd_writable_protocol(pt, c->protocol);
+			break;
+		}
+
+		lws_free(c);
+	}
+}
+
+void
+lws_pt_cmd_destroy(struct lws_context_per_thread *pt)
+{
+	struct lws_pt_cmd *c = lws_atomic_ptr_swap(&pt->cmd_head, NULL), *next;
+
+	while (c) {
+		next = c->next;
+		lws_free(c);
+		c = next;
+	}
+}
@@ -0,0 +1,189 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+#if defined(LWS_HAVE_GETRANDOM)
+#include <sys/random.h>
+#endif
+
+/*
+ * Each service thread has a ChaCha20 keystream generator, so ws frame masks
+ * and client handshake keys don't cost a read() of the random device each.
+ *
+ * It works like OpenBSD's arc4random: a refill makes LWS_RNG_BUF bytes of
+ * keystream, the first 32 become the key for the next refill and are wiped,
+ * and bytes are wiped as they are handed out.  So nothing in memory can
+ * give away output already used.  It is keyed from the OS when first used
+ * and stirred with fresh OS randomness every LWS_RNG_RESEED bytes.
+ */
+
+#define LWS_RNG_RESEED (1600 * 1024)
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QR(a, b, c, d) \
+	a += b; d ^= a; d = ROTL32(d, 16); \
+	c += d; b ^= c; b = ROTL32(b, 12); \
+	a += b; d ^= a; d = ROTL32(d, 8); \
+	c += d; b ^= c; b = ROTL32(b, 7);
+
+static void
+lws_chacha20_block(const unsigned int *key, unsigned int counter,
+		   unsigned char *out)
+{
+	unsigned int in[16], x[16];
+	int n;
+
+	/* "expand 32-byte k" */
+	in[0] = 0x61707865;
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (n = 0; n < 8; n++)
+		in[4 + n] = key[n];
+	/* a new key every refill, so the nonce can stay 0 */
+	in[12] = counter;
+	in[13] = in[14] = in[15] = 0;
+
+	memcpy(x, in, sizeof(x));
+	for (n = 0; n < 10; n++) {
+		QR(x[0], x[4], x[8], x[12]);
+		QR(x[1], x[5], x[9], x[13]);
+		QR(x[2], x[6], x[10], x[14]);
+		QR(x[3], x[7], x[11], x[15]);
+		QR(x[0], x[5], x[10], x[15]);
+		QR(x[1], x[6], x[11], x[12]);
+		QR(x[2], x[7], x[8], x[13]);
+		QR(x[3], x[4], x[9], x[14]);
+	}
+	for (n = 0; n < 16; n++)
+		x[n] += in[n];
+
+	memcpy(out, x, 64);
+}
+
+static void
+lws_rng_refill(struct lws_rng *r)
+{
+	unsigned int n;
+
+	for (n = 0; n < LWS_RNG_BUF / 64; n++)
+		lws_chacha20_block(r->key, n, r->buf + (n * 64));
+
+	memcpy(r->key, r->buf, sizeof(r->key));
+	memset(r->buf, 0, sizeof(r->key));
+	r->have = LWS_RNG_BUF - sizeof(r->key);
+}
+
+static int
+lws_rng_os(struct lws_context *context, unsigned char *buf, int len)
+{
+#if defined(LWS_HAVE_GETRANDOM)
+	int n;
+
+	while (len) {
+		n = getrandom(buf, len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* older kernel, use the random device */
+			break;
+		}
+		buf += n;
+		len -= n;
+	}
+	if (!len)
+		return 0;
+#endif
+
+	return lws_get_random(context, buf, len) != len;
+}
+
+static int
+lws_rng_stir(struct lws_context *context, struct lws_rng *r)
+{
+	unsigned int seed[8];
+	int n;
+
+	if (lws_rng_os(context, (unsigned char *)seed, sizeof(seed))) {
+		lwsl_err("%s: unable to get randomness from the OS\n",
+			 __func__);
+		return 1;
+	}
+
+	for (n = 0; n < 8; n++)
+		r->key[n] ^= seed[n];
+	memset(seed, 0, sizeof(seed));
+
+	lws_rng_refill(r);
+	r->since_stir = 0;
+	r->seeded = 1;
+
+	return 0;
+}
+
+/**
+ * lws_get_random_tsi() - cryptographic random bytes without the syscall
+ *
+ * @context:	lws context
+ * @tsi:	service thread index whose generator to use
+ * @buf:	where to put the bytes
+ * @len:	how many bytes
+ *
+ *	Like lws_get_random(), but from the service thread's generator, so
+ *	it only goes to the OS for every LWS_RNG_RESEED bytes.  lws uses it
+ *	for ws frame masks and client handshake keys.  It isn't locked, only
+ *	call it from the service thread tsi belongs to.  Returns len, or -1
+ *	if the OS had no randomness to give.
+ */
+LWS_VISIBLE int
+lws_get_random_tsi(struct lws_context *context, int tsi, void *buf, int len)
+{
+	struct lws_rng *r = &context->pt[tsi].rng;
+	unsigned char *p = buf;
+	int n, left = len;
+
+	if (len < 0)
+		return -1;
+
+	if (!r->seeded || r->since_stir >= LWS_RNG_RESEED)
+		if (lws_rng_stir(context, r))
+			return -1;
+
+	while (left) {
+		if (!r->have)
+			lws_rng_refill(r);
+
+		n = left;
+		if (n > (int)r->have)
+			n = r->have;
+
+		memcpy(p, r->buf + LWS_RNG_BUF - r->have, n);
+		memset(r->buf + LWS_RNG_BUF - r->have, 0, n);
+		r->have -= n;
+		p += n;
+		left -= n;
+	}
+	r->since_stir += len;
+
+	return len;
+}
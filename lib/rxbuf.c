@@ -0,0 +1,232 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * A ws connection only holds an rx buffer while it has a frame partly
+ * assembled, or an extension is still draining what was in it.  Otherwise the
+ * buffer goes back to its service thread's pool, which keeps a few spare ones
+ * of each size and frees the rest.
+ *
+ * Only the service thread that owns the wsi lends or takes back its buffer,
+ * so there is no locking.  A wsi holding a buffer is not moved between
+ * threads.
+ *
+ * The buffer starts at the protocol's rx_buffer_size.  If the protocol also
+ * gives rx_buffer_size_max, each time a connection borrows a buffer it looks
+ * at how much is left of the frame coming in, and doubles its size until the
+ * frame fits, up to the max, so big frames are delivered whole.  When no
+ * frame needed more than half of it for LWS_RXBUF_SHRINK_MS, it goes back
+ * down to what the frame in hand needs.
+ */
+
+/* what a connection using this protocol starts with, and spills at */
+
+static unsigned int
+lws_ws_rxbuf_base(struct lws *wsi)
+{
+	if (wsi->protocol->rx_buffer_size)
+		return wsi->protocol->rx_buffer_size;
+
+	return wsi->context->pt_serv_buf_size;
+}
+
+void
+lws_ws_rxbuf_init(struct lws *wsi)
+{
+	wsi->u.ws.rx_ubuf_alloc = LWS_PRE + lws_ws_rxbuf_base(wsi);
+	wsi->u.ws.rx_ubuf_used_ms = (unsigned int)
+			wsi->context->pt[(int)wsi->tsi].now_ms;
+}
+
+void
+lws_pt_rxbuf_destroy(struct lws_context_per_thread *pt)
+{
+	void *p, *next;
+	int n;
+
+	for (n = 0; n < LWS_RXBUF_POOL_SIZES; n++) {
+		p = pt->rxbuf_pool.s[n].free_list;
+		while (p) {
+			next = *(void **)p;
+			lws_free(p);
+			p = next;
+		}
+		pt->rxbuf_pool.s[n].free_list = NULL;
+		pt->rxbuf_pool.s[n].count = 0;
+	}
+}
+
+/* no buffer is held, so we can choose its size */
+
+static void
+lws_ws_rxbuf_adapt(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	size_t max = wsi->protocol->rx_buffer_size_max,
+	       frame = wsi->u.ws.rx_packet_length;
+	unsigned int base = lws_ws_rxbuf_base(wsi),
+		     size = wsi->u.ws.rx_ubuf_alloc - LWS_PRE, want;
+
+	if (max <= base)
+		return;
+	if (max > 1u << 30)
+		max = 1u << 30;
+
+	if (frame > size && size < max) {
+		want = size;
+		while (want < frame && want < max)
+			want <<= 1;
+		if (want > max)
+			want = max;
+		pt->rxbuf_pool.grows++;
+	} else
+		if (size > base && frame <= size / 2 &&
+		    (unsigned int)pt->now_ms - wsi->u.ws.rx_ubuf_used_ms >
+							LWS_RXBUF_SHRINK_MS) {
+			want = base;
+			while (want < frame)
+				want <<= 1;
+			pt->rxbuf_pool.shrinks++;
+		} else
+			want = size;
+
+	wsi->u.ws.rx_ubuf_alloc = LWS_PRE + want;
+	if (frame > want / 2)
+		wsi->u.ws.rx_ubuf_used_ms = (unsigned int)pt->now_ms;
+}
+
+/* the buffer is rx_ubuf_alloc, plus 4 for zlib to append 0x0000ffff */
+
+int
+lws_ws_rxbuf_get(struct lws *wsi)
+{
+	struct lws_rxbuf_pool *pool = &wsi->context->pt[(int)wsi->tsi].rxbuf_pool;
+	unsigned int size;
+	char *p = NULL;
+	int n;
+
+	if (wsi->u.ws.rx_ubuf)
+		return 0;
+
+	lws_ws_rxbuf_adapt(wsi);
+	size = wsi->u.ws.rx_ubuf_alloc + 4;
+
+	for (n = 0; n < LWS_RXBUF_POOL_SIZES; n++)
+		if (pool->s[n].size == size && pool->s[n].free_list) {
+			p = pool->s[n].free_list;
+			pool->s[n].free_list = *(void **)p;
+			pool->s[n].count--;
+			break;
+		}
+
+	if (!p) {
+		p = lws_malloc(size);
+		if (!p) {
+			lwsl_err("Out of Mem allocating rx buffer %d\n", size);
+			return 1;
+		}
+		pool->heap_allocs++;
+	}
+
+	wsi->u.ws.rx_ubuf = p;
+	pool->borrows++;
+	pool->lent++;
+	lws_mem_set(wsi, LWSMT_RXBUF, size);
+
+	return 0;
+}
+
+void
+lws_ws_rxbuf_put(struct lws *wsi)
+{
+	struct lws_rxbuf_pool *pool = &wsi->context->pt[(int)wsi->tsi].rxbuf_pool;
+	unsigned int size = wsi->u.ws.rx_ubuf_alloc + 4;
+	char *p = wsi->u.ws.rx_ubuf;
+	int n, spare = -1;
+
+	if (!p)
+		return;
+
+	wsi->u.ws.rx_ubuf = NULL;
+	pool->lent--;
+	lws_mem_set(wsi, LWSMT_RXBUF, 0);
+
+	for (n = 0; n < LWS_RXBUF_POOL_SIZES; n++) {
+		if (pool->s[n].size == size)
+			break;
+		if (spare < 0 && !pool->s[n].count)
+			spare = n;
+	}
+	if (n == LWS_RXBUF_POOL_SIZES) {
+		/* take over a size nobody has spares of */
+		if (spare < 0) {
+			lws_free(p);
+			return;
+		}
+		n = spare;
+		pool->s[n].size = size;
+	}
+
+	if (pool->s[n].count >= (size > LWS_RXBUF_POOL_BIG ?
+					LWS_RXBUF_POOL_SPARE_BIG :
+					LWS_RXBUF_POOL_SPARE)) {
+		lws_free(p);
+		return;
+	}
+
+	*(void **)p = pool->s[n].free_list;
+	pool->s[n].free_list = p;
+	pool->s[n].count++;
+}
+
+/*
+ * Called when we finished with the rx we had for now.  If no payload is
+ * buffered and no extension is still reading from the buffer, it can go
+ * back to the pool.
+ */
+
+void
+lws_ws_rxbuf_idle(struct lws *wsi)
+{
+	if (wsi->mode != LWSCM_WS_SERVING && wsi->mode != LWSCM_WS_CLIENT)
+		return;
+
+	if (!wsi->u.ws.rx_ubuf || wsi->u.ws.rx_ubuf_head ||
+	    wsi->u.ws.rx_draining_ext)
+		return;
+
+	lws_ws_rxbuf_put(wsi);
+}
+
+/* payload is going up to the user, was that the end of the message? */
+
+void
+lws_ws_rxbuf_count(struct lws *wsi)
+{
+	struct lws_rxbuf_pool *pool = &wsi->context->pt[(int)wsi->tsi].rxbuf_pool;
+
+	if (wsi->u.ws.rx_packet_length || !wsi->u.ws.final)
+		pool->spills++;
+	else
+		pool->messages++;
+}
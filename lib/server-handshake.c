@@ -123,17 +123,20 @@ lws_extension_server_handshake(struct lws *wsi, char **p)
 
 			/* apply it */
 
+			if (lws_ensure_ext_space(wsi))
+				break;
+
 			ext_count++;
 
 			/* instantiate the extension on this conn */
 
-			wsi->active_extensions[wsi->count_act_ext] = ext;
+			wsi->ext->active_extensions[wsi->count_act_ext] = ext;
 
 			/* allow him to construct his context */
 
 			if (ext->callback(lws_get_context(wsi), ext, wsi,
 				      LWS_EXT_CB_CONSTRUCT,
-				      (void *)&wsi->act_ext_user[wsi->count_act_ext],
+				      (void *)&wsi->ext->act_ext_user[wsi->count_act_ext],
 				      NULL, 0)) {
 				lwsl_notice("ext %s failed construction\n", ext_name);
 				ext_count--;
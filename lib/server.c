@@ -125,18 +125,20 @@ lws_context_init_server(struct lws_context_creation_info *info,
 	vhost->listen_port = info->port;
 	vhost->iface = info->iface;
 
-	wsi = lws_zalloc(sizeof(struct lws));
+	wsi = lws_slab_zalloc(&vhost->context->pt[m], sizeof(struct lws));
 	if (wsi == NULL) {
 		lwsl_err("Out of mem\n");
 		goto bail;
 	}
 	wsi->context = vhost->context;
+	wsi->gen = lws_wsi_new_gen(vhost->context);
 	wsi->sock = sockfd;
 	wsi->mode = LWSCM_SERVER_LISTENER;
 	wsi->protocol = vhost->protocols;
 	wsi->tsi = m;
 	wsi->vhost = vhost;
 	wsi->listener = 1;
+	lws_mem_set(wsi, LWSMT_WSI, sizeof(*wsi));
 
 	vhost->context->pt[m].wsi_listening = wsi;
 	if (insert_wsi_socket_into_fds(vhost->context, wsi))
@@ -147,6 +149,27 @@ lws_context_init_server(struct lws_context_creation_info *info,
 
 #if LWS_POSIX
 	listen(wsi->sock, LWS_SOMAXCONN);
+
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF) && LWS_MAX_SMP > 1
+	/*
+	 * The listeners join the reuseport group in listen() order, so
+	 * socket index in the group == tsi.  Have the kernel choose the
+	 * listener by the cpu the SYN arrived on, instead of the 4-tuple hash
+	 */
+	if (!m && limit > 1 && lws_check_opt(vhost->options,
+					 LWS_SERVER_OPTION_LISTEN_AFFINITY)) {
+		struct sock_filter code[] = {
+			{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+			{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, (unsigned int)limit },
+			{ BPF_RET | BPF_A, 0, 0, 0 },
+		};
+		struct sock_fprog prog = { ARRAY_SIZE(code), code };
+
+		if (setsockopt(wsi->sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+			       (const void *)&prog, sizeof(prog)) < 0)
+			lwsl_notice(" unable to steer listeners by cpu\n");
+	}
+#endif
 	} /* for each thread able to independently listen */
 #else
 	mbed3_tcp_stream_bind(wsi->sock, info->port, wsi);
@@ -621,8 +644,13 @@ lws_http_action(struct lws *wsi)
 		if (wsi->access_log_pending)
 			lws_access_log(wsi);
 
-		wsi->access_log.header_log = lws_malloc(l);
-		if (wsi->access_log.header_log) {
+		if (!wsi->access_log)
+			wsi->access_log = lws_slab_zalloc(
+					&wsi->context->pt[(int)wsi->tsi],
+					sizeof(*wsi->access_log));
+		if (wsi->access_log)
+			wsi->access_log->header_log = lws_arena_alloc(wsi, l);
+		if (wsi->access_log && wsi->access_log->header_log) {
 
 			tmp = localtime(&t);
 			if (tmp)
@@ -639,20 +667,13 @@ lws_http_action(struct lws *wsi)
 			else
 				me = "unknown";
 
-			snprintf(wsi->access_log.header_log, l,
+			snprintf(wsi->access_log->header_log, l,
 				 "%s - - [%s] \"%s %s %s\"",
 				 pa, da, me, uri_ptr,
 				 hver[wsi->u.http.request_version]);
 
-			l = lws_hdr_total_length(wsi, WSI_TOKEN_HTTP_USER_AGENT);
-			if (l) {
-				wsi->access_log.user_agent = lws_malloc(l + 2);
-				if (wsi->access_log.user_agent)
-					lws_hdr_copy(wsi, wsi->access_log.user_agent,
-							l + 1, WSI_TOKEN_HTTP_USER_AGENT);
-				else
-					lwsl_err("OOM getting user agent\n");
-			}
+			wsi->access_log->user_agent = lws_hdr_copy_arena(wsi,
+						WSI_TOKEN_HTTP_USER_AGENT);
 			wsi->access_log_pending = 1;
 		}
 	}
@@ -786,7 +807,7 @@ lws_http_action(struct lws *wsi)
 
 						if (wsi->protocol != &wsi->vhost->protocols[n])
 							if (!wsi->user_space_externally_allocated)
-								lws_free_set_NULL(wsi->user_space);
+								lws_slab_free_set_NULL(wsi->user_space);
 						wsi->protocol = &wsi->vhost->protocols[n];
 						if (lws_ensure_user_space(wsi)) {
 							lwsl_err("Unable to allocate user space\n");
@@ -890,8 +911,9 @@ lws_http_action(struct lws *wsi)
 
 		if (wsi->protocol != &wsi->vhost->protocols[0])
 			if (!wsi->user_space_externally_allocated)
-				lws_free_set_NULL(wsi->user_space);
+				lws_slab_free_set_NULL(wsi->user_space);
 		wsi->protocol = &wsi->vhost->protocols[0];
+		lws_mem_rebook(wsi);
 
 		n = wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP,
 				    wsi->user_space, uri_ptr, uri_len);
@@ -984,9 +1006,9 @@ lws_handshake_server(struct lws *wsi, unsigned char **buf, size_t len)
 				wsi->vhost = vhost;
 		}
 
-		wsi->vhost->trans++;
+		lws_vh_stats(wsi)->trans++;
 		if (!wsi->conn_stat_done) {
-			wsi->vhost->conn++;
+			lws_vh_stats(wsi)->conn++;
 			wsi->conn_stat_done = 1;
 		}
 
@@ -998,14 +1020,14 @@ lws_handshake_server(struct lws *wsi, unsigned char **buf, size_t len)
 		if (lws_hdr_total_length(wsi, WSI_TOKEN_UPGRADE)) {
 			if (!strcasecmp(lws_hdr_simple_ptr(wsi, WSI_TOKEN_UPGRADE),
 					"websocket")) {
-				wsi->vhost->ws_upgrades++;
+				lws_vh_stats(wsi)->ws_upgrades++;
 				lwsl_info("Upgrade to ws\n");
 				goto upgrade_ws;
 			}
 #ifdef LWS_USE_HTTP2
 			if (!strcasecmp(lws_hdr_simple_ptr(wsi, WSI_TOKEN_UPGRADE),
 					"h2c")) {
-				wsi->vhost->http2_upgrades++;
+				lws_vh_stats(wsi)->http2_upgrades++;
 				lwsl_info("Upgrade to h2c\n");
 				goto upgrade_h2c;
 			}
@@ -1247,20 +1269,12 @@ upgrade_ws:
 		/*
 		 * create the frame buffer for this connection according to the
 		 * size mentioned in the protocol definition.  If 0 there, use
-		 * a big default for compatibility
+		 * a big default for compatibility.  It's only borrowed from
+		 * the pt pool while rx is in flight.
 		 */
-
-		n = wsi->protocol->rx_buffer_size;
-		if (!n)
-			n = context->pt_serv_buf_size;
-		n += LWS_PRE;
-		wsi->u.ws.rx_ubuf = lws_malloc(n + 4 /* 0x0000ffff zlib */);
-		if (!wsi->u.ws.rx_ubuf) {
-			lwsl_err("Out of Mem allocating rx buffer %d\n", n);
-			return 1;
-		}
-		wsi->u.ws.rx_ubuf_alloc = n;
-		lwsl_info("Allocating RX buffer %d\n", n);
+		lws_ws_rxbuf_init(wsi);
+		lws_ws_hibernate_arm(wsi);
+		n = wsi->u.ws.rx_ubuf_alloc;
 #if LWS_POSIX
 		if (setsockopt(wsi->sock, SOL_SOCKET, SO_SNDBUF,
 			       (const char *)&n, sizeof n)) {
@@ -1303,18 +1317,25 @@ lws_get_idlest_tsi(struct lws_context *context)
 	return hit;
 }
 
+/*
+ * tsi < 0 means put it on whichever service thread has the fewest fds
+ */
+
 struct lws *
-lws_create_new_server_wsi(struct lws_vhost *vhost)
+lws_create_new_server_wsi(struct lws_vhost *vhost, int tsi)
 {
 	struct lws *new_wsi;
-	int n = lws_get_idlest_tsi(vhost->context);
+	int n = tsi;
+
+	if (n < 0)
+		n = lws_get_idlest_tsi(vhost->context);
 
 	if (n < 0) {
 		lwsl_err("no space for new conn\n");
 		return NULL;
 	}
 
-	new_wsi = lws_zalloc(sizeof(struct lws));
+	new_wsi = lws_slab_zalloc(&vhost->context->pt[n], sizeof(struct lws));
 	if (new_wsi == NULL) {
 		lwsl_err("Out of memory for new connection\n");
 		return NULL;
@@ -1325,6 +1346,7 @@ lws_create_new_server_wsi(struct lws_vhost *vhost)
 
 	new_wsi->vhost = vhost;
 	new_wsi->context = vhost->context;
+	new_wsi->gen = lws_wsi_new_gen(vhost->context);
 	new_wsi->pending_timeout = NO_PENDING_TIMEOUT;
 	new_wsi->rxflow_change_to = LWS_RXFLOW_ALLOW;
 
@@ -1349,6 +1371,7 @@ lws_create_new_server_wsi(struct lws_vhost *vhost)
 	new_wsi->ietf_spec_revision = 0;
 	new_wsi->sock = LWS_SOCK_INVALID;
 	vhost->context->count_wsi_allocated++;
+	lws_mem_set(new_wsi, LWSMT_WSI, sizeof(*new_wsi));
 
 	/*
 	 * outermost create notification for wsi
@@ -1386,10 +1409,16 @@ lws_http_transaction_completed(struct lws *wsi)
 	n = wsi->protocol->callback(wsi, LWS_CALLBACK_HTTP_DROP_PROTOCOL,
 				    wsi->user_space, NULL, 0);
 
-	if (!wsi->user_space_externally_allocated)
-		lws_free_set_NULL(wsi->user_space);
+	if (!wsi->user_space_externally_allocated) {
+		lws_slab_free_set_NULL(wsi->user_space);
+		lws_mem_set(wsi, LWSMT_USER, 0);
+	}
+
+	/* everything allocated for the transaction goes in one go */
+	lws_arena_reset(wsi);
 
 	wsi->protocol = &wsi->vhost->protocols[0];
+	lws_mem_rebook(wsi);
 
 	/* otherwise set ourselves up ready to go again */
 	wsi->state = LWSS_HTTP;
@@ -1398,7 +1427,8 @@ lws_http_transaction_completed(struct lws *wsi)
 	wsi->u.http.content_remain = 0;
 	wsi->hdr_parsing_completed = 0;
 #ifdef LWS_WITH_ACCESS_LOG
-	wsi->access_log.sent = 0;
+	if (wsi->access_log)
+		wsi->access_log->sent = 0;
 #endif
 
 	if (wsi->vhost->keepalive_timeout)
@@ -1437,10 +1467,11 @@ lws_http_transaction_completed(struct lws *wsi)
 }
 
 static struct lws *
-lws_adopt_socket_vhost(struct lws_vhost *vh, lws_sockfd_type accept_fd)
+lws_adopt_socket_vhost(struct lws_vhost *vh, lws_sockfd_type accept_fd,
+		       int tsi)
 {
 	struct lws_context *context = vh->context;
-	struct lws *new_wsi = lws_create_new_server_wsi(vh);
+	struct lws *new_wsi = lws_create_new_server_wsi(vh, tsi);
 
 	if (!new_wsi) {
 		compatible_close(accept_fd);
@@ -1467,7 +1498,7 @@ lws_adopt_socket_vhost(struct lws_vhost *vh, lws_sockfd_type accept_fd)
 	if ((context->vhost_list->protocols[0].callback)(new_wsi,
 	     LWS_CALLBACK_SERVER_NEW_CLIENT_INSTANTIATED, NULL, NULL, 0)) {
 		compatible_close(new_wsi->sock);
-		lws_free(new_wsi);
+		lws_slab_free(new_wsi);
 		return NULL;
 	}
 
@@ -1475,6 +1506,7 @@ lws_adopt_socket_vhost(struct lws_vhost *vh, lws_sockfd_type accept_fd)
 	lws_libuv_accept(new_wsi, new_wsi->sock);
 
 	if (!LWS_SSL_ENABLED(new_wsi->vhost)) {
+		lws_uring_adopt(new_wsi);
 		if (insert_wsi_socket_into_fds(context, new_wsi)) {
 			lwsl_err("%s: fail inserting socket\n", __func__);
 			goto fail;
@@ -1513,7 +1545,7 @@ fail:
 LWS_VISIBLE struct lws *
 lws_adopt_socket(struct lws_context *context, lws_sockfd_type accept_fd)
 {
-	return lws_adopt_socket_vhost(context->vhost_list, accept_fd);
+	return lws_adopt_socket_vhost(context->vhost_list, accept_fd, -1);
 }
 
 
@@ -1626,6 +1658,8 @@ lws_server_socket_service(struct lws_context *context, struct lws *wsi,
 #if LWS_POSIX
 	struct sockaddr_in cli_addr;
 	socklen_t clilen;
+	unsigned int batch;
+	char drained;
 #endif
 	int n, len;
 
@@ -1643,9 +1677,7 @@ lws_server_socket_service(struct lws_context *context, struct lws *wsi,
 			if (!(pollfd->revents & LWS_POLLOUT))
 				break;
 
-			if (lws_issue_raw(wsi, wsi->trunc_alloc +
-					       wsi->trunc_offset,
-					  wsi->trunc_len) < 0)
+			if (lws_txq_drain(wsi) < 0)
 				goto fail;
 			/*
 			 * we can't afford to allow input processing to send
@@ -1811,29 +1843,40 @@ try_pollout:
 #if LWS_POSIX
 		/* pollin means a client has connected to us then */
 
-		do {
-			if (!(pollfd->revents & LWS_POLLIN) || !(pollfd->events & LWS_POLLIN))
-				break;
+		if (!(pollfd->revents & LWS_POLLIN) ||
+		    !(pollfd->events & LWS_POLLIN))
+			break;
 
+		/*
+		 * take up to the vhost's accept budget of connections off the
+		 * accept queue now, rather than one per trip round the loop
+		 */
+		lws_vh_stats(wsi)->accept_wakeups++;
+		batch = 0;
+		drained = 0;
+
+		do {
 			/* listen socket got an unencrypted connection... */
 
 			clilen = sizeof(cli_addr);
 			lws_latency_pre(context, wsi);
-			accept_fd  = accept(pollfd->fd, (struct sockaddr *)&cli_addr,
-					    &clilen);
+			accept_fd = lws_plat_accept(wsi->vhost, pollfd->fd,
+						    (struct sockaddr *)&cli_addr,
+						    &clilen);
 			lws_latency(context, wsi, "listener accept", accept_fd,
 				    accept_fd >= 0);
 			if (accept_fd < 0) {
 				if (LWS_ERRNO == LWS_EAGAIN ||
 				    LWS_ERRNO == LWS_EWOULDBLOCK) {
-					lwsl_err("accept asks to try again\n");
+					drained = 1;
 					break;
 				}
 				lwsl_err("ERROR on accept: %s\n", strerror(LWS_ERRNO));
 				break;
 			}
 
-			lws_plat_set_socket_options(wsi->vhost, accept_fd);
+			batch++;
+			lws_vh_stats(wsi)->accepts++;
 
 			lwsl_debug("accepted new conn  port %u on fd=%d\n",
 					  ntohs(cli_addr.sin_port), accept_fd);
@@ -1855,13 +1898,38 @@ try_pollout:
 				break;
 			}
 
-			if (!lws_adopt_socket_vhost(wsi->vhost, accept_fd))
+			/*
+			 * with listen affinity, the kernel already chose this
+			 * thread's listener for the connection: keep it here
+			 */
+			n = -1;
+			if (lws_check_opt(wsi->vhost->options,
+					  LWS_SERVER_OPTION_LISTEN_AFFINITY) &&
+			    pt->fds_count < context->fd_limit_per_thread - 1)
+				n = wsi->tsi;
+
+			if (!lws_adopt_socket_vhost(wsi->vhost, accept_fd, n))
 				/* already closed cleanly as necessary */
 				return 1;
 
 #if LWS_POSIX
-		} while (pt->fds_count < context->fd_limit_per_thread - 1 &&
-			 lws_poll_listen_fd(&pt->fds[wsi->position_in_fds_table]) > 0);
+		} while (batch < wsi->vhost->accept_budget &&
+			 pt->fds_count < context->fd_limit_per_thread - 1);
+
+		if (batch > lws_vh_stats(wsi)->accept_batch_peak)
+			lws_vh_stats(wsi)->accept_batch_peak = batch;
+
+		if (!drained) {
+#if defined(LWS_USE_EPOLL)
+			/* edge-triggered won't tell us about the rest again */
+			wsi->epoll_rearm = 1;
+#endif
+			if (batch == wsi->vhost->accept_budget) {
+				lws_vh_stats(wsi)->accept_budget_hit++;
+				if (lws_plat_listen_q_full(pollfd->fd))
+					lws_vh_stats(wsi)->listen_q_full++;
+			}
+		}
 #endif
 		return 0;
 
@@ -2004,15 +2072,13 @@ lws_interpret_incoming_packet(struct lws *wsi, unsigned char **buf, size_t len)
 			continue;
 		}
 
+		/* consume header and payload bytes efficiently */
+		lws_ws_rx_bulk(wsi, buf, &len);
+
 		/* account for what we're using in rxflow buffer */
 		if (wsi->rxflow_buffer)
 			wsi->rxflow_pos++;
 
-		/* consume payload bytes efficiently */
-		if (wsi->lws_rx_parse_state ==
-		    LWS_RXPS_PAYLOAD_UNTIL_LENGTH_EXHAUSTED)
-			lws_payload_until_length_exhausted(wsi, buf, &len);
-
 		/* process the byte */
 		m = lws_rx_sm(wsi, *(*buf)++);
 		if (m < 0)
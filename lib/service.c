@@ -65,8 +65,7 @@ lws_handle_POLLOUT_event(struct lws *wsi, struct lws_pollfd *pollfd)
 	 *	       corrupted.
 	 */
 	if (wsi->trunc_len) {
-		if (lws_issue_raw(wsi, wsi->trunc_alloc + wsi->trunc_offset,
-				  wsi->trunc_len) < 0) {
+		if (lws_txq_drain(wsi) < 0) {
 			lwsl_info("%s signalling to close\n", __func__);
 			return -1;
 		}
@@ -112,6 +111,10 @@ lws_handle_POLLOUT_event(struct lws *wsi, struct lws_pollfd *pollfd)
 		if (wsi->u.ws.payload_is_close)
 			write_type = LWS_WRITE_CLOSE;
 
+		/* a dropped close payload leaves us with nothing allocated */
+		if (lws_ensure_ws_ctrl_buf(wsi))
+			return -1;
+
 		n = lws_write(wsi, &wsi->u.ws.ping_payload_buf[LWS_PRE],
 			      wsi->u.ws.ping_payload_len, write_type);
 		if (n < 0)
@@ -306,57 +309,68 @@ notify:
 	return lws_calllback_as_writeable(wsi);
 }
 
-int
-lws_service_timeout_check(struct lws *wsi, unsigned int sec)
+void
+lws_service_timeout_cb(struct lws_timer *t)
 {
+	struct lws *wsi = lws_container_of(t, struct lws, timeout_timer);
 	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
 	int n = 0;
+#ifndef LWS_NO_EXTENSIONS
+	unsigned int ms = 1000;
 
 	/*
 	 * if extensions want in on it (eg, we are a mux parent)
-	 * give them a chance to service child timeouts
+	 * give them a chance to service child timeouts.  They get it once
+	 * a second while the timeout is pending, and if they take it, the
+	 * timeout waits another second.
 	 */
-	if (lws_ext_cb_active(wsi, LWS_EXT_CB_1HZ, NULL, sec) < 0)
-		return 0;
+	if (wsi->count_act_ext) {
+		n = lws_ext_cb_active(wsi, LWS_EXT_CB_1HZ, NULL,
+				      (unsigned int)(pt->now_ms / 1000));
+		if (n >= 0 && wsi->pending_timeout_ms > pt->now_ms &&
+		    wsi->pending_timeout_ms - pt->now_ms < ms)
+			ms = (unsigned int)(wsi->pending_timeout_ms -
+					    pt->now_ms);
+		if (n < 0 || wsi->pending_timeout_ms > pt->now_ms) {
+			lws_timer_schedule(wsi->context, wsi->tsi, t,
+					   lws_service_timeout_cb, ms);
+			return;
+		}
+		n = 0;
+	}
+#endif
 
 	if (!wsi->pending_timeout)
-		return 0;
+		return;
 
 	/*
-	 * if we went beyond the allowed time, kill the
-	 * connection
+	 * we went beyond the allowed time, kill the connection
 	 */
-	if ((time_t)sec > wsi->pending_timeout_limit) {
 #if LWS_POSIX
-		if (wsi->sock != LWS_SOCK_INVALID)
-			n = pt->fds[wsi->sock].events;
-
-		/* no need to log normal idle keepalive timeout */
-		if (wsi->pending_timeout != PENDING_TIMEOUT_HTTP_KEEPALIVE_IDLE)
-			lwsl_notice("wsi %p: TIMEDOUT WAITING on %d (did hdr %d, ah %p, wl %d, pfd events %d)\n",
-			    (void *)wsi, wsi->pending_timeout,
-			    wsi->hdr_parsing_completed, wsi->u.hdr.ah,
-			    pt->ah_wait_list_length, n);
+	if (wsi->position_in_fds_table >= 0)
+		n = pt->fds[wsi->position_in_fds_table].events;
+
+	/* no need to log normal idle keepalive timeout */
+	if (wsi->pending_timeout != PENDING_TIMEOUT_HTTP_KEEPALIVE_IDLE)
+		lwsl_notice("wsi %p: TIMEDOUT WAITING on %d (did hdr %d, ah %p, wl %d, pfd events %d)\n",
+		    (void *)wsi, wsi->pending_timeout,
+		    wsi->hdr_parsing_completed, wsi->u.hdr.ah,
+		    pt->ah_wait_list_length, n);
 #endif
-		/*
-		 * Since he failed a timeout, he already had a chance to do
-		 * something and was unable to... that includes situations like
-		 * half closed connections.  So process this "failed timeout"
-		 * close as a violent death and don't try to do protocol
-		 * cleanup like flush partials.
-		 */
-		wsi->socket_is_permanently_unusable = 1;
-		if (wsi->mode == LWSCM_WSCL_WAITING_SSL)
-			wsi->vhost->protocols[0].callback(wsi,
-				LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
-				wsi->user_space, NULL, 0);
-
-		lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
-
-		return 1;
-	}
+	/*
+	 * Since he failed a timeout, he already had a chance to do
+	 * something and was unable to... that includes situations like
+	 * half closed connections.  So process this "failed timeout"
+	 * close as a violent death and don't try to do protocol
+	 * cleanup like flush partials.
+	 */
+	wsi->socket_is_permanently_unusable = 1;
+	if (wsi->mode == LWSCM_WSCL_WAITING_SSL)
+		wsi->vhost->protocols[0].callback(wsi,
+			LWS_CALLBACK_CLIENT_CONNECTION_ERROR,
+			wsi->user_space, NULL, 0);
 
-	return 0;
+	lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
 }
 
 int lws_rxflow_cache(struct lws *wsi, unsigned char *buf, int n, int len)
@@ -388,6 +402,7 @@ int
 lws_service_adjust_timeout(struct lws_context *context, int timeout_ms, int tsi)
 {
 	struct lws_context_per_thread *pt = &context->pt[tsi];
+	struct allocated_headers *ah;
 	int n;
 
 	/* Figure out if we really want to wait in poll()
@@ -408,16 +423,29 @@ lws_service_adjust_timeout(struct lws_context *context, int timeout_ms, int tsi)
 #endif
 
 	/* 3) if any ah has pending rx, do not wait in poll */
-	for (n = 0; n < context->max_http_header_pool; n++)
-		if (pt->ah_pool[n].rxpos != pt->ah_pool[n].rxlen) {
+	for (ah = pt->ah_list; ah; ah = ah->next)
+		if (ah->rxpos != ah->rxlen) {
 			/* any ah with pending rx must be attached to someone */
-			if (!pt->ah_pool[n].wsi) {
+			if (!ah->wsi) {
 				lwsl_err("%s: assert: no wsi attached to ah\n", __func__);
 				assert(0);
 			}
 			return 0;
 		}
 
+	/* 4) other threads queued things for us to do */
+	if (lws_pt_cmd_pending(pt))
+		return 0;
+
+	/* io_uring already brought in input that wasn't all read */
+	if (lws_uring_pending(pt))
+		return 0;
+
+	/* 5) don't sleep past when the timer wheel needs service */
+	n = lws_timer_wheel_next_ms(pt);
+	if (n >= 0 && (timeout_ms < 0 || n < timeout_ms))
+		return n;
+
 	return timeout_ms;
 }
 
@@ -434,9 +462,9 @@ lws_service_flag_pending(struct lws_context *context, int tsi)
 #ifdef LWS_OPENSSL_SUPPORT
 	struct lws *wsi_next;
 #endif
+	struct allocated_headers *ah;
 	struct lws *wsi;
 	int forced = 0;
-	int n;
 
 	/* POLLIN faking */
 
@@ -486,13 +514,12 @@ lws_service_flag_pending(struct lws_context *context, int tsi)
 	 * fake their POLLIN status so they will be able to drain the
 	 * rx buffered in the ah
 	 */
-	for (n = 0; n < context->max_http_header_pool; n++)
-		if (pt->ah_pool[n].rxpos != pt->ah_pool[n].rxlen &&
-		    !pt->ah_pool[n].wsi->hdr_parsing_completed) {
-			pt->fds[pt->ah_pool[n].wsi->position_in_fds_table].revents |=
-				pt->fds[pt->ah_pool[n].wsi->position_in_fds_table].events &
+	for (ah = pt->ah_list; ah; ah = ah->next)
+		if (ah->rxpos != ah->rxlen && !ah->wsi->hdr_parsing_completed) {
+			pt->fds[ah->wsi->position_in_fds_table].revents |=
+				pt->fds[ah->wsi->position_in_fds_table].events &
 					LWS_POLLIN;
-			if (pt->fds[pt->ah_pool[n].wsi->position_in_fds_table].revents &
+			if (pt->fds[ah->wsi->position_in_fds_table].revents &
 			    LWS_POLLIN)
 				forced = 1;
 		}
@@ -657,12 +684,10 @@ LWS_VISIBLE int
 lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int tsi)
 {
 	struct lws_context_per_thread *pt = &context->pt[tsi];
-	lws_sockfd_type our_fd = 0, tmp_fd;
 	struct lws_tokens eff_buf;
 	unsigned int pending = 0;
-	struct lws *wsi, *wsi1;
 	char draining_flow = 0;
-	int timed_out = 0;
+	struct lws *wsi;
 	time_t now;
 	int n = 0, m;
 	int more;
@@ -671,11 +696,30 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int t
 		lws_protocol_init(context);
 
 	/*
-	 * you can call us with pollfd = NULL to just allow the once-per-second
-	 * global timeout checks; if less than a second since the last check
-	 * it returns immediately then.
+	 * you can call us with pollfd = NULL to just allow the timer and
+	 * once-per-second housekeeping checks.
+	 *
+	 * Inside lws_service() the clock was already read once for this pass,
+	 * otherwise (external poll) read it here.
 	 */
 
+	if (!pt->clock_cached)
+		pt->now_ms = lws_plat_monotonic_ms();
+
+	/* expired timeouts may close the guy we came to service... */
+	lws_timer_wheel_service(pt);
+
+	/* give back header tables that stayed idle */
+	lws_pt_ah_pool_trim(pt);
+
+	/* close whatever holds the most of a memory budget that's exceeded */
+	if (context->mem_over)
+		lws_mem_shed(pt);
+
+	/* ...and so may things other threads asked us to do */
+	if (lws_pt_cmd_pending(pt))
+		lws_pt_cmd_drain(pt);
+
 	time(&now);
 
 	/*
@@ -691,25 +735,6 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int t
 
 		lws_plat_service_periodic(context);
 
-		/* global timeout check once per second */
-
-		if (pollfd)
-			our_fd = pollfd->fd;
-
-		wsi = context->pt[tsi].timeout_list;
-		while (wsi) {
-			/* we have to take copies, because he may be deleted */
-			wsi1 = wsi->timeout_list;
-			tmp_fd = wsi->sock;
-			if (lws_service_timeout_check(wsi, (unsigned int)now)) {
-				/* he did time out... */
-				if (tmp_fd == our_fd)
-					/* it was the guy we came to service! */
-					timed_out = 1;
-					/* he's gone, no need to mark as handled */
-			}
-			wsi = wsi1;
-		}
 #ifdef LWS_WITH_CGI
 		lws_cgi_kill_terminated(pt);
 #endif
@@ -727,10 +752,6 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int t
 #endif
 	}
 
-	/* the socket we came to service timed out, nothing to do */
-	if (timed_out)
-		return 0;
-
 	/* just here for timeout management? */
 	if (!pollfd)
 		return 0;
@@ -738,9 +759,20 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int t
 	/* no, here to service a socket descriptor */
 	wsi = wsi_from_fd(context, pollfd->fd);
 	if (!wsi)
-		/* not lws connection ... leave revents alone and return */
+		/*
+		 * not lws connection (or he just timed out) ... leave revents
+		 * alone and return
+		 */
 		return 0;
 
+	/* load accounting, for LWS_SERVER_OPTION_BALANCE_THREADS */
+	pt->load.events++;
+	if (wsi->svc_window != pt->load.window) {
+		wsi->svc_window = pt->load.window;
+		wsi->svc_events = 0;
+	}
+	wsi->svc_events++;
+
 	/*
 	 * so that caller can tell we handled, past here we need to
 	 * zero down pollfd->revents after handling
@@ -758,10 +790,8 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int t
 		goto close_and_handled;
 	}
 
-#ifdef _WIN32
 	if (pollfd->revents & LWS_POLLOUT)
-		wsi->sock_send_blocking = FALSE;
-#endif
+		wsi->sock_send_blocking = 0;
 
 #endif
 
@@ -796,6 +826,13 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int t
 	case LWSCM_HTTP2_SERVING:
 	case LWSCM_HTTP_CLIENT_ACCEPTED:
 
+		if (wsi->ws_hibernating && lws_ws_wake(wsi))
+			goto close_and_handled;
+		if (wsi->mode == LWSCM_WS_SERVING ||
+		    wsi->mode == LWSCM_WS_CLIENT)
+			/* not idle, see hibernate.c */
+			wsi->u.ws.active_ms = (unsigned int)pt->now_ms;
+
 		/* 1: something requested a callback when it was OK to write */
 
 		if ((pollfd->revents & LWS_POLLOUT) &&
@@ -852,9 +889,15 @@ lws_service_fd_tsi(struct lws_context *context, struct lws_pollfd *pollfd, int t
 				if (n < 0)
 					/* we closed wsi */
 					n = 0;
+				else
+					lws_ws_rxbuf_idle(wsi);
 			} else
 #endif
+			{
 				n = lws_rx_sm(wsi, 0);
+				if (n >= 0)
+					lws_ws_rxbuf_idle(wsi);
+			}
 
 			goto handled;
 		}
@@ -0,0 +1,344 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * struct lws and the pss are allocated and freed once per connection.  Each
+ * service thread keeps a slab per object size, carving objects from chunks
+ * of LWS_SLAB_CHUNK_BYTES and keeping freed ones on their chunk's free list
+ * for the next connection.
+ *
+ * New objects come from the chunks that are already partly used, so after
+ * a burst of connections goes away its chunks empty out.  A slab keeps
+ * LWS_SLAB_KEEP_IDLE of those for the next burst and gives the rest back to
+ * the heap.
+ *
+ * Every object has a header in front of it pointing to the chunk it came
+ * from, so it can be freed from anywhere, even after the wsi moved to another
+ * service thread: it goes back to the slab that owns the chunk, under that
+ * pt's lock.  Objects that didn't fit in a slab have a NULL there and came
+ * from the heap.
+ */
+
+static void
+lws_slab_setup(struct lws_slab *s, struct lws_context_per_thread *pt,
+	       unsigned int size)
+{
+	s->pt = pt;
+	s->size = size;
+	s->per_chunk = (LWS_SLAB_CHUNK_BYTES - LWS_SLAB_CHUNK_HDR) /
+		       (LWS_SLAB_HDR + size);
+	if (s->per_chunk < LWS_SLAB_MIN_PER_CHUNK)
+		s->per_chunk = LWS_SLAB_MIN_PER_CHUNK;
+}
+
+int
+lws_pt_slab_init(struct lws_context_per_thread *pt)
+{
+	pt->slabs = lws_zalloc(sizeof(*pt->slabs));
+	if (!pt->slabs)
+		return 1;
+
+	lws_slab_setup(&pt->slabs->s[0], pt,
+		       (sizeof(struct lws) + LWS_SLAB_HDR - 1) &
+		       ~(LWS_SLAB_HDR - 1));
+
+	return 0;
+}
+
+static void
+lws_slab_free_chunks(struct lws_slab_chunk *c)
+{
+	struct lws_slab_chunk *next;
+
+	while (c) {
+		next = c->next;
+		lws_free(c);
+		c = next;
+	}
+}
+
+void
+lws_pt_slab_destroy(struct lws_context_per_thread *pt)
+{
+	struct lws_slab *s;
+	int n;
+
+	if (!pt->slabs)
+		return;
+
+	for (n = 0; n < LWS_SLAB_CLASSES; n++) {
+		s = &pt->slabs->s[n];
+		lws_slab_free_chunks(s->partial);
+		lws_slab_free_chunks(s->full);
+		lws_slab_free_chunks(s->idle);
+	}
+
+	lws_free_set_NULL(pt->slabs);
+}
+
+/* all of these need the pt lock held */
+
+static void
+lws_slab_chunk_unlink(struct lws_slab_chunk *c)
+{
+	if (c->next)
+		c->next->prev = c->prev;
+	*c->prev = c->next;
+}
+
+static void
+lws_slab_chunk_link(struct lws_slab_chunk **head, struct lws_slab_chunk *c)
+{
+	c->next = *head;
+	if (c->next)
+		c->next->prev = &c->next;
+	c->prev = head;
+	*head = c;
+}
+
+/* returns the object header */
+
+static char *
+lws_slab_get(struct lws_slab *s)
+{
+	unsigned int stride = LWS_SLAB_HDR + s->size;
+	struct lws_slab_chunk *c = s->partial;
+	char *h;
+
+	if (!c && s->idle) {
+		c = s->idle;
+		lws_slab_chunk_unlink(c);
+		lws_slab_chunk_link(&s->partial, c);
+		s->idle_count--;
+	}
+
+	if (!c) {
+		c = lws_malloc(LWS_SLAB_CHUNK_HDR + s->per_chunk * stride);
+		if (!c)
+			return NULL;
+		c->slab = s;
+		c->free_list = NULL;
+		c->carved = 0;
+		c->in_use = 0;
+		lws_slab_chunk_link(&s->partial, c);
+		s->chunk_count++;
+	}
+
+	h = c->free_list;
+	if (h) {
+		c->free_list = *(void **)h;
+		s->recycled++;
+	} else
+		/* carve as we go, so chunk pages are first touched by the user */
+		h = (char *)c + LWS_SLAB_CHUNK_HDR + c->carved++ * stride;
+
+	if (++c->in_use == s->per_chunk) {
+		lws_slab_chunk_unlink(c);
+		lws_slab_chunk_link(&s->full, c);
+	}
+
+	*(struct lws_slab_chunk **)h = c;
+	s->in_use++;
+	s->allocs++;
+
+	return h;
+}
+
+static void
+lws_slab_put(struct lws_slab *s, struct lws_slab_chunk *c, char *h)
+{
+	*(void **)h = c->free_list;
+	c->free_list = h;
+	s->in_use--;
+
+	if (c->in_use-- == s->per_chunk) {
+		/* he has room again */
+		lws_slab_chunk_unlink(c);
+		lws_slab_chunk_link(&s->partial, c);
+	}
+
+	if (c->in_use)
+		return;
+
+	lws_slab_chunk_unlink(c);
+	if (s->idle_count < LWS_SLAB_KEEP_IDLE) {
+		lws_slab_chunk_link(&s->idle, c);
+		s->idle_count++;
+		return;
+	}
+
+	lws_free(c);
+	s->chunk_count--;
+}
+
+/*
+ * Freed with lws_slab_free() whichever thread does it.  lws_slab_zalloc()
+ * zeroes the object like lws_zalloc(), lws_slab_alloc() leaves it as it was
+ * for callers about to fill it anyway.
+ */
+
+static void *
+_lws_slab_alloc(struct lws_context_per_thread *pt, size_t size, int zero)
+{
+	size_t rsize = (size + LWS_SLAB_HDR - 1) & ~(size_t)(LWS_SLAB_HDR - 1);
+	struct lws_slab *s = NULL;
+	char *h = NULL;
+	int n;
+
+	if (pt->slabs && size && rsize <= LWS_SLAB_MAX_OBJECT) {
+		lws_pt_lock(pt);
+		for (n = 0; n < LWS_SLAB_CLASSES; n++) {
+			s = &pt->slabs->s[n];
+			if (!s->size)
+				lws_slab_setup(s, pt, (unsigned int)rsize);
+			if (s->size == rsize)
+				break;
+		}
+		/* if every slab has some other size, just use the heap */
+		if (n < LWS_SLAB_CLASSES)
+			h = lws_slab_get(s);
+		lws_pt_unlock(pt);
+
+		if (h) {
+			if (zero)
+				memset(h + LWS_SLAB_HDR, 0, size);
+
+			return h + LWS_SLAB_HDR;
+		}
+	}
+
+	/* the zeroed header says we came from the heap */
+	h = lws_zalloc(LWS_SLAB_HDR + size);
+	if (!h)
+		return NULL;
+
+	return h + LWS_SLAB_HDR;
+}
+
+void *
+lws_slab_zalloc(struct lws_context_per_thread *pt, size_t size)
+{
+	return _lws_slab_alloc(pt, size, 1);
+}
+
+void *
+lws_slab_alloc(struct lws_context_per_thread *pt, size_t size)
+{
+	return _lws_slab_alloc(pt, size, 0);
+}
+
+void
+lws_slab_free(void *p)
+{
+	struct lws_slab_chunk *c;
+	struct lws_slab *s;
+	char *h;
+
+	if (!p)
+		return;
+
+	h = (char *)p - LWS_SLAB_HDR;
+	c = *(struct lws_slab_chunk **)h;
+	if (!c) {
+		lws_free(h);
+		return;
+	}
+	s = c->slab;
+
+	lws_pt_lock(s->pt);
+	lws_slab_put(s, c, h);
+	lws_pt_unlock(s->pt);
+}
+
+/**
+ * lws_slab_get_info() - find out how full a service thread's slab is
+ *
+ * @context:	lws context
+ * @tsi:	service thread index
+ * @index:	which slab, 0 is the one for struct lws
+ * @info:	filled in with the slab's size and occupancy
+ *
+ *	Slabs are created as objects of new sizes are needed, so you can
+ *	start at index 0 and go up until this fails.  Returns 0 if @info was
+ *	filled.
+ */
+LWS_VISIBLE int
+lws_slab_get_info(struct lws_context *context, int tsi, int index,
+		  struct lws_slab_info *info)
+{
+	struct lws_context_per_thread *pt;
+	struct lws_slab *s;
+
+	if (tsi < 0 || tsi >= context->count_threads ||
+	    index < 0 || index >= LWS_SLAB_CLASSES)
+		return 1;
+	pt = &context->pt[tsi];
+	if (!pt->slabs || !pt->slabs->s[index].size)
+		return 1;
+	s = &pt->slabs->s[index];
+
+	lws_pt_lock(pt);
+	info->size = s->size;
+	info->chunks = s->chunk_count;
+	info->objects = s->chunk_count * s->per_chunk;
+	info->in_use = s->in_use;
+	info->allocs = s->allocs;
+	info->recycled = s->recycled;
+	lws_pt_unlock(pt);
+
+	return 0;
+}
+
+#if defined(LWS_WITH_SERVER_STATUS)
+
+int
+lws_json_dump_pt_slabs(const struct lws_context_per_thread *pt, char *buf,
+		       int len)
+{
+	struct lws_slab_info info;
+	char *orig = buf, *end = buf + len - 1;
+	int n;
+
+	if (!pt->slabs || len < 256)
+		return 0;
+
+	buf += snprintf(buf, end - buf, "[");
+	for (n = 0; n < LWS_SLAB_CLASSES; n++) {
+		if (lws_slab_get_info(pt->context, pt->tid, n, &info))
+			break;
+		/* each entry is < 160 chars, stop rather than truncate */
+		if (end - buf < 160)
+			break;
+		buf += snprintf(buf, end - buf,
+				"%s{\"size\":\"%u\",\"objects\":\"%u\","
+				"\"in_use\":\"%u\",\"allocs\":\"%llu\","
+				"\"recycled\":\"%llu\"}", n ? "," : "",
+				info.size, info.objects, info.in_use,
+				info.allocs, info.recycled);
+	}
+	buf += snprintf(buf, end - buf, "]");
+
+	return buf - orig;
+}
+
+#endif
@@ -43,6 +43,8 @@ lws_ssl_client_bio_create(struct lws *wsi)
 #endif
 
 	wsi->ssl = SSL_new(wsi->vhost->ssl_client_ctx);
+	if (wsi->ssl)
+		lws_mem_set(wsi, LWSMT_TLS, LWS_TLS_MEM_ESTIMATE);
 #ifndef USE_WOLFSSL
 	SSL_set_mode(wsi->ssl,  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 #endif
@@ -257,6 +257,37 @@ lws_ssl_remove_wsi_from_buffered_list(struct lws *wsi)
 	wsi->pending_read_list_next = NULL;
 }
 
+/*
+ * An idle connection doesn't need the TLS library's record buffers, it
+ * allocates them again when the connection is next used
+ */
+
+void
+lws_ssl_hibernate(struct lws *wsi, int hibernate)
+{
+	if (!wsi->ssl)
+		return;
+
+#if !defined(LWS_USE_POLARSSL) && !defined(LWS_USE_MBEDTLS) && \
+    defined(SSL_MODE_RELEASE_BUFFERS)
+	if (!hibernate) {
+		SSL_clear_mode(wsi->ssl, SSL_MODE_RELEASE_BUFFERS);
+		lws_mem_set(wsi, LWSMT_TLS, LWS_TLS_MEM_ESTIMATE);
+		return;
+	}
+
+	/* anything that does get buffered is freed again once it's used */
+	SSL_set_mode(wsi->ssl, SSL_MODE_RELEASE_BUFFERS);
+#if (OPENSSL_VERSION_NUMBER >= 0x10101000L) && !defined(USE_WOLFSSL) && \
+    !defined(LIBRESSL_VERSION_NUMBER)
+	SSL_free_buffers(wsi->ssl);
+#endif
+	lws_mem_set(wsi, LWSMT_TLS, LWS_TLS_MEM_HIBERNATED);
+#else
+	(void)hibernate;
+#endif
+}
+
 LWS_VISIBLE int
 lws_ssl_capable_read(struct lws *wsi, unsigned char *buf, int len)
 {
@@ -288,7 +319,13 @@ lws_ssl_capable_read(struct lws *wsi, unsigned char *buf, int len)
 	}
 
 	if (wsi->vhost)
-		wsi->vhost->rx += n;
+		lws_vh_stats(wsi)->rx += n;
+	wsi->context->pt[(int)wsi->tsi].load.rx += n;
+
+#if defined(LWS_USE_EPOLL)
+	/* SSL reads by record, more may be left in the socket */
+	wsi->epoll_rearm = 1;
+#endif
 
 	/*
 	 * if it was our buffer that limited what we read,
@@ -378,6 +415,39 @@ lws_ssl_capable_write(struct lws *wsi, unsigned char *buf, int len)
 	return LWS_SSL_CAPABLE_ERROR;
 }
 
+/*
+ * There's no gathered write for TLS: the first segment goes as it is if
+ * it's big, otherwise small segments (like a ws header and what follows it)
+ * are batched so they make one TLS record, not one each.  If it blocks, the
+ * caller queues the segments so the retry sees the same bytes in one piece.
+ */
+
+LWS_VISIBLE int
+lws_ssl_capable_write_vec(struct lws *wsi, const struct lws_iov *iov,
+			  int count)
+{
+	unsigned char batch[4096];
+	size_t n = 0, m;
+	int i;
+
+	if (!wsi->ssl)
+		return lws_ssl_capable_write_vec_no_ssl(wsi, iov, count);
+
+	if (count == 1 || iov[0].len >= sizeof(batch) / 2)
+		return lws_ssl_capable_write(wsi, (unsigned char *)iov[0].base,
+					     iov[0].len);
+
+	for (i = 0; i < count && n < sizeof(batch); i++) {
+		m = iov[i].len;
+		if (m > sizeof(batch) - n)
+			m = sizeof(batch) - n;
+		memcpy(batch + n, iov[i].base, m);
+		n += m;
+	}
+
+	return lws_ssl_capable_write(wsi, batch, n);
+}
+
 LWS_VISIBLE int
 lws_ssl_close(struct lws *wsi)
 {
@@ -400,6 +470,7 @@ lws_ssl_close(struct lws *wsi)
 #endif
 #endif
 	wsi->ssl = NULL;
+	lws_mem_set(wsi, LWSMT_TLS, 0);
 
 	return 1; /* handled */
 }
@@ -474,6 +545,7 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 				compatible_close(accept_fd);
 			goto fail;
 		}
+		lws_mem_set(wsi, LWSMT_TLS, LWS_TLS_MEM_ESTIMATE);
 
 		SSL_set_ex_data(wsi->ssl,
 			openssl_websocket_private_data_index, wsi->vhost);
@@ -571,6 +643,7 @@ lws_server_socket_service_ssl(struct lws *wsi, lws_sockfd_type accept_fd)
 #endif
 #endif
 				wsi->ssl = NULL;
+				lws_mem_set(wsi, LWSMT_TLS, 0);
 				if (lws_check_opt(context->options,
 				    LWS_SERVER_OPTION_REDIRECT_HTTP_TO_HTTPS))
 					wsi->redirect_to_https = 1;
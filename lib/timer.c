@@ -0,0 +1,306 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+#define LWS_TW_L0_SIZE (1 << LWS_TW_L0_BITS)
+#define LWS_TW_L0_MASK (LWS_TW_L0_SIZE - 1)
+#define LWS_TW_LN_SIZE (1 << LWS_TW_LN_BITS)
+#define LWS_TW_LN_MASK (LWS_TW_LN_SIZE - 1)
+/* ms covered by the l0 slots plus levels 1 .. n */
+#define LWS_TW_SPAN(n) (1ull << (LWS_TW_L0_BITS + ((n) * LWS_TW_LN_BITS)))
+
+int
+lws_timer_wheel_init(struct lws_context_per_thread *pt)
+{
+	pt->tw = lws_zalloc(sizeof(*pt->tw));
+	if (!pt->tw)
+		return 1;
+
+	pt->now_ms = lws_plat_monotonic_ms();
+	pt->tw->next = pt->now_ms;
+
+	return 0;
+}
+
+void
+lws_timer_wheel_destroy(struct lws_context_per_thread *pt)
+{
+	lws_free_set_NULL(pt->tw);
+}
+
+/* all of these need the pt lock held */
+
+static void
+lws_tw_unlink(struct lws_timer_wheel *tw, struct lws_timer *t)
+{
+	if (t->next)
+		t->next->prev = t->prev;
+	*t->prev = t->next;
+	t->next = NULL;
+	t->prev = NULL;
+	tw->count--;
+}
+
+static void
+lws_tw_link(struct lws_timer_wheel *tw, struct lws_timer *t)
+{
+	unsigned long long exp = t->expiry_ms, delta;
+	struct lws_timer **slot;
+	int n;
+
+	/* anything already due goes in the next slot we will process */
+	if (exp < tw->next)
+		exp = tw->next;
+	delta = exp - tw->next;
+
+	if (delta < LWS_TW_SPAN(0)) {
+		n = (int)(exp & LWS_TW_L0_MASK);
+		slot = &tw->l0[n];
+		tw->l0_map[n >> 6] |= 1ull << (n & 63);
+	} else {
+		for (n = 1; n < LWS_TW_LEVELS && delta >= LWS_TW_SPAN(n); n++)
+			;
+		/* beyond the top level, park in its furthest slot */
+		if (delta >= LWS_TW_SPAN(n))
+			exp = tw->next + LWS_TW_SPAN(n) - LWS_TW_SPAN(n - 1);
+		slot = &tw->ln[n - 1][(exp >> (LWS_TW_L0_BITS +
+				       (n - 1) * LWS_TW_LN_BITS)) &
+				      LWS_TW_LN_MASK];
+	}
+
+	t->next = *slot;
+	if (t->next)
+		t->next->prev = &t->next;
+	t->prev = slot;
+	*slot = t;
+	tw->count++;
+}
+
+static void
+lws_tw_cascade(struct lws_timer_wheel *tw, int level)
+{
+	struct lws_timer **slot, *t;
+
+	slot = &tw->ln[level][(tw->next >> (LWS_TW_L0_BITS +
+			       level * LWS_TW_LN_BITS)) & LWS_TW_LN_MASK];
+
+	while ((t = *slot)) {
+		lws_tw_unlink(tw, t);
+		lws_tw_link(tw, t);
+	}
+}
+
+/* first occupied l0 slot at or after n in this lap, or LWS_TW_L0_SIZE */
+
+static int
+lws_tw_l0_next_occupied(struct lws_timer_wheel *tw, int n)
+{
+	unsigned long long m;
+
+	while (n < LWS_TW_L0_SIZE) {
+		m = tw->l0_map[n >> 6] >> (n & 63);
+		if (m)
+			return n + __builtin_ctzll(m);
+		n = (n | 63) + 1;
+	}
+
+	return LWS_TW_L0_SIZE;
+}
+
+/**
+ * lws_timer_schedule() - arm a millisecond timer
+ *
+ * @context:	lws context
+ * @tsi:	service thread index whose loop will call back
+ * @t:		timer struct you own, zeroed before first use
+ * @cb:		called from the service thread when the timer expires
+ * @ms:		how many ms from now
+ *
+ *	"now" is the time the service thread last woke, not the time of the
+ *	call.  If the timer was already pending it is rescheduled.  Timers are
+ *	one-shot, the callback may schedule it again.  Arming and cancelling
+ *	are O(1), and the service loop only visits timers that are expiring.
+ */
+LWS_VISIBLE void
+lws_timer_schedule(struct lws_context *context, int tsi, struct lws_timer *t,
+		   lws_timer_cb cb, unsigned int ms)
+{
+	struct lws_context_per_thread *pt = &context->pt[tsi];
+	unsigned long long at = pt->now_ms + ms;
+
+	lws_pt_lock(pt);
+	if (t->prev)
+		lws_tw_unlink(pt->tw, t);
+	t->cb = cb;
+	t->expiry_ms = at;
+	lws_tw_link(pt->tw, t);
+	lws_pt_unlock(pt);
+
+	/* an event library's loop only wakes for us when its timer says */
+	lws_libuv_timer(pt, at);
+	lws_libev_timer(pt, at);
+}
+
+/**
+ * lws_timer_cancel() - disarm a millisecond timer
+ *
+ * @context:	lws context
+ * @tsi:	service thread index the timer was scheduled on
+ * @t:		timer struct
+ *
+ *	It's OK to call this on a timer that is not pending.
+ */
+LWS_VISIBLE void
+lws_timer_cancel(struct lws_context *context, int tsi, struct lws_timer *t)
+{
+	struct lws_context_per_thread *pt = &context->pt[tsi];
+
+	if (!t->prev)
+		return;
+
+	lws_pt_lock(pt);
+	if (t->prev)
+		lws_tw_unlink(pt->tw, t);
+	lws_pt_unlock(pt);
+}
+
+static void
+lws_user_timer_cb(struct lws_timer *t)
+{
+	struct lws *wsi = lws_container_of(t, struct lws, user_timer);
+
+	if ((wsi->ws_hibernating && lws_ws_wake(wsi)) ||
+	    (wsi->protocol && wsi->protocol->callback(wsi, LWS_CALLBACK_TIMER,
+						      wsi->user_space, NULL, 0)))
+		lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
+}
+
+/**
+ * lws_set_timer_ms() - get a LWS_CALLBACK_TIMER on this wsi later
+ *
+ * @wsi:	connection to get the callback
+ * @ms:		how many ms from now, or < 0 to cancel
+ *
+ *	The callback comes to the wsi's protocol handler from its service
+ *	thread.  Setting it again before it expired replaces the old time.
+ *	It is cancelled automatically when the wsi closes.
+ */
+LWS_VISIBLE void
+lws_set_timer_ms(struct lws *wsi, int ms)
+{
+	if (ms < 0) {
+		lws_timer_cancel(wsi->context, wsi->tsi, &wsi->user_timer);
+		return;
+	}
+
+	lws_timer_schedule(wsi->context, wsi->tsi, &wsi->user_timer,
+			   lws_user_timer_cb, ms);
+}
+
+/*
+ * Run everything due up to pt->now_ms.  Callbacks are made without the pt
+ * lock held, so they can schedule or cancel timers, or close wsi.
+ */
+void
+lws_timer_wheel_service(struct lws_context_per_thread *pt)
+{
+	struct lws_timer_wheel *tw = pt->tw;
+	struct lws_timer *due, *t;
+	int n, m;
+
+	lws_pt_lock(pt);
+
+	while (tw->next <= pt->now_ms) {
+		if (!tw->count) {
+			/* nothing anywhere, catch straight up */
+			tw->next = pt->now_ms + 1;
+			break;
+		}
+
+		n = (int)(tw->next & LWS_TW_L0_MASK);
+		if (!n) {
+			/* l0 wrapped, pull down the next lot from above */
+			for (m = LWS_TW_LEVELS - 1; m >= 0; m--)
+				if (!(tw->next & (LWS_TW_SPAN(m) - 1)))
+					lws_tw_cascade(tw, m);
+		}
+
+		m = lws_tw_l0_next_occupied(tw, n);
+		if (m != n) {
+			/* skip the empty slots, up to the next wrap */
+			tw->next = (tw->next & ~(unsigned long long)
+				    LWS_TW_L0_MASK) + m;
+			if (tw->next > pt->now_ms + 1)
+				tw->next = pt->now_ms + 1;
+			continue;
+		}
+
+		/*
+		 * detach the slot first, so anything scheduled from the
+		 * callbacks as already due lands in the next slot instead
+		 */
+		due = tw->l0[n];
+		tw->l0[n] = NULL;
+		tw->l0_map[n >> 6] &= ~(1ull << (n & 63));
+		tw->next++;
+		if (!due)
+			/* map is only a hint, cancels don't clear it */
+			continue;
+		due->prev = &due;
+
+		while ((t = due)) {
+			lws_tw_unlink(tw, t);
+			lws_pt_unlock(pt);
+			t->cb(t);
+			lws_pt_lock(pt);
+		}
+	}
+
+	lws_pt_unlock(pt);
+}
+
+/*
+ * How long the service thread can sleep before the wheel needs attention,
+ * or -1 if no timers are pending.  If the next timer is in the upper
+ * levels we wake at the next l0 wrap to cascade it down.
+ */
+int
+lws_timer_wheel_next_ms(struct lws_context_per_thread *pt)
+{
+	struct lws_timer_wheel *tw = pt->tw;
+	unsigned long long at;
+
+	if (!tw->count)
+		return -1;
+
+	if (!(tw->next & LWS_TW_L0_MASK))
+		/* sitting on a wrap we haven't cascaded yet */
+		at = tw->next;
+	else
+		at = (tw->next & ~(unsigned long long)LWS_TW_L0_MASK) +
+		     lws_tw_l0_next_occupied(tw,
+					     (int)(tw->next & LWS_TW_L0_MASK));
+	if (at <= pt->now_ms)
+		return 0;
+
+	return (int)(at - pt->now_ms);
+}
@@ -0,0 +1,397 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * When the socket won't take everything, the rest is queued on the wsi and
+ * sent first when it becomes writable.  Writes made while something is queued
+ * are appended behind it, so the order on the wire is kept.
+ *
+ * Queued bytes are copied into fixed size segments from the service thread's
+ * slabs, filling the last one before starting another.  A frame made with
+ * lws_txbuf_create() is queued by reference instead, however many connections
+ * it was written to.
+ *
+ * A TLS write that blocked must be retried starting with the same bytes and
+ * at least as many of them, so after one the queue starts with a single
+ * segment big enough to hold them all, from the heap if it has to be.
+ *
+ * Only the service thread the wsi belongs to touches its queue, and a wsi
+ * with something queued is not moved to another thread.  Shared frames can
+ * be released from any thread, so their refcount is atomic.
+ */
+
+static void
+lws_txbuf_ref(struct lws_txbuf *b)
+{
+	lws_atomic_int_add(&b->refcount, 1);
+}
+
+LWS_VISIBLE void
+lws_txbuf_unref(struct lws_txbuf *b)
+{
+	if (!b || lws_atomic_int_add(&b->refcount, -1))
+		return;
+
+	if (b->shared || b->heap)
+		lws_free(b);
+	else
+		lws_slab_free(b);
+}
+
+static int
+lws_txq_check_limits(struct lws *wsi, size_t len)
+{
+	struct lws_context *context = wsi->context;
+	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
+
+	if (context->tx_queue_limit &&
+	    wsi->trunc_len + len > context->tx_queue_limit) {
+		lwsl_notice("%s: wsi %p: %u queued, over limit\n", __func__,
+			    wsi, wsi->trunc_len);
+		return 1;
+	}
+	if (context->tx_queue_limit_pt &&
+	    pt->txq_bytes + len > context->tx_queue_limit_pt) {
+		lwsl_notice("%s: wsi %p: thread has %lu queued, over limit\n",
+			    __func__, wsi, pt->txq_bytes);
+		return 1;
+	}
+
+	return 0;
+}
+
+static struct lws_txq_node *
+lws_txq_add_node(struct lws *wsi, struct lws_txbuf *b, unsigned char *p)
+{
+	struct lws_txq_node *q;
+
+	q = lws_slab_alloc(&wsi->context->pt[(int)wsi->tsi], sizeof(*q));
+	if (!q)
+		return NULL;
+
+	q->next = NULL;
+	q->b = b;
+	q->p = p;
+	q->len = 0;
+
+	if (wsi->txq_tail)
+		wsi->txq_tail->next = q;
+	else
+		wsi->txq = q;
+	wsi->txq_tail = q;
+
+	return q;
+}
+
+int
+lws_txq_append(struct lws *wsi, const unsigned char *buf, size_t len)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_txq_node *q = wsi->txq_tail;
+	struct lws_txbuf *b;
+	size_t m;
+
+	if (lws_txq_check_limits(wsi, len))
+		return -1;
+
+	while (len) {
+		/* the last segment has room and nobody else sees it */
+		if (q && !q->b->shared && q->b->len < q->b->size) {
+			b = q->b;
+		} else {
+			b = lws_slab_alloc(pt, LWS_SLAB_MAX_OBJECT);
+			if (!b) {
+				lwsl_err("%s: OOM\n", __func__);
+				return -1;
+			}
+			b->refcount = 1;
+			b->size = LWS_TXQ_SEG_SIZE;
+			b->len = 0;
+			b->shared = 0;
+			b->heap = 0;
+			q = lws_txq_add_node(wsi, b, lws_txbuf_data(b));
+			if (!q) {
+				lws_slab_free(b);
+				lwsl_err("%s: OOM\n", __func__);
+				return -1;
+			}
+		}
+
+		m = b->size - b->len;
+		if (m > len)
+			m = len;
+		memcpy(lws_txbuf_data(b) + b->len, buf, m);
+		b->len += m;
+		q->len += m;
+		wsi->trunc_len += m;
+		pt->txq_bytes += m;
+		buf += m;
+		len -= m;
+	}
+	lws_mem_set(wsi, LWSMT_TXQ, wsi->trunc_len);
+
+	return 0;
+}
+
+/*
+ * Start an empty queue with one segment that @len bytes appended next will
+ * all fit in, so they stay contiguous
+ */
+
+int
+lws_txq_reserve(struct lws *wsi, size_t len)
+{
+	struct lws_txbuf *b;
+
+	if (wsi->txq || len <= LWS_TXQ_SEG_SIZE)
+		return 0;
+
+	b = lws_malloc(sizeof(*b) + len);
+	if (!b) {
+		lwsl_err("%s: OOM\n", __func__);
+		return -1;
+	}
+	b->refcount = 1;
+	b->size = len;
+	b->len = 0;
+	b->shared = 0;
+	b->heap = 1;
+	if (!lws_txq_add_node(wsi, b, lws_txbuf_data(b))) {
+		lws_free(b);
+		lwsl_err("%s: OOM\n", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+lws_txq_append_ref(struct lws *wsi, struct lws_txbuf *b, unsigned char *p,
+		   size_t len)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_txq_node *q;
+
+	if (lws_txq_check_limits(wsi, len))
+		return -1;
+
+	q = lws_txq_add_node(wsi, b, p);
+	if (!q) {
+		lwsl_err("%s: OOM\n", __func__);
+		return -1;
+	}
+	lws_txbuf_ref(b);
+	q->len = len;
+	wsi->trunc_len += len;
+	pt->txq_bytes += len;
+	pt->txq_refs++;
+	lws_mem_set(wsi, LWSMT_TXQ, wsi->trunc_len);
+
+	return 0;
+}
+
+static void
+lws_txq_pop(struct lws *wsi)
+{
+	struct lws_txq_node *q = wsi->txq;
+
+	wsi->txq = q->next;
+	if (!wsi->txq)
+		wsi->txq_tail = NULL;
+
+	lws_txbuf_unref(q->b);
+	lws_slab_free(q);
+}
+
+/*
+ * Send what we can of the queue.  Returns -1 if the connection should close,
+ * either because the send failed or because the queue was all that was
+ * holding up a close.
+ */
+
+int
+lws_txq_drain(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	struct lws_txq_node *q;
+	int n;
+
+	while ((q = wsi->txq)) {
+		n = lws_issue_raw_sock(wsi, q->p, q->len);
+		if (n < 0)
+			goto bail;
+
+		lwsl_info("%p partial adv %d (vs %d)\n", wsi, n, q->len);
+		q->p += n;
+		q->len -= n;
+		wsi->trunc_len -= n;
+		pt->txq_bytes -= n;
+
+		if (q->len)
+			/* the socket took what it could */
+			break;
+
+		lws_txq_pop(wsi);
+	}
+	lws_mem_set(wsi, LWSMT_TXQ, wsi->trunc_len);
+
+	if (!wsi->trunc_len) {
+		lwsl_info("***** %p partial send completed\n", wsi);
+		if (wsi->state == LWSS_FLUSHING_STORED_SEND_BEFORE_CLOSE) {
+			lwsl_info("***** %p signalling to close now\n", wsi);
+			return -1; /* retry closing now */
+		}
+	}
+
+	/* always callback on writeable */
+	lws_callback_on_writable(wsi);
+
+	return 0;
+
+bail:
+	lws_mem_set(wsi, LWSMT_TXQ, wsi->trunc_len);
+
+	return -1;
+}
+
+void
+lws_txq_destroy(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+
+	/* not going to be completed... nuke it */
+	while (wsi->txq)
+		lws_txq_pop(wsi);
+
+	pt->txq_bytes -= wsi->trunc_len;
+	wsi->trunc_len = 0;
+	lws_mem_set(wsi, LWSMT_TXQ, 0);
+}
+
+/**
+ * lws_txbuf_create() - frame a ws message once, to write to many connections
+ *
+ * @payload:	the message payload
+ * @len:	its length in bytes
+ * @protocol:	LWS_WRITE_TEXT, LWS_WRITE_BINARY, etc as for lws_write()
+ *
+ *	Returns a refcounted copy of the payload with its ws server frame
+ *	header already in front, or NULL if OOM.  Pass it to
+ *	lws_write_txbuf() on as many connections as you like, from their
+ *	writeable callbacks, then lws_txbuf_unref() it.  Connections that
+ *	can't send it all at once keep a reference to it rather than copying
+ *	the rest, so it is only freed when the last of them has sent it.
+ */
+LWS_VISIBLE struct lws_txbuf *
+lws_txbuf_create(const void *payload, size_t len,
+		 enum lws_write_protocol protocol)
+{
+	struct lws_txbuf *b;
+	int n;
+
+	b = lws_malloc(sizeof(*b) + LWS_PRE + len);
+	if (!b)
+		return NULL;
+
+	b->refcount = 1;
+	b->size = LWS_PRE + len;
+	b->len = len;
+	b->shared = 1;
+	b->heap = 0;
+	b->wp = protocol;
+	memcpy(lws_txbuf_data(b) + LWS_PRE, payload, len);
+
+	n = lws_ws_frame_header(lws_txbuf_data(b) + LWS_PRE, len, protocol, 0);
+	if (n < 0) {
+		lws_free(b);
+		return NULL;
+	}
+	b->pre = n;
+
+	return b;
+}
+
+/**
+ * lws_write_txbuf() - write a message from lws_txbuf_create()
+ *
+ * @wsi:	Websocket instance (available from user callback)
+ * @b:		the message
+ *
+ *	Use it like lws_write(), it returns the payload length if the message
+ *	was sent or queued, or -1 for a fatal error needing connection close.
+ *
+ *	A server connection with no extension active sends the shared frame
+ *	as it is.  Anything else, like a client connection that must mask
+ *	what it sends, or one using permessage-deflate, gets its own copy of
+ *	the payload passed to lws_write().
+ */
+LWS_VISIBLE int
+lws_write_txbuf(struct lws *wsi, struct lws_txbuf *b)
+{
+	struct lws_context_per_thread *pt = &wsi->context->pt[(int)wsi->tsi];
+	unsigned char *p = lws_txbuf_data(b) + LWS_PRE - b->pre, *copy;
+	size_t len = b->pre + b->len;
+	int n;
+
+	if (wsi->mode != LWSCM_WS_SERVING || wsi->state != LWSS_ESTABLISHED ||
+	    wsi->count_act_ext || wsi->u.ws.inside_frame ||
+	    wsi->u.ws.tx_draining_ext) {
+		if (LWS_PRE + b->len <= wsi->context->pt_serv_buf_size)
+			copy = pt->serv_buf;
+		else {
+			copy = lws_malloc(LWS_PRE + b->len);
+			if (!copy)
+				return -1;
+		}
+		memcpy(copy + LWS_PRE, lws_txbuf_data(b) + LWS_PRE, b->len);
+		n = lws_write(wsi, copy + LWS_PRE, b->len, b->wp);
+		if (copy != pt->serv_buf)
+			lws_free(copy);
+
+		return n;
+	}
+
+#ifdef LWS_WITH_ACCESS_LOG
+	if (wsi->access_log)
+		wsi->access_log->sent += b->len;
+#endif
+	if (wsi->vhost)
+		lws_vh_stats(wsi)->tx += b->len;
+	pt->load.tx += b->len;
+
+	/* behind something already queued, it just joins the queue */
+	if (wsi->trunc_len)
+		return lws_txq_append_ref(wsi, b, p, len) ? -1 : (int)b->len;
+
+	n = lws_issue_raw_sock(wsi, p, len);
+	if (n < 0)
+		return -1;
+
+	if ((size_t)n < len) {
+		if (lws_txq_append_ref(wsi, b, p + n, len - n))
+			return -1;
+		lws_callback_on_writable(wsi);
+	}
+
+	return b->len;
+}
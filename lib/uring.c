@@ -0,0 +1,952 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * io_uring service engine
+ *
+ * Each service thread owns a ring.  Interest in an fd is expressed as one-shot
+ * IORING_OP_POLL_ADD per direction, queued into the submission ring as the
+ * pollfd events change, and all of them are submitted by the same
+ * io_uring_enter() that waits for completions.  So however many sockets
+ * changed their interest or became ready, a service pass is one syscall.
+ *
+ * Where the kernel can, input doesn't need a syscall of its own either:
+ *
+ *  - listeners keep a multishot IORING_OP_ACCEPT queued.  The fds it gives
+ *    us wait on pt->uring.accq, and lws_plat_accept() takes them from there,
+ *    so the accept budget and the filter callbacks work as before.
+ *
+ *  - accepted connections without TLS keep one IORING_OP_RECV queued, that
+ *    lets the kernel pick a buffer from a ring of them the thread provides.
+ *    lws_ssl_capable_read_no_ssl() copies out of that buffer, and the recv
+ *    is queued again once it's empty.  If the ring runs dry, the connection
+ *    polls for that one read instead.  TLS does its own reads on the socket,
+ *    so those connections just poll.
+ *
+ * Sends still go by send() when lws writes, since the callers need to know
+ * at once how much went; what doesn't is queued on the wsi as usual.
+ *
+ * The completion user_data carries the fd, the op and the fd generation,
+ * so completions for something queued by a connection that has since
+ * closed (and whose fd got reused) are recognized and dropped, giving back
+ * any buffer or fd they carry.
+ */
+
+#include "private-libwebsockets.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define LWS_URING_UD(fd, op, gen) ((unsigned long long)(unsigned int)(fd) | \
+				   ((unsigned long long)(op) << 32) | \
+				   ((unsigned long long)(gen) << 35))
+#define LWS_URING_UD_FD(ud) ((int)((ud) & 0xffffffff))
+#define LWS_URING_UD_OP(ud) ((int)(((ud) >> 32) & 7))
+#define LWS_URING_UD_GEN(ud) ((unsigned short)((ud) >> 35))
+
+/* ops in the user_data besides LWS_URING_DIR_IN / OUT polls */
+#define LWS_URING_OP_RECV 3
+#define LWS_URING_OP_ACCEPT 4
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, arg, argsz);
+}
+
+static unsigned int
+lws_uring_sq_pending(struct lws_io_uring *r)
+{
+	return *r->sq_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* caller must hold the pt lock, or be the only thread that can see the pt */
+
+static struct io_uring_sqe *
+lws_uring_get_sqe(struct lws_io_uring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *r->sq_tail, idx;
+
+	if (lws_uring_sq_pending(r) >= r->sq_entries) {
+		/* full... push what we have to the kernel now */
+		if (sys_io_uring_enter(r->fd, lws_uring_sq_pending(r), 0, 0,
+				       NULL, 0) < 0) {
+			lwsl_err("%s: io_uring flush failed %d\n", __func__,
+				 LWS_ERRNO);
+			return NULL;
+		}
+		if (lws_uring_sq_pending(r) >= r->sq_entries)
+			return NULL;
+	}
+
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+
+	return sqe;
+}
+
+static void
+lws_uring_commit_sqe(struct lws_io_uring *r)
+{
+	__atomic_store_n(r->sq_tail, *r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static int
+lws_uring_queue_poll(struct lws_io_uring *r, int fd, int dir,
+		     unsigned short gen)
+{
+	struct io_uring_sqe *sqe = lws_uring_get_sqe(r);
+
+	if (!sqe)
+		return 1;
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = dir == LWS_URING_DIR_IN ? POLLIN : POLLOUT;
+	sqe->user_data = LWS_URING_UD(fd, dir, gen);
+	lws_uring_commit_sqe(r);
+
+	return 0;
+}
+
+static void
+lws_uring_queue_poll_remove(struct lws_io_uring *r, unsigned long long ud)
+{
+	struct io_uring_sqe *sqe = lws_uring_get_sqe(r);
+
+	if (!sqe)
+		return;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = ud;
+	/* op 0 marks completions we don't care about */
+	sqe->user_data = LWS_URING_UD(0, 0, 0);
+	lws_uring_commit_sqe(r);
+}
+
+static void
+lws_uring_queue_cancel(struct lws_io_uring *r, unsigned long long ud)
+{
+	struct io_uring_sqe *sqe = lws_uring_get_sqe(r);
+
+	if (!sqe)
+		return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = ud;
+	sqe->user_data = LWS_URING_UD(0, 0, 0);
+	lws_uring_commit_sqe(r);
+}
+
+/* a listener takes accepted fds, anything else a recv into a ring buffer */
+
+static int
+lws_uring_queue_rx(struct lws_io_uring *r, struct lws *wsi, unsigned short gen)
+{
+#if defined(LWS_HAVE_IO_URING_MULTISHOT)
+	struct io_uring_sqe *sqe = lws_uring_get_sqe(r);
+
+	if (!sqe)
+		return 1;
+
+	sqe->fd = wsi->sock;
+	if (wsi->listener) {
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		sqe->user_data = LWS_URING_UD(wsi->sock, LWS_URING_OP_ACCEPT,
+					      gen);
+	} else {
+		sqe->opcode = IORING_OP_RECV;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->len = LWS_URING_RX_BUF_SIZE;
+		sqe->user_data = LWS_URING_UD(wsi->sock, LWS_URING_OP_RECV,
+					      gen);
+	}
+	lws_uring_commit_sqe(r);
+
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+/* hand a buffer (back) to the kernel to recv into */
+
+static void
+lws_uring_buf_give(struct lws_io_uring *r, unsigned short bid)
+{
+	struct io_uring_buf *b;
+
+	b = &r->br->bufs[r->br_tail & (LWS_URING_RX_BUFS - 1)];
+	b->addr = (unsigned long long)(uintptr_t)(r->bufs +
+				(size_t)bid * LWS_URING_RX_BUF_SIZE);
+	b->len = LWS_URING_RX_BUF_SIZE;
+	b->bid = bid;
+	r->br_tail++;
+	__atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
+
+static int
+lws_uring_has_rx(struct lws_io_uring *r, struct lws *wsi)
+{
+	unsigned int n;
+
+	if (!wsi->listener)
+		return wsi->uring_rx_len || wsi->uring_eof;
+
+	for (n = 0; n < r->accq_count; n++)
+		if (r->accq[n].lfd == wsi->sock)
+			return 1;
+
+	return 0;
+}
+
+static void
+lws_uring_rx_list(struct lws_io_uring *r, struct lws *wsi)
+{
+	if (wsi->uring_rx_listed)
+		return;
+
+	wsi->uring_rx_next = r->rx_pending;
+	r->rx_pending = wsi;
+	wsi->uring_rx_listed = 1;
+}
+
+static void
+lws_uring_rx_unlist(struct lws_io_uring *r, struct lws *wsi)
+{
+	struct lws **pw;
+
+	if (!wsi->uring_rx_listed)
+		return;
+
+	for (pw = &r->rx_pending; *pw; pw = &(*pw)->uring_rx_next)
+		if (*pw == wsi) {
+			*pw = wsi->uring_rx_next;
+			break;
+		}
+	wsi->uring_rx_listed = 0;
+}
+
+static void
+lws_uring_accq_add(struct lws_io_uring *r, int lfd, int fd)
+{
+	struct lws_uring_acc *a;
+	unsigned int n;
+
+	if (r->accq_count == r->accq_size) {
+		n = r->accq_size ? r->accq_size * 2 : 16;
+		a = lws_realloc(r->accq, n * sizeof(*a));
+		if (!a) {
+			lwsl_err("%s: OOM, dropping accepted fd\n", __func__);
+			close(fd);
+			return;
+		}
+		r->accq = a;
+		r->accq_size = n;
+	}
+
+	r->accq[r->accq_count].lfd = lfd;
+	r->accq[r->accq_count++].fd = fd;
+}
+
+/* take the oldest fd accepted for lfd, or -1 */
+
+static int
+lws_uring_accq_take(struct lws_io_uring *r, int lfd)
+{
+	unsigned int n;
+	int fd;
+
+	for (n = 0; n < r->accq_count; n++)
+		if (r->accq[n].lfd == lfd) {
+			fd = r->accq[n].fd;
+			memmove(&r->accq[n], &r->accq[n + 1],
+				(r->accq_count - n - 1) * sizeof(*r->accq));
+			r->accq_count--;
+
+			return fd;
+		}
+
+	return -1;
+}
+
+/* should input on this wsi come by ring recv / multishot accept */
+
+static int
+lws_uring_wants_rx(struct lws_io_uring *r, struct lws *wsi)
+{
+	if (wsi->listener)
+		return !r->no_multishot_accept;
+
+	return wsi->uring_recv && r->br && !wsi->uring_poll_in;
+}
+
+/* the generation lives next to the wsi in the fd lookup page */
+
+static unsigned short *
+lws_uring_gen(struct lws_context *context, int fd)
+{
+	struct lws_fd_page *page = lws_fd_page(context, fd);
+
+	return page ? &page->uring_gen[fd & (LWS_FD_PAGE - 1)] : NULL;
+}
+
+void
+lws_uring_arm(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	struct lws_context *context = pt->context;
+	struct lws_pollfd *pfd;
+	unsigned short *pgen, gen;
+
+	if (!LWS_URING_ENABLED(context) || wsi->position_in_fds_table < 0)
+		return;
+
+	pgen = lws_uring_gen(context, wsi->sock);
+	if (!pgen)
+		return;
+	gen = *pgen;
+	pfd = &pt->fds[wsi->position_in_fds_table];
+
+	if ((pfd->events & LWS_POLLIN) &&
+	    !(wsi->uring_armed & (LWS_URING_DIR_IN | LWS_URING_DIR_RX))) {
+		if (lws_uring_wants_rx(&pt->uring, wsi)) {
+			/* one buffer at a time, the next recv when it's read */
+			if (!wsi->uring_rx_len && !wsi->uring_eof &&
+			    !lws_uring_queue_rx(&pt->uring, wsi, gen))
+				wsi->uring_armed |= LWS_URING_DIR_RX;
+		} else if (!lws_uring_queue_poll(&pt->uring, wsi->sock,
+						 LWS_URING_DIR_IN, gen))
+			wsi->uring_armed |= LWS_URING_DIR_IN;
+	}
+
+	/*
+	 * a listener stops taking POLLIN when the thread is full: multishot
+	 * accept has to be stopped then.  He stays armed until the kernel
+	 * says it stopped, so a new one isn't started alongside.
+	 */
+	if (wsi->listener && !(pfd->events & LWS_POLLIN) &&
+	    (wsi->uring_armed & LWS_URING_DIR_RX))
+		lws_uring_queue_cancel(&pt->uring, LWS_URING_UD(wsi->sock,
+				       LWS_URING_OP_ACCEPT, gen));
+
+	if ((pfd->events & LWS_POLLOUT) &&
+	    !(wsi->uring_armed & LWS_URING_DIR_OUT) &&
+	    !lws_uring_queue_poll(&pt->uring, wsi->sock, LWS_URING_DIR_OUT, gen))
+		wsi->uring_armed |= LWS_URING_DIR_OUT;
+}
+
+void
+lws_uring_remove(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	struct lws_context *context = pt->context;
+	struct lws_io_uring *r = &pt->uring;
+	unsigned short *pgen, gen;
+	int fd;
+
+	if (!LWS_URING_ENABLED(context))
+		return;
+
+	/* give back what came in that nobody read */
+	if (wsi->uring_rx_len)
+		lws_uring_buf_give(r, wsi->uring_bid);
+	wsi->uring_rx_len = 0;
+	wsi->uring_rx_off = 0;
+	wsi->uring_eof = 0;
+	lws_uring_rx_unlist(r, wsi);
+	if (wsi->listener)
+		while ((fd = lws_uring_accq_take(r, wsi->sock)) >= 0)
+			close(fd);
+
+	if (!lws_socket_is_valid(wsi->sock))
+		return;
+
+	pgen = lws_uring_gen(context, wsi->sock);
+	if (!pgen)
+		return;
+
+	/*
+	 * the kernel holds a reference on the file while a poll is queued,
+	 * so they have to be cancelled or the socket won't really close
+	 */
+	gen = *pgen;
+	if (wsi->uring_armed & LWS_URING_DIR_IN)
+		lws_uring_queue_poll_remove(&pt->uring,
+			LWS_URING_UD(wsi->sock, LWS_URING_DIR_IN, gen));
+	if (wsi->uring_armed & LWS_URING_DIR_OUT)
+		lws_uring_queue_poll_remove(&pt->uring,
+			LWS_URING_UD(wsi->sock, LWS_URING_DIR_OUT, gen));
+	if (wsi->uring_armed & LWS_URING_DIR_RX)
+		lws_uring_queue_cancel(&pt->uring,
+			LWS_URING_UD(wsi->sock, wsi->listener ?
+				     LWS_URING_OP_ACCEPT : LWS_URING_OP_RECV,
+				     gen));
+	wsi->uring_armed = 0;
+
+	/* anything still in flight for this fd is stale from now on */
+	(*pgen)++;
+}
+
+/*
+ * The provided buffers for ring recv.  Without them (or multishot accept),
+ * input is polled for as before.
+ */
+
+static void
+lws_uring_init_rx(struct lws_io_uring *r)
+{
+#if defined(LWS_HAVE_IO_URING_MULTISHOT)
+	struct io_uring_buf_reg reg;
+	int n;
+
+	r->br_size = LWS_URING_RX_BUFS * sizeof(struct io_uring_buf);
+	r->br = mmap(NULL, r->br_size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r->br == MAP_FAILED) {
+		r->br = NULL;
+		return;
+	}
+
+	r->bufs = lws_malloc((size_t)LWS_URING_RX_BUFS * LWS_URING_RX_BUF_SIZE);
+	if (!r->bufs)
+		goto bail;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)(uintptr_t)r->br;
+	reg.ring_entries = LWS_URING_RX_BUFS;
+	reg.bgid = 0;
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING,
+		    &reg, 1) < 0) {
+		lwsl_notice("io_uring: no buffer ring (%d), polling for rx\n",
+			    LWS_ERRNO);
+		goto bail;
+	}
+
+	for (n = 0; n < LWS_URING_RX_BUFS; n++)
+		lws_uring_buf_give(r, n);
+
+	return;
+
+bail:
+	if (r->bufs)
+		lws_free(r->bufs);
+	r->bufs = NULL;
+	munmap(r->br, r->br_size);
+	r->br = NULL;
+#else
+	r->no_multishot_accept = 1;
+#endif
+}
+
+static int
+lws_uring_init_pt(struct lws_context_per_thread *pt)
+{
+	struct lws_io_uring *r = &pt->uring;
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = sys_io_uring_setup(LWS_URING_SQ_ENTRIES, &p);
+	if (r->fd < 0) {
+		lwsl_notice("io_uring_setup failed: %d\n", LWS_ERRNO);
+		return 1;
+	}
+
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		lwsl_notice("io_uring lacks needed features (0x%x)\n",
+			    p.features);
+		goto bail;
+	}
+
+	r->sq_entries = p.sq_entries;
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_ring_size = p.cq_off.cqes +
+			  p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size)
+			r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = r->sq_ring_size;
+	}
+
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ring == MAP_FAILED) {
+		r->sq_ring = NULL;
+		goto bail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ring = r->sq_ring;
+	else {
+		r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, r->fd,
+				  IORING_OFF_CQ_RING);
+		if (r->cq_ring == MAP_FAILED) {
+			r->cq_ring = NULL;
+			goto bail;
+		}
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto bail;
+	}
+
+	r->sq_head = (unsigned int *)((char *)r->sq_ring + p.sq_off.head);
+	r->sq_tail = (unsigned int *)((char *)r->sq_ring + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)r->sq_ring + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)r->cq_ring + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->cq_ring + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)r->cq_ring + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+
+	r->ready = lws_malloc(sizeof(int) * p.cq_entries);
+	if (!r->ready)
+		goto bail;
+	r->ready_size = p.cq_entries;
+
+	lws_uring_init_rx(r);
+
+	return 0;
+
+bail:
+	lwsl_notice("io_uring unusable on this kernel\n");
+
+	return 1;
+}
+
+static void
+lws_uring_destroy_pt(struct lws_context_per_thread *pt)
+{
+	struct lws_io_uring *r = &pt->uring;
+	unsigned int n;
+
+	for (n = 0; n < r->accq_count; n++)
+		close(r->accq[n].fd);
+	if (r->accq)
+		lws_free(r->accq);
+	if (r->bufs)
+		lws_free(r->bufs);
+	if (r->br)
+		munmap(r->br, r->br_size);
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring && r->cq_ring != r->sq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_size);
+	if (r->ready)
+		lws_free(r->ready);
+	if (r->fd > 0)
+		close(r->fd);
+
+	memset(r, 0, sizeof(*r));
+}
+
+/*
+ * Called from lws_plat_init() after the dummy pipes exist.  If the kernel
+ * can't give us what we need, clear the option and return nonzero, so the
+ * caller carries on with the poll() (or epoll) service backend instead.
+ */
+int
+lws_uring_init(struct lws_context *context)
+{
+	struct lws_context_per_thread *pt = &context->pt[0];
+	int n;
+
+	for (n = 0; n < context->count_threads; n++) {
+		if (lws_uring_init_pt(&pt[n]))
+			goto bail;
+		pt[n].uring.pipe_armed = 1;
+		lws_uring_queue_poll(&pt[n].uring, pt[n].dummy_pipe_fds[0],
+				     LWS_URING_DIR_IN, 0);
+	}
+
+	lwsl_notice(" io_uring service backend (%d x %u sq entries)%s%s\n",
+		    context->count_threads, pt[0].uring.sq_entries,
+		    pt[0].uring.no_multishot_accept ? "" : ", multishot accept",
+		    pt[0].uring.br ? ", ring recv" : "");
+
+	return 0;
+
+bail:
+	lws_uring_destroy(context);
+	context->options &= ~LWS_SERVER_OPTION_IO_URING;
+
+	return 1;
+}
+
+/* an accepted connection without TLS, its input can come by ring recv */
+
+void
+lws_uring_adopt(struct lws *wsi)
+{
+	if (LWS_URING_ENABLED(wsi->context) &&
+	    wsi->context->pt[(int)wsi->tsi].uring.br)
+		wsi->uring_recv = 1;
+}
+
+/*
+ * lws_ssl_capable_read_no_ssl() for a wsi whose input comes by ring recv,
+ * returns what it copied, 0 for the peer closed, or
+ * LWS_SSL_CAPABLE_MORE_SERVICE if nothing came yet
+ */
+
+int
+lws_uring_read(struct lws *wsi, unsigned char *buf, int len)
+{
+	struct lws_io_uring *r = &wsi->context->pt[(int)wsi->tsi].uring;
+	int n = wsi->uring_rx_len - wsi->uring_rx_off;
+
+	if (!wsi->uring_rx_len)
+		return wsi->uring_eof ? 0 : LWS_SSL_CAPABLE_MORE_SERVICE;
+
+	if (n > len)
+		n = len;
+	memcpy(buf, r->bufs + (size_t)wsi->uring_bid * LWS_URING_RX_BUF_SIZE +
+		    wsi->uring_rx_off, n);
+	wsi->uring_rx_off += n;
+
+	if (wsi->uring_rx_off == wsi->uring_rx_len) {
+		/* the next recv gets queued when he is armed again */
+		lws_uring_buf_give(r, wsi->uring_bid);
+		wsi->uring_rx_len = 0;
+		wsi->uring_rx_off = 0;
+	}
+
+	return n;
+}
+
+/*
+ * lws_plat_accept() for a listener with multishot accept: returns 1 and
+ * sets *afd to the next fd it accepted, or to -1 with errno EAGAIN if there
+ * isn't one yet.  Returns 0 if the listener isn't using it.
+ */
+
+int
+lws_uring_accept(struct lws_context *context, lws_sockfd_type lfd,
+		 lws_sockfd_type *afd)
+{
+	struct lws *wsi = wsi_from_fd(context, lfd);
+	struct lws_io_uring *r;
+
+	if (!wsi)
+		return 0;
+	r = &context->pt[(int)wsi->tsi].uring;
+
+	*afd = lws_uring_accq_take(r, lfd);
+	if (*afd >= 0)
+		return 1;
+	if (!(wsi->uring_armed & LWS_URING_DIR_RX))
+		/* it stopped, maybe the kernel's queue has more */
+		return 0;
+
+	errno = LWS_EAGAIN;
+
+	return 1;
+}
+
+/* is there input we already have, for somebody who wants it */
+
+int
+lws_uring_pending(struct lws_context_per_thread *pt)
+{
+	struct lws *wsi;
+
+	if (!LWS_URING_ENABLED(pt->context))
+		return 0;
+
+	for (wsi = pt->uring.rx_pending; wsi; wsi = wsi->uring_rx_next)
+		if (wsi->position_in_fds_table >= 0 &&
+		    (pt->fds[wsi->position_in_fds_table].events & LWS_POLLIN) &&
+		    lws_uring_has_rx(&pt->uring, wsi))
+			return 1;
+
+	return 0;
+}
+
+void
+lws_uring_destroy(struct lws_context *context)
+{
+	int n;
+
+	for (n = 0; n < context->count_threads; n++)
+		lws_uring_destroy_pt(&context->pt[n]);
+}
+
+/* a completion nobody will take: don't leak the buffer or fd it carries */
+
+static void
+lws_uring_cqe_drop(struct lws_io_uring *r, int op, struct io_uring_cqe *cqe)
+{
+	if (cqe->flags & IORING_CQE_F_BUFFER)
+		lws_uring_buf_give(r, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+	if (op == LWS_URING_OP_ACCEPT && cqe->res >= 0)
+		close(cqe->res);
+}
+
+/* re-arm from the completion loop, which doesn't hold the pt lock */
+
+static void
+lws_uring_rearm(struct lws_context_per_thread *pt, struct lws *wsi)
+{
+	lws_pt_lock(pt);
+	lws_uring_arm(pt, wsi);
+	lws_pt_unlock(pt);
+}
+
+/* input for the wsi is waiting for him: service him if he wants it */
+
+static void
+lws_uring_ready(struct lws_io_uring *r, struct lws_pollfd *pfd, int *ready,
+		short revents)
+{
+	revents &= pfd->events | LWS_POLLHUP | POLLERR;
+	if (!revents)
+		return;
+
+	if (!pfd->revents) {
+		if ((unsigned int)*ready == r->ready_size)
+			return; /* still listed, next time then */
+		r->ready[(*ready)++] = pfd->fd;
+	}
+	pfd->revents |= revents;
+}
+
+int
+lws_uring_service_tsi(struct lws_context *context, int timeout_ms, int tsi)
+{
+	struct lws_context_per_thread *pt = &context->pt[tsi];
+	struct lws_io_uring *r = &pt->uring;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int head, tail, to_submit;
+	unsigned long long ud;
+	unsigned short *pgen;
+	struct io_uring_cqe *cqe;
+	struct lws_pollfd *pfd;
+	int n, m, fd, op, ready = 0;
+	struct lws *wsi, **pw;
+
+	lws_pt_lock(pt);
+	to_submit = lws_uring_sq_pending(r);
+	lws_pt_unlock(pt);
+
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+	arg.ts = (unsigned long long)(uintptr_t)&ts;
+
+	/* submit everything queued and wait, in the one syscall */
+	n = sys_io_uring_enter(r->fd, to_submit, timeout_ms ? 1 : 0,
+			       IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			       &arg, sizeof(arg));
+	lws_pt_woke(pt);
+	if (n < 0 && LWS_ERRNO != LWS_EINTR && LWS_ERRNO != ETIME &&
+	    LWS_ERRNO != EBUSY && LWS_ERRNO != LWS_EAGAIN)
+		return -1;
+
+	/* collect the completions into the pollfd revents */
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		ud = cqe->user_data;
+		n = cqe->res;
+		head++;
+
+		op = LWS_URING_UD_OP(ud);
+		fd = LWS_URING_UD_FD(ud);
+		if (!op)
+			continue;
+
+		if (fd == pt->dummy_pipe_fds[0]) {
+			if (n > 0)
+				lws_plat_pipe_drain(pt);
+			pt->uring.pipe_armed = 0;
+			continue;
+		}
+
+		pgen = lws_uring_gen(context, fd);
+		wsi = wsi_from_fd(context, fd);
+		if (!pgen || LWS_URING_UD_GEN(ud) != *pgen || !wsi ||
+		    wsi->position_in_fds_table < 0) {
+			/* left over from a closed connection */
+			lws_uring_cqe_drop(r, op, cqe);
+			continue;
+		}
+		pfd = &pt->fds[wsi->position_in_fds_table];
+
+		switch (op) {
+		case LWS_URING_DIR_IN:
+		case LWS_URING_DIR_OUT:
+			wsi->uring_armed &= ~op;
+			if (op == LWS_URING_DIR_IN)
+				/* the ring may have buffers again */
+				wsi->uring_poll_in = 0;
+			if (n > 0)
+				lws_uring_ready(r, pfd, &ready, n);
+			break;
+
+		case LWS_URING_OP_RECV:
+			wsi->uring_armed &= ~LWS_URING_DIR_RX;
+			if (n == -ENOBUFS) {
+				/* all lent out, poll and recv() this once */
+				wsi->uring_poll_in = 1;
+				lws_uring_rearm(pt, wsi);
+				break;
+			}
+			if (n < 0) {
+				lws_uring_ready(r, pfd, &ready, LWS_POLLHUP);
+				break;
+			}
+			if (n)
+				wsi->uring_bid = cqe->flags >>
+						 IORING_CQE_BUFFER_SHIFT;
+			else
+				wsi->uring_eof = 1;
+			wsi->uring_rx_len = n;
+			wsi->uring_rx_off = 0;
+			lws_uring_rx_list(r, wsi);
+			lws_uring_ready(r, pfd, &ready, LWS_POLLIN);
+			break;
+
+		case LWS_URING_OP_ACCEPT:
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				wsi->uring_armed &= ~LWS_URING_DIR_RX;
+			if (n >= 0) {
+				lws_uring_accq_add(r, fd, n);
+				lws_uring_rx_list(r, wsi);
+				lws_uring_ready(r, pfd, &ready, LWS_POLLIN);
+			} else if (n == -EINVAL)
+				/* the kernel can't, poll for accepts instead */
+				r->no_multishot_accept = 1;
+			if (!(wsi->uring_armed & LWS_URING_DIR_RX))
+				lws_uring_rearm(pt, wsi);
+			break;
+		}
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+	/* input still waiting from earlier that wasn't all read */
+
+	for (pw = &r->rx_pending; (wsi = *pw); ) {
+		if (!lws_uring_has_rx(r, wsi)) {
+			*pw = wsi->uring_rx_next;
+			wsi->uring_rx_listed = 0;
+			continue;
+		}
+		pw = &wsi->uring_rx_next;
+		if (wsi->position_in_fds_table >= 0)
+			lws_uring_ready(r, &pt->fds[wsi->position_in_fds_table],
+					&ready, LWS_POLLIN);
+	}
+
+	if (!pt->uring.pipe_armed) {
+		lws_pt_lock(pt);
+		if (!lws_uring_queue_poll(r, pt->dummy_pipe_fds[0],
+					  LWS_URING_DIR_IN, 0))
+			pt->uring.pipe_armed = 1;
+		lws_pt_unlock(pt);
+	}
+
+#ifdef LWS_OPENSSL_SUPPORT
+	if (!pt->rx_draining_ext_list &&
+	    !lws_ssl_anybody_has_buffered_read_tsi(context, tsi) && !ready) {
+#else
+	if (!pt->rx_draining_ext_list && !ready) /* timeout */ {
+#endif
+		lws_service_fd_tsi(context, NULL, tsi);
+		return 0;
+	}
+
+	if (lws_service_flag_pending(context, tsi)) {
+		/* somebody had POLLIN faked, find them the slow way */
+		for (m = 0; m < (int)pt->fds_count; m++) {
+			if (!pt->fds[m].revents)
+				continue;
+			if (pt->fds[m].fd == pt->dummy_pipe_fds[0]) {
+				pt->fds[m].revents = 0;
+				continue;
+			}
+			n = lws_service_fd_tsi(context, &pt->fds[m], tsi);
+			if (n < 0)
+				return -1;
+			/* if something closed, retry this slot */
+			if (n)
+				m--;
+		}
+	} else
+		for (m = 0; m < ready; m++) {
+			/* an earlier service action may have closed him */
+			wsi = wsi_from_fd(context, r->ready[m]);
+			if (!wsi || wsi->position_in_fds_table < 0)
+				continue;
+			pfd = &pt->fds[wsi->position_in_fds_table];
+			if (!pfd->revents)
+				continue;
+			if (lws_service_fd_tsi(context, pfd, tsi) < 0)
+				return -1;
+		}
+
+	/* the polls that fired were one-shot, queue them again if wanted */
+
+	lws_pt_lock(pt);
+	for (m = 0; m < ready; m++) {
+		wsi = wsi_from_fd(context, r->ready[m]);
+		if (!wsi || wsi->position_in_fds_table < 0)
+			continue;
+		/*
+		 * a close that only got as far as shutdown leaves revents
+		 * set, nothing refills them like poll() would
+		 */
+		pt->fds[wsi->position_in_fds_table].revents = 0;
+		lws_uring_arm(pt, wsi);
+	}
+	lws_pt_unlock(pt);
+
+	/* the wake may have been all there was, nobody else drained them */
+	if (lws_pt_cmd_pending(pt))
+		lws_pt_cmd_drain(pt);
+
+	return 0;
+}
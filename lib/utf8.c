@@ -0,0 +1,400 @@
+/*
+ * libwebsockets - small server side websockets and web server implementation
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "private-libwebsockets.h"
+
+/*
+ * UTF-8 validation of ws text payload.
+ *
+ * The state machine is what decides, and carries a sequence split over
+ * fragments in one byte of state.  Where it starts at a character boundary
+ * with a lot to do, a SIMD kernel (AVX2 or SSSE3, picked at context
+ * creation) validates whole blocks first, using the lookup method from
+ * Keiser and Lemire's "Validating UTF-8 In Less Than One Instruction Per
+ * Byte".  All-ASCII blocks only cost a movemask there.  Without a kernel,
+ * ASCII is still skipped 8 bytes at a time.
+ */
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define LWS_UTF8_X86
+#include <immintrin.h>
+#endif
+
+/* below this much, it's not worth starting up a kernel */
+#define LWS_UTF8_SIMD_MIN 64
+
+#define LWS_UTF8_BAD 0xff
+
+static const unsigned char e0f4[] = {
+	0xa0 | ((2 - 1) << 2) | 1, /* e0 */
+	0x80 | ((4 - 1) << 2) | 1, /* e1 */
+	0x80 | ((4 - 1) << 2) | 1, /* e2 */
+	0x80 | ((4 - 1) << 2) | 1, /* e3 */
+	0x80 | ((4 - 1) << 2) | 1, /* e4 */
+	0x80 | ((4 - 1) << 2) | 1, /* e5 */
+	0x80 | ((4 - 1) << 2) | 1, /* e6 */
+	0x80 | ((4 - 1) << 2) | 1, /* e7 */
+	0x80 | ((4 - 1) << 2) | 1, /* e8 */
+	0x80 | ((4 - 1) << 2) | 1, /* e9 */
+	0x80 | ((4 - 1) << 2) | 1, /* ea */
+	0x80 | ((4 - 1) << 2) | 1, /* eb */
+	0x80 | ((4 - 1) << 2) | 1, /* ec */
+	0x80 | ((2 - 1) << 2) | 1, /* ed */
+	0x80 | ((4 - 1) << 2) | 1, /* ee */
+	0x80 | ((4 - 1) << 2) | 1, /* ef */
+	0x90 | ((3 - 1) << 2) | 2, /* f0 */
+	0x80 | ((4 - 1) << 2) | 2, /* f1 */
+	0x80 | ((4 - 1) << 2) | 2, /* f2 */
+	0x80 | ((4 - 1) << 2) | 2, /* f3 */
+	0x80 | ((1 - 1) << 2) | 2, /* f4 */
+
+	0,			   /* s0 */
+	0x80 | ((4 - 1) << 2) | 0, /* s2 */
+	0x80 | ((4 - 1) << 2) | 1, /* s3 */
+};
+
+/* next state after c, or LWS_UTF8_BAD */
+
+static LWS_INLINE unsigned char
+lws_utf8_step(unsigned char s, unsigned char c)
+{
+	if (!s) {
+		if (c < 0x80)
+			return 0;
+		if (c < 0xc2 || c > 0xf4)
+			return LWS_UTF8_BAD;
+		if (c < 0xe0)
+			return 0x80 | ((4 - 1) << 2);
+
+		return e0f4[c - 0xe0];
+	}
+
+	if (c < (s & 0xf0) ||
+	    c >= (s & 0xf0) + 0x10 + ((s << 2) & 0x30))
+		return LWS_UTF8_BAD;
+
+	return e0f4[21 + (s & 3)];
+}
+
+#if defined(LWS_UTF8_X86)
+
+/*
+ * A kernel validates whole blocks from a character boundary and returns how
+ * much of buf is valid and ends on a character boundary, or -1.  What's
+ * after that, including a sequence the last block left open, is for the
+ * state machine.
+ */
+typedef size_t (*lws_utf8_kernel)(const unsigned char *buf, size_t len);
+
+static lws_utf8_kernel lws_utf8_best;
+
+/*
+ * Error bits for the lookups.  Each is set in all three tables for the
+ * byte pairs that make that error, so ANDing the lookups leaves a bit set
+ * only where a pair is bad.
+ */
+#define TOO_SHORT	(1 << 0) /* lead or ASCII, then lead or ASCII */
+#define TOO_LONG	(1 << 1) /* ASCII, then continuation */
+#define OVERLONG_3	(1 << 2) /* e0, then 80..9f */
+#define TOO_LARGE	(1 << 3) /* f4, then 90..bf, or f5+ */
+#define SURROGATE	(1 << 4) /* ed, then a0..bf */
+#define OVERLONG_2	(1 << 5) /* c0 or c1 */
+#define TOO_LARGE_1000	(1 << 6) /* f5+, then 80..8f */
+#define OVERLONG_4	(1 << 6) /* f0, then 80..8f */
+#define TWO_CONTS	(1 << 7) /* continuation, then continuation */
+#define CARRY		(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define LWS_UTF8_BYTE_1_HIGH \
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+	TOO_SHORT | OVERLONG_2, \
+	TOO_SHORT, \
+	TOO_SHORT | OVERLONG_3 | SURROGATE, \
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define LWS_UTF8_BYTE_1_LOW \
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+	CARRY | OVERLONG_2, \
+	CARRY, \
+	CARRY, \
+	CARRY | TOO_LARGE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define LWS_UTF8_BYTE_2_HIGH \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | \
+		OVERLONG_4, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+/* the last 3 bytes of a block can't start a sequence that long */
+#define LWS_UTF8_MAX_TAIL \
+	(char)0xef, (char)0xdf, (char)0xbf
+
+/* back up to a sequence that runs on past n, if there is one */
+
+static size_t
+lws_utf8_boundary(const unsigned char *buf, size_t n)
+{
+	unsigned char c;
+	size_t k;
+
+	for (k = 1; k <= 3 && k <= n; k++) {
+		c = buf[n - k];
+		if (c < 0x80)
+			break;
+		if (c >= 0xc0) {
+			if (k < (size_t)(c >= 0xf0 ? 4 : (c >= 0xe0 ? 3 : 2)))
+				return n - k;
+			break;
+		}
+	}
+
+	return n;
+}
+
+__attribute__((target("ssse3")))
+static size_t
+lws_utf8_ssse3(const unsigned char *buf, size_t len)
+{
+	const __m128i b1h = _mm_setr_epi8(LWS_UTF8_BYTE_1_HIGH),
+		      b1l = _mm_setr_epi8(LWS_UTF8_BYTE_1_LOW),
+		      b2h = _mm_setr_epi8(LWS_UTF8_BYTE_2_HIGH),
+		      max = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+					  -1, -1, -1, -1, -1,
+					  LWS_UTF8_MAX_TAIL),
+		      nib = _mm_set1_epi8(0x0f);
+	__m128i in, prev = _mm_setzero_si128(), err = _mm_setzero_si128(),
+		inc = _mm_setzero_si128(), p1, p2, p3, sc, m23;
+	size_t n;
+
+	for (n = 0; n + 16 <= len; n += 16) {
+		in = _mm_loadu_si128((const __m128i *)(buf + n));
+		if (!_mm_movemask_epi8(in)) {
+			/* ASCII, only wrong if the last block ended early */
+			err = _mm_or_si128(err, inc);
+			inc = _mm_setzero_si128();
+			prev = in;
+			continue;
+		}
+
+		p1 = _mm_alignr_epi8(in, prev, 15);
+		p2 = _mm_alignr_epi8(in, prev, 14);
+		p3 = _mm_alignr_epi8(in, prev, 13);
+
+		sc = _mm_and_si128(
+			_mm_and_si128(
+			  _mm_shuffle_epi8(b1h, _mm_and_si128(
+					   _mm_srli_epi16(p1, 4), nib)),
+			  _mm_shuffle_epi8(b1l, _mm_and_si128(p1, nib))),
+			_mm_shuffle_epi8(b2h, _mm_and_si128(
+					 _mm_srli_epi16(in, 4), nib)));
+
+		/* third and fourth bytes must be continuations, and only them */
+		m23 = _mm_and_si128(_mm_or_si128(
+				_mm_subs_epu8(p2, _mm_set1_epi8(0xe0 - 0x80)),
+				_mm_subs_epu8(p3, _mm_set1_epi8(0xf0 - 0x80))),
+				_mm_set1_epi8((char)0x80));
+
+		err = _mm_or_si128(err, _mm_xor_si128(m23, sc));
+		inc = _mm_subs_epu8(in, max);
+		prev = in;
+	}
+
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(err, _mm_setzero_si128())) !=
+	    0xffff)
+		return (size_t)-1;
+
+	return lws_utf8_boundary(buf, n);
+}
+
+__attribute__((target("avx2")))
+static size_t
+lws_utf8_avx2(const unsigned char *buf, size_t len)
+{
+	const __m256i b1h = _mm256_setr_epi8(LWS_UTF8_BYTE_1_HIGH,
+					     LWS_UTF8_BYTE_1_HIGH),
+		      b1l = _mm256_setr_epi8(LWS_UTF8_BYTE_1_LOW,
+					     LWS_UTF8_BYTE_1_LOW),
+		      b2h = _mm256_setr_epi8(LWS_UTF8_BYTE_2_HIGH,
+					     LWS_UTF8_BYTE_2_HIGH),
+		      max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+					     -1, -1, -1, -1, -1, -1, -1, -1,
+					     -1, -1, -1, -1, -1, -1, -1, -1,
+					     -1, -1, -1, -1, -1,
+					     LWS_UTF8_MAX_TAIL),
+		      nib = _mm256_set1_epi8(0x0f);
+	__m256i in, prev = _mm256_setzero_si256(),
+		err = _mm256_setzero_si256(), inc = _mm256_setzero_si256(),
+		pp, p1, p2, p3, sc, m23;
+	size_t n;
+
+	for (n = 0; n + 32 <= len; n += 32) {
+		in = _mm256_loadu_si256((const __m256i *)(buf + n));
+		if (!_mm256_movemask_epi8(in)) {
+			/* ASCII, only wrong if the last block ended early */
+			err = _mm256_or_si256(err, inc);
+			inc = _mm256_setzero_si256();
+			prev = in;
+			continue;
+		}
+
+		/* high half of prev, low half of in: alignr is per lane */
+		pp = _mm256_permute2x128_si256(prev, in, 0x21);
+		p1 = _mm256_alignr_epi8(in, pp, 15);
+		p2 = _mm256_alignr_epi8(in, pp, 14);
+		p3 = _mm256_alignr_epi8(in, pp, 13);
+
+		sc = _mm256_and_si256(
+			_mm256_and_si256(
+			  _mm256_shuffle_epi8(b1h, _mm256_and_si256(
+					      _mm256_srli_epi16(p1, 4), nib)),
+			  _mm256_shuffle_epi8(b1l, _mm256_and_si256(p1, nib))),
+			_mm256_shuffle_epi8(b2h, _mm256_and_si256(
+					    _mm256_srli_epi16(in, 4), nib)));
+
+		m23 = _mm256_and_si256(_mm256_or_si256(
+			_mm256_subs_epu8(p2, _mm256_set1_epi8(0xe0 - 0x80)),
+			_mm256_subs_epu8(p3, _mm256_set1_epi8(0xf0 - 0x80))),
+			_mm256_set1_epi8((char)0x80));
+
+		err = _mm256_or_si256(err, _mm256_xor_si256(m23, sc));
+		inc = _mm256_subs_epu8(in, max);
+		prev = in;
+	}
+
+	if (!_mm256_testz_si256(err, err))
+		return (size_t)-1;
+
+	return lws_utf8_boundary(buf, n);
+}
+
+#endif
+
+/*
+ * Use the given kernel instead of the best one, so the self-test can check
+ * each of them.  Returns nonzero if this build or cpu can't run it.  Nothing
+ * may be validating meanwhile.
+ */
+
+int
+lws_utf8_force(int kernel)
+{
+	switch (kernel) {
+	case LWS_UTF8_SCALAR:
+		lws_utf8_best = NULL;
+		return 0;
+#if defined(LWS_UTF8_X86)
+	case LWS_UTF8_SSSE3:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("ssse3"))
+			return 1;
+		lws_utf8_best = lws_utf8_ssse3;
+		return 0;
+	case LWS_UTF8_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			return 1;
+		lws_utf8_best = lws_utf8_avx2;
+		return 0;
+#endif
+	}
+
+	return 1;
+}
+
+void
+lws_utf8_init(void)
+{
+	if (!lws_utf8_force(LWS_UTF8_AVX2)) {
+		lwsl_info(" utf8 validation       : avx2\n");
+		return;
+	}
+	if (!lws_utf8_force(LWS_UTF8_SSSE3)) {
+		lwsl_info(" utf8 validation       : ssse3\n");
+		return;
+	}
+	lws_utf8_force(LWS_UTF8_SCALAR);
+	lwsl_info(" utf8 validation       : 64-bit ASCII\n");
+}
+
+/*
+ * *state is 0 between characters, otherwise it says what the rest of a
+ * sequence split by the end of the last buf must be.  Returns nonzero if
+ * buf can't be valid UTF-8.
+ */
+
+LWS_EXTERN int
+lws_check_utf8(unsigned char *state, unsigned char *buf, size_t len)
+{
+	unsigned char s = *state;
+	unsigned long long v;
+	size_t n = 0;
+
+	/* finish the sequence the last fragment left open first */
+	while (s && n < len) {
+		s = lws_utf8_step(s, buf[n++]);
+		if (s == LWS_UTF8_BAD)
+			return 1;
+	}
+
+#if defined(LWS_UTF8_X86)
+	if (lws_utf8_best && len - n >= LWS_UTF8_SIMD_MIN) {
+		size_t m = lws_utf8_best(buf + n, len - n);
+
+		if (m == (size_t)-1)
+			return 1;
+		n += m;
+	}
+#endif
+
+	while (n < len) {
+		if (!s && len - n >= 8) {
+			memcpy(&v, buf + n, 8);
+			if (!(v & 0x8080808080808080ull)) {
+				n += 8;
+				continue;
+			}
+		}
+		s = lws_utf8_step(s, buf[n++]);
+		if (s == LWS_UTF8_BAD)
+			return 1;
+	}
+
+	*state = s;
+
+	return 0;
+}
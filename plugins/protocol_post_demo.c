@@ -51,11 +51,14 @@ callback_post_demo(struct lws *wsi, enum lws_callback_reasons reason,
 	switch (reason) {
 
 	case LWS_CALLBACK_HTTP_BODY:
-		/* create the POST argument parser if not already existing */
+		/*
+		 * create the POST argument parser if not already existing,
+		 * it lives in the transaction arena and goes when it does
+		 */
 		if (!pss->spa) {
-			pss->spa = lws_urldecode_spa_create(param_names,
-					ARRAY_SIZE(param_names), 1024,
-					NULL, NULL);
+			pss->spa = lws_urldecode_spa_create_arena(wsi,
+					param_names, ARRAY_SIZE(param_names),
+					1024, NULL, NULL);
 			if (!pss->spa)
 				return -1;
 		}
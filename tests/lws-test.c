@@ -0,0 +1,109 @@
+/*
+ * libwebsockets - self-test helpers
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+#include "lws-test.h"
+
+#define WAIT_MS		3000 /* well under the tests' service timeouts */
+
+static unsigned long long rng = 0x9e3779b97f4a7c15ull;
+static int fails;
+
+void
+lws_test_init(unsigned long long seed)
+{
+	lws_set_log_level(LLL_ERR | LLL_WARN | LLL_NOTICE, NULL);
+	if (seed)
+		rng = seed;
+}
+
+unsigned int
+lws_test_rnd(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	return (unsigned int)(rng >> 16);
+}
+
+void
+lws_test_fail(void)
+{
+	lws_atomic_int_add(&fails, 1);
+}
+
+int
+lws_test_fails(void)
+{
+	return lws_atomic_int_add(&fails, 0);
+}
+
+int
+lws_test_get(int *p)
+{
+	return lws_atomic_int_add(p, 0);
+}
+
+int
+lws_test_add(int *p, int n)
+{
+	return lws_atomic_int_add(p, n);
+}
+
+int
+lws_test_wait_for(int *p, int want, const char *what)
+{
+	unsigned long long end = lws_plat_monotonic_ms() + WAIT_MS;
+
+	while (lws_test_get(p) != want) {
+		if (lws_plat_monotonic_ms() > end) {
+			lwsl_err("timed out waiting for %s (%d, wanted %d)\n",
+				 what, lws_test_get(p), want);
+			lws_test_fail();
+			return 1;
+		}
+#if defined(WIN32)
+		Sleep(1);
+#else
+		usleep(1000);
+#endif
+	}
+
+	return 0;
+}
+
+int
+lws_test_result(const char *what, int r)
+{
+	if (r) {
+		lwsl_err("%s: FAIL\n", what);
+		lws_test_fail();
+	} else
+		lwsl_notice("%s: pass\n", what);
+
+	return r;
+}
+
+int
+lws_test_exit(void)
+{
+	return !!lws_test_fails();
+}
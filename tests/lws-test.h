@@ -0,0 +1,65 @@
+/*
+ * libwebsockets - self-test helpers
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * What the self-tests in this directory share.  They test lws internals, so
+ * they see the private header and link the static library.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "private-libwebsockets.h"
+
+/* quiet enough that only problems and the results show, and seed rnd() */
+void
+lws_test_init(unsigned long long seed);
+
+/* xorshift, so a failure can be reproduced exactly */
+unsigned int
+lws_test_rnd(void);
+
+/* count a failure, from any thread */
+void
+lws_test_fail(void);
+
+/* how many failures so far */
+int
+lws_test_fails(void);
+
+/* log "what: pass" or "what: FAIL", counting it if r is nonzero */
+int
+lws_test_result(const char *what, int r);
+
+/* for tests with threads: read or add to a flag another thread uses */
+int
+lws_test_get(int *p);
+
+int
+lws_test_add(int *p, int n);
+
+/* wait until *p is want, or a few seconds, failing if it doesn't get there */
+int
+lws_test_wait_for(int *p, int want, const char *what);
+
+/* what main() should return */
+int
+lws_test_exit(void);
@@ -0,0 +1,319 @@
+/*
+ * libwebsockets - header table pool self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * Connections adopted on socketpairs take an ah from the pool as soon as
+ * they are adopted, or wait for one.  The test calls the pool directly from
+ * the service thread, between service passes, and after every step checks
+ * the pool's lists and counts still agree with each other.
+ *
+ *  - grow: the pool starts at its min, and grows up to its max
+ *
+ *  - fifo: past the max, connections wait, and are served in the order they
+ *    came however often the later ones try again.  Detach hands the ah
+ *    straight to the oldest waiter, and one that goes away while waiting
+ *    leaves the queue
+ *
+ *  - trim: ahs idle for a whole window are freed, coldest first, but never
+ *    below the min
+ */
+
+#include "lws-test.h"
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define AH_MIN		2
+#define AH_MAX		4
+#define CONNS		8
+
+static struct lws_context *context;
+static struct lws_context_per_thread *pt;
+static struct lws *w[CONNS];
+static int peer[CONNS];
+
+static int
+check_pool(const char *when)
+{
+	struct allocated_headers *ah;
+	struct lws *wsi, *last = NULL;
+	int alloc = 0, idle = 0, used = 0, waiting = 0;
+
+	for (ah = pt->ah_list; ah; ah = ah->next) {
+		alloc++;
+		if (!ah->in_use)
+			continue;
+		used++;
+		if (!ah->wsi || ah->wsi->u.hdr.ah != ah) {
+			lwsl_err("%s: ah %p isn't his owner's\n", when, ah);
+			return 1;
+		}
+	}
+	for (ah = pt->ah_free; ah; ah = ah->next_free) {
+		idle++;
+		if (ah->in_use || ah->wsi) {
+			lwsl_err("%s: ah %p is idle but used\n", when, ah);
+			return 1;
+		}
+	}
+	for (wsi = pt->ah_wait_list; wsi; wsi = wsi->u.hdr.ah_wait_list) {
+		waiting++;
+		last = wsi;
+		if (wsi->u.hdr.ah ||
+		    pt->fds[wsi->position_in_fds_table].events & LWS_POLLIN) {
+			lwsl_err("%s: waiter %p has an ah or POLLIN\n", when,
+				 wsi);
+			return 1;
+		}
+	}
+
+	if (alloc != pt->ah_count_alloc || used != pt->ah_count_in_use ||
+	    idle != alloc - used || alloc > AH_MAX ||
+	    waiting != pt->ah_wait_list_length ||
+	    last != pt->ah_wait_list_tail) {
+		lwsl_err("%s: %d allocated, %d used, %d idle, %d waiting, "
+			 "but the pool says %d, %d, -, %d\n", when, alloc,
+			 used, idle, waiting, pt->ah_count_alloc,
+			 pt->ah_count_in_use, pt->ah_wait_list_length);
+		return 1;
+	}
+
+	return 0;
+}
+
+static struct lws *
+adopt(int n)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		return NULL;
+	}
+	peer[n] = sv[1];
+	w[n] = lws_adopt_socket(context, sv[0]);
+
+	return w[n];
+}
+
+static void
+drop(int n)
+{
+	w[n]->socket_is_permanently_unusable = 1;
+	lws_close_free_wsi(w[n], LWS_CLOSE_STATUS_NOSTATUS);
+	w[n] = NULL;
+}
+
+/* the wait list, as the indexes of w[] */
+
+static int
+waiters_are(const int *want, int count)
+{
+	struct lws *wsi = pt->ah_wait_list;
+	int n;
+
+	for (n = 0; n < count; n++, wsi = wsi->u.hdr.ah_wait_list)
+		if (!wsi || wsi != w[want[n]]) {
+			lwsl_err("waiter %d is not w[%d]\n", n, want[n]);
+			return 1;
+		}
+	if (wsi) {
+		lwsl_err("more than %d waiting\n", count);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_grow(void)
+{
+	int n;
+
+	if (pt->ah_count_alloc != AH_MIN || check_pool("start")) {
+		lwsl_err("pool started at %d\n", pt->ah_count_alloc);
+		return 1;
+	}
+
+	for (n = 0; n < AH_MAX; n++)
+		if (!adopt(n) || !w[n]->u.hdr.ah || check_pool("grow"))
+			return 1;
+
+	if (pt->ah_count_alloc != AH_MAX ||
+	    pt->ah_stats.peak_in_use != AH_MAX) {
+		lwsl_err("pool is %d, peak %d\n", pt->ah_count_alloc,
+			 pt->ah_stats.peak_in_use);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_fifo(void)
+{
+	static const int q1[] = { 4, 5, 6 }, q2[] = { 5, 6 }, q3[] = { 7 };
+	struct allocated_headers *ah;
+	int n;
+
+	for (n = AH_MAX; n < AH_MAX + 3; n++)
+		if (!adopt(n) || w[n]->u.hdr.ah || check_pool("wait"))
+			return 1;
+	if (waiters_are(q1, 3))
+		return 1;
+
+	/* trying again doesn't get anyone ahead, or on the list twice */
+	if (!lws_header_table_attach(w[6], 0) ||
+	    !lws_header_table_attach(w[5], 0) || waiters_are(q1, 3) ||
+	    check_pool("retry"))
+		return 1;
+
+	/* an ah given back goes to the oldest waiter, not the pool */
+	ah = w[0]->u.hdr.ah;
+	if (lws_header_table_detach(w[0], 0) || w[4]->u.hdr.ah != ah ||
+	    !(pt->fds[w[4]->position_in_fds_table].events & LWS_POLLIN) ||
+	    waiters_are(q2, 2) || check_pool("handed on"))
+		return 1;
+
+	/* the last one gives up, the list must end at the one before */
+	drop(6);
+	if (waiters_are(q2, 1) || pt->ah_stats.starved != 1 ||
+	    check_pool("gave up"))
+		return 1;
+
+	/* closing with an ah also hands it on */
+	drop(1);
+	if (!w[5]->u.hdr.ah || waiters_are(q2, 0) || check_pool("closed"))
+		return 1;
+
+	/* a new waiter on the emptied list */
+	if (!adopt(7) || w[7]->u.hdr.ah || waiters_are(q3, 1))
+		return 1;
+	drop(2);
+	if (!w[7]->u.hdr.ah || waiters_are(q3, 0) || check_pool("again"))
+		return 1;
+
+	if (pt->ah_stats.waits != 4 || pt->ah_stats.served != 3) {
+		lwsl_err("%lu waits, %lu served\n", pt->ah_stats.waits,
+			 pt->ah_stats.served);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_trim(void)
+{
+	struct allocated_headers *warm[AH_MIN], *ah;
+	int n, m;
+
+	for (n = 0; n < CONNS; n++)
+		if (w[n])
+			drop(n);
+	if (pt->ah_count_in_use || pt->ah_count_alloc != AH_MAX ||
+	    check_pool("all idle"))
+		return 1;
+
+	/* all of them were in use during this window, so none go */
+	pt->now_ms = pt->ah_trim_ms + LWS_AH_TRIM_MS;
+	lws_pt_ah_pool_trim(pt);
+	if (pt->ah_count_alloc != AH_MAX || check_pool("busy window"))
+		return 1;
+
+	/* nobody used any in this one, all but the min go, the warmest stay */
+	ah = pt->ah_free;
+	for (n = 0; n < AH_MIN; n++, ah = ah->next_free)
+		warm[n] = ah;
+	pt->now_ms += LWS_AH_TRIM_MS;
+	lws_pt_ah_pool_trim(pt);
+	if (pt->ah_count_alloc != AH_MIN || check_pool("idle window"))
+		return 1;
+	for (n = 0; n < AH_MIN; n++) {
+		for (m = 0, ah = pt->ah_free; ah; ah = ah->next_free)
+			m |= ah == warm[n];
+		if (!m) {
+			lwsl_err("trimmed a warm ah\n");
+			return 1;
+		}
+	}
+
+	/* ...and no further */
+	pt->now_ms += LWS_AH_TRIM_MS;
+	lws_pt_ah_pool_trim(pt);
+	if (pt->ah_count_alloc != AH_MIN || pt->ah_stats.trimmed !=
+					    AH_MAX - AH_MIN) {
+		lwsl_err("trimmed below the min\n");
+		return 1;
+	}
+
+	return check_pool("min");
+}
+
+static int
+callback_test(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	      void *in, size_t len)
+{
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "test", callback_test, 0, 0, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+	int n;
+
+	lws_test_init(0);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.min_http_header_pool = AH_MIN;
+	info.max_http_header_pool = AH_MAX;
+	info.gid = -1;
+	info.uid = -1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		return 1;
+	}
+	pt = &context->pt[0];
+	for (n = 0; n < CONNS; n++)
+		peer[n] = -1;
+
+	/* the pool is filled when the service thread starts */
+	lws_service(context, 0);
+
+	if (!lws_test_result("grow", test_grow()) &&
+	    !lws_test_result("fifo", test_fifo()))
+		lws_test_result("trim", test_trim());
+
+	lws_context_destroy(context);
+	for (n = 0; n < CONNS; n++)
+		if (peer[n] >= 0)
+			close(peer[n]);
+
+	return lws_test_exit();
+}
@@ -0,0 +1,358 @@
+/*
+ * libwebsockets - fd lookup and pollfd table self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * One end of a socketpair is adopted for each connection, the other is kept
+ * here.
+ *
+ *  - pages: fds far apart, dup2()'d onto pages nobody has used, up to the
+ *    last fd the context allows.  A page must appear only when the first fd
+ *    on it does, and lookups outside max_fds or on missing pages must come
+ *    back NULL.  Closing must clear the entry but leave the page.
+ *
+ *  - grow: connections are added until the pollfd table is full.  It must
+ *    double from LWS_POLLFD_INITIAL, once as the service thread first runs
+ *    and then whenever it fills, stop at fd_limit_per_thread, keep every
+ *    entry as it was across each move, and free the old arrays on the next
+ *    service pass.  The last slot is always kept back, so adopting into it
+ *    must fail cleanly.
+ *
+ *  - remove: they're closed in a random order, each one moving the last
+ *    entry into its slot, and then the table is filled up again.
+ *
+ * After every change each entry must be where its wsi thinks it is.
+ */
+
+#include "lws-test.h"
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define LIMIT		300 /* fd_limit_per_thread */
+
+static struct lws_context *context;
+static struct lws *conn[LIMIT];
+static int peer[LIMIT], conns;
+
+static int
+check_table(void)
+{
+	struct lws_context_per_thread *pt = &context->pt[0];
+	struct lws *wsi;
+	unsigned int n;
+
+	if (pt->fds_count > pt->fds_alloc ||
+	    pt->fds_alloc > context->fd_limit_per_thread) {
+		lwsl_err("fds_count %u, alloc %u, limit %u\n", pt->fds_count,
+			 pt->fds_alloc, context->fd_limit_per_thread);
+		return 1;
+	}
+
+	for (n = 0; n < pt->fds_count; n++) {
+		if (pt->fds[n].fd == pt->dummy_pipe_fds[0])
+			continue; /* the wake fd has no wsi */
+		wsi = wsi_from_fd(context, pt->fds[n].fd);
+		if (!wsi || wsi->sock != pt->fds[n].fd ||
+		    wsi->position_in_fds_table != (int)n) {
+			lwsl_err("entry %u fd %d: wsi %p thinks %d\n", n,
+				 pt->fds[n].fd, wsi,
+				 wsi ? wsi->position_in_fds_table : -1);
+			return 1;
+		}
+	}
+
+	for (n = 0; n < (unsigned int)conns; n++)
+		if (wsi_from_fd(context, conn[n]->sock) != conn[n]) {
+			lwsl_err("lost fd %d\n", conn[n]->sock);
+			return 1;
+		}
+
+	return 0;
+}
+
+/* adopt one end of a new socketpair, on fd "at" if it's >= 0 */
+
+static struct lws *
+add_conn(int at)
+{
+	struct lws *wsi;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		return NULL;
+	}
+	if (at >= 0) {
+		if (dup2(sv[0], at) != at) {
+			lwsl_err("dup2 to %d failed\n", at);
+			close(sv[0]);
+			close(sv[1]);
+			return NULL;
+		}
+		close(sv[0]);
+		sv[0] = at;
+	}
+
+	wsi = lws_adopt_socket(context, sv[0]);
+	if (!wsi) {
+		/* he closed sv[0] already */
+		close(sv[1]);
+		return NULL;
+	}
+	conn[conns] = wsi;
+	peer[conns++] = sv[1];
+
+	return wsi;
+}
+
+static void
+close_conn(int n)
+{
+	struct lws *wsi = conn[n];
+
+	wsi->socket_is_permanently_unusable = 1;
+	lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
+	close(peer[n]);
+
+	conn[n] = conn[--conns];
+	peer[n] = peer[conns];
+}
+
+static int
+test_pages(void)
+{
+	int pages = context->fd_pages, last = context->max_fds - 1, fd, n;
+	struct lws *wsi;
+
+	if (wsi_from_fd(context, -1) ||
+	    wsi_from_fd(context, context->max_fds) ||
+	    wsi_from_fd(context, context->max_fds + LWS_FD_PAGE)) {
+		lwsl_err("lookup outside max_fds\n");
+		return 1;
+	}
+
+	if (last < 3 * LWS_FD_PAGE) {
+		lwsl_notice("only %d fds, not trying far pages\n",
+			    context->max_fds);
+		return 0;
+	}
+
+	/* nothing is on page 2 or the last page yet */
+	fd = 2 * LWS_FD_PAGE + 7;
+	if (lws_fd_page(context, fd) || lws_fd_page(context, last) ||
+	    wsi_from_fd(context, fd) || wsi_from_fd(context, last)) {
+		lwsl_err("page there already\n");
+		return 1;
+	}
+
+	wsi = add_conn(fd);
+	if (!wsi || context->fd_pages != pages + 1 ||
+	    !lws_fd_page(context, fd) || wsi_from_fd(context, fd) != wsi ||
+	    lws_fd_page(context, last)) {
+		lwsl_err("first fd on a page: %d pages\n", context->fd_pages);
+		return 1;
+	}
+
+	/* a neighbour shares it */
+	if (!add_conn(fd + LWS_FD_PAGE - 8) || context->fd_pages != pages + 1) {
+		lwsl_err("second fd on a page: %d pages\n", context->fd_pages);
+		return 1;
+	}
+
+	/* the very last fd gets the very last page */
+	wsi = add_conn(last);
+	if (!wsi || context->fd_pages != pages + 2 ||
+	    wsi_from_fd(context, last) != wsi) {
+		lwsl_err("last fd: %d pages\n", context->fd_pages);
+		return 1;
+	}
+
+	if (check_table())
+		return 1;
+
+	/* closing them clears the entry and keeps the page */
+	for (n = conns - 1; n >= 0; n--) {
+		fd = conn[n]->sock;
+		close_conn(n);
+		if (wsi_from_fd(context, fd) || !lws_fd_page(context, fd) ||
+		    check_table()) {
+			lwsl_err("fd %d still there after close\n", fd);
+			return 1;
+		}
+	}
+
+	return context->fd_pages != pages + 2;
+}
+
+static int
+test_grow(void)
+{
+	struct lws_context_per_thread *pt = &context->pt[0];
+	struct lws_pollfd *before;
+	unsigned int alloc = LWS_POLLFD_INITIAL, count;
+
+	before = malloc(sizeof(*before) * LIMIT);
+	if (!before)
+		return 1;
+
+	if (pt->fds_alloc != alloc) {
+		lwsl_err("started with %u\n", pt->fds_alloc);
+		goto bail;
+	}
+
+	/* the first pass moves it to the service thread, growing it once */
+	lws_service(context, 0);
+	alloc *= 2;
+	if (pt->fds_alloc != alloc || pt->fds_retired) {
+		lwsl_err("first pass left %u\n", pt->fds_alloc);
+		goto bail;
+	}
+
+	while (pt->fds_count < context->fd_limit_per_thread - 1) {
+		/* some stop reading, so not every entry is the same */
+		if (conns && !(lws_test_rnd() % 4))
+			lws_change_pollfd(conn[lws_test_rnd() % conns],
+					  LWS_POLLIN, 0);
+
+		count = pt->fds_count;
+		memcpy(before, pt->fds, sizeof(*before) * count);
+
+		if (!add_conn(-1))
+			goto bail;
+
+		if (count == alloc) {
+			alloc *= 2;
+			if (alloc > context->fd_limit_per_thread)
+				alloc = context->fd_limit_per_thread;
+			if (!pt->fds_retired) {
+				lwsl_err("nothing retired at %u\n", count);
+				goto bail;
+			}
+		}
+		if (pt->fds_alloc != alloc ||
+		    memcmp(before, pt->fds, sizeof(*before) * count)) {
+			lwsl_err("at %u: alloc %u, expected %u, or moved "
+				 "wrong\n", count, pt->fds_alloc, alloc);
+			goto bail;
+		}
+		if (check_table())
+			goto bail;
+
+		/* the next pass frees what was outgrown */
+		if (pt->fds_retired) {
+			lws_service(context, 0);
+			if (pt->fds_retired) {
+				lwsl_err("not reaped\n");
+				goto bail;
+			}
+		}
+	}
+
+	if (alloc != context->fd_limit_per_thread) {
+		lwsl_err("full at %u\n", alloc);
+		goto bail;
+	}
+
+	/* one too many */
+	count = pt->fds_count;
+	if (add_conn(-1) || pt->fds_count != count ||
+	    pt->fds_alloc != alloc || pt->fds_retired) {
+		lwsl_err("went past the limit\n");
+		goto bail;
+	}
+
+	free(before);
+
+	return check_table();
+
+bail:
+	free(before);
+
+	return 1;
+}
+
+static int
+test_remove(void)
+{
+	struct lws_context_per_thread *pt = &context->pt[0];
+	unsigned int count;
+	int fd, n;
+
+	while (conns) {
+		n = lws_test_rnd() % conns;
+		fd = conn[n]->sock;
+		count = pt->fds_count;
+
+		close_conn(n);
+		if (pt->fds_count != count - 1 || wsi_from_fd(context, fd) ||
+		    check_table())
+			return 1;
+	}
+
+	/* back up to full, without growing any more */
+	while (pt->fds_count < context->fd_limit_per_thread - 1)
+		if (!add_conn(-1) || check_table())
+			return 1;
+
+	return pt->fds_alloc != context->fd_limit_per_thread ||
+	       pt->fds_retired != NULL;
+}
+
+static int
+callback_http(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	      void *in, size_t len)
+{
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "http", callback_http, 0, 0, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+
+	lws_test_init(0);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.fd_limit_per_thread = LIMIT;
+	info.gid = -1;
+	info.uid = -1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		return 1;
+	}
+
+	lws_test_result("pages", test_pages());
+	if (!lws_test_result("grow", test_grow()))
+		lws_test_result("remove", test_remove());
+
+	while (conns)
+		close_conn(conns - 1);
+	lws_context_destroy(context);
+
+	return lws_test_exit();
+}
@@ -0,0 +1,211 @@
+/*
+ * libwebsockets - ws masking self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * lws_ws_xor_mask() with each kernel this cpu can run forced in turn,
+ * against doing it a byte at a time.
+ *
+ *  - lengths: every length up to a few times the widest kernel step, so
+ *    every tail the kernels leave is covered, at every mask phase and
+ *    alignment, in place and not, and without touching anything past the
+ *    end.
+ *
+ *  - rolling: a long payload unmasked in random pieces, carrying the mask
+ *    index on from one to the next the way the rx path does, must come out
+ *    the same as doing it in one go.
+ *
+ * Given "bench", it times each kernel at a few payload sizes instead.
+ */
+
+#include "lws-test.h"
+
+#define MAX_LEN		300
+#define GUARD		16
+#define ROLL_LEN	8192
+#define ROLLS		200
+#define BENCH_MS	250
+
+static const char * const kernel_name[] = { "64-bit", "sse2", "avx2" };
+
+static int
+test_lengths(void)
+{
+	unsigned char in[MAX_LEN + 2 * GUARD], out[MAX_LEN + 2 * GUARD],
+		      ref[MAX_LEN], mask[4];
+	int len, idx, align, inplace, t, n;
+	unsigned char *o, *i;
+
+	for (len = 0; len <= MAX_LEN; len++)
+		for (t = 0; t < 8 * 8 * 2; t++) {
+			idx = t & 7;
+			align = (t >> 3) & 7;
+			inplace = t >> 6;
+
+			for (n = 0; n < 4; n++)
+				mask[n] = lws_test_rnd();
+			for (n = 0; n < (int)sizeof(in); n++) {
+				in[n] = lws_test_rnd();
+				out[n] = ~in[n];
+			}
+
+			i = in + GUARD + align;
+			o = inplace ? i : out + GUARD + ((align * 3) & 7);
+			for (n = 0; n < len; n++)
+				ref[n] = i[n] ^ mask[(idx + n) & 3];
+
+			if (inplace)
+				memcpy(out, in, sizeof(in));
+
+			lws_ws_xor_mask(o, i, len, mask, idx);
+
+			if (memcmp(o, ref, len)) {
+				lwsl_err("len %d idx %d align %d%s: wrong\n",
+					 len, idx, align,
+					 inplace ? " in place" : "");
+				return 1;
+			}
+
+			/* nothing either side of it may change */
+			if (inplace) {
+				if (memcmp(in, out, GUARD + align) ||
+				    memcmp(i + len, out + (i + len - in),
+					   sizeof(in) - (i + len - in))) {
+					lwsl_err("len %d idx %d align %d in "
+						 "place: overran\n", len, idx,
+						 align);
+					return 1;
+				}
+				continue;
+			}
+			for (n = 0; n < (int)sizeof(out); n++)
+				if ((out + n < o || out + n >= o + len) &&
+				    out[n] != (unsigned char)~in[n]) {
+					lwsl_err("len %d idx %d align %d: "
+						 "overran\n", len, idx, align);
+					return 1;
+				}
+		}
+
+	return 0;
+}
+
+static int
+test_rolling(void)
+{
+	static unsigned char in[ROLL_LEN + 8], out[ROLL_LEN + 8], ref[ROLL_LEN];
+	unsigned char mask[4];
+	size_t at, len, n;
+	int round, idx, start, align;
+
+	for (round = 0; round < ROLLS; round++) {
+		for (n = 0; n < 4; n++)
+			mask[n] = lws_test_rnd();
+		for (n = 0; n < sizeof(in); n++)
+			in[n] = lws_test_rnd();
+
+		align = lws_test_rnd() % 8;
+		idx = start = lws_test_rnd() % 4;
+		for (n = 0; n < ROLL_LEN; n++)
+			ref[n] = in[align + n] ^ mask[(start + n) & 3];
+
+		for (at = 0; at < ROLL_LEN; at += len) {
+			/* mostly what's left of a read after a header */
+			len = 1 + lws_test_rnd() % (lws_test_rnd() % 4 ? 70 :
+								    1500);
+			if (len > ROLL_LEN - at)
+				len = ROLL_LEN - at;
+			lws_ws_xor_mask(out + at, in + align + at, len, mask,
+					idx);
+			idx = (idx + len) & 3;
+		}
+
+		if (memcmp(out, ref, ROLL_LEN)) {
+			lwsl_err("round %d: wrong\n", round);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+bench(int kernel)
+{
+	static const size_t sizes[] = { 16, 125, 1500, 16384, 1 << 20 };
+	unsigned long long start, ms, bytes;
+	unsigned char *buf, mask[4] = { 1, 2, 3, 4 };
+	unsigned int s;
+	int n;
+
+	buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	if (!buf)
+		return;
+	memset(buf, 0x55, sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		bytes = 0;
+		start = lws_plat_monotonic_ms();
+		do {
+			for (n = 0; n < 64; n++)
+				lws_ws_xor_mask(buf, buf, sizes[s], mask, n);
+			bytes += 64 * sizes[s];
+			ms = lws_plat_monotonic_ms() - start;
+		} while (ms < BENCH_MS);
+
+		lwsl_notice("%-6s %7lu bytes: %8.0f MB/s\n",
+			    kernel_name[kernel], (unsigned long)sizes[s],
+			    (double)bytes / (ms * 1000.0));
+	}
+
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	int kernel, benching = argc > 1 && !strcmp(argv[1], "bench");
+	char what[32];
+
+	lws_test_init(0x853c49e6748fea9bull);
+
+	for (kernel = 0; kernel < LWS_WS_MASK_COUNT; kernel++) {
+		if (lws_ws_mask_force(kernel)) {
+			lwsl_notice("%s: not on this cpu\n",
+				    kernel_name[kernel]);
+			continue;
+		}
+
+		if (benching) {
+			bench(kernel);
+			continue;
+		}
+
+		snprintf(what, sizeof(what), "%s lengths",
+			 kernel_name[kernel]);
+		lws_test_result(what, test_lengths());
+		snprintf(what, sizeof(what), "%s rolling",
+			 kernel_name[kernel]);
+		lws_test_result(what, test_rolling());
+	}
+
+	lws_ws_mask_init();
+
+	return lws_test_exit();
+}
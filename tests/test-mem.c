@@ -0,0 +1,279 @@
+/*
+ * libwebsockets - memory accounting self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * Two service threads, both serviced in turn from here, so the test can
+ * look at everything between passes.  Connections are adopted on
+ * socketpairs: "small" is an http connection on thread 0, "big" is a ws
+ * connection using a protocol with a large per-session allocation, that is
+ * moved to thread 1 by lws_migrate_wsi() as the balancer would.
+ *
+ *  - booked: what the vhost, each protocol and each thread is said to hold
+ *    is what the connections on them hold, before and after the move
+ *
+ *  - shed: with the vhost one byte over budget, the thread holding the most
+ *    closes its biggest connection, which is "big" on thread 1, and nothing
+ *    else is closed
+ */
+
+#include "lws-test.h"
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define BIG_PSS		20000
+#define ROUNDS		100
+
+static const char get[] = "GET / HTTP/1.1\r\n\r\n";
+static const char upgrade[] = "GET / HTTP/1.1\r\n"
+			      "Host: localhost\r\n"
+			      "Upgrade: websocket\r\n"
+			      "Connection: Upgrade\r\n"
+			      "Sec-WebSocket-Protocol: big\r\n"
+			      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+			      "Sec-WebSocket-Version: 13\r\n\r\n";
+
+static struct lws_context *context;
+static struct lws_vhost *vh;
+static struct lws *small, *big;
+static int peer[3] = { -1, -1, -1 }, closed_small, closed_big;
+
+static void
+service_all(void)
+{
+	int n;
+
+	for (n = 0; n < 2; n++)
+		lws_service_tsi(context, 0, n);
+}
+
+static struct lws *
+adopt(int n, const char *rx, size_t len)
+{
+	struct lws *wsi;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		return NULL;
+	}
+	peer[n] = sv[1];
+	if (rx)
+		wsi = lws_adopt_socket_readbuf(context, sv[0], rx, len);
+	else
+		wsi = lws_adopt_socket(context, sv[0]);
+	if (!wsi)
+		lwsl_err("adopt failed\n");
+
+	return wsi;
+}
+
+static unsigned long long
+held(struct lws *wsi)
+{
+	unsigned long long t = 0;
+	int n;
+
+	for (n = 0; wsi && n < LWSMT_COUNT; n++)
+		t += wsi->mem[n];
+
+	return t;
+}
+
+static unsigned long long
+thread_held(int tsi)
+{
+	long long t = 0;
+	int n;
+
+	for (n = 0; n < LWSMT_COUNT; n++)
+		t += vh->stats[tsi].mem.held[n];
+
+	return (unsigned long long)t;
+}
+
+static unsigned long long
+total(const struct lws_protocols *prot)
+{
+	struct lws_mem_info info;
+
+	if (lws_mem_get_info(vh, prot, &info))
+		return ~0ull;
+
+	return info.total;
+}
+
+/* what's booked everywhere agrees with what small and big hold */
+
+static int
+check_books(const char *when)
+{
+	unsigned long long s = held(small), b = held(big), t[2] = { 0, 0 };
+
+	if (small)
+		t[(int)small->tsi] += s;
+	if (big)
+		t[(int)big->tsi] += b;
+
+	if (total(NULL) != s + b || total(&vh->protocols[0]) != s ||
+	    total(&vh->protocols[1]) != b || thread_held(0) != t[0] ||
+	    thread_held(1) != t[1]) {
+		lwsl_err("%s: small %llu, big %llu, but vhost %llu, http %llu, "
+			 "big %llu, threads %llu %llu\n", when, s, b,
+			 total(NULL), total(&vh->protocols[0]),
+			 total(&vh->protocols[1]), thread_held(0),
+			 thread_held(1));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_booked(void)
+{
+	struct lws *dummy;
+	int n;
+
+	/* big lands on thread 0, dummy on 1, so small is on 0 too */
+	big = adopt(0, upgrade, sizeof(upgrade) - 1);
+	dummy = adopt(1, NULL, 0);
+	small = adopt(2, get, sizeof(get) - 1);
+	if (!big || !dummy || !small)
+		return 1;
+	if (big->tsi || dummy->tsi != 1 || small->tsi) {
+		lwsl_err("adopted to threads %d %d %d\n", big->tsi, dummy->tsi,
+			 small->tsi);
+		return 1;
+	}
+	dummy->socket_is_permanently_unusable = 1;
+	lws_close_free_wsi(dummy, LWS_CLOSE_STATUS_NOSTATUS);
+
+	/* until big is past his upgrade and has given back his ah */
+	for (n = 0; n < ROUNDS && (big->state != LWSS_ESTABLISHED ||
+				   big->u.hdr.ah); n++)
+		service_all();
+	if (n == ROUNDS) {
+		lwsl_err("big didn't get established\n");
+		return 1;
+	}
+	if (big->protocol != &vh->protocols[1] ||
+	    big->mem[LWSMT_USER] != BIG_PSS || check_books("established"))
+		return 1;
+
+	if (lws_migrate_wsi(big, 1)) {
+		lwsl_err("couldn't move big\n");
+		return 1;
+	}
+
+	return check_books("moved");
+}
+
+static int
+test_shed(void)
+{
+	unsigned long long s = held(small);
+	struct lws_mem_info info;
+	int n;
+
+	vh->mem_budget = total(NULL) - 1;
+	context->mem_over = 1;
+
+	for (n = 0; n < ROUNDS && !closed_big && !closed_small; n++)
+		service_all();
+
+	if (!closed_big || closed_small) {
+		lwsl_err("closed %s\n", closed_small ? "small" : "nothing");
+		return 1;
+	}
+	if (lws_mem_get_info(vh, NULL, &info) || info.shed != 1 ||
+	    info.total != s) {
+		lwsl_err("%lu shed, %llu held\n", info.shed, info.total);
+		return 1;
+	}
+
+	return check_books("shed");
+}
+
+static int
+callback_test(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	      void *in, size_t len)
+{
+	switch (reason) {
+	case LWS_CALLBACK_WSI_DESTROY:
+		if (wsi == small) {
+			small = NULL;
+			closed_small = 1;
+		}
+		if (wsi == big) {
+			big = NULL;
+			closed_big = 1;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "http", callback_test, 64, 0, },
+	{ "big", callback_test, BIG_PSS, 0, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+	int n;
+
+	lws_test_init(0);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.count_threads = 2;
+	info.gid = -1;
+	info.uid = -1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		return 1;
+	}
+	if (lws_get_count_threads(context) != 2) {
+		lwsl_notice("mem: skipped, only one service thread\n");
+		lws_context_destroy(context);
+		return 0;
+	}
+	vh = context->vhost_list;
+	service_all();
+
+	if (!lws_test_result("booked", test_booked()))
+		lws_test_result("shed", test_shed());
+
+	lws_context_destroy(context);
+	for (n = 0; n < 3; n++)
+		if (peer[n] >= 0)
+			close(peer[n]);
+
+	return lws_test_exit();
+}
@@ -0,0 +1,325 @@
+/*
+ * libwebsockets - thread migration self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * Two service threads.  A ws connection is adopted on one end of a
+ * socketpair, and moved from one thread to the other and back with
+ * lws_migrate_wsi(), called from his own thread as the balancer does.
+ * Every callback he gets must come on the thread that owns him then.
+ *
+ *  - moved: after moving, his rx and his timer that was already set come on
+ *    the new thread, and so does a writable posted with lws_pt_cmd_writable()
+ *    before he moved that his old thread only drained after
+ *
+ *  - close: likewise a close that was queued for him on his old thread is
+ *    passed on to the new one, not acted on by the old one
+ */
+
+#include "lws-test.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+static const char upgrade[] = "GET / HTTP/1.1\r\n"
+			      "Host: localhost\r\n"
+			      "Upgrade: websocket\r\n"
+			      "Connection: Upgrade\r\n"
+			      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+			      "Sec-WebSocket-Version: 13\r\n\r\n";
+
+/* "hi" from the client, with a zero mask */
+static const char frame[] = "\x81\x82\0\0\0\0hi";
+
+static struct lws_context *context;
+static pthread_t svc_tid[2];
+static struct lws *wsi_m;
+static int sv[2] = { -1, -1 };
+static int blocked[2], released[2], established, received, writable, timer,
+	   moved, checked, destroyed, done;
+
+static void
+check_owner(struct lws *wsi, const char *what)
+{
+	if (!pthread_equal(pthread_self(), svc_tid[(int)wsi->tsi])) {
+		lwsl_err("%s for tsi %d on the wrong thread\n", what,
+			 (int)wsi->tsi);
+		lws_test_fail();
+	}
+}
+
+static void
+block_cb(struct lws_context *context, int tsi, void *user)
+{
+	int n = lws_test_add(&blocked[tsi], 1);
+
+	lws_test_wait_for(&released[tsi], n, "release");
+}
+
+/* keep a service thread in its command drain until release() */
+
+static int
+hold(int tsi)
+{
+	int n = lws_test_get(&blocked[tsi]) + 1;
+
+	lws_pt_cmd_run(context, tsi, block_cb, NULL);
+
+	return lws_test_wait_for(&blocked[tsi], n, "block");
+}
+
+static void
+release(int tsi)
+{
+	lws_test_add(&released[tsi], 1);
+}
+
+static void
+adopt_cb(struct lws_context *context, int tsi, void *user)
+{
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		lws_test_fail();
+		return;
+	}
+	if (!lws_adopt_socket_readbuf(context, sv[0], upgrade,
+				      sizeof(upgrade) - 1)) {
+		lwsl_err("adopt failed\n");
+		lws_test_fail();
+	}
+}
+
+static void
+timer_cb(struct lws_context *context, int tsi, void *user)
+{
+	lws_set_timer_ms(wsi_m, 50);
+}
+
+static void
+migrate_cb(struct lws_context *context, int tsi, void *user)
+{
+	int to = (int)(intptr_t)user;
+
+	if (wsi_m->tsi != tsi || wsi_m->u.hdr.ah ||
+	    lws_migrate_wsi(wsi_m, to) || wsi_m->tsi != to) {
+		lwsl_err("couldn't move from %d to %d\n", tsi, to);
+		lws_test_fail();
+	}
+	lws_test_add(&moved, 1);
+}
+
+/* the thread he left must not have acted on the close */
+
+static void
+not_closed_cb(struct lws_context *context, int tsi, void *user)
+{
+	if (wsi_m->state != LWSS_ESTABLISHED) {
+		lwsl_err("the old thread closed him\n");
+		lws_test_fail();
+	}
+	lws_test_add(&checked, 1);
+}
+
+/* ...his new one must have */
+
+static void
+closed_cb(struct lws_context *context, int tsi, void *user)
+{
+	if (wsi_m->state == LWSS_ESTABLISHED) {
+		lwsl_err("the close was lost\n");
+		lws_test_fail();
+	}
+	/* he waits for the peer to hang up */
+	close(sv[1]);
+	lws_test_add(&checked, 1);
+}
+
+static int
+send_frame(void)
+{
+	if (write(sv[1], frame, sizeof(frame) - 1) != sizeof(frame) - 1) {
+		lwsl_err("write failed\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_moved(int from, int to)
+{
+	if (send_frame() || lws_test_wait_for(&received, 1, "rx"))
+		return 1;
+
+	if (hold(from))
+		return 1;
+	lws_pt_cmd_run(context, from, timer_cb, NULL);
+	lws_pt_cmd_run(context, from, migrate_cb, (void *)(intptr_t)to);
+	lws_pt_cmd_writable(wsi_m);
+	release(from);
+
+	if (lws_test_wait_for(&moved, 1, "move") ||
+	    lws_test_wait_for(&writable, 1, "writable") ||
+	    send_frame() || lws_test_wait_for(&received, 2, "rx after move") ||
+	    lws_test_wait_for(&timer, 1, "timer"))
+		return 1;
+
+	return lws_test_fails();
+}
+
+static int
+test_close(int from, int to)
+{
+	/* hold his new thread too, so a close passed on waits there */
+	if (hold(to) || hold(from))
+		return 1;
+	lws_pt_cmd_run(context, from, migrate_cb, (void *)(intptr_t)to);
+	lws_pt_cmd_close(wsi_m);
+	lws_pt_cmd_run(context, from, not_closed_cb, NULL);
+	release(from);
+	if (lws_test_wait_for(&checked, 1, "old thread"))
+		return 1;
+
+	lws_pt_cmd_run(context, to, closed_cb, NULL);
+	release(to);
+
+	if (lws_test_wait_for(&checked, 2, "new thread") ||
+	    lws_test_wait_for(&destroyed, 1, "close"))
+		return 1;
+
+	return lws_test_fails();
+}
+
+static int
+callback_test(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	      void *in, size_t len)
+{
+	switch (reason) {
+	case LWS_CALLBACK_ESTABLISHED:
+		check_owner(wsi, "established");
+		wsi_m = wsi;
+		lws_test_add(&established, 1);
+		break;
+	case LWS_CALLBACK_RECEIVE:
+		check_owner(wsi, "rx");
+		if (len != 2 || memcmp(in, "hi", 2)) {
+			lwsl_err("rx wrong\n");
+			lws_test_fail();
+		}
+		lws_test_add(&received, 1);
+		break;
+	case LWS_CALLBACK_SERVER_WRITEABLE:
+		check_owner(wsi, "writable");
+		lws_test_add(&writable, 1);
+		break;
+	case LWS_CALLBACK_TIMER:
+		check_owner(wsi, "timer");
+		lws_test_add(&timer, 1);
+		break;
+	case LWS_CALLBACK_MIGRATE_THREAD:
+		check_owner(wsi, "migrate");
+		break;
+	case LWS_CALLBACK_WSI_DESTROY:
+		check_owner(wsi, "destroy");
+		if (wsi == wsi_m)
+			lws_test_add(&destroyed, 1);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "test", callback_test, 0, 0, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+static void *
+service(void *user)
+{
+	int tsi = (int)(intptr_t)user;
+
+	while (!lws_test_get(&done))
+		lws_service_tsi(context, 10000, tsi);
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+	int m, from;
+	char buf[256];
+
+	lws_test_init(0);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.count_threads = 2;
+	info.gid = -1;
+	info.uid = -1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		return 1;
+	}
+	if (lws_get_count_threads(context) != 2) {
+		lwsl_notice("migrate: skipped, only one service thread\n");
+		lws_context_destroy(context);
+		return 0;
+	}
+
+	for (m = 0; m < 2; m++)
+		if (pthread_create(&svc_tid[m], NULL, service,
+				   (void *)(intptr_t)m)) {
+			lwsl_err("pthread_create failed\n");
+			lws_test_fail();
+			goto stop;
+		}
+
+	lws_pt_cmd_run(context, 0, adopt_cb, NULL);
+	if (lws_test_wait_for(&established, 1, "established"))
+		goto stop;
+	/* the 101 */
+	if (read(sv[1], buf, sizeof(buf)) <= 0) {
+		lwsl_err("no upgrade response\n");
+		lws_test_fail();
+		goto stop;
+	}
+
+	from = wsi_m->tsi;
+	if (!lws_test_result("moved", test_moved(from, !from)))
+		lws_test_result("close", test_close(!from, from));
+
+stop:
+	lws_test_add(&done, 1);
+	lws_cancel_service(context);
+	while (m--)
+		pthread_join(svc_tid[m], NULL);
+
+	lws_context_destroy(context);
+
+	return lws_test_exit();
+}
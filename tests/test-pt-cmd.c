@@ -0,0 +1,327 @@
+/*
+ * libwebsockets - cross-thread command self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * main() is the service thread, sleeping in lws_service() with a long
+ * timeout, so anything that isn't woken by the command queue shows up as a
+ * stall.  A control thread does the tests:
+ *
+ *  - several threads post lws_pt_cmd_run() at once, in bursts, and each
+ *    command must run once, on the service thread, in the order its poster
+ *    posted it, without waiting for the service timeout
+ *
+ *  - a writable and a close posted for a connection that has gone, and had
+ *    its fd reused, by the time the service thread gets to them must be
+ *    dropped, while the same commands for a live connection are acted on
+ */
+
+#include "lws-test.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define POSTERS		4
+#define POSTS		2000
+
+struct run {
+	unsigned long long posted_us;
+	int poster, seq;
+};
+
+static struct lws_context *context;
+static pthread_t service_tid;
+static struct run *runs;
+static int last_seq[POSTERS];
+static int ran, done;
+static unsigned long long worst_us;
+
+static struct lws *wsi_a, *wsi_b;
+static int sv_a[2] = { -1, -1 }, sv_b[2] = { -1, -1 };
+static int destroyed, writable_b, blocked, released, stale_done;
+
+static void
+on_service_thread(const char *what)
+{
+	if (!pthread_equal(pthread_self(), service_tid)) {
+		lwsl_err("%s ran on the wrong thread\n", what);
+		lws_test_fail();
+	}
+}
+
+static void
+run_cb(struct lws_context *context, int tsi, void *user)
+{
+	struct run *r = user;
+	unsigned long long us = lws_plat_monotonic_us() - r->posted_us;
+
+	on_service_thread("run");
+	if (r->seq != last_seq[r->poster] + 1) {
+		lwsl_err("poster %d: ran %d after %d\n", r->poster, r->seq,
+			 last_seq[r->poster]);
+		lws_test_fail();
+	}
+	last_seq[r->poster] = r->seq;
+	if (us > worst_us)
+		worst_us = us;
+
+	lws_test_add(&ran, 1);
+}
+
+static void *
+poster(void *user)
+{
+	int p = (int)(intptr_t)user, n;
+	struct run *r = &runs[p * POSTS];
+
+	for (n = 0; n < POSTS; n++) {
+		r[n].poster = p;
+		r[n].seq = n;
+		r[n].posted_us = lws_plat_monotonic_us();
+		if (lws_pt_cmd_run(context, 0, run_cb, &r[n])) {
+			lwsl_err("post failed\n");
+			lws_test_fail();
+		}
+		/* let the queue empty now and then, so we need a wake */
+		if (!(rand() % 64))
+			usleep(rand() % 2000);
+	}
+
+	return NULL;
+}
+
+static int
+test_run(void)
+{
+	pthread_t t[POSTERS];
+	int n;
+
+	for (n = 0; n < POSTERS; n++)
+		last_seq[n] = -1;
+
+	for (n = 0; n < POSTERS; n++)
+		if (pthread_create(&t[n], NULL, poster, (void *)(intptr_t)n)) {
+			lwsl_err("pthread_create failed\n");
+			return 1;
+		}
+	for (n = 0; n < POSTERS; n++)
+		pthread_join(t[n], NULL);
+
+	lws_test_wait_for(&ran, POSTERS * POSTS, "runs");
+	lwsl_notice("run: %d commands, slowest %lluus\n", lws_test_get(&ran),
+		    worst_us);
+
+	return lws_test_fails();
+}
+
+/* already past its headers, so a writable request gets a callback */
+
+static struct lws *
+adopt(int *sv)
+{
+	static const char req[] = "GET / HTTP/1.1\r\n\r\n";
+	struct lws *wsi;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		lws_test_fail();
+		return NULL;
+	}
+	wsi = lws_adopt_socket_readbuf(context, sv[0], req, sizeof(req) - 1);
+	if (!wsi) {
+		lwsl_err("adopt failed\n");
+		lws_test_fail();
+	}
+
+	return wsi;
+}
+
+static void
+adopt_a_cb(struct lws_context *context, int tsi, void *user)
+{
+	on_service_thread("adopt");
+	wsi_a = adopt(sv_a);
+	lws_test_add(&stale_done, 1);
+}
+
+static void
+block_cb(struct lws_context *context, int tsi, void *user)
+{
+	lws_test_add(&blocked, 1);
+	lws_test_wait_for(&released, 1, "release");
+}
+
+/*
+ * Runs just ahead of the commands for wsi_a in the same drain.  Close him
+ * without waiting for the peer, then adopt a new socket, which gets his fd
+ * back and very likely his struct too.
+ */
+
+static void
+replace_a_cb(struct lws_context *context, int tsi, void *user)
+{
+	unsigned int gen = wsi_a->gen;
+
+	wsi_a->socket_is_permanently_unusable = 1;
+	lws_close_free_wsi(wsi_a, LWS_CLOSE_STATUS_NOSTATUS);
+	close(sv_a[1]);
+
+	wsi_b = adopt(sv_b);
+	if (!wsi_b)
+		return;
+
+	lwsl_notice("stale: fd %s, struct %s\n",
+		    sv_b[0] == sv_a[0] ? "reused" : "new",
+		    wsi_b == wsi_a && wsi_b->gen != gen ? "reused" : "new");
+}
+
+static void
+stale_done_cb(struct lws_context *context, int tsi, void *user)
+{
+	if (wsi_b && wsi_b->state == LWSS_SHUTDOWN) {
+		lwsl_err("stale close reached the new wsi\n");
+		lws_test_fail();
+	}
+	lws_test_add(&stale_done, 1);
+}
+
+static int
+test_stale(void)
+{
+	lws_pt_cmd_run(context, 0, adopt_a_cb, NULL);
+	if (lws_test_wait_for(&stale_done, 1, "adopt") || !wsi_a)
+		return 1;
+
+	/* hold the service thread, so everything below is drained at once */
+	lws_pt_cmd_run(context, 0, block_cb, NULL);
+	if (lws_test_wait_for(&blocked, 1, "block"))
+		return 1;
+
+	lws_pt_cmd_run(context, 0, replace_a_cb, NULL);
+	lws_pt_cmd_writable(wsi_a);
+	lws_pt_cmd_close(wsi_a);
+	lws_pt_cmd_run(context, 0, stale_done_cb, NULL);
+	lws_test_add(&released, 1);
+
+	if (lws_test_wait_for(&stale_done, 2, "stale commands") || !wsi_b ||
+	    lws_test_fails())
+		return 1;
+
+	usleep(100000);
+	if (lws_test_get(&writable_b) || lws_test_get(&destroyed) != 1) {
+		lwsl_err("stale writable reached the new wsi\n");
+		lws_test_fail();
+		return 1;
+	}
+
+	/* the same commands for a live connection do get through */
+
+	lws_pt_cmd_writable(wsi_b);
+	if (lws_test_wait_for(&writable_b, 1, "writable"))
+		return 1;
+
+	lws_pt_cmd_close(wsi_b);
+	close(sv_b[1]);
+	if (lws_test_wait_for(&destroyed, 2, "close"))
+		return 1;
+
+	return lws_test_fails();
+}
+
+static void *
+control(void *user)
+{
+	if (!lws_test_result("run", test_run()))
+		lws_test_result("stale", test_stale());
+
+	lws_test_add(&done, 1);
+	lws_cancel_service(context);
+
+	return NULL;
+}
+
+static int
+callback_test(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	      void *in, size_t len)
+{
+	switch (reason) {
+	case LWS_CALLBACK_WSI_DESTROY:
+		lws_test_add(&destroyed, 1);
+		break;
+	case LWS_CALLBACK_HTTP_WRITEABLE:
+		on_service_thread("writable");
+		if (wsi == wsi_b)
+			lws_test_add(&writable_b, 1);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "test", callback_test, 0, 0, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+	pthread_t t;
+
+	lws_test_init(0);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.gid = -1;
+	info.uid = -1;
+
+	runs = malloc(sizeof(*runs) * POSTERS * POSTS);
+	if (!runs)
+		return 1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		free(runs);
+		return 1;
+	}
+
+	service_tid = pthread_self();
+	if (pthread_create(&t, NULL, control, NULL)) {
+		lwsl_err("pthread_create failed\n");
+		lws_test_fail();
+		goto bail;
+	}
+
+	while (!lws_test_get(&done))
+		lws_service(context, 10000);
+
+	pthread_join(t, NULL);
+
+bail:
+	lws_context_destroy(context);
+	free(runs);
+
+	return lws_test_exit();
+}
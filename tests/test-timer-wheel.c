@@ -0,0 +1,206 @@
+/*
+ * libwebsockets - timer wheel self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * This drives the service thread's clock by hand instead of sleeping, so it
+ * can check that every timer fires on exactly the ms it was due, whether it
+ * started in l0, had to cascade down from the upper levels, or was parked
+ * beyond the top level.
+ */
+
+#include "lws-test.h"
+
+#define COUNT_MS	600
+#define COUNT_CASCADE	2000
+
+struct tt {
+	struct lws_timer t;
+	unsigned long long want;
+	int hits, want_hits;
+	int resched; /* ms to schedule again from the callback, or 0 */
+	int cancelled;
+};
+
+static struct lws_context *context;
+static struct lws_context_per_thread *pt;
+static struct tt *tts;
+
+static void
+cb(struct lws_timer *t)
+{
+	struct tt *p = lws_container_of(t, struct tt, t);
+
+	if (p->cancelled) {
+		lwsl_err("%d: fired after cancel\n", (int)(p - tts));
+		lws_test_fail();
+	}
+
+	if (pt->now_ms != p->want) {
+		lwsl_err("%d: fired at %llu, due %llu\n", (int)(p - tts),
+			 pt->now_ms, p->want);
+		lws_test_fail();
+	}
+	p->hits++;
+
+	if (p->resched) {
+		p->want = pt->now_ms + p->resched;
+		lws_timer_schedule(context, 0, t, cb, p->resched);
+		p->resched = 0;
+	}
+}
+
+static void
+sched(struct tt *p, unsigned int ms)
+{
+	p->want = pt->now_ms + ms;
+	p->want_hits = 1;
+	lws_timer_schedule(context, 0, &p->t, cb, ms);
+}
+
+static int
+check(int count)
+{
+	int n;
+
+	for (n = 0; n < count; n++)
+		if (!tts[n].cancelled && tts[n].hits != tts[n].want_hits) {
+			lwsl_err("%d: %d hits, wanted %d\n", n, tts[n].hits,
+				 tts[n].want_hits);
+			lws_test_fail();
+		}
+
+	if (pt->tw->count) {
+		lwsl_err("%u timers left on the wheel\n", pt->tw->count);
+		lws_test_fail();
+	}
+
+	return lws_test_fails();
+}
+
+/* every ms in turn, l0 only */
+
+static int
+test_ms(void)
+{
+	int n;
+
+	memset(tts, 0, sizeof(*tts) * COUNT_MS);
+	for (n = 0; n < COUNT_MS; n++)
+		sched(&tts[n], 1 + (n % ((1 << LWS_TW_L0_BITS) - 1)));
+
+	while (pt->tw->count && lws_test_fails() < 20) {
+		pt->now_ms++;
+		lws_timer_wheel_service(pt);
+	}
+
+	return check(COUNT_MS);
+}
+
+/*
+ * Delays spread over every level and past the top one, some cancelled, some
+ * rescheduled from their own callback.  The clock jumps straight to when
+ * lws_timer_wheel_next_ms() says the wheel next needs service, or sometimes
+ * less as if something else woke the thread.
+ */
+
+static int
+test_cascade(void)
+{
+	unsigned long long span;
+	int n, level, ms;
+
+	memset(tts, 0, sizeof(*tts) * COUNT_CASCADE);
+	for (n = 0; n < COUNT_CASCADE; n++) {
+		level = lws_test_rnd() % (LWS_TW_LEVELS + 2);
+		span = 1ull << (LWS_TW_L0_BITS + level * LWS_TW_LN_BITS);
+		if (level > LWS_TW_LEVELS)
+			span = (1ull << (LWS_TW_L0_BITS + LWS_TW_LEVELS *
+					 LWS_TW_LN_BITS)) * 2;
+		sched(&tts[n], 1 + (unsigned int)(lws_test_rnd() % span));
+		if (!(lws_test_rnd() % 8)) {
+			tts[n].resched = 1 + lws_test_rnd() % 5000;
+			tts[n].want_hits = 2;
+		}
+	}
+
+	for (n = 0; n < COUNT_CASCADE / 10; n++) {
+		level = lws_test_rnd() % COUNT_CASCADE;
+		lws_timer_cancel(context, 0, &tts[level].t);
+		tts[level].cancelled = 1;
+	}
+
+	while (pt->tw->count && lws_test_fails() < 20) {
+		ms = lws_timer_wheel_next_ms(pt);
+		if (ms > 1 && !(lws_test_rnd() % 4))
+			ms = 1 + lws_test_rnd() % (ms - 1);
+		pt->now_ms += ms;
+		lws_timer_wheel_service(pt);
+	}
+
+	return check(COUNT_CASCADE);
+}
+
+static int
+callback_dummy(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	       void *in, size_t len)
+{
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "dummy", callback_dummy, 0, 0, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+
+	lws_test_init(0);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.gid = -1;
+	info.uid = -1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		return 1;
+	}
+	pt = &context->pt[0];
+
+	tts = malloc(sizeof(*tts) * COUNT_CASCADE);
+	if (!tts) {
+		lws_test_fail();
+		goto bail;
+	}
+
+	if (!lws_test_result("ms expiry", test_ms()))
+		lws_test_result("cascade", test_cascade());
+
+bail:
+	free(tts);
+	lws_context_destroy(context);
+
+	return lws_test_exit();
+}
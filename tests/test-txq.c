@@ -0,0 +1,506 @@
+/*
+ * libwebsockets - send queue self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * An http connection is adopted on one end of a socketpair, and the other
+ * end is read here in the service loop, slowly and in fits, so most writes
+ * only partly go out and the rest is queued.
+ *
+ *  - partial: lws_write() and lws_write_vec() of every size from a byte to
+ *    many queue segments, the vec ones in up to LWS_WRITE_VEC_MAX pieces,
+ *    some of them empty, made whether or not something is already queued.
+ *    Every byte must arrive once and in order, a write made behind
+ *    something queued must join the queue whole, and the queue's accounting
+ *    must always add up.
+ *
+ *  - limits: lws_write_vec() must refuse no segments or too many without
+ *    touching the queue, and segments that are all empty send nothing.
+ *
+ *  - blocked: the queue as it is left after a TLS write that blocked.
+ *    lws_txq_reserve() must give the whole remainder one contiguous
+ *    segment even when it is appended in pieces, as the vec path does, so
+ *    the retry can start with the same bytes.  Then it must drain in order
+ *    like anything else.
+ *
+ *  - ws: the partial test again on a ws server connection, where the vec
+ *    path sends the frame header as one more segment in front.  The frames
+ *    are taken apart here and must carry the stream in order.
+ */
+
+#include "lws-test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#define TOTAL		(8 * 1024 * 1024)
+#define MAX_WRITE	(5 * LWS_TXQ_SEG_SIZE + 123)
+#define MAX_QUEUED	(1024 * 1024)
+#define TIMEOUT_MS	20000
+
+static struct lws_context *context;
+static struct lws *wsi_t;
+static int sv[2] = { -1, -1 };
+static unsigned char *buf;
+static size_t sent, received, total = TOTAL;
+static int writing, ws, established;
+
+/* taking apart the ws frames the server sends */
+static unsigned char fh[10];
+static size_t frame_left;
+static int fh_len;
+
+/* the byte at position n of the stream */
+
+static unsigned char
+pattern(size_t n)
+{
+	unsigned int x = (unsigned int)n * 2654435761u;
+
+	return (unsigned char)((x ^ (x >> 15)) >> 24);
+}
+
+static void
+fill(unsigned char *p, size_t pos, size_t len)
+{
+	while (len--)
+		*p++ = pattern(pos++);
+}
+
+static int
+check_queue(struct lws *wsi)
+{
+	struct lws_context_per_thread *pt = &context->pt[(int)wsi->tsi];
+	struct lws_txq_node *q;
+	size_t n = 0;
+
+	for (q = wsi->txq; q; q = q->next) {
+		if (!q->next && q != wsi->txq_tail) {
+			lwsl_err("txq tail is wrong\n");
+			return 1;
+		}
+		n += q->len;
+	}
+
+	if (n != wsi->trunc_len || n != pt->txq_bytes) {
+		lwsl_err("queue has %lu, trunc_len %u, pt %lu\n",
+			 (unsigned long)n, wsi->trunc_len,
+			 (unsigned long)pt->txq_bytes);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* the ws frame header lws_write() puts in front of len bytes */
+
+static size_t
+framing(size_t len)
+{
+	if (!ws)
+		return 0;
+
+	return len < 126 ? 2 : len < 65536 ? 4 : 10;
+}
+
+static int
+write_one(struct lws *wsi)
+{
+	enum lws_write_protocol wp = ws ? LWS_WRITE_BINARY : LWS_WRITE_HTTP;
+	struct lws_iov iov[LWS_WRITE_VEC_MAX];
+	size_t len, left, queued = wsi->trunc_len;
+	int n, count;
+
+	len = 1 + lws_test_rnd() % (lws_test_rnd() % 4 ? LWS_TXQ_SEG_SIZE * 2 :
+							 MAX_WRITE);
+	if (len > total - sent)
+		len = total - sent;
+	fill(buf + LWS_PRE, sent, len);
+
+	if (lws_test_rnd() % 2) {
+		n = lws_write(wsi, buf + LWS_PRE, len, wp);
+	} else {
+		/* the same bytes, cut into pieces, some of them empty */
+		count = 1 + lws_test_rnd() % LWS_WRITE_VEC_MAX;
+		left = len;
+		for (n = 0; n < count; n++) {
+			iov[n].base = buf + LWS_PRE + (len - left);
+			if (n == count - 1)
+				iov[n].len = left;
+			else if (!(lws_test_rnd() % 4))
+				iov[n].len = 0;
+			else
+				iov[n].len = lws_test_rnd() % (left + 1);
+			left -= iov[n].len;
+		}
+		n = lws_write_vec(wsi, iov, count, wp);
+	}
+
+	if (n != (int)len) {
+		lwsl_err("write of %lu returned %d\n", (unsigned long)len, n);
+		return 1;
+	}
+	sent += len;
+
+	/* behind something queued, none of it may go ahead */
+	if (queued ? wsi->trunc_len != queued + framing(len) + len :
+		     wsi->trunc_len > framing(len) + len) {
+		lwsl_err("write of %lu with %lu queued left %u\n",
+			 (unsigned long)len, (unsigned long)queued,
+			 wsi->trunc_len);
+		return 1;
+	}
+
+	return check_queue(wsi);
+}
+
+/* one more byte of a ws frame header from the server */
+
+static int
+frame_header(unsigned char c)
+{
+	int need, n;
+
+	fh[fh_len++] = c;
+	if (fh_len < 2)
+		return 0;
+	need = (fh[1] & 0x7f) == 126 ? 4 : (fh[1] & 0x7f) == 127 ? 10 : 2;
+	if (fh_len < need)
+		return 0;
+
+	if (fh[0] != (0x80 | LWSWSOPC_BINARY_FRAME) || fh[1] & 0x80) {
+		lwsl_err("bad frame header %02x %02x at %lu\n", fh[0], fh[1],
+			 (unsigned long)received);
+		return 1;
+	}
+	if (need == 2)
+		frame_left = fh[1];
+	else
+		for (frame_left = 0, n = 2; n < need; n++)
+			frame_left = (frame_left << 8) | fh[n];
+	fh_len = 0;
+
+	return 0;
+}
+
+/* read some of what's arrived and check it's what was sent, in order */
+
+static int
+read_some(size_t max)
+{
+	unsigned char rx[16384];
+	ssize_t n, m;
+
+	if (max > sizeof(rx))
+		max = sizeof(rx);
+	n = read(sv[1], rx, max);
+	if (n <= 0)
+		return 0;
+
+	for (m = 0; m < n; m++) {
+		if (ws && !frame_left) {
+			if (frame_header(rx[m]))
+				return 1;
+			continue;
+		}
+		if (rx[m] != pattern(received)) {
+			lwsl_err("stream wrong at %lu\n",
+				 (unsigned long)received);
+			return 1;
+		}
+		received++;
+		if (ws)
+			frame_left--;
+	}
+
+	return 0;
+}
+
+static int
+service_until(size_t want)
+{
+	unsigned long long end = lws_plat_monotonic_ms() + TIMEOUT_MS;
+
+	while (received < want || (wsi_t && wsi_t->trunc_len)) {
+		if (lws_test_fails() || lws_plat_monotonic_ms() > end) {
+			lwsl_err("stuck at %lu of %lu\n",
+				 (unsigned long)received, (unsigned long)want);
+			return 1;
+		}
+		lws_service(context, 0);
+		/* sometimes let it back up */
+		if (lws_test_rnd() % 4 && read_some(1 + lws_test_rnd() % 16384))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_partial(void)
+{
+	static const char req[] = "GET / HTTP/1.1\r\n\r\n";
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		return 1;
+	}
+	/* as the listener would have left it */
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+
+	writing = 1;
+	wsi_t = lws_adopt_socket_readbuf(context, sv[0], req, sizeof(req) - 1);
+	if (!wsi_t) {
+		lwsl_err("adopt failed\n");
+		return 1;
+	}
+
+	return service_until(total) || lws_test_fails();
+}
+
+static int
+test_blocked(void)
+{
+	size_t len = 3 * LWS_TXQ_SEG_SIZE + 77, at = 0, m;
+	struct lws_txq_node *q;
+
+	/* nothing needs reserving for what fits a segment anyway */
+	if (lws_txq_reserve(wsi_t, LWS_TXQ_SEG_SIZE) || wsi_t->txq) {
+		lwsl_err("reserved for a small write\n");
+		return 1;
+	}
+
+	/* what the vec path does after the TLS write blocked */
+	if (lws_txq_reserve(wsi_t, len)) {
+		lwsl_err("reserve failed\n");
+		return 1;
+	}
+	fill(buf, sent, len);
+	while (at < len) {
+		m = 1 + lws_test_rnd() % LWS_TXQ_SEG_SIZE;
+		if (m > len - at)
+			m = len - at;
+		if (lws_txq_append(wsi_t, buf + at, m))
+			return 1;
+		at += m;
+	}
+	sent += len;
+
+	q = wsi_t->txq;
+	if (!q || q->next || q->len != len || q->p != lws_txbuf_data(q->b) ||
+	    memcmp(q->p, buf, len)) {
+		lwsl_err("blocked write not in one segment\n");
+		return 1;
+	}
+
+	/* a reserve behind something queued doesn't change anything */
+	if (lws_txq_reserve(wsi_t, len) || wsi_t->txq != q || q->next) {
+		lwsl_err("reserved behind the queue\n");
+		return 1;
+	}
+
+	/* later writes queue behind it as usual */
+	fill(buf, sent, 100);
+	if (lws_txq_append(wsi_t, buf, 100) || !q->next ||
+	    q->next->len != 100 || check_queue(wsi_t))
+		return 1;
+	sent += 100;
+
+	lws_callback_on_writable(wsi_t);
+
+	return service_until(sent);
+}
+
+static int
+test_limits(void)
+{
+	struct lws_iov iov[LWS_WRITE_VEC_MAX + 1];
+	int n;
+
+	for (n = 0; n <= LWS_WRITE_VEC_MAX; n++) {
+		iov[n].base = buf;
+		iov[n].len = 0;
+	}
+
+	if (lws_write_vec(wsi_t, iov, 0, LWS_WRITE_HTTP) != -1 ||
+	    lws_write_vec(wsi_t, iov, LWS_WRITE_VEC_MAX + 1,
+			  LWS_WRITE_HTTP) != -1 || wsi_t->trunc_len) {
+		lwsl_err("took a bad segment count\n");
+		return 1;
+	}
+
+	if (lws_write_vec(wsi_t, iov, LWS_WRITE_VEC_MAX, LWS_WRITE_HTTP) ||
+	    wsi_t->trunc_len) {
+		lwsl_err("empty segments sent something\n");
+		return 1;
+	}
+
+	return check_queue(wsi_t);
+}
+
+static int
+test_ws(void)
+{
+	static const char upgrade[] = "GET / HTTP/1.1\r\n"
+				      "Host: localhost\r\n"
+				      "Upgrade: websocket\r\n"
+				      "Connection: Upgrade\r\n"
+				      "Sec-WebSocket-Key: "
+					      "dGhlIHNhbXBsZSBub25jZQ==\r\n"
+				      "Sec-WebSocket-Protocol: test\r\n"
+				      "Sec-WebSocket-Version: 13\r\n\r\n";
+	unsigned long long end = lws_plat_monotonic_ms() + TIMEOUT_MS;
+	int crlf = 0;
+	char c;
+
+	/* the http connection goes away when it sees its peer close */
+	close(sv[1]);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		return 1;
+	}
+	/* as the listener would have left it */
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+
+	sent = received = 0;
+	total = TOTAL / 4;
+	ws = 1;
+	wsi_t = lws_adopt_socket_readbuf(context, sv[0], upgrade,
+					 sizeof(upgrade) - 1);
+	if (!wsi_t) {
+		lwsl_err("adopt failed\n");
+		return 1;
+	}
+	while (!established) {
+		if (!wsi_t || lws_plat_monotonic_ms() > end) {
+			lwsl_err("upgrade failed\n");
+			return 1;
+		}
+		lws_service(context, 0);
+	}
+
+	/* the 101 went out before he was established, skip it */
+	while (crlf < 4) {
+		if (read(sv[1], &c, 1) != 1) {
+			lwsl_err("no 101\n");
+			return 1;
+		}
+		crlf = c == "\r\n\r\n"[crlf] ? crlf + 1 : c == '\r';
+	}
+
+	writing = 1;
+
+	return service_until(total) || lws_test_fails() || frame_left ||
+	       fh_len;
+}
+
+static int
+writeable(struct lws *wsi)
+{
+	int n;
+
+	if (!writing)
+		return 0;
+	for (n = 1 + lws_test_rnd() % 3; n && sent < total; n--)
+		if (write_one(wsi)) {
+			lws_test_fail();
+			return -1;
+		}
+	if (sent == total) {
+		writing = 0;
+		return 0;
+	}
+	/* usually keep writing whatever is still queued */
+	if (wsi->trunc_len < MAX_QUEUED || !(lws_test_rnd() % 8))
+		lws_callback_on_writable(wsi);
+
+	return 0;
+}
+
+static int
+callback_test(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	      void *in, size_t len)
+{
+	switch (reason) {
+	case LWS_CALLBACK_ESTABLISHED:
+		established = 1;
+		/* fallthru */
+	case LWS_CALLBACK_HTTP:
+		lws_callback_on_writable(wsi);
+		break;
+
+	case LWS_CALLBACK_HTTP_WRITEABLE:
+	case LWS_CALLBACK_SERVER_WRITEABLE:
+		return writeable(wsi);
+
+	case LWS_CALLBACK_WSI_DESTROY:
+		if (wsi == wsi_t)
+			wsi_t = NULL;
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "test", callback_test, 0, 0, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+
+	lws_test_init(0x2545f4914f6cdd1dull);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.gid = -1;
+	info.uid = -1;
+
+	buf = malloc(LWS_PRE + MAX_WRITE);
+	if (!buf)
+		return 1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		free(buf);
+		return 1;
+	}
+
+	if (!lws_test_result("partial", test_partial()) &&
+	    !lws_test_result("limits", !wsi_t || test_limits()) &&
+	    !lws_test_result("blocked", !wsi_t || test_blocked()))
+		lws_test_result("ws", test_ws());
+
+	lws_context_destroy(context);
+	if (sv[1] >= 0)
+		close(sv[1]);
+	free(buf);
+
+	return lws_test_exit();
+}
@@ -0,0 +1,328 @@
+/*
+ * libwebsockets - UTF-8 validation self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * lws_check_utf8() with each kernel this cpu can run forced in turn, against
+ * a plain decoder following table 3-7 of the Unicode standard.  Each kernel
+ * gets the same random text: long ASCII runs so the SIMD kernels get used,
+ * every kind of character including the edges of the ranges, and for half of
+ * it one corruption.  It's fed in one piece and in random fragments that
+ * split sequences anywhere.  The fragment holding the first byte that makes
+ * it invalid must be the one that fails, and between fragments the state
+ * must be 0 exactly at character boundaries.
+ */
+
+#include "lws-test.h"
+
+#define MAX_TEXT	4096
+#define ROUNDS		20000
+#define SPLITS		8
+
+#define SEED		0xda942042e4dd58b5ull
+
+static const char * const kernel_name[] = { "scalar", "ssse3", "avx2" };
+static unsigned char text[MAX_TEXT + 8];
+static unsigned char boundary[MAX_TEXT + 8 + 1];
+
+/*
+ * How far the text is a prefix of valid UTF-8, so len if it's all good.
+ * *open is set if it ends partway through a character.  boundary[] marks
+ * where characters start.
+ */
+
+static size_t
+ref_valid(const unsigned char *p, size_t len, int *open)
+{
+	static const unsigned char lo[] = { 0xa0, 0x80, 0x80, 0x90, 0x80, 0x80 },
+				   hi[] = { 0xbf, 0xbf, 0x9f, 0xbf, 0xbf, 0x8f };
+	size_t i = 0;
+	int need, k, r;
+	unsigned char c;
+
+	memset(boundary, 0, len + 1);
+	*open = 0;
+
+	while (i < len) {
+		boundary[i] = 1;
+		c = p[i];
+		r = 1; /* which lo / hi the second byte checks against */
+		if (c < 0x80)
+			need = 0;
+		else if (c >= 0xc2 && c <= 0xdf)
+			need = 1;
+		else if (c == 0xe0) {
+			need = 2;
+			r = 0;
+		} else if (c == 0xed) {
+			need = 2;
+			r = 2;
+		} else if (c >= 0xe1 && c <= 0xef)
+			need = 2;
+		else if (c == 0xf0) {
+			need = 3;
+			r = 3;
+		} else if (c >= 0xf1 && c <= 0xf3) {
+			need = 3;
+			r = 4;
+		} else if (c == 0xf4) {
+			need = 3;
+			r = 5;
+		} else
+			return i;
+		i++;
+
+		for (k = 0; k < need; k++, i++) {
+			if (i == len) {
+				*open = 1;
+				return len;
+			}
+			if (p[i] < (k ? 0x80 : lo[r]) ||
+			    p[i] > (k ? 0xbf : hi[r]))
+				return i;
+		}
+	}
+	boundary[len] = 1;
+
+	return len;
+}
+
+static size_t
+encode(unsigned char *p, unsigned int cp)
+{
+	if (cp < 0x80) {
+		p[0] = cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		p[0] = 0xc0 | (cp >> 6);
+		p[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+	if (cp < 0x10000) {
+		p[0] = 0xe0 | (cp >> 12);
+		p[1] = 0x80 | ((cp >> 6) & 0x3f);
+		p[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	p[0] = 0xf0 | (cp >> 18);
+	p[1] = 0x80 | ((cp >> 12) & 0x3f);
+	p[2] = 0x80 | ((cp >> 6) & 0x3f);
+	p[3] = 0x80 | (cp & 0x3f);
+
+	return 4;
+}
+
+/* a valid character, often one at the edge of a range */
+
+static unsigned int
+codepoint(void)
+{
+	static const unsigned int edge[] = {
+		0, 0x7f, 0x80, 0x7ff, 0x800, 0xfff, 0x1000, 0xd7ff, 0xe000,
+		0xfffd, 0xffff, 0x10000, 0x3ffff, 0x40000, 0xfffff, 0x100000,
+		0x10ffff
+	};
+	unsigned int cp;
+
+	switch (lws_test_rnd() % 5) {
+	case 0:
+		return edge[lws_test_rnd() % (sizeof(edge) / sizeof(edge[0]))];
+	case 1:
+		return 0x80 + lws_test_rnd() % (0x800 - 0x80);
+	case 2:
+		do
+			cp = 0x800 + lws_test_rnd() % (0x10000 - 0x800);
+		while (cp >= 0xd800 && cp < 0xe000);
+		return cp;
+	case 3:
+		return 0x10000 + lws_test_rnd() % (0x110000 - 0x10000);
+	}
+
+	return lws_test_rnd() % 0x80;
+}
+
+static const unsigned char never[] = { 0xc0, 0xc1, 0xf5, 0xff, 0x80, 0xbf };
+static const char * const wrong[] = {
+	"\xe0\x9f\xbf\x41", /* overlong */
+	"\xed\xa0\x80\x41", /* surrogate */
+	"\xf4\x90\x80\x80", /* above U+10FFFF */
+};
+
+static size_t
+make_text(void)
+{
+	size_t len = 0, n, target = lws_test_rnd() % MAX_TEXT;
+
+	while (len < target) {
+		if (!(lws_test_rnd() % 8)) {
+			/* a run of ASCII long enough for the kernels */
+			n = lws_test_rnd() % 200;
+			if (n > MAX_TEXT - len)
+				n = MAX_TEXT - len;
+			while (n--)
+				text[len++] = 0x20 + lws_test_rnd() % 0x5f;
+			continue;
+		}
+		if (len + 4 > MAX_TEXT)
+			break;
+		len += encode(text + len, codepoint());
+	}
+
+	if (!len || lws_test_rnd() % 2)
+		return len;
+
+	/* break it somehow */
+	n = lws_test_rnd() % len;
+	switch (lws_test_rnd() % 4) {
+	case 0: /* any byte */
+		text[n] = lws_test_rnd();
+		break;
+	case 1: /* something that's never allowed */
+		text[n] = never[lws_test_rnd() % (sizeof(never) / sizeof(never[0]))];
+		break;
+	case 2: /* overlong, surrogate or too big */
+		if (len + 4 > MAX_TEXT)
+			len -= 4;
+		n = lws_test_rnd() % (sizeof(wrong) / sizeof(wrong[0]));
+		memcpy(text + len, wrong[n], 4);
+		len += 4;
+		break;
+	default: /* cut off in the middle of a character */
+		text[len++] = 0xe0 + lws_test_rnd() % 0x15;
+		break;
+	}
+
+	return len;
+}
+
+/* check it in the given fragments, returns nonzero if it disagrees */
+
+static int
+check(size_t len, const size_t *cut, int cuts, size_t bad, int open)
+{
+	unsigned char state = 0;
+	size_t start = 0, end;
+	int n, r;
+
+	for (n = 0; n <= cuts; n++) {
+		end = n == cuts ? len : cut[n];
+		r = lws_check_utf8(&state, text + start, end - start);
+
+		if (r != (bad < end)) {
+			lwsl_err("len %lu, bad at %lu: fragment %lu-%lu "
+				 "said %d\n", (unsigned long)len,
+				 (unsigned long)bad, (unsigned long)start,
+				 (unsigned long)end, r);
+			return 1;
+		}
+		if (r)
+			return 0;
+
+		if ((state == 0) != boundary[end]) {
+			lwsl_err("len %lu: state %02x at %lu\n",
+				 (unsigned long)len, state,
+				 (unsigned long)end);
+			return 1;
+		}
+		start = end;
+	}
+
+	if ((state == 0) == open) {
+		lwsl_err("len %lu: ended in state %02x\n", (unsigned long)len,
+			 state);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+cmp_size(const void *a, const void *b)
+{
+	size_t x = *(const size_t *)a, y = *(const size_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int
+test_corpus(int kernel)
+{
+	static size_t cut[MAX_TEXT + 8];
+	int round, n, cuts, open, fails = 0, invalid = 0;
+	size_t len, bad;
+
+	for (round = 0; round < ROUNDS && fails < 20; round++) {
+		len = make_text();
+		bad = ref_valid(text, len, &open);
+		if (bad == len)
+			bad = (size_t)-1;
+		invalid += bad != (size_t)-1 || open;
+
+		/* all in one */
+		if (check(len, cut, 0, bad, open))
+			fails++;
+
+		/* a byte at a time */
+		if (!(round % 16)) {
+			for (cuts = 0; cuts < (int)len; cuts++)
+				cut[cuts] = cuts;
+			if (check(len, cut, cuts, bad, open))
+				fails++;
+		}
+
+		/* chopped up anyhow */
+		for (n = 0; len && n < SPLITS; n++) {
+			for (cuts = 0; cuts < SPLITS * 8 && lws_test_rnd() % (n + 2);
+			     cuts++)
+				cut[cuts] = lws_test_rnd() % (len + 1);
+			qsort(cut, cuts, sizeof(cut[0]), cmp_size);
+			if (check(len, cut, cuts, bad, open))
+				fails++;
+		}
+	}
+
+	if (!fails)
+		lwsl_notice("%s: %d texts, %d invalid\n", kernel_name[kernel],
+			    round, invalid);
+
+	return fails;
+}
+
+int main(int argc, char **argv)
+{
+	int kernel;
+
+	for (kernel = 0; kernel < LWS_UTF8_COUNT; kernel++) {
+		if (lws_utf8_force(kernel)) {
+			lwsl_notice("%s: not on this cpu\n",
+				    kernel_name[kernel]);
+			continue;
+		}
+
+		/* the same texts for each */
+		lws_test_init(SEED);
+		lws_test_result(kernel_name[kernel], test_corpus(kernel));
+	}
+
+	lws_utf8_init();
+
+	return lws_test_exit();
+}
@@ -0,0 +1,602 @@
+/*
+ * libwebsockets - ws frame parsing self-test
+ *
+ * Copyright (C) 2010-2016 Andy Green <andy@warmcat.com>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation:
+ *  version 2.1 of the License.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+
+/*
+ * The bulk frame header decode against the byte at a time parser, for the
+ * server and the client.
+ *
+ * Random streams of frames are made: fragmented messages, empty fragments,
+ * every length encoding including ones wider than they need to be, masked,
+ * unmasked and masked with zeros, pings and pongs between fragments, and
+ * sometimes a frame the parser must reject followed by more it must never
+ * see.  Each stream goes to a fresh connection's rx loop a byte at a time,
+ * which never leaves the bulk path anything to do, then all in one go, then
+ * cut up anywhere.
+ *
+ * Since spills only depend on the frames and the rx buffer size, every way
+ * of feeding it must give exactly the same callbacks, with the same flags
+ * and remaining payload, and stop in the same place.  The byte at a time run
+ * must also have delivered what was sent.
+ */
+
+#include "lws-test.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ROUNDS		60
+#define RX_BUF		1000
+#define MAX_STREAM	(320 * 1024)
+#define MAX_LOG		(2 * MAX_STREAM)
+#define TIMEOUT_MS	5000
+
+enum {
+	FEED_BYTES,
+	FEED_WHOLE,
+	FEED_CUTS,
+
+	FEED_COUNT
+};
+
+static const char * const feed_name[] = { "bytes", "whole", "cuts" };
+
+struct log {
+	unsigned char *p;
+	size_t len;
+	size_t stopped; /* where the rx loop gave up, or 0 */
+};
+
+static struct lws_context *context;
+static unsigned char *stream, *sent;
+static size_t stream_len, sent_len, bad_at;
+static struct log ref, run, *log_to;
+static int listen_fd = -1, port, established, overflowed;
+
+/* the callback reason, flags and remaining payload, then what it got */
+
+static void
+log_rx(struct lws *wsi, int reason, const void *in, size_t len)
+{
+	size_t left = lws_remaining_packet_payload(wsi);
+	unsigned char h[10];
+
+	h[0] = reason;
+	h[1] = lws_is_final_fragment(wsi) | lws_frame_is_binary(wsi) << 1;
+	h[2] = len >> 24;
+	h[3] = len >> 16;
+	h[4] = len >> 8;
+	h[5] = len;
+	h[6] = left >> 24;
+	h[7] = left >> 16;
+	h[8] = left >> 8;
+	h[9] = left;
+
+	if (log_to->len + sizeof(h) + len > MAX_LOG) {
+		overflowed = 1;
+		return;
+	}
+	memcpy(log_to->p + log_to->len, h, sizeof(h));
+	if (len)
+		memcpy(log_to->p + log_to->len + sizeof(h), in, len);
+	log_to->len += sizeof(h) + len;
+}
+
+/* add a frame to the stream, sent[] gets the payload if it's data */
+
+static void
+frame(int fin, int opcode, const unsigned char *pay, size_t len)
+{
+	unsigned char *p = stream + stream_len, mask[4];
+	int n, enc, masked;
+	size_t m;
+
+	*p++ = (fin ? 0x80 : 0) | opcode;
+
+	/* the shortest length encoding, or sometimes a wider one */
+	enc = len < 126 ? 0 : (len < 65536 ? 1 : 2);
+	if (!(opcode & 8) && enc < 2 && !(lws_test_rnd() % 6))
+		enc += 1 + lws_test_rnd() % (2 - enc);
+
+	masked = lws_test_rnd() % 4 ? 0x80 : 0;
+	switch (enc) {
+	case 0:
+		*p++ = masked | len;
+		break;
+	case 1:
+		*p++ = masked | 126;
+		*p++ = len >> 8;
+		*p++ = len;
+		break;
+	default:
+		*p++ = masked | 127;
+		for (n = 7; n >= 0; n--)
+			*p++ = (unsigned char)((unsigned long long)len >>
+					       (n * 8));
+		break;
+	}
+
+	memset(mask, 0, sizeof(mask));
+	if (masked) {
+		if (lws_test_rnd() % 6)
+			for (n = 0; n < 4; n++)
+				mask[n] = lws_test_rnd();
+		memcpy(p, mask, 4);
+		p += 4;
+	}
+	for (m = 0; m < len; m++)
+		p[m] = pay[m] ^ mask[m & 3];
+	stream_len = (p + len) - stream;
+
+	if (!(opcode & 8)) {
+		memcpy(sent + sent_len, pay, len);
+		sent_len += len;
+	}
+}
+
+static void
+control(void)
+{
+	unsigned char pay[125];
+	size_t len = lws_test_rnd() % 3 ? lws_test_rnd() % 16 :
+					  lws_test_rnd() % sizeof(pay), n;
+
+	for (n = 0; n < len; n++)
+		pay[n] = lws_test_rnd();
+	frame(1, lws_test_rnd() % 2 ? LWSWSOPC_PING : LWSWSOPC_PONG, pay, len);
+}
+
+/* something the parser has to kill the connection for */
+
+static void
+reject(void)
+{
+	static const unsigned char bad[][10] = {
+		/* a ping with a 16-bit length */
+		{ 0x89, 0x7e, 0x00, 0x02 },
+		/* a pong with a 64-bit length */
+		{ 0x8a, 0x7f, 0, 0, 0, 0, 0, 0, 0, 2 },
+		/* b63 of the length set */
+		{ 0x82, 0x7f, 0x80, 0, 0, 0, 0, 0, 0, 2 },
+		/* an opcode that doesn't exist */
+		{ 0x83, 0x02 },
+	};
+	/* how long each is, and the byte it must give up on */
+	static const unsigned char len[] = { 4, 10, 10, 2 },
+				   at[] = { 2, 2, 3, 1 };
+	int n = lws_test_rnd() % 4;
+
+	memcpy(stream + stream_len, bad[n], len[n]);
+	bad_at = stream_len + at[n];
+	stream_len += len[n];
+
+	/* and then something it must never get to */
+	memset(stream + stream_len, 'x', 16);
+	stream_len += 16;
+}
+
+static void
+make_stream(void)
+{
+	static unsigned char pay[100000];
+	size_t target = 1 + lws_test_rnd() % (MAX_STREAM - 2 * sizeof(pay)),
+	       len, n;
+	int frags, opcode, text;
+
+	stream_len = sent_len = 0;
+	bad_at = 0;
+
+	while (stream_len < target) {
+		if (!(lws_test_rnd() % 8)) {
+			control();
+			continue;
+		}
+
+		text = lws_test_rnd() % 2;
+		opcode = text ? LWSWSOPC_TEXT_FRAME : LWSWSOPC_BINARY_FRAME;
+		frags = 1 + (lws_test_rnd() % 3 ? 0 : lws_test_rnd() % 4);
+
+		while (frags--) {
+			switch (lws_test_rnd() % 8) {
+			case 0:
+				/* only the last fragment can't be empty */
+				len = frags ? 0 : 1;
+				break;
+			case 1:
+			case 2:
+				len = 126 + lws_test_rnd() % (65536 - 126);
+				break;
+			case 3:
+				len = 65536 + lws_test_rnd() %
+					      (sizeof(pay) - 65536);
+				break;
+			default:
+				len = 1 + lws_test_rnd() % 125;
+				break;
+			}
+			if (stream_len + len > MAX_STREAM - sizeof(pay))
+				len = 1;
+
+			for (n = 0; n < len; n++)
+				pay[n] = text ? 0x20 + lws_test_rnd() % 0x5f :
+						lws_test_rnd();
+			frame(!frags, opcode, pay, len);
+			opcode = LWSWSOPC_CONTINUATION;
+
+			if (frags && !(lws_test_rnd() % 4))
+				control();
+		}
+	}
+
+	if (!(lws_test_rnd() % 4))
+		reject();
+}
+
+static int
+service_until(int *flag)
+{
+	unsigned long long end = lws_plat_monotonic_ms() + TIMEOUT_MS;
+
+	while (!*flag) {
+		if (lws_plat_monotonic_ms() > end) {
+			lwsl_err("timed out connecting\n");
+			return 1;
+		}
+		lws_service(context, 0);
+	}
+
+	return 0;
+}
+
+/* a server connection, on a socketpair whose other end is *peer */
+
+static struct lws *
+server_conn(int *peer)
+{
+	static const char upgrade[] = "GET / HTTP/1.1\r\n"
+				      "Host: localhost\r\n"
+				      "Upgrade: websocket\r\n"
+				      "Connection: Upgrade\r\n"
+				      "Sec-WebSocket-Key: "
+					      "dGhlIHNhbXBsZSBub25jZQ==\r\n"
+				      "Sec-WebSocket-Protocol: test\r\n"
+				      "Sec-WebSocket-Version: 13\r\n\r\n";
+	struct lws *wsi;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		lwsl_err("socketpair failed\n");
+		return NULL;
+	}
+	*peer = sv[1];
+
+	established = 0;
+	wsi = lws_adopt_socket_readbuf(context, sv[0], upgrade,
+				       sizeof(upgrade) - 1);
+	if (!wsi || service_until(&established)) {
+		lwsl_err("server connection failed\n");
+		return NULL;
+	}
+
+	return wsi;
+}
+
+/* a client connection, we're the server on *peer */
+
+static struct lws *
+client_conn(int *peer)
+{
+	static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	unsigned long long end = lws_plat_monotonic_ms() + TIMEOUT_MS;
+	char req[2048], key[128], resp[512], acc[64];
+	struct lws_client_connect_info i;
+	unsigned char hash[20];
+	size_t len = 0;
+	struct lws *wsi;
+	char *p, *e;
+	ssize_t n;
+
+	req[0] = '\0';
+	memset(&i, 0, sizeof(i));
+	i.context = context;
+	i.address = "127.0.0.1";
+	i.port = port;
+	i.path = "/";
+	i.host = "127.0.0.1";
+	i.origin = "127.0.0.1";
+	i.protocol = "test";
+	i.ietf_version_or_minus_one = -1;
+
+	established = 0;
+	*peer = -1;
+	wsi = lws_client_connect_via_info(&i);
+	if (!wsi)
+		goto bail;
+
+	/* take the handshake a piece at a time as it comes */
+	while (!strstr(req, "\r\n\r\n")) {
+		if (lws_plat_monotonic_ms() > end)
+			goto bail;
+		lws_service(context, 0);
+		if (*peer < 0) {
+			*peer = accept(listen_fd, NULL, NULL);
+			if (*peer >= 0)
+				fcntl(*peer, F_SETFL, O_NONBLOCK);
+			req[0] = '\0';
+			continue;
+		}
+		n = read(*peer, req + len, sizeof(req) - 1 - len);
+		if (n > 0)
+			len += n;
+		req[len] = '\0';
+	}
+
+	p = strstr(req, "Sec-WebSocket-Key: ");
+	if (!p)
+		goto bail;
+	p += 19;
+	e = strstr(p, "\r\n");
+	if (!e || e - p + sizeof(guid) > sizeof(key))
+		goto bail;
+	memcpy(key, p, e - p);
+	strcpy(key + (e - p), guid);
+
+	lws_SHA1((unsigned char *)key, strlen(key), hash);
+	if (lws_b64_encode_string((char *)hash, 20, acc, sizeof(acc)) < 0)
+		goto bail;
+
+	n = snprintf(resp, sizeof(resp), "HTTP/1.1 101 Switching Protocols\r\n"
+		     "Upgrade: websocket\r\n"
+		     "Connection: Upgrade\r\n"
+		     "Sec-WebSocket-Accept: %s\r\n"
+		     "Sec-WebSocket-Protocol: test\r\n\r\n", acc);
+	if (write(*peer, resp, n) != n || service_until(&established))
+		goto bail;
+
+	return wsi;
+
+bail:
+	lwsl_err("client connection failed\n");
+
+	return NULL;
+}
+
+/* give it to the role's rx loop in pieces, nonzero if it gave up */
+
+static int
+rx(struct lws *wsi, int client, size_t start, size_t end)
+{
+	unsigned char *p = stream + start;
+
+	if (client)
+		return lws_handshake_client(wsi, &p, end - start);
+
+	return lws_interpret_incoming_packet(wsi, &p, end - start);
+}
+
+static void
+feed(struct lws *wsi, int client, int how)
+{
+	size_t at = 0, to;
+
+	while (at < stream_len) {
+		switch (how) {
+		case FEED_BYTES:
+			to = at + 1;
+			break;
+		case FEED_WHOLE:
+			to = stream_len;
+			break;
+		default:
+			to = at + 1 + lws_test_rnd() % (lws_test_rnd() % 4 ?
+							16 : 4 * RX_BUF);
+			if (to > stream_len)
+				to = stream_len;
+			break;
+		}
+		if (rx(wsi, client, at, to)) {
+			log_to->stopped = to;
+			return;
+		}
+		at = to;
+	}
+}
+
+/* the byte parser must itself deliver what was sent */
+
+static int
+check_ref(void)
+{
+	size_t at = 0, got = 0, len;
+	unsigned char *h;
+
+	while (at < ref.len) {
+		h = ref.p + at;
+		len = (h[2] << 24) | (h[3] << 16) | (h[4] << 8) | h[5];
+		if (h[0] == LWS_CALLBACK_RECEIVE ||
+		    h[0] == LWS_CALLBACK_CLIENT_RECEIVE) {
+			if (got + len > sent_len ||
+			    memcmp(sent + got, h + 10, len))
+				return 1;
+			got += len;
+		}
+		at += 10 + len;
+	}
+
+	/* if it stopped partway, some of it wasn't delivered */
+	return bad_at ? got > sent_len : got != sent_len;
+}
+
+static int
+test_role(int client)
+{
+	int round, how, peer = -1;
+	struct lws *wsi;
+	size_t start;
+
+	for (round = 0; round < ROUNDS; round++) {
+		make_stream();
+
+		for (how = 0; how < FEED_COUNT; how++) {
+			log_to = how ? &run : &ref;
+			log_to->len = log_to->stopped = 0;
+
+			wsi = client ? client_conn(&peer) : server_conn(&peer);
+			if (!wsi)
+				return 1;
+
+			feed(wsi, client, how);
+
+			/* the first ping is still waiting for its pong */
+			log_rx(wsi, 0xff, wsi->u.ws.ping_payload_buf ?
+				wsi->u.ws.ping_payload_buf + LWS_PRE : NULL,
+			       wsi->u.ws.ping_pending_flag ?
+				wsi->u.ws.ping_payload_len : 0);
+
+			wsi->socket_is_permanently_unusable = 1;
+			lws_close_free_wsi(wsi, LWS_CLOSE_STATUS_NOSTATUS);
+			close(peer);
+
+			if (overflowed) {
+				lwsl_err("log overflowed\n");
+				return 1;
+			}
+
+			if (how == FEED_BYTES) {
+				if (ref.stopped != bad_at) {
+					lwsl_err("round %d: stopped at %lu, "
+						 "bad frame at %lu\n", round,
+						 (unsigned long)ref.stopped,
+						 (unsigned long)bad_at);
+					return 1;
+				}
+				if (check_ref()) {
+					lwsl_err("round %d: wrong payload\n",
+						 round);
+					return 1;
+				}
+				continue;
+			}
+
+			/* it should give up in the piece with the bad frame */
+			start = run.stopped;
+			if (ref.stopped && start < ref.stopped) {
+				lwsl_err("round %d %s: stopped early at %lu\n",
+					 round, feed_name[how],
+					 (unsigned long)start);
+				return 1;
+			}
+			if (run.len != ref.len || memcmp(run.p, ref.p, ref.len) ||
+			    !ref.stopped != !run.stopped) {
+				lwsl_err("round %d %s: differs from bytes\n",
+					 round, feed_name[how]);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int
+callback_test(struct lws *wsi, enum lws_callback_reasons reason, void *user,
+	      void *in, size_t len)
+{
+	switch (reason) {
+	case LWS_CALLBACK_ESTABLISHED:
+	case LWS_CALLBACK_CLIENT_ESTABLISHED:
+		established = 1;
+		break;
+
+	case LWS_CALLBACK_RECEIVE:
+	case LWS_CALLBACK_CLIENT_RECEIVE:
+	case LWS_CALLBACK_RECEIVE_PONG:
+	case LWS_CALLBACK_CLIENT_RECEIVE_PONG:
+		log_rx(wsi, reason, in, len);
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static struct lws_protocols protocols[] = {
+	{ "http", callback_test, 0, 0, },
+	{ "test", callback_test, 0, RX_BUF, },
+	{ NULL, NULL, 0, 0 } /* terminator */
+};
+
+int main(int argc, char **argv)
+{
+	struct lws_context_creation_info info;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+
+	lws_test_init(0x6a09e667f3bcc909ull);
+
+	stream = malloc(MAX_STREAM + 64);
+	sent = malloc(MAX_STREAM);
+	ref.p = malloc(MAX_LOG);
+	run.p = malloc(MAX_LOG);
+	if (!stream || !sent || !ref.p || !run.p)
+		return 1;
+
+	/* the raw server end for the client connections */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&sin,
+				  sizeof(sin)) || listen(listen_fd, 4) ||
+	    getsockname(listen_fd, (struct sockaddr *)&sin, &slen)) {
+		lwsl_err("listen failed\n");
+		return 1;
+	}
+	fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+	port = ntohs(sin.sin_port);
+
+	memset(&info, 0, sizeof info);
+	info.port = CONTEXT_PORT_NO_LISTEN;
+	info.protocols = protocols;
+	info.gid = -1;
+	info.uid = -1;
+
+	context = lws_create_context(&info);
+	if (!context) {
+		lwsl_err("Creating context failed\n");
+		return 1;
+	}
+
+	lws_test_result("server", test_role(0));
+	lws_test_result("client", test_role(1));
+
+	lws_context_destroy(context);
+	close(listen_fd);
+	free(stream);
+	free(sent);
+	free(ref.p);
+	free(run.p);
+
+	return lws_test_exit();
+}